@@ -36,6 +36,7 @@
 #include "ephy-settings.h"
 #include "ephy-smaps.h"
 #include "ephy-snapshot-service.h"
+#include "ephy-sqlite-connection.h"
 #include "ephy-web-app-utils.h"
 
 struct _EphyAboutHandler {
@@ -417,12 +418,11 @@ history_service_query_urls_cb (EphyHistoryService     *history,
   GString *data_str;
   gsize data_length;
   char *lang;
-  GList *l;
-  g_autolist (EphyHistoryURL) urls = NULL;
+  g_autoptr (EphyHistoryURLTable) urls = NULL;
   g_autoptr (GError) error = NULL;
   guint list_length;
 
-  urls = ephy_history_service_query_urls_finish (history, result, &error);
+  urls = ephy_history_service_query_url_table_finish (history, result, &error);
   if (error) {
     if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
       g_warning ("Failed to query overview URLs: %s", error->message);
@@ -452,7 +452,7 @@ history_service_query_urls_cb (EphyHistoryService     *history,
                           _(NEW_TAB_PAGE_TITLE));
   g_free (lang);
 
-  list_length = g_list_length (urls);
+  list_length = ephy_history_url_table_get_length (urls);
 
   if (list_length == 0) {
     GtkIconTheme *icon_theme;
@@ -494,24 +494,26 @@ history_service_query_urls_cb (EphyHistoryService     *history,
   g_string_append (data_str,
                    "<div id=\"most-visited-grid\">\n");
 
-  for (l = urls; l; l = g_list_next (l)) {
-    EphyHistoryURL *url = (EphyHistoryURL *)l->data;
+  for (guint i = 0; i < list_length; i++) {
+    const char *url = ephy_history_url_table_get_url (urls, i);
+    const char *title = ephy_history_url_table_get_title (urls, i);
+    gboolean pinned = ephy_history_url_table_get_pinned (urls, i);
     const char *snapshot;
     g_autofree char *thumbnail_style = NULL;
     g_autofree char *entity_encoded_title = NULL;
     g_autofree char *attribute_encoded_title = NULL;
     g_autofree char *encoded_url = NULL;
 
-    snapshot = ephy_snapshot_service_lookup_cached_snapshot_path (snapshot_service, url->url);
+    snapshot = ephy_snapshot_service_lookup_cached_snapshot_path (snapshot_service, url);
     if (snapshot)
       thumbnail_style = g_strdup_printf (" style=\"background: url(file://%s) no-repeat; background-size: 100%%;\"", snapshot);
     else
       ephy_embed_shell_schedule_thumbnail_update (shell, url);
 
     /* Title and URL are controlled by web content and could be malicious. */
-    entity_encoded_title = ephy_encode_for_html_entity (url->title);
-    attribute_encoded_title = ephy_encode_for_html_attribute (url->title);
-    encoded_url = ephy_encode_for_html_attribute (url->url);
+    entity_encoded_title = ephy_encode_for_html_entity (title);
+    attribute_encoded_title = ephy_encode_for_html_attribute (title);
+    encoded_url = ephy_encode_for_html_attribute (url);
     g_string_append_printf (data_str,
                             "<a class=\"%s\" title=\"%s\" href=\"%s\">"
                             "  <div class=\"overview-close-button\" title=\"%s\"></div>"
@@ -519,9 +521,9 @@ history_service_query_urls_cb (EphyHistoryService     *history,
                             "  <span class=\"overview-thumbnail\"%s></span>"
                             "  <span class=\"overview-title\">%s</span>"
                             "</a>",
-                            url->pinned ? "overview-item overview-item-pinned" : "overview-item",
+                            pinned ? "overview-item overview-item-pinned" : "overview-item",
                             attribute_encoded_title, encoded_url, _("Remove from overview"),
-                            url->pinned ? _("Unpin from overview") : _("Pin to overview"),
+                            pinned ? _("Unpin from overview") : _("Pin to overview"),
                             thumbnail_style ? thumbnail_style : "",
                             entity_encoded_title);
   }
@@ -558,7 +560,7 @@ ephy_history_query_new_for_overview (void)
   EphyHistoryQuery *query;
 
   query = ephy_history_query_new ();
-  query->sort_type = EPHY_HISTORY_SORT_MOST_VISITED;
+  query->sort_type = EPHY_HISTORY_SORT_FRECENCY;
   query->limit = EPHY_ABOUT_OVERVIEW_MAX_ITEMS;
   query->ignore_hidden = TRUE;
   query->ignore_local = TRUE;
@@ -575,9 +577,9 @@ ephy_about_handler_handle_html_overview (EphyAboutHandler       *handler,
 
   history = ephy_embed_shell_get_global_history_service (ephy_embed_shell_get_default ());
   query = ephy_history_query_new_for_overview ();
-  ephy_history_service_query_urls (history, query, NULL,
-                                   (GAsyncReadyCallback)history_service_query_urls_cb,
-                                   g_object_ref (request));
+  ephy_history_service_query_url_table (history, query, NULL,
+                                        (GAsyncReadyCallback)history_service_query_urls_cb,
+                                        g_object_ref (request));
   ephy_history_query_free (query);
 
   return TRUE;
@@ -627,6 +629,66 @@ ephy_about_handler_handle_incognito (EphyAboutHandler       *handler,
   return TRUE;
 }
 
+static gboolean
+ephy_about_handler_handle_sqlite (EphyAboutHandler       *handler,
+                                  WebKitURISchemeRequest *request)
+{
+  g_autoptr (GPtrArray) stats = NULL;
+  GString *data_str;
+  gsize data_length;
+
+  data_str = g_string_new (NULL);
+  g_string_append_printf (data_str, "<html><head><title>%s</title>"
+                          "<meta http-equiv=\"Content-Type\" content=\"text/html; charset=utf-8\" />"
+                          "<link href=\""EPHY_PAGE_TEMPLATE_ABOUT_CSS "\" rel=\"stylesheet\" type=\"text/css\">"
+                          "</head><body>"
+                          "<div id='sqlite'>"
+                          "<h1>%s</h1>",
+                          _("Database queries"),
+                          _("Database queries"));
+
+  if (!ephy_sqlite_query_stats_enabled ()) {
+    g_string_append_printf (data_str, "<p>%s</p>",
+                            _("Query statistics are only collected when Web is started with the EPHY_SQLITE_STATS environment variable set."));
+  } else {
+    stats = ephy_sqlite_get_query_stats ();
+
+    g_string_append_printf (data_str, "<table class=\"memory-table\"><thead><tr>"
+                            "<th>%s</th><th>%s</th><th>%s</th><th>%s</th><th>%s</th><th>%s</th>"
+                            "</tr></thead><tbody>",
+                            /* Translators: column headers of the about:sqlite statistics table. */
+                            _("Query"),
+                            /* Translators: how many times a database query was run. */
+                            _("Runs"),
+                            /* Translators: how many rows a database query returned in total. */
+                            _("Rows"),
+                            /* Translators: "ms" is the abbreviation of milliseconds. */
+                            _("Total (ms)"),
+                            _("Average (ms)"),
+                            _("Slowest (ms)"));
+    for (guint i = 0; i < stats->len; i++) {
+      EphySQLiteQueryStats *query = g_ptr_array_index (stats, i);
+      g_autofree char *sql = g_markup_escape_text (query->sql, -1);
+
+      g_string_append_printf (data_str, "<tr><td class=\"sql\">%s</td>"
+                              "<td>%" G_GUINT64_FORMAT "</td><td>%" G_GUINT64_FORMAT "</td>"
+                              "<td>%.2f</td><td>%.3f</td><td>%.2f</td></tr>",
+                              sql, query->count, query->rows,
+                              query->total_time / 1000.0,
+                              query->count ? query->total_time / 1000.0 / query->count : 0.0,
+                              query->max_time / 1000.0);
+    }
+    g_string_append (data_str, "</tbody></table>");
+  }
+
+  g_string_append (data_str, "</div></body></html>");
+
+  data_length = data_str->len;
+  ephy_about_handler_finish_request (request, g_string_free_and_steal (data_str), data_length);
+
+  return TRUE;
+}
+
 static void
 ephy_about_handler_handle_blank (EphyAboutHandler       *handler,
                                  WebKitURISchemeRequest *request)
@@ -661,6 +723,8 @@ ephy_about_handler_handle_request (EphyAboutHandler       *handler,
     handled = ephy_about_handler_handle_html_overview (handler, request);
   else if (g_strcmp0 (path, "incognito") == 0)
     handled = ephy_about_handler_handle_incognito (handler, request);
+  else if (g_strcmp0 (path, "sqlite") == 0)
+    handled = ephy_about_handler_handle_sqlite (handler, request);
   else if (!path || path[0] == '\0' || g_strcmp0 (path, "Web") == 0 || g_strcmp0 (path, "web") == 0)
     handled = ephy_about_handler_handle_about (handler, request);
 
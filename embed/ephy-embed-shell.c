@@ -48,6 +48,7 @@
 #include "ephy-snapshot-service.h"
 #include "ephy-tabs-catalog.h"
 #include "ephy-uri-helpers.h"
+#include "ephy-user-agent.h"
 #include "ephy-view-source-handler.h"
 #include "ephy-web-app-utils.h"
 
@@ -58,6 +59,7 @@ typedef struct {
   WebKitWebContext *web_context;
   WebKitNetworkSession *network_session;
   EphyHistoryService *global_history_service;
+  EphyHistoryIndex *history_index;
   EphyEncodings *encodings;
   GtkPageSetup *page_setup;
   GtkPrintSettings *print_settings;
@@ -72,6 +74,8 @@ typedef struct {
   EphyFiltersManager *filters_manager;
   GVariant *web_extension_initialization_data;
   EphySearchEngineManager *search_engine_manager;
+  EphySearchSuggestionsCache *search_suggestions_cache;
+  SoupSession *soup_session;
   GCancellable *cancellable;
 } EphyEmbedShellPrivate;
 
@@ -190,6 +194,7 @@ ephy_embed_shell_dispose (GObject *object)
   g_clear_object (&priv->encodings);
   g_clear_object (&priv->page_setup);
   g_clear_object (&priv->print_settings);
+  g_clear_object (&priv->history_index);
   g_clear_object (&priv->global_history_service);
   g_clear_object (&priv->about_handler);
   g_clear_object (&priv->reader_handler);
@@ -202,6 +207,8 @@ ephy_embed_shell_dispose (GObject *object)
   g_clear_pointer (&priv->guid, g_free);
   g_clear_object (&priv->filters_manager);
   g_clear_object (&priv->search_engine_manager);
+  g_clear_object (&priv->search_suggestions_cache);
+  g_clear_object (&priv->soup_session);
   g_clear_pointer (&priv->web_extension_initialization_data, g_variant_unref);
 
   G_OBJECT_CLASS (ephy_embed_shell_parent_class)->dispose (object);
@@ -231,12 +238,11 @@ history_service_query_urls_cb (EphyHistoryService *service,
                                EphyEmbedShell     *shell)
 {
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
-  g_autolist (EphyHistoryURL) urls = NULL;
+  g_autoptr (EphyHistoryURLTable) urls = NULL;
   g_autoptr (GError) error = NULL;
-  GList *l;
   GVariantBuilder builder;
 
-  urls = ephy_history_service_query_urls_finish (service, result, &error);
+  urls = ephy_history_service_query_url_table_finish (service, result, &error);
   if (error) {
     if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
       g_warning ("Failed to query overview URLs: %s", error->message);
@@ -244,11 +250,13 @@ history_service_query_urls_cb (EphyHistoryService *service,
   }
 
   g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ssb)"));
-  for (l = urls; l; l = g_list_next (l)) {
-    EphyHistoryURL *url = (EphyHistoryURL *)l->data;
+  for (guint i = 0; i < ephy_history_url_table_get_length (urls); i++) {
+    const char *url = ephy_history_url_table_get_url (urls, i);
 
-    g_variant_builder_add (&builder, "(ssb)", url->url, url->title, url->pinned);
-    ephy_embed_shell_schedule_thumbnail_update (shell, (EphyHistoryURL *)l->data);
+    g_variant_builder_add (&builder, "(ssb)", url,
+                           ephy_history_url_table_get_title (urls, i),
+                           ephy_history_url_table_get_pinned (urls, i));
+    ephy_embed_shell_schedule_thumbnail_update (shell, url);
   }
 
   webkit_web_context_send_message_to_all_extensions (priv->web_context,
@@ -263,13 +271,14 @@ ephy_embed_shell_update_overview_urls (EphyEmbedShell *shell)
   g_autoptr (EphyHistoryQuery) query = NULL;
 
   query = ephy_history_query_new_for_overview ();
-  ephy_history_service_query_urls (priv->global_history_service, query, priv->cancellable,
-                                   (GAsyncReadyCallback)history_service_query_urls_cb,
-                                   shell);
+  ephy_history_service_query_url_table (priv->global_history_service, query, priv->cancellable,
+                                        (GAsyncReadyCallback)history_service_query_urls_cb,
+                                        shell);
 }
 
 static void
 history_service_urls_visited_cb (EphyHistoryService *history,
+                                 GList              *urls,
                                  EphyEmbedShell     *shell)
 {
   ephy_embed_shell_update_overview_urls (shell);
@@ -501,6 +510,29 @@ history_service_url_deleted_cb (EphyHistoryService *service,
                                                                               g_variant_new_string (url->url)));
 }
 
+static void
+history_service_urls_deleted_cb (EphyHistoryService *service,
+                                 GList              *urls,
+                                 EphyEmbedShell     *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+  EphySnapshotService *snapshot_service = ephy_snapshot_service_get_default ();
+  g_autoptr (GStrvBuilder) builder = g_strv_builder_new ();
+  g_auto (GStrv) deleted_urls = NULL;
+
+  for (GList *l = urls; l; l = l->next) {
+    EphyHistoryURL *url = l->data;
+
+    g_strv_builder_add (builder, url->url);
+    ephy_snapshot_service_delete_snapshot_for_url (snapshot_service, url->url);
+  }
+
+  deleted_urls = g_strv_builder_end (builder);
+  webkit_web_context_send_message_to_all_extensions (priv->web_context,
+                                                     webkit_user_message_new ("History.DeleteURLs",
+                                                                              g_variant_new_strv ((const char * const *)deleted_urls, -1)));
+}
+
 static void
 history_service_host_deleted_cb (EphyHistoryService *service,
                                  const char         *deleted_url,
@@ -559,23 +591,23 @@ got_snapshot_path_for_url_cb (EphySnapshotService *service,
 
 void
 ephy_embed_shell_schedule_thumbnail_update (EphyEmbedShell *shell,
-                                            EphyHistoryURL *url)
+                                            const char     *url)
 {
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
   EphySnapshotService *service;
   const char *snapshot;
 
   service = ephy_snapshot_service_get_default ();
-  snapshot = ephy_snapshot_service_lookup_cached_snapshot_path (service, url->url);
+  snapshot = ephy_snapshot_service_lookup_cached_snapshot_path (service, url);
 
   if (snapshot) {
-    ephy_embed_shell_set_thumbnail_path (shell, url->url, snapshot);
+    ephy_embed_shell_set_thumbnail_path (shell, url, snapshot);
   } else {
     ephy_snapshot_service_get_snapshot_path_for_url_async (service,
-                                                           url->url,
+                                                           url,
                                                            priv->cancellable,
                                                            (GAsyncReadyCallback)got_snapshot_path_for_url_cb,
-                                                           g_strdup (url->url));
+                                                           g_strdup (url));
   }
 }
 
@@ -615,6 +647,9 @@ ephy_embed_shell_get_global_history_service (EphyEmbedShell *shell)
     g_signal_connect_object (priv->global_history_service, "url-deleted",
                              G_CALLBACK (history_service_url_deleted_cb),
                              shell, G_CONNECT_DEFAULT);
+    g_signal_connect_object (priv->global_history_service, "urls-deleted",
+                             G_CALLBACK (history_service_urls_deleted_cb),
+                             shell, G_CONNECT_DEFAULT);
     g_signal_connect_object (priv->global_history_service, "host-deleted",
                              G_CALLBACK (history_service_host_deleted_cb),
                              shell, G_CONNECT_DEFAULT);
@@ -626,6 +661,28 @@ ephy_embed_shell_get_global_history_service (EphyEmbedShell *shell)
   return priv->global_history_service;
 }
 
+/* Only the most frecent part of history is kept in memory for suggestions.
+ * Lookups that do not find enough matches there go back to the database. */
+#define HISTORY_INDEX_SIZE 5000
+
+/**
+ * ephy_embed_shell_get_history_index:
+ * @shell: the #EphyEmbedShell
+ *
+ * Return value: (transfer none): the in-memory index of the global history,
+ * shared by everything that suggests history URLs
+ **/
+EphyHistoryIndex *
+ephy_embed_shell_get_history_index (EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  if (!priv->history_index)
+    priv->history_index = ephy_history_index_new (ephy_embed_shell_get_global_history_service (shell),
+                                                  HISTORY_INDEX_SIZE);
+  return priv->history_index;
+}
+
 /**
  * ephy_embed_shell_get_encodings:
  * @shell: the #EphyEmbedShell
@@ -1335,6 +1392,27 @@ ephy_embed_shell_get_permissions_manager (EphyEmbedShell *shell)
   return priv->permissions_manager;
 }
 
+/**
+ * ephy_embed_shell_get_soup_session:
+ *
+ * Returns the #SoupSession used for the requests the browser makes on its
+ * own, like search suggestions and OpenSearch descriptions, as opposed to
+ * the ones made by web pages. Sharing it lets those requests reuse open
+ * connections instead of doing a new TLS handshake every time.
+ *
+ * Returns: (transfer none): the shared #SoupSession
+ */
+SoupSession *
+ephy_embed_shell_get_soup_session (EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  if (!priv->soup_session)
+    priv->soup_session = soup_session_new_with_options ("user-agent", ephy_user_agent_get (),
+                                                        NULL);
+  return priv->soup_session;
+}
+
 EphySearchEngineManager *
 ephy_embed_shell_get_search_engine_manager (EphyEmbedShell *shell)
 {
@@ -1345,6 +1423,23 @@ ephy_embed_shell_get_search_engine_manager (EphyEmbedShell *shell)
   return priv->search_engine_manager;
 }
 
+#define SEARCH_SUGGESTIONS_CACHE_SIZE    200
+#define SEARCH_SUGGESTIONS_MAX_AGE       (10 * G_TIME_SPAN_MINUTE)
+#define SEARCH_SUGGESTIONS_DEBOUNCE_MS   100
+
+EphySearchSuggestionsCache *
+ephy_embed_shell_get_search_suggestions_cache (EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  if (!priv->search_suggestions_cache)
+    priv->search_suggestions_cache = ephy_search_suggestions_cache_new (ephy_embed_shell_get_soup_session (shell),
+                                                                        SEARCH_SUGGESTIONS_CACHE_SIZE,
+                                                                        SEARCH_SUGGESTIONS_MAX_AGE,
+                                                                        SEARCH_SUGGESTIONS_DEBOUNCE_MS);
+  return priv->search_suggestions_cache;
+}
+
 EphyPasswordManager *
 ephy_embed_shell_get_password_manager (EphyEmbedShell *shell)
 {
@@ -22,14 +22,17 @@
 #pragma once
 
 #include <adwaita.h>
+#include <libsoup/soup.h>
 #include <webkit/webkit.h>
 
 #include "ephy-downloads-manager.h"
 #include "ephy-encodings.h"
+#include "ephy-history-index.h"
 #include "ephy-history-service.h"
 #include "ephy-password-manager.h"
 #include "ephy-permissions-manager.h"
 #include "ephy-search-engine-manager.h"
+#include "ephy-search-suggestions-cache.h"
 
 G_BEGIN_DECLS
 
@@ -63,6 +66,7 @@ WebKitWebContext  *ephy_embed_shell_get_web_context            (EphyEmbedShell
 WebKitNetworkSession *ephy_embed_shell_get_network_session     (EphyEmbedShell   *shell);
 EphyHistoryService
                   *ephy_embed_shell_get_global_history_service (EphyEmbedShell   *shell);
+EphyHistoryIndex  *ephy_embed_shell_get_history_index          (EphyEmbedShell   *shell);
 EphyEncodings     *ephy_embed_shell_get_encodings              (EphyEmbedShell   *shell);
 void               ephy_embed_shell_restored_window            (EphyEmbedShell   *shell);
 void               ephy_embed_shell_update_overview_urls       (EphyEmbedShell   *shell);
@@ -77,11 +81,13 @@ void               ephy_embed_shell_set_thumbnail_path         (EphyEmbedShell
                                                                 const char       *url,
                                                                 const char       *path);
 void               ephy_embed_shell_schedule_thumbnail_update  (EphyEmbedShell   *shell,
-                                                                EphyHistoryURL   *url);
+                                                                const char       *url);
 EphyFiltersManager       *ephy_embed_shell_get_filters_manager      (EphyEmbedShell *shell);
 EphyDownloadsManager     *ephy_embed_shell_get_downloads_manager    (EphyEmbedShell *shell);
 EphyPermissionsManager   *ephy_embed_shell_get_permissions_manager  (EphyEmbedShell *shell);
+SoupSession              *ephy_embed_shell_get_soup_session          (EphyEmbedShell *shell);
 EphySearchEngineManager  *ephy_embed_shell_get_search_engine_manager (EphyEmbedShell *shell);
+EphySearchSuggestionsCache *ephy_embed_shell_get_search_suggestions_cache (EphyEmbedShell *shell);
 EphyPasswordManager      *ephy_embed_shell_get_password_manager      (EphyEmbedShell *shell);
 WebKitFaviconDatabase    *ephy_embed_shell_get_favicon_database      (EphyEmbedShell *shell);
 
@@ -1034,37 +1034,24 @@ out:
 }
 
 static void
-get_host_for_url_cb (EphyHistoryService *service,
-                     GAsyncResult       *result,
-                     EphyWebView        *view)
+restore_zoom_level (EphyWebView *view,
+                    const char  *address)
 {
-  g_autoptr (EphyHistoryHost) host = NULL;
-  g_autoptr (GError) error = NULL;
   double current_zoom;
   double set_zoom;
 
-  host = ephy_history_service_get_host_for_url_finish (service, result, &error);
-  if (error) {
-    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-      g_warning ("Failed to get host zoom level: %s", error->message);
-    return;
-  }
-
-  if (!host)
+  if (!ephy_embed_utils_address_has_web_scheme (address))
     return;
 
-  current_zoom = webkit_web_view_get_zoom_level (WEBKIT_WEB_VIEW (view));
+  /* The history service keeps the zoom levels in memory, so this does not
+   * have to wait behind pending history writes. */
+  set_zoom = ephy_history_service_get_url_zoom_level (view->history_service, address);
 
-  /* Use default zoom level in case web page is
-   *  - not visited before
-   *  - uses default zoom level (0)
-   */
-  if (host->visit_count == 0 || host->zoom_level == 0.0) {
+  /* Use default zoom level in case web page uses default zoom level (0) */
+  if (set_zoom == 0.0)
     set_zoom = g_settings_get_double (EPHY_SETTINGS_WEB, EPHY_PREFS_WEB_DEFAULT_ZOOM_LEVEL);
-  } else {
-    set_zoom = host->zoom_level;
-  }
 
+  current_zoom = webkit_web_view_get_zoom_level (WEBKIT_WEB_VIEW (view));
   if (set_zoom != current_zoom) {
     view->is_setting_zoom = TRUE;
     webkit_web_view_set_zoom_level (WEBKIT_WEB_VIEW (view), set_zoom);
@@ -1072,17 +1059,6 @@ get_host_for_url_cb (EphyHistoryService *service,
   }
 }
 
-static void
-restore_zoom_level (EphyWebView *view,
-                    const char  *address)
-{
-  if (ephy_embed_utils_address_has_web_scheme (address))
-    ephy_history_service_get_host_for_url (view->history_service,
-                                           address, view->cancellable,
-                                           (GAsyncReadyCallback)get_host_for_url_cb,
-                                           view);
-}
-
 static void
 ephy_web_view_set_loading_message (EphyWebView *view,
                                    const char  *address)
@@ -269,6 +269,38 @@ ephy_web_overview_model_delete_url (EphyWebOverviewModel *model,
     ephy_web_overview_model_notify_urls_changed (model);
 }
 
+void
+ephy_web_overview_model_delete_urls (EphyWebOverviewModel *model,
+                                     const char * const   *urls)
+{
+  g_autoptr (GHashTable) deleted = g_hash_table_new (g_str_hash, g_str_equal);
+  GList *l;
+  gboolean changed = FALSE;
+
+  g_assert (EPHY_IS_WEB_OVERVIEW_MODEL (model));
+
+  for (guint i = 0; urls[i]; i++)
+    g_hash_table_add (deleted, (gpointer)urls[i]);
+
+  l = model->items;
+  while (l) {
+    EphyWebOverviewModelItem *item = (EphyWebOverviewModelItem *)l->data;
+    GList *next = l->next;
+
+    if (item->url && g_hash_table_contains (deleted, item->url)) {
+      changed = TRUE;
+
+      ephy_web_overview_model_item_free (item);
+      model->items = g_list_delete_link (model->items, l);
+    }
+
+    l = next;
+  }
+
+  if (changed)
+    ephy_web_overview_model_notify_urls_changed (model);
+}
+
 void
 ephy_web_overview_model_delete_host (EphyWebOverviewModel *model,
                                      const char           *host)
@@ -41,6 +41,8 @@ void                  ephy_web_overview_model_set_url_title     (EphyWebOverview
                                                                  const char           *title);
 void                  ephy_web_overview_model_delete_url        (EphyWebOverviewModel *model,
                                                                  const char           *url);
+void                  ephy_web_overview_model_delete_urls       (EphyWebOverviewModel *model,
+                                                                 const char * const   *urls);
 void                  ephy_web_overview_model_delete_host       (EphyWebOverviewModel *model,
                                                                  const char           *host);
 void                  ephy_web_overview_model_clear             (EphyWebOverviewModel *model);
@@ -285,6 +285,18 @@ ephy_web_process_extension_user_message_received_cb (EphyWebProcessExtension *ex
       g_variant_get (parameters, "&s", &url);
       ephy_web_overview_model_delete_url (extension->overview_model, url);
     }
+  } else if (g_strcmp0 (name, "History.DeleteURLs") == 0) {
+    if (extension->overview_model) {
+      GVariant *parameters;
+      g_autofree const char **urls = NULL;
+
+      parameters = webkit_user_message_get_parameters (message);
+      if (!parameters)
+        return;
+
+      urls = g_variant_get_strv (parameters, NULL);
+      ephy_web_overview_model_delete_urls (extension->overview_model, urls);
+    }
   } else if (g_strcmp0 (name, "History.DeleteHost") == 0) {
     if (extension->overview_model) {
       GVariant *parameters;
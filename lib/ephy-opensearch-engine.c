@@ -26,8 +26,6 @@
 #include <libsoup/soup.h>
 #include <pango/pango.h>
 
-#include "ephy-user-agent.h"
-
 /* This code handles all the parsing of the OpenSearch description file, and
  * creates a new EphySearchEngine from it.
  */
@@ -509,8 +507,6 @@ on_opensearch_file_downloaded_cb (SoupSession  *session,
   const char *file_content;
 
   bytes = soup_session_send_and_read_finish (session, result, &error);
-  /* One-time use SoupSession so clean it up properly here. */
-  g_clear_object (&session);
   if (!bytes) {
     g_prefix_error (&error,
                     /* TRANSLATORS: The %s is the name of the search engine. */
@@ -532,6 +528,7 @@ on_opensearch_file_downloaded_cb (SoupSession  *session,
 /**
  * ephy_opensearch_engine_load_from_link_async:
  * @autodiscovery_link: (transfer none): The OpenSearch engine's autodiscovered link to be added to @self
+ * @session: the #SoupSession to download the description file with
  * @cancellable: (nullable): a #GCancellable
  * @callback: a #GAsyncReadyCallback to execute upon completion
  * @user_data: closure data for @callback
@@ -545,6 +542,7 @@ on_opensearch_file_downloaded_cb (SoupSession  *session,
  */
 void
 ephy_opensearch_engine_load_from_link_async (EphyOpensearchAutodiscoveryLink *autodiscovery_link,
+                                             SoupSession                     *session,
                                              GCancellable                    *cancellable,
                                              GAsyncReadyCallback              callback,
                                              gpointer                         user_data)
@@ -552,8 +550,8 @@ ephy_opensearch_engine_load_from_link_async (EphyOpensearchAutodiscoveryLink *au
   AddOpensearch *data = NULL;
   g_autoptr (SoupMessage) msg = NULL;
   GTask *task = NULL;
-  g_autoptr (SoupSession) soup_session = NULL;
 
+  g_return_if_fail (SOUP_IS_SESSION (session));
   g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
 
   task = g_task_new (autodiscovery_link, cancellable, callback, user_data);
@@ -563,11 +561,9 @@ ephy_opensearch_engine_load_from_link_async (EphyOpensearchAutodiscoveryLink *au
   data->autodiscovery_link = g_object_ref (autodiscovery_link);
   g_task_set_task_data (task, data, (GDestroyNotify)free_add_opensearch);
 
-  soup_session = soup_session_new ();
-  soup_session_set_user_agent (soup_session, ephy_user_agent_get ());
   msg = soup_message_new (SOUP_METHOD_GET,
                           ephy_opensearch_autodiscovery_link_get_url (autodiscovery_link));
-  soup_session_send_and_read_async (g_steal_pointer (&soup_session),
+  soup_session_send_and_read_async (session,
                                     msg,
                                     G_PRIORITY_DEFAULT, cancellable,
                                     (GAsyncReadyCallback)on_opensearch_file_downloaded_cb,
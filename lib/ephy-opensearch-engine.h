@@ -31,6 +31,7 @@ EphySearchEngine *ephy_opensearch_engine_load_from_data        (EphyOpensearchAu
                                                                 gsize                             length,
                                                                 GError                          **error);
 void              ephy_opensearch_engine_load_from_link_async  (EphyOpensearchAutodiscoveryLink  *autodiscovery_link,
+                                                                SoupSession                      *session,
                                                                 GCancellable                     *cancellable,
                                                                 GAsyncReadyCallback               callback,
                                                                 gpointer                          user_data);
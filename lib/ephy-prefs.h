@@ -165,6 +165,8 @@ static const char * const ephy_prefs_web_schema[] = {
 #define EPHY_PREFS_ACTIVE_CLEAR_DATA_ITEMS            "active-clear-data-items"
 #define EPHY_PREFS_INCOGNITO_SEARCH_ENGINE            "incognito-search-engine"
 #define EPHY_PREFS_USE_SEARCH_SUGGESTIONS             "use-search-suggestions"
+#define EPHY_PREFS_HISTORY_MAX_AGE                    "history-max-age"
+#define EPHY_PREFS_HISTORY_MAX_VISITS                 "history-max-visits"
 
 #define EPHY_PREFS_LOCKDOWN_SCHEMA            "org.gnome.Epiphany.lockdown"
 #define EPHY_PREFS_LOCKDOWN_FULLSCREEN        "disable-fullscreen"
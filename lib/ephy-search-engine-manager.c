@@ -23,6 +23,8 @@
 
 #include "ephy-search-engine-manager.h"
 
+#include <string.h>
+
 #include "ephy-file-helpers.h"
 #include "ephy-prefs.h"
 #include "ephy-settings.h"
@@ -42,6 +44,12 @@ struct _EphySearchEngineManager {
    * corresponding EphySearchEngine.
    */
   GHashTable *bangs;
+
+  /* The engines of @bangs sorted by bang, so that the bangs starting with
+   * some text can be found with a binary search. It is built when first
+   * needed and dropped whenever a bang changes. The engines are unowned.
+   */
+  GPtrArray *sorted_bangs;
 };
 
 static void list_model_iface_init (GListModelInterface *iface,
@@ -66,6 +74,14 @@ search_engine_compare_func (EphySearchEngine **a,
                     ephy_search_engine_get_name (*b));
 }
 
+static int
+search_engine_bang_compare_func (EphySearchEngine **a,
+                                 EphySearchEngine **b)
+{
+  return strcmp (ephy_search_engine_get_bang (*a),
+                 ephy_search_engine_get_bang (*b));
+}
+
 static void
 on_search_engine_bang_changed_cb (EphySearchEngine        *engine,
                                   GParamSpec              *pspec,
@@ -75,6 +91,8 @@ on_search_engine_bang_changed_cb (EphySearchEngine        *engine,
   const char *bang;
   EphySearchEngine *old_bang_engine;
 
+  g_clear_pointer (&manager->sorted_bangs, g_ptr_array_unref);
+
   g_hash_table_iter_init (&iter, manager->bangs);
 
   /* We have no way of knowing what bang @engine was previously using, so
@@ -236,6 +254,7 @@ ephy_search_engine_manager_finalize (GObject *object)
   EphySearchEngineManager *manager = EPHY_SEARCH_ENGINE_MANAGER (object);
 
   g_clear_pointer (&manager->bangs, g_hash_table_destroy);
+  g_clear_pointer (&manager->sorted_bangs, g_ptr_array_unref);
   g_clear_pointer (&manager->engines, g_ptr_array_unref);
 
   G_OBJECT_CLASS (ephy_search_engine_manager_parent_class)->finalize (object);
@@ -403,6 +422,7 @@ ephy_search_engine_manager_add_engine (EphySearchEngineManager *manager,
   }
   /* Programmer/validation error that doesn't properly use ephy_search_engine_manager_has_bang(). */
   g_assert (!bang_existed);
+  g_clear_pointer (&manager->sorted_bangs, g_ptr_array_unref);
   g_signal_connect (engine, "notify::bang", G_CALLBACK (on_search_engine_bang_changed_cb), manager);
 
   g_ptr_array_add (manager->engines, g_object_ref (engine));
@@ -446,8 +466,10 @@ ephy_search_engine_manager_delete_engine (EphySearchEngineManager *manager,
   g_assert (g_ptr_array_find (manager->engines, engine, &pos));
 
   bang = ephy_search_engine_get_bang (engine);
-  if (*bang != '\0')
+  if (*bang != '\0') {
     g_hash_table_remove (manager->bangs, bang);
+    g_clear_pointer (&manager->sorted_bangs, g_ptr_array_unref);
+  }
 
   /* Temporary ref so that we can remove the engine, and be sure that
    * the engine at index 0 isn't already the same as this one when
@@ -523,6 +545,57 @@ ephy_search_engine_manager_has_bang (EphySearchEngineManager *manager,
   return !!g_hash_table_lookup (manager->bangs, bang);
 }
 
+/**
+ * ephy_search_engine_manager_complete_bang:
+ * @prefix: the beginning of a bang, as typed so far
+ *
+ * Finds the search engines whose bang starts with @prefix, which is what
+ * the user might be about to type when @prefix is the first word of a
+ * search.
+ *
+ * Returns: (transfer container) (element-type EphySearchEngine): the
+ *   matching search engines, sorted by bang.
+ */
+GPtrArray *
+ephy_search_engine_manager_complete_bang (EphySearchEngineManager *manager,
+                                          const char              *prefix)
+{
+  GPtrArray *engines = g_ptr_array_new_with_free_func (g_object_unref);
+  guint lower = 0;
+  guint upper;
+
+  if (!prefix || *prefix == '\0')
+    return engines;
+
+  if (!manager->sorted_bangs) {
+    manager->sorted_bangs = g_hash_table_get_values_as_ptr_array (manager->bangs);
+    g_ptr_array_sort (manager->sorted_bangs, (GCompareFunc)search_engine_bang_compare_func);
+  }
+
+  /* All the bangs starting with @prefix sort right after it. */
+  upper = manager->sorted_bangs->len;
+  while (lower < upper) {
+    guint middle = lower + (upper - lower) / 2;
+    EphySearchEngine *engine = g_ptr_array_index (manager->sorted_bangs, middle);
+
+    if (strcmp (ephy_search_engine_get_bang (engine), prefix) < 0)
+      lower = middle + 1;
+    else
+      upper = middle;
+  }
+
+  for (guint i = lower; i < manager->sorted_bangs->len; i++) {
+    EphySearchEngine *engine = g_ptr_array_index (manager->sorted_bangs, i);
+
+    if (!g_str_has_prefix (ephy_search_engine_get_bang (engine), prefix))
+      break;
+
+    g_ptr_array_add (engines, g_object_ref (engine));
+  }
+
+  return engines;
+}
+
 /**
  * parse_bang_query:
  * @search: the search with bangs to perform
@@ -530,8 +603,9 @@ ephy_search_engine_manager_has_bang (EphySearchEngineManager *manager,
  *   argument will be set to the search engine from @manager that should be used
  *   to perform the search using the search query this function returns.
  *
- * This is the implementation for ephy_search_engine_manager_parse_bang_search()
- * and ephy_search_engine_manager_parse_bang_suggestions(). See the doc of the
+ * This is the implementation for ephy_search_engine_manager_parse_bang_search(),
+ * ephy_search_engine_manager_parse_bang_suggestions() and
+ * ephy_search_engine_manager_parse_bang_suggestions_query(). See the doc of the
  * former for details on this function's behaviours.
  *
  * Returns: (transfer full): the search query without the bangs.
@@ -698,6 +772,27 @@ ephy_search_engine_manager_parse_bang_suggestions (EphySearchEngineManager  *man
   }
 }
 
+/**
+ * ephy_search_engine_manager_parse_bang_suggestions_query:
+ *
+ * Same as ephy_search_engine_manager_parse_bang_suggestions() but returns the
+ * search query without the bangs instead of the suggestions URL, for callers
+ * that cache suggestions by engine and query.
+ */
+char *
+ephy_search_engine_manager_parse_bang_suggestions_query (EphySearchEngineManager  *manager,
+                                                         const char               *search,
+                                                         EphySearchEngine        **out_engine)
+{
+  EphySearchEngine *engine = NULL;
+  char *no_bangs_query = parse_bang_query (manager, search, &engine);
+
+  if (no_bangs_query && out_engine)
+    *out_engine = engine;
+
+  return no_bangs_query;
+}
+
 /**
  * ephy_search_engine_manager_save_to_settings:
  *
@@ -47,11 +47,16 @@ EphySearchEngine        *ephy_search_engine_manager_find_engine_by_name (EphySea
                                                                          const char              *engine_name);
 gboolean                 ephy_search_engine_manager_has_bang            (EphySearchEngineManager *manager,
                                                                          const char              *bang);
+GPtrArray               *ephy_search_engine_manager_complete_bang       (EphySearchEngineManager *manager,
+                                                                         const char              *prefix);
 char                    *ephy_search_engine_manager_parse_bang_search   (EphySearchEngineManager *manager,
                                                                          const char              *search);
 char                    *ephy_search_engine_manager_parse_bang_suggestions (EphySearchEngineManager *manager,
                                                                             const char              *search,
                                                                             EphySearchEngine       **out_engine);
+char                    *ephy_search_engine_manager_parse_bang_suggestions_query (EphySearchEngineManager *manager,
+                                                                                  const char              *search,
+                                                                                  EphySearchEngine       **out_engine);
 void                     ephy_search_engine_manager_save_to_settings    (EphySearchEngineManager *manager);
 
 G_END_DECLS
@@ -27,7 +27,6 @@
 #include <libsoup/soup.h>
 
 #include "ephy-suggestion.h"
-#include "ephy-user-agent.h"
 
 struct _EphySearchEngine {
   GObject parent_instance;
@@ -468,7 +467,6 @@ on_suggestions_downloaded_cb (SoupSession  *session,
                               gpointer      user_data)
 {
   g_autoptr (GTask) task = user_data;
-  EphySearchEngine *engine = EPHY_SEARCH_ENGINE (g_task_get_task_data (task));
   g_autoptr (GBytes) bytes = NULL;
   GError *error = NULL;
   g_autoptr (JsonParser) json = NULL;
@@ -482,10 +480,9 @@ on_suggestions_downloaded_cb (SoupSession  *session,
   JsonArray *suggestions_array;
   const char *error_msg;
   guint suggestions_count;
-  g_autoptr (GSequence) suggestions = NULL;
+  g_autoptr (GStrvBuilder) terms = NULL;
 
   bytes = soup_session_send_and_read_finish (session, result, &error);
-  g_clear_object (&session);
   if (!bytes) {
     g_prefix_error (&error,
                     /* TRANSLATORS: The %s is the URL for the search suggestions. */
@@ -544,18 +541,39 @@ on_suggestions_downloaded_cb (SoupSession  *session,
   }
   suggestions_array = json_array_get_array_element (json_array, 1);
   suggestions_count = json_array_get_length (suggestions_array);
-  suggestions = g_sequence_new (g_object_unref);
+  terms = g_strv_builder_new ();
   for (guint i = 0; i < suggestions_count; i++) {
     const char *suggestion_term = json_array_get_string_element (suggestions_array, i);
+
+    /* For now we don't bother if the suggestion term wasn't a string. */
+    if (suggestion_term)
+      g_strv_builder_add (terms, suggestion_term);
+  }
+
+  g_task_return_pointer (task, g_strv_builder_end (terms), (GDestroyNotify)g_strfreev);
+}
+
+/**
+ * ephy_search_engine_build_suggestions:
+ * @self: an #EphySearchEngine
+ * @terms: the suggested search terms, as loaded by
+ *   ephy_search_engine_load_suggestions_async()
+ *
+ * Returns: (transfer full): a new #GSequence with an #EphySuggestion searching
+ * @self for each of @terms.
+ */
+GSequence *
+ephy_search_engine_build_suggestions (EphySearchEngine   *self,
+                                      const char * const *terms)
+{
+  GSequence *suggestions = g_sequence_new (g_object_unref);
+
+  for (guint i = 0; terms[i]; i++) {
     EphySuggestion *suggestion;
     g_autofree char *unescaped_title = NULL;
     g_autofree char *escaped_title = NULL;
     g_autofree char *suggestion_address = NULL;
 
-    /* For now we don't bother if the suggestion term wasn't a string. */
-    if (!suggestion_term)
-      continue;
-
     /* TRANSLATORS: This is when you have search engines with suggestions support
      * (e.g. DuckDuckGo when added from the "search" button in the location entry,
      * as an OpenSearch engine): typing any text in the location entry will ask
@@ -565,10 +583,10 @@ on_suggestions_downloaded_cb (SoupSession  *session,
      * from which the suggestions are coming.
      */
     unescaped_title = g_strdup_printf ("%s — %s Search Suggestion",
-                                       suggestion_term,
-                                       ephy_search_engine_get_name (engine));
+                                       terms[i],
+                                       ephy_search_engine_get_name (self));
     escaped_title = g_markup_escape_text (unescaped_title, -1);
-    suggestion_address = ephy_search_engine_build_search_address (engine, suggestion_term);
+    suggestion_address = ephy_search_engine_build_search_address (self, terms[i]);
     suggestion = ephy_suggestion_new_without_subtitle (escaped_title, unescaped_title, suggestion_address);
 
     ephy_suggestion_set_icon (suggestion, "ephy-loupe-plus-symbolic");
@@ -576,7 +594,7 @@ on_suggestions_downloaded_cb (SoupSession  *session,
     g_sequence_append (suggestions, suggestion);
   }
 
-  g_task_return_pointer (task, g_steal_pointer (&suggestions), (GDestroyNotify)g_sequence_free);
+  return suggestions;
 }
 
 /**
@@ -585,22 +603,26 @@ on_suggestions_downloaded_cb (SoupSession  *session,
  *   method, built using ephy_search_engine_manager_parse_bang_suggestions()
  *   or ephy_search_engine_build_suggestions_address().
  * @engine: The search engine corresponding to the @built_suggestions_url.
+ * @session: The #SoupSession to load the suggestions with.
  *
  * Fetches the suggestions for a given suggestions URL.
- * Use ephy_search_engine_load_suggestions_finish() to retrieve the suggestions.
+ * Use ephy_search_engine_load_suggestions_finish() to retrieve the suggested
+ * terms, and ephy_search_engine_build_suggestions() to turn them into
+ * suggestions.
  */
 void
 ephy_search_engine_load_suggestions_async (const char          *built_suggestions_url,
                                            EphySearchEngine    *engine,
+                                           SoupSession         *session,
                                            GCancellable        *cancellable,
                                            GAsyncReadyCallback  callback,
                                            gpointer             user_data)
 {
   g_autoptr (SoupMessage) msg = NULL;
   GTask *task = NULL;
-  g_autoptr (SoupSession) soup_session = NULL;
 
   g_assert (EPHY_IS_SEARCH_ENGINE (engine));
+  g_assert (SOUP_IS_SESSION (session));
   g_assert (built_suggestions_url && *built_suggestions_url != '\0');
 
   g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
@@ -609,10 +631,8 @@ ephy_search_engine_load_suggestions_async (const char          *built_suggestion
   g_task_set_source_tag (task, ephy_search_engine_load_suggestions_async);
   g_task_set_task_data (task, g_object_ref (engine), g_object_unref);
 
-  soup_session = soup_session_new ();
-  soup_session_set_user_agent (soup_session, ephy_user_agent_get ());
   msg = soup_message_new (SOUP_METHOD_GET, built_suggestions_url);
-  soup_session_send_and_read_async (g_steal_pointer (&soup_session),
+  soup_session_send_and_read_async (session,
                                     g_steal_pointer (&msg),
                                     G_PRIORITY_DEFAULT, cancellable,
                                     (GAsyncReadyCallback)on_suggestions_downloaded_cb,
@@ -624,9 +644,9 @@ ephy_search_engine_load_suggestions_async (const char          *built_suggestion
  *
  * Finishes the asynchronous operation started with ephy_search_engine_load_suggestions_async().
  *
- * Returns: (transfer full) (nullable): a new #GSequence with the loaded #EphySuggestion as items or %NULL in case of error.
+ * Returns: (transfer full) (nullable): the suggested search terms or %NULL in case of error.
  */
-GSequence *
+char **
 ephy_search_engine_load_suggestions_finish (GAsyncResult  *result,
                                             GError       **error)
 {
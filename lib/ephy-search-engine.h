@@ -23,6 +23,7 @@
 
 #include <gio/gio.h>
 #include <glib-object.h>
+#include <libsoup/soup.h>
 
 #include "ephy-opensearch-autodiscovery-link.h"
 
@@ -61,11 +62,14 @@ char       *ephy_search_engine_build_suggestions_address (EphySearchEngine *self
 char       *ephy_search_engine_build_bang_for_name       (const char *name);
 void        ephy_search_engine_load_suggestions_async    (const char          *built_suggestions_url,
                                                           EphySearchEngine    *engine,
+                                                          SoupSession         *session,
                                                           GCancellable        *cancellable,
                                                           GAsyncReadyCallback  callback,
                                                           gpointer             user_data);
-GSequence  *ephy_search_engine_load_suggestions_finish   (GAsyncResult *result,
+char      **ephy_search_engine_load_suggestions_finish   (GAsyncResult *result,
                                                           GError      **error);
+GSequence  *ephy_search_engine_build_suggestions         (EphySearchEngine   *self,
+                                                          const char * const *terms);
 gboolean    ephy_search_engine_matches_by_autodiscovery_link (EphySearchEngine                *self,
                                                               EphyOpensearchAutodiscoveryLink *autodiscovery_link);
 
@@ -0,0 +1,563 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2; -*- */
+/*
+ *  Copyright © 2026 Epiphany Developers
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-search-suggestions-cache.h"
+
+#include <string.h>
+
+/* Remote search suggestions are fetched on every keystroke, so this keeps
+ * the answers around for a while, keyed by engine and normalized query.
+ *
+ * Loads wait for a short debounce window before going to the network. The
+ * location entry cancels the previous query on every keystroke, so while
+ * the user is typing, requests that nobody waits for anymore are dropped
+ * before they are sent. Identical loads share a single request. Once a
+ * request has been sent it always completes and fills the cache, even if
+ * everyone waiting for it gave up, because backspacing will ask for it.
+ */
+
+typedef struct {
+  char *key;
+  char **terms;
+  gint64 expiry_time;
+  GList link;
+} CacheEntry;
+
+typedef struct {
+  EphySearchSuggestionsCache *cache;
+  EphySearchEngine *engine;
+  char *key;
+  char *query; /* As typed, only the key is normalized */
+  GList *waiters; /* GTask */
+  guint debounce_id;
+} Request;
+
+struct _EphySearchSuggestionsCache {
+  GObject parent_instance;
+
+  GHashTable *entries; /* key -> CacheEntry */
+  GQueue lru; /* Most recently used first */
+  GHashTable *requests; /* key -> Request */
+  SoupSession *session;
+  GCancellable *cancellable;
+
+  guint max_entries;
+  GTimeSpan max_age;
+  guint debounce_ms;
+};
+
+G_DEFINE_FINAL_TYPE (EphySearchSuggestionsCache, ephy_search_suggestions_cache, G_TYPE_OBJECT)
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+  g_free (entry->key);
+  g_strfreev (entry->terms);
+  g_free (entry);
+}
+
+static void
+request_free (Request *request)
+{
+  g_assert (!request->waiters);
+
+  g_clear_handle_id (&request->debounce_id, g_source_remove);
+  g_object_unref (request->cache);
+  g_object_unref (request->engine);
+  g_free (request->key);
+  g_free (request->query);
+  g_free (request);
+}
+
+/* Lowercases @query and collapses its whitespace, so that queries the
+ * search engine would answer the same way share a cache entry. */
+static char *
+normalize_query (const char *query)
+{
+  g_autofree char *composed = NULL;
+  g_autofree char *lowercase = NULL;
+  GString *normalized;
+  gboolean pending_space = FALSE;
+
+  composed = g_utf8_normalize (query, -1, G_NORMALIZE_DEFAULT_COMPOSE);
+  if (!composed)
+    return NULL;
+
+  lowercase = g_utf8_strdown (composed, -1);
+  normalized = g_string_sized_new (strlen (lowercase));
+
+  for (const char *p = lowercase; *p; p = g_utf8_next_char (p)) {
+    gunichar c = g_utf8_get_char (p);
+
+    if (g_unichar_isspace (c)) {
+      pending_space = normalized->len > 0;
+      continue;
+    }
+
+    if (pending_space)
+      g_string_append_c (normalized, ' ');
+    g_string_append_unichar (normalized, c);
+    pending_space = FALSE;
+  }
+
+  return g_string_free (normalized, FALSE);
+}
+
+static char *
+make_key (EphySearchEngine *engine,
+          const char       *normalized_query)
+{
+  return g_strconcat (ephy_search_engine_get_suggestions_url (engine), "\n", normalized_query, NULL);
+}
+
+static void
+remove_entry (EphySearchSuggestionsCache *self,
+              CacheEntry                 *entry)
+{
+  g_queue_unlink (&self->lru, &entry->link);
+  g_hash_table_remove (self->entries, entry->key);
+}
+
+static CacheEntry *
+lookup_entry (EphySearchSuggestionsCache *self,
+              const char                 *key)
+{
+  CacheEntry *entry;
+
+  entry = g_hash_table_lookup (self->entries, key);
+  if (!entry)
+    return NULL;
+
+  if (g_get_monotonic_time () > entry->expiry_time) {
+    remove_entry (self, entry);
+    return NULL;
+  }
+
+  g_queue_unlink (&self->lru, &entry->link);
+  g_queue_push_head_link (&self->lru, &entry->link);
+
+  return entry;
+}
+
+static void
+store_entry (EphySearchSuggestionsCache  *self,
+             const char                  *key,
+             char                       **terms)
+{
+  CacheEntry *entry;
+
+  entry = g_hash_table_lookup (self->entries, key);
+  if (entry)
+    remove_entry (self, entry);
+
+  entry = g_new0 (CacheEntry, 1);
+  entry->key = g_strdup (key);
+  entry->terms = terms;
+  entry->expiry_time = g_get_monotonic_time () + self->max_age;
+  entry->link.data = entry;
+
+  g_hash_table_insert (self->entries, entry->key, entry);
+  g_queue_push_head_link (&self->lru, &entry->link);
+
+  while (self->lru.length > self->max_entries)
+    remove_entry (self, g_queue_peek_tail (&self->lru));
+}
+
+static void
+request_loaded_cb (GObject      *source,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  Request *request = user_data;
+  EphySearchSuggestionsCache *self = request->cache;
+  g_auto (GStrv) terms = NULL;
+  g_autoptr (GError) error = NULL;
+
+  terms = ephy_search_engine_load_suggestions_finish (result, &error);
+
+  /* Loads started from now on need a new request. */
+  g_hash_table_steal (self->requests, request->key);
+
+  if (terms)
+    store_entry (self, request->key, g_strdupv (terms));
+
+  for (GList *l = request->waiters; l; l = l->next) {
+    GTask *task = l->data;
+    EphySearchEngine *engine = g_task_get_task_data (task);
+
+    if (terms)
+      g_task_return_pointer (task,
+                             ephy_search_engine_build_suggestions (engine, (const char * const *)terms),
+                             (GDestroyNotify)g_sequence_free);
+    else
+      g_task_return_error (task, g_error_copy (error));
+  }
+
+  g_list_free_full (g_steal_pointer (&request->waiters), g_object_unref);
+  request_free (request);
+}
+
+static void
+request_send (Request *request)
+{
+  g_autofree char *url = NULL;
+
+  url = ephy_search_engine_build_suggestions_address (request->engine, request->query);
+  ephy_search_engine_load_suggestions_async (url,
+                                             request->engine,
+                                             request->cache->session,
+                                             request->cache->cancellable,
+                                             request_loaded_cb,
+                                             request);
+}
+
+static gboolean
+request_debounce_cb (gpointer user_data)
+{
+  Request *request = user_data;
+  GList *l = request->waiters;
+
+  request->debounce_id = 0;
+
+  while (l) {
+    GList *next = l->next;
+    GTask *task = l->data;
+
+    if (g_task_return_error_if_cancelled (task)) {
+      request->waiters = g_list_delete_link (request->waiters, l);
+      g_object_unref (task);
+    }
+
+    l = next;
+  }
+
+  if (request->waiters)
+    request_send (request);
+  else
+    g_hash_table_remove (request->cache->requests, request->key);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+ephy_search_suggestions_cache_dispose (GObject *object)
+{
+  EphySearchSuggestionsCache *self = EPHY_SEARCH_SUGGESTIONS_CACHE (object);
+
+  g_cancellable_cancel (self->cancellable);
+
+  G_OBJECT_CLASS (ephy_search_suggestions_cache_parent_class)->dispose (object);
+}
+
+static void
+ephy_search_suggestions_cache_finalize (GObject *object)
+{
+  EphySearchSuggestionsCache *self = EPHY_SEARCH_SUGGESTIONS_CACHE (object);
+
+  /* Every request holds a reference on the cache. */
+  g_assert (g_hash_table_size (self->requests) == 0);
+
+  /* The list links are part of the entries. */
+  g_queue_init (&self->lru);
+  g_hash_table_unref (self->entries);
+  g_hash_table_unref (self->requests);
+  g_object_unref (self->session);
+  g_object_unref (self->cancellable);
+
+  G_OBJECT_CLASS (ephy_search_suggestions_cache_parent_class)->finalize (object);
+}
+
+static void
+ephy_search_suggestions_cache_class_init (EphySearchSuggestionsCacheClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = ephy_search_suggestions_cache_dispose;
+  object_class->finalize = ephy_search_suggestions_cache_finalize;
+}
+
+static void
+ephy_search_suggestions_cache_init (EphySearchSuggestionsCache *self)
+{
+  self->entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify)cache_entry_free);
+  self->requests = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify)request_free);
+  self->cancellable = g_cancellable_new ();
+  g_queue_init (&self->lru);
+}
+
+/**
+ * ephy_search_suggestions_cache_new:
+ * @session: the #SoupSession to send the requests with
+ * @max_entries: how many answers to keep, dropping the least recently used
+ * @max_age: how long an answer is valid for, in microseconds
+ * @debounce_ms: how long to wait before sending a request, in milliseconds
+ *
+ * Returns: (transfer full): a new #EphySearchSuggestionsCache
+ */
+EphySearchSuggestionsCache *
+ephy_search_suggestions_cache_new (SoupSession *session,
+                                   guint        max_entries,
+                                   GTimeSpan    max_age,
+                                   guint        debounce_ms)
+{
+  EphySearchSuggestionsCache *self;
+
+  g_assert (SOUP_IS_SESSION (session));
+  g_assert (max_entries > 0);
+
+  self = g_object_new (EPHY_TYPE_SEARCH_SUGGESTIONS_CACHE, NULL);
+  self->session = g_object_ref (session);
+  self->max_entries = max_entries;
+  self->max_age = max_age;
+  self->debounce_ms = debounce_ms;
+
+  return self;
+}
+
+/**
+ * ephy_search_suggestions_cache_lookup:
+ * @engine: an #EphySearchEngine with a suggestions URL
+ * @query: the search query
+ * @is_exact: (out): whether the suggestions are the answer for @query
+ *
+ * Looks @query up without going to the network. If only the answer to a
+ * shorter query typed on the way to @query is known, returns the ones of
+ * its suggestions that still start with @query, which is a good guess
+ * until the real answer comes in.
+ *
+ * Returns: (transfer full) (nullable): a new #GSequence of #EphySuggestion,
+ * or %NULL if there is nothing to suggest yet.
+ */
+GSequence *
+ephy_search_suggestions_cache_lookup (EphySearchSuggestionsCache *self,
+                                      EphySearchEngine           *engine,
+                                      const char                 *query,
+                                      gboolean                   *is_exact)
+{
+  g_autofree char *normalized = NULL;
+  g_autofree char *key = NULL;
+  CacheEntry *entry;
+  const char *end;
+
+  g_assert (EPHY_IS_SEARCH_SUGGESTIONS_CACHE (self));
+  g_assert (EPHY_IS_SEARCH_ENGINE (engine));
+  g_assert (is_exact);
+
+  *is_exact = FALSE;
+
+  normalized = normalize_query (query);
+  if (!normalized || *normalized == '\0')
+    return NULL;
+
+  key = make_key (engine, normalized);
+  entry = lookup_entry (self, key);
+  if (entry) {
+    *is_exact = TRUE;
+    return ephy_search_engine_build_suggestions (engine, (const char * const *)entry->terms);
+  }
+
+  for (end = g_utf8_find_prev_char (normalized, normalized + strlen (normalized));
+       end && end > normalized;
+       end = g_utf8_find_prev_char (normalized, end)) {
+    g_autofree char *prefix = g_strndup (normalized, end - normalized);
+    g_autofree char *prefix_key = make_key (engine, prefix);
+    g_autoptr (GStrvBuilder) builder = NULL;
+    g_auto (GStrv) terms = NULL;
+
+    entry = lookup_entry (self, prefix_key);
+    if (!entry)
+      continue;
+
+    builder = g_strv_builder_new ();
+    for (guint i = 0; entry->terms[i]; i++) {
+      g_autofree char *term = normalize_query (entry->terms[i]);
+
+      if (term && g_str_has_prefix (term, normalized))
+        g_strv_builder_add (builder, entry->terms[i]);
+    }
+
+    /* The closest answer is the best guess, older ones would not do better. */
+    terms = g_strv_builder_end (builder);
+    if (!terms[0])
+      return NULL;
+
+    return ephy_search_engine_build_suggestions (engine, (const char * const *)terms);
+  }
+
+  return NULL;
+}
+
+/**
+ * ephy_search_suggestions_cache_load_async:
+ * @engine: an #EphySearchEngine with a suggestions URL
+ * @query: the search query
+ *
+ * Loads the suggestions of @engine for @query, from the cache if possible.
+ * Use ephy_search_suggestions_cache_load_finish() to retrieve them.
+ */
+void
+ephy_search_suggestions_cache_load_async (EphySearchSuggestionsCache *self,
+                                          EphySearchEngine           *engine,
+                                          const char                 *query,
+                                          GCancellable               *cancellable,
+                                          GAsyncReadyCallback         callback,
+                                          gpointer                    user_data)
+{
+  g_autoptr (GTask) task = NULL;
+  g_autofree char *normalized = NULL;
+  g_autofree char *key = NULL;
+  CacheEntry *entry;
+  Request *request;
+
+  g_assert (EPHY_IS_SEARCH_SUGGESTIONS_CACHE (self));
+  g_assert (EPHY_IS_SEARCH_ENGINE (engine));
+  g_assert (ephy_search_engine_get_suggestions_url (engine));
+  g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, ephy_search_suggestions_cache_load_async);
+  g_task_set_task_data (task, g_object_ref (engine), g_object_unref);
+
+  normalized = normalize_query (query);
+  if (!normalized || *normalized == '\0') {
+    g_task_return_pointer (task, g_sequence_new (g_object_unref), (GDestroyNotify)g_sequence_free);
+    return;
+  }
+
+  key = make_key (engine, normalized);
+  entry = lookup_entry (self, key);
+  if (entry) {
+    g_task_return_pointer (task,
+                           ephy_search_engine_build_suggestions (engine, (const char * const *)entry->terms),
+                           (GDestroyNotify)g_sequence_free);
+    return;
+  }
+
+  request = g_hash_table_lookup (self->requests, key);
+  if (!request) {
+    request = g_new0 (Request, 1);
+    request->cache = g_object_ref (self);
+    request->engine = g_object_ref (engine);
+    request->key = g_steal_pointer (&key);
+    request->query = g_strdup (query);
+    g_hash_table_insert (self->requests, request->key, request);
+
+    if (self->debounce_ms > 0)
+      request->debounce_id = g_timeout_add (self->debounce_ms, request_debounce_cb, request);
+    else
+      request_send (request);
+  }
+
+  request->waiters = g_list_append (request->waiters, g_steal_pointer (&task));
+}
+
+/**
+ * ephy_search_suggestions_cache_load_finish:
+ *
+ * Finishes the asynchronous operation started with
+ * ephy_search_suggestions_cache_load_async().
+ *
+ * Returns: (transfer full) (nullable): a new #GSequence of #EphySuggestion or
+ * %NULL in case of error.
+ */
+GSequence *
+ephy_search_suggestions_cache_load_finish (EphySearchSuggestionsCache  *self,
+                                           GAsyncResult                *result,
+                                           GError                     **error)
+{
+  g_assert (g_task_is_valid (result, self));
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+preconnect_cb (SoupSession  *session,
+               GAsyncResult *result,
+               GTask        *task)
+{
+  GError *error = NULL;
+
+  if (soup_session_preconnect_finish (session, result, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+
+  g_object_unref (task);
+}
+
+/**
+ * ephy_search_suggestions_cache_preconnect_async:
+ * @engine: an #EphySearchEngine with a suggestions URL
+ *
+ * Opens a connection to the suggestions server of @engine ahead of time, so
+ * that the first load does not have to wait for the DNS lookup and the TLS
+ * handshake. The connection is kept in the session's pool, and used by the
+ * next load if the server does not close it first.
+ */
+void
+ephy_search_suggestions_cache_preconnect_async (EphySearchSuggestionsCache *self,
+                                                EphySearchEngine           *engine,
+                                                GCancellable               *cancellable,
+                                                GAsyncReadyCallback         callback,
+                                                gpointer                    user_data)
+{
+  g_autoptr (SoupMessage) msg = NULL;
+  g_autofree char *url = NULL;
+  GTask *task;
+
+  g_assert (EPHY_IS_SEARCH_SUGGESTIONS_CACHE (self));
+  g_assert (EPHY_IS_SEARCH_ENGINE (engine));
+  g_assert (ephy_search_engine_get_suggestions_url (engine));
+  g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, ephy_search_suggestions_cache_preconnect_async);
+
+  url = ephy_search_engine_build_suggestions_address (engine, "");
+  msg = soup_message_new (SOUP_METHOD_GET, url);
+  if (!msg) {
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                             "Invalid suggestions URL %s", url);
+    g_object_unref (task);
+    return;
+  }
+
+  soup_session_preconnect_async (self->session, msg, G_PRIORITY_LOW, cancellable,
+                                 (GAsyncReadyCallback)preconnect_cb, task);
+}
+
+/**
+ * ephy_search_suggestions_cache_preconnect_finish:
+ *
+ * Finishes the asynchronous operation started with
+ * ephy_search_suggestions_cache_preconnect_async().
+ *
+ * Returns: %TRUE if the connection is ready
+ */
+gboolean
+ephy_search_suggestions_cache_preconnect_finish (EphySearchSuggestionsCache  *self,
+                                                 GAsyncResult                *result,
+                                                 GError                     **error)
+{
+  g_assert (g_task_is_valid (result, self));
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
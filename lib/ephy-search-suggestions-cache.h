@@ -0,0 +1,60 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2; -*- */
+/*
+ *  Copyright © 2026 Epiphany Developers
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <libsoup/soup.h>
+
+#include "ephy-search-engine.h"
+
+G_BEGIN_DECLS
+
+#define EPHY_TYPE_SEARCH_SUGGESTIONS_CACHE (ephy_search_suggestions_cache_get_type ())
+
+G_DECLARE_FINAL_TYPE (EphySearchSuggestionsCache, ephy_search_suggestions_cache, EPHY, SEARCH_SUGGESTIONS_CACHE, GObject)
+
+EphySearchSuggestionsCache *ephy_search_suggestions_cache_new               (SoupSession                 *session,
+                                                                             guint                        max_entries,
+                                                                             GTimeSpan                    max_age,
+                                                                             guint                        debounce_ms);
+GSequence                  *ephy_search_suggestions_cache_lookup            (EphySearchSuggestionsCache  *self,
+                                                                             EphySearchEngine            *engine,
+                                                                             const char                  *query,
+                                                                             gboolean                    *is_exact);
+void                        ephy_search_suggestions_cache_load_async        (EphySearchSuggestionsCache  *self,
+                                                                             EphySearchEngine            *engine,
+                                                                             const char                  *query,
+                                                                             GCancellable                *cancellable,
+                                                                             GAsyncReadyCallback          callback,
+                                                                             gpointer                     user_data);
+GSequence                  *ephy_search_suggestions_cache_load_finish       (EphySearchSuggestionsCache  *self,
+                                                                             GAsyncResult                *result,
+                                                                             GError                     **error);
+void                        ephy_search_suggestions_cache_preconnect_async  (EphySearchSuggestionsCache  *self,
+                                                                             EphySearchEngine            *engine,
+                                                                             GCancellable                *cancellable,
+                                                                             GAsyncReadyCallback          callback,
+                                                                             gpointer                     user_data);
+gboolean                    ephy_search_suggestions_cache_preconnect_finish (EphySearchSuggestionsCache  *self,
+                                                                             GAsyncResult                *result,
+                                                                             GError                     **error);
+
+G_END_DECLS
@@ -23,6 +23,7 @@
 #include "ephy-sqlite-connection.h"
 
 #include <errno.h>
+#include <string.h>
 
 #include <glib/gstdio.h>
 #include <sqlite3.h>
@@ -37,8 +38,42 @@ struct _EphySQLiteConnection {
   EphySQLiteConnectionMode mode;
 
   EphySQLiteStatement *connection_table_exists_statement;
+
+  /* Prepared statements for dynamically built queries, by query shape. */
+  GHashTable *statement_cache;
+  guint64 statement_cache_hits;
+  guint64 statement_cache_misses;
+
+  /* Checkpoints run by ephy_sqlite_connection_checkpoint() instead of by
+   * SQLite itself, once enabled. wal_frames is the length of the WAL as of
+   * the last commit or checkpoint. */
+  gboolean manual_checkpoints;
+  gint64 wal_size_limit;
+  int page_size;
+  int wal_frames;
+  guint64 checkpoint_count;
+  gint64 checkpoint_duration_last;
+  gint64 checkpoint_duration_max;
+
+  /* The statement last seen by the query stats trace, and its stats. */
+  sqlite3_stmt *traced_statement;
+  EphySQLiteQueryStats *traced_stats;
 };
 
+/* Queries are cached by shape, and there are only a handful of shapes in
+ * practice. The limit only guards against unusual callers. */
+#define STATEMENT_CACHE_MAX_SIZE 64
+
+/* Query stats are collected for every connection in the process when the
+ * EPHY_SQLITE_STATS environment variable is set. Its value is the time in
+ * milliseconds past which a query is also logged as slow. */
+#define SLOW_QUERY_DEFAULT_THRESHOLD (100 * G_TIME_SPAN_MILLISECOND)
+
+static gboolean query_stats_enabled;
+static gint64 slow_query_threshold;
+static GMutex query_stats_mutex;
+static GHashTable *query_stats;
+
 G_DEFINE_FINAL_TYPE (EphySQLiteConnection, ephy_sqlite_connection, G_TYPE_OBJECT);
 
 typedef enum {
@@ -53,8 +88,9 @@ ephy_sqlite_connection_finalize (GObject *object)
 {
   EphySQLiteConnection *self = EPHY_SQLITE_CONNECTION (object);
   g_clear_object (&self->connection_table_exists_statement);
-  g_free (EPHY_SQLITE_CONNECTION (self)->database_path);
   ephy_sqlite_connection_close (EPHY_SQLITE_CONNECTION (self));
+  g_free (EPHY_SQLITE_CONNECTION (self)->database_path);
+  g_hash_table_unref (self->statement_cache);
   G_OBJECT_CLASS (ephy_sqlite_connection_parent_class)->finalize (object);
 }
 
@@ -98,12 +134,79 @@ ephy_sqlite_connection_class_init (EphySQLiteConnectionClass *klass)
                          G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE | G_PARAM_STATIC_STRINGS);
 
   g_object_class_install_properties (gobject_class, G_N_ELEMENTS (obj_properties), obj_properties);
+
+  if (g_getenv ("EPHY_SQLITE_STATS")) {
+    gint64 threshold = g_ascii_strtoll (g_getenv ("EPHY_SQLITE_STATS"), NULL, 10);
+
+    query_stats_enabled = TRUE;
+    slow_query_threshold = threshold > 0 ? threshold * G_TIME_SPAN_MILLISECOND : SLOW_QUERY_DEFAULT_THRESHOLD;
+    query_stats = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify)ephy_sqlite_query_stats_free);
+  }
 }
 
 static void
 ephy_sqlite_connection_init (EphySQLiteConnection *self)
 {
   self->database = NULL;
+  self->statement_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+}
+
+gboolean
+ephy_sqlite_query_stats_enabled (void)
+{
+  return query_stats_enabled;
+}
+
+void
+ephy_sqlite_query_stats_free (EphySQLiteQueryStats *stats)
+{
+  g_free (stats->sql);
+  g_free (stats);
+}
+
+static int
+compare_query_stats (EphySQLiteQueryStats **a,
+                     EphySQLiteQueryStats **b)
+{
+  if ((*a)->total_time == (*b)->total_time)
+    return 0;
+
+  return (*a)->total_time > (*b)->total_time ? -1 : 1;
+}
+
+/**
+ * ephy_sqlite_get_query_stats:
+ *
+ * Returns the time spent in each query run on any connection, as
+ * #EphySQLiteQueryStats with times in microseconds. The stats are only
+ * collected when the EPHY_SQLITE_STATS environment variable is set.
+ *
+ * Returns: (transfer full): a copy of the stats, the most expensive
+ *   queries first
+ */
+GPtrArray *
+ephy_sqlite_get_query_stats (void)
+{
+  GPtrArray *result = g_ptr_array_new_with_free_func ((GDestroyNotify)ephy_sqlite_query_stats_free);
+  GHashTableIter iter;
+  EphySQLiteQueryStats *stats;
+
+  if (!query_stats_enabled)
+    return result;
+
+  g_mutex_lock (&query_stats_mutex);
+  g_hash_table_iter_init (&iter, query_stats);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&stats)) {
+    EphySQLiteQueryStats *copy = g_memdup2 (stats, sizeof (EphySQLiteQueryStats));
+
+    copy->sql = g_strdup (stats->sql);
+    g_ptr_array_add (result, copy);
+  }
+  g_mutex_unlock (&query_stats_mutex);
+
+  g_ptr_array_sort (result, (GCompareFunc)compare_query_stats);
+
+  return result;
 }
 
 GQuark
@@ -130,25 +233,93 @@ ephy_sqlite_connection_new (EphySQLiteConnectionMode  mode,
                                                NULL));
 }
 
+static EphySQLiteQueryStats *
+get_query_stats (EphySQLiteConnection *self,
+                 sqlite3_stmt         *statement)
+{
+  const char *sql = sqlite3_sql (statement);
+
+  /* A finalized statement's address can be reused by the next one, so the
+   * text has to match as well. */
+  if (statement == self->traced_statement && strcmp (sql, self->traced_stats->sql) == 0)
+    return self->traced_stats;
+
+  self->traced_statement = statement;
+  self->traced_stats = g_hash_table_lookup (query_stats, sql);
+  if (!self->traced_stats) {
+    self->traced_stats = g_new0 (EphySQLiteQueryStats, 1);
+    self->traced_stats->sql = g_strdup (sql);
+    g_hash_table_insert (query_stats, self->traced_stats->sql, self->traced_stats);
+  }
+
+  return self->traced_stats;
+}
+
+static int
+trace_cb (unsigned int  event,
+          void         *user_data,
+          void         *p,
+          void         *x)
+{
+  EphySQLiteConnection *self = user_data;
+  EphySQLiteQueryStats *stats;
+  gint64 duration = 0;
+
+  /* Connections are used from several threads, but the stats are shared. */
+  g_mutex_lock (&query_stats_mutex);
+  stats = get_query_stats (self, p);
+  if (event == SQLITE_TRACE_ROW) {
+    stats->rows++;
+  } else {
+    duration = *(sqlite3_int64 *)x / 1000;
+    stats->count++;
+    stats->total_time += duration;
+    stats->max_time = MAX (stats->max_time, duration);
+  }
+  g_mutex_unlock (&query_stats_mutex);
+
+  if (duration >= slow_query_threshold)
+    g_message ("Slow query on %s (%.1f ms): %s", self->database_path, duration / 1000.0, sqlite3_sql (p));
+
+  return 0;
+}
+
 gboolean
 ephy_sqlite_connection_open (EphySQLiteConnection  *self,
                              GError               **error)
 {
+  int flags;
+
   if (self->database) {
     set_error_from_string ("Connection already open.", error);
     return FALSE;
   }
 
+  switch (self->mode) {
+    case EPHY_SQLITE_CONNECTION_MODE_MEMORY:
+      flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_MEMORY;
+      break;
+    case EPHY_SQLITE_CONNECTION_MODE_READONLY:
+      flags = SQLITE_OPEN_READONLY;
+      break;
+    case EPHY_SQLITE_CONNECTION_MODE_READWRITE:
+    default:
+      flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+      break;
+  }
+
   if (sqlite3_open_v2 (self->database_path,
                        &self->database,
-                       self->mode == EPHY_SQLITE_CONNECTION_MODE_MEMORY ? SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_MEMORY
-                                                                        : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                       flags,
                        NULL) != SQLITE_OK) {
     ephy_sqlite_connection_get_error (self, error);
     ephy_sqlite_connection_close (self);
     return FALSE;
   }
 
+  if (query_stats_enabled)
+    sqlite3_trace_v2 (self->database, SQLITE_TRACE_PROFILE | SQLITE_TRACE_ROW, trace_cb, self);
+
   /* Create a local copy of current database for in memory usage */
   if (self->mode == EPHY_SQLITE_CONNECTION_MODE_MEMORY) {
     sqlite3 *init_db;
@@ -168,6 +339,10 @@ ephy_sqlite_connection_open (EphySQLiteConnection  *self,
     }
 
     sqlite3_close (init_db);
+  } else if (self->mode == EPHY_SQLITE_CONNECTION_MODE_READONLY) {
+    /* The journal mode is a property of the database file, which only the
+     * read/write connection can change. */
+    ephy_sqlite_connection_execute (self, "PRAGMA main.cache_size=10000", error);
   } else {
     ephy_sqlite_connection_execute (self, "PRAGMA main.journal_mode=WAL", error);
     ephy_sqlite_connection_execute (self, "PRAGMA main.synchronous=NORMAL", error);
@@ -180,6 +355,23 @@ ephy_sqlite_connection_open (EphySQLiteConnection  *self,
 void
 ephy_sqlite_connection_close (EphySQLiteConnection *self)
 {
+  /* Leave an empty WAL behind, so the next start does not have to replay
+   * it. */
+  if (self->database && self->manual_checkpoints) {
+    GError *error = NULL;
+
+    ephy_sqlite_connection_checkpoint (self, EPHY_SQLITE_CHECKPOINT_TRUNCATE, &error);
+    if (error) {
+      g_warning ("Failed to checkpoint database at %s: %s", self->database_path, error->message);
+      g_error_free (error);
+    }
+  }
+  self->manual_checkpoints = FALSE;
+  self->traced_statement = NULL;
+
+  /* Cached statements must be finalized before the database can be closed,
+   * and they hold a reference to the connection. */
+  g_hash_table_remove_all (self->statement_cache);
   g_clear_pointer (&self->database, sqlite3_close);
 }
 
@@ -256,12 +448,99 @@ ephy_sqlite_connection_create_statement (EphySQLiteConnection         *self,
                                               NULL));
 }
 
+/**
+ * ephy_sqlite_connection_get_cached_statement:
+ * @self: an #EphySQLiteConnection
+ * @key: a string describing the shape of the query
+ *
+ * Looks up a statement previously added with
+ * ephy_sqlite_connection_add_cached_statement(). The statement is reset, but
+ * keeps its old bindings, so every parameter must be bound again.
+ *
+ * Returns: (transfer full) (nullable): the statement, or %NULL if it is not
+ *   cached yet
+ */
+EphySQLiteStatement *
+ephy_sqlite_connection_get_cached_statement (EphySQLiteConnection *self,
+                                             const char           *key)
+{
+  EphySQLiteStatement *statement;
+
+  g_assert (EPHY_IS_SQLITE_CONNECTION (self));
+  g_assert (key);
+
+  statement = g_hash_table_lookup (self->statement_cache, key);
+  if (!statement) {
+    self->statement_cache_misses++;
+    return NULL;
+  }
+
+  self->statement_cache_hits++;
+  ephy_sqlite_statement_reset (statement);
+
+  return g_object_ref (statement);
+}
+
+/**
+ * ephy_sqlite_connection_add_cached_statement:
+ * @self: an #EphySQLiteConnection
+ * @key: a string describing the shape of the query
+ * @sql: the SQL text for queries of this shape
+ * @error: return location for a #GError, or %NULL
+ *
+ * Compiles @sql and keeps it so that later queries with the same @key can
+ * reuse it through ephy_sqlite_connection_get_cached_statement().
+ *
+ * Returns: (transfer full) (nullable): the statement, or %NULL on error
+ */
+EphySQLiteStatement *
+ephy_sqlite_connection_add_cached_statement (EphySQLiteConnection  *self,
+                                             const char            *key,
+                                             const char            *sql,
+                                             GError               **error)
+{
+  EphySQLiteStatement *statement;
+
+  g_assert (EPHY_IS_SQLITE_CONNECTION (self));
+  g_assert (key);
+
+  statement = ephy_sqlite_connection_create_statement (self, sql, EPHY_SQLITE_STATEMENT_LONG_LIVED, error);
+  if (!statement)
+    return NULL;
+
+  if (g_hash_table_size (self->statement_cache) >= STATEMENT_CACHE_MAX_SIZE)
+    g_hash_table_remove_all (self->statement_cache);
+
+  g_hash_table_replace (self->statement_cache, g_strdup (key), g_object_ref (statement));
+
+  return statement;
+}
+
+void
+ephy_sqlite_connection_get_statement_cache_stats (EphySQLiteConnection *self,
+                                                  guint64              *hits,
+                                                  guint64              *misses)
+{
+  g_assert (EPHY_IS_SQLITE_CONNECTION (self));
+
+  if (hits)
+    *hits = self->statement_cache_hits;
+  if (misses)
+    *misses = self->statement_cache_misses;
+}
+
 gint64
 ephy_sqlite_connection_get_last_insert_id (EphySQLiteConnection *self)
 {
   return sqlite3_last_insert_rowid (self->database);
 }
 
+int
+ephy_sqlite_connection_get_changes (EphySQLiteConnection *self)
+{
+  return sqlite3_changes (self->database);
+}
+
 void
 ephy_sqlite_connection_enable_foreign_keys (EphySQLiteConnection *self)
 {
@@ -276,6 +555,146 @@ ephy_sqlite_connection_enable_foreign_keys (EphySQLiteConnection *self)
   }
 }
 
+static int
+wal_hook (void       *user_data,
+          sqlite3    *database,
+          const char *name,
+          int         frames)
+{
+  EphySQLiteConnection *self = user_data;
+  GError *error = NULL;
+
+  self->wal_frames = frames;
+
+  if (self->wal_size_limit > 0 && ephy_sqlite_connection_get_wal_size (self) > self->wal_size_limit) {
+    ephy_sqlite_connection_checkpoint (self, EPHY_SQLITE_CHECKPOINT_TRUNCATE, &error);
+    if (error) {
+      g_warning ("Failed to checkpoint database at %s: %s", self->database_path, error->message);
+      g_error_free (error);
+    }
+  }
+
+  return SQLITE_OK;
+}
+
+/**
+ * ephy_sqlite_connection_enable_manual_checkpoints:
+ * @self: an open, read/write #EphySQLiteConnection
+ * @wal_size_limit: the WAL size in bytes past which a commit also
+ *   checkpoints, or 0 for no limit
+ *
+ * Turns off SQLite's automatic checkpoints, which run in the middle of
+ * whatever transaction happens to cross the threshold. The caller runs
+ * passive checkpoints with ephy_sqlite_connection_checkpoint() when it is
+ * idle instead. The WAL is still truncated when it grows past
+ * @wal_size_limit, and when the connection is closed.
+ */
+void
+ephy_sqlite_connection_enable_manual_checkpoints (EphySQLiteConnection *self,
+                                                  gint64                wal_size_limit)
+{
+  EphySQLiteStatement *statement;
+
+  g_assert (EPHY_IS_SQLITE_CONNECTION (self));
+  g_assert (self->mode == EPHY_SQLITE_CONNECTION_MODE_READWRITE);
+
+  if (!self->database)
+    return;
+
+  statement = ephy_sqlite_connection_create_statement (self, "PRAGMA main.page_size", EPHY_SQLITE_STATEMENT_SHORT_LIVED, NULL);
+  if (statement && ephy_sqlite_statement_step (statement, NULL))
+    self->page_size = ephy_sqlite_statement_get_column_as_int (statement, 0);
+  g_clear_object (&statement);
+
+  /* Replaces the hook that runs automatic checkpoints. */
+  sqlite3_wal_hook (self->database, wal_hook, self);
+
+  self->manual_checkpoints = TRUE;
+  self->wal_size_limit = wal_size_limit;
+}
+
+/**
+ * ephy_sqlite_connection_checkpoint:
+ * @self: an #EphySQLiteConnection
+ * @mode: %EPHY_SQLITE_CHECKPOINT_PASSIVE to copy what can be copied without
+ *   waiting for readers, or %EPHY_SQLITE_CHECKPOINT_TRUNCATE to also empty
+ *   the WAL file
+ * @error: return location for a #GError, or %NULL
+ *
+ * Copies the pages in the WAL back into the database.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+ephy_sqlite_connection_checkpoint (EphySQLiteConnection      *self,
+                                   EphySQLiteCheckpointMode   mode,
+                                   GError                   **error)
+{
+  gint64 start_time;
+  int log_frames = 0;
+  int checkpointed_frames = 0;
+  int rc;
+
+  g_assert (EPHY_IS_SQLITE_CONNECTION (self));
+
+  if (!self->database) {
+    set_error_from_string ("Connection not open.", error);
+    return FALSE;
+  }
+
+  start_time = g_get_monotonic_time ();
+  rc = sqlite3_wal_checkpoint_v2 (self->database, NULL,
+                                  mode == EPHY_SQLITE_CHECKPOINT_TRUNCATE ? SQLITE_CHECKPOINT_TRUNCATE : SQLITE_CHECKPOINT_PASSIVE,
+                                  &log_frames, &checkpointed_frames);
+
+  self->checkpoint_count++;
+  self->checkpoint_duration_last = g_get_monotonic_time () - start_time;
+  self->checkpoint_duration_max = MAX (self->checkpoint_duration_max, self->checkpoint_duration_last);
+
+  /* A truncating checkpoint is busy while readers still use the WAL. What
+   * could be copied has been, and the next one will try again. */
+  if (rc != SQLITE_OK && rc != SQLITE_BUSY) {
+    ephy_sqlite_connection_get_error (self, error);
+    return FALSE;
+  }
+
+  if (log_frames >= 0)
+    self->wal_frames = log_frames;
+
+  return TRUE;
+}
+
+/**
+ * ephy_sqlite_connection_get_wal_size:
+ * @self: an #EphySQLiteConnection with manual checkpoints
+ *
+ * Returns: the size of the WAL in bytes, as of the last commit or
+ *   checkpoint
+ */
+gint64
+ephy_sqlite_connection_get_wal_size (EphySQLiteConnection *self)
+{
+  g_assert (EPHY_IS_SQLITE_CONNECTION (self));
+
+  return (gint64)self->wal_frames * self->page_size;
+}
+
+void
+ephy_sqlite_connection_get_checkpoint_stats (EphySQLiteConnection *self,
+                                             guint64              *count,
+                                             gint64               *last_duration,
+                                             gint64               *max_duration)
+{
+  g_assert (EPHY_IS_SQLITE_CONNECTION (self));
+
+  if (count)
+    *count = self->checkpoint_count;
+  if (last_duration)
+    *last_duration = self->checkpoint_duration_last;
+  if (max_duration)
+    *max_duration = self->checkpoint_duration_max;
+}
+
 gboolean
 ephy_sqlite_connection_begin_transaction (EphySQLiteConnection  *self,
                                           GError               **error)
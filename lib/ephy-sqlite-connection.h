@@ -33,7 +33,8 @@ G_DECLARE_FINAL_TYPE (EphySQLiteConnection, ephy_sqlite_connection, EPHY, SQLITE
 
 typedef enum {
   EPHY_SQLITE_CONNECTION_MODE_MEMORY,
-  EPHY_SQLITE_CONNECTION_MODE_READWRITE
+  EPHY_SQLITE_CONNECTION_MODE_READWRITE,
+  EPHY_SQLITE_CONNECTION_MODE_READONLY
 } EphySQLiteConnectionMode;
 
 typedef enum {
@@ -41,6 +42,19 @@ typedef enum {
   EPHY_SQLITE_STATEMENT_LONG_LIVED
 } EphySQLiteStatementLifetime;
 
+typedef enum {
+  EPHY_SQLITE_CHECKPOINT_PASSIVE,
+  EPHY_SQLITE_CHECKPOINT_TRUNCATE
+} EphySQLiteCheckpointMode;
+
+typedef struct {
+  char *sql;
+  guint64 count;
+  guint64 rows;
+  gint64 total_time;
+  gint64 max_time;
+} EphySQLiteQueryStats;
+
 EphySQLiteConnection *  ephy_sqlite_connection_new                     (EphySQLiteConnectionMode  mode, const char *database_path);
 
 gboolean                ephy_sqlite_connection_open                    (EphySQLiteConnection *self, GError **error);
@@ -51,16 +65,30 @@ void                    ephy_sqlite_connection_get_error               (EphySQLi
 
 gboolean                ephy_sqlite_connection_execute                 (EphySQLiteConnection *self, const char *sql, GError **error);
 EphySQLiteStatement *   ephy_sqlite_connection_create_statement        (EphySQLiteConnection *self, const char *sql, EphySQLiteStatementLifetime lifetime, GError **error);
+EphySQLiteStatement *   ephy_sqlite_connection_get_cached_statement    (EphySQLiteConnection *self, const char *key);
+EphySQLiteStatement *   ephy_sqlite_connection_add_cached_statement    (EphySQLiteConnection *self, const char *key, const char *sql, GError **error);
+void                    ephy_sqlite_connection_get_statement_cache_stats (EphySQLiteConnection *self, guint64 *hits, guint64 *misses);
 gint64                  ephy_sqlite_connection_get_last_insert_id      (EphySQLiteConnection *self);
+int                     ephy_sqlite_connection_get_changes             (EphySQLiteConnection *self);
 void                    ephy_sqlite_connection_enable_foreign_keys     (EphySQLiteConnection *self);
+void                    ephy_sqlite_connection_enable_manual_checkpoints (EphySQLiteConnection *self, gint64 wal_size_limit);
+gboolean                ephy_sqlite_connection_checkpoint              (EphySQLiteConnection *self, EphySQLiteCheckpointMode mode, GError **error);
+gint64                  ephy_sqlite_connection_get_wal_size            (EphySQLiteConnection *self);
+void                    ephy_sqlite_connection_get_checkpoint_stats    (EphySQLiteConnection *self, guint64 *count, gint64 *last_duration, gint64 *max_duration);
 
 gboolean                ephy_sqlite_connection_begin_transaction       (EphySQLiteConnection *self, GError **error);
 gboolean                ephy_sqlite_connection_commit_transaction      (EphySQLiteConnection *self, GError **error);
 
 gboolean                ephy_sqlite_connection_table_exists            (EphySQLiteConnection *self, const char *table_name);
 
+gboolean                ephy_sqlite_query_stats_enabled                (void);
+GPtrArray *             ephy_sqlite_get_query_stats                    (void);
+void                    ephy_sqlite_query_stats_free                   (EphySQLiteQueryStats *stats);
+
 GQuark                  ephy_sqlite_error_quark                        (void);
 
 #define EPHY_SQLITE_ERROR ephy_sqlite_error_quark ()
 
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EphySQLiteQueryStats, ephy_sqlite_query_stats_free)
+
 G_END_DECLS
@@ -0,0 +1,163 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2; -*- */
+/*
+ *  Copyright © 2026 Epiphany Developers
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-suggestion-index.h"
+
+#include <string.h>
+
+EphySuggestionIndexEntry *
+ephy_suggestion_index_entry_new (const char *url,
+                                 const char *title,
+                                 const char *extra_text,
+                                 gint64      rank)
+{
+  EphySuggestionIndexEntry *entry = g_rc_box_new0 (EphySuggestionIndexEntry);
+  g_autofree char *text = NULL;
+
+  entry->url = g_strdup (url);
+  entry->title = g_strdup (title);
+  entry->rank = rank;
+
+  /* Query terms never contain spaces, so they cannot match across fields. */
+  text = g_strjoin (" ", title, url, extra_text, NULL);
+  entry->text = g_utf8_casefold (text, -1);
+
+  return entry;
+}
+
+static void
+ephy_suggestion_index_entry_clear (EphySuggestionIndexEntry *entry)
+{
+  g_free (entry->url);
+  g_free (entry->title);
+  g_free (entry->text);
+}
+
+EphySuggestionIndexEntry *
+ephy_suggestion_index_entry_ref (EphySuggestionIndexEntry *entry)
+{
+  return g_rc_box_acquire (entry);
+}
+
+void
+ephy_suggestion_index_entry_unref (EphySuggestionIndexEntry *entry)
+{
+  g_rc_box_release_full (entry, (GDestroyNotify)ephy_suggestion_index_entry_clear);
+}
+
+/* Drops the lookup table's reference, for use as its value destroy func. */
+void
+ephy_suggestion_index_entry_release (EphySuggestionIndexEntry *entry)
+{
+  entry->stale = TRUE;
+  ephy_suggestion_index_entry_unref (entry);
+}
+
+gboolean
+ephy_suggestion_index_entry_matches (EphySuggestionIndexEntry  *entry,
+                                     char                     **terms)
+{
+  if (entry->stale)
+    return FALSE;
+
+  for (guint i = 0; terms[i]; i++) {
+    if (!strstr (entry->text, terms[i]))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+int
+ephy_suggestion_index_entry_compare_rank (gconstpointer a,
+                                          gconstpointer b)
+{
+  const EphySuggestionIndexEntry *entry_a = *(EphySuggestionIndexEntry **)a;
+  const EphySuggestionIndexEntry *entry_b = *(EphySuggestionIndexEntry **)b;
+
+  if (entry_a->rank < entry_b->rank)
+    return -1;
+  if (entry_a->rank > entry_b->rank)
+    return 1;
+  return 0;
+}
+
+DzlFuzzyMutableIndex *
+ephy_suggestion_index_build (GHashTable *entries)
+{
+  DzlFuzzyMutableIndex *index;
+  GHashTableIter iter;
+  EphySuggestionIndexEntry *entry;
+
+  index = dzl_fuzzy_mutable_index_new_with_free_func (FALSE, (GDestroyNotify)ephy_suggestion_index_entry_unref);
+
+  dzl_fuzzy_mutable_index_begin_bulk_insert (index);
+  g_hash_table_iter_init (&iter, entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&entry))
+    ephy_suggestion_index_insert (index, entry);
+  dzl_fuzzy_mutable_index_end_bulk_insert (index);
+
+  return index;
+}
+
+void
+ephy_suggestion_index_insert (DzlFuzzyMutableIndex     *index,
+                              EphySuggestionIndexEntry *entry)
+{
+  dzl_fuzzy_mutable_index_insert (index, entry->text, ephy_suggestion_index_entry_ref (entry));
+}
+
+/* Returns the live entries whose text contains every one of @terms,
+ * ordered by rank, or %NULL if there is no term to look up. */
+GPtrArray *
+ephy_suggestion_index_lookup (DzlFuzzyMutableIndex  *index,
+                              char                 **terms)
+{
+  g_autoptr (GArray) matches = NULL;
+  GPtrArray *results;
+  const char *needle = NULL;
+
+  /* Every entry containing the longest term also contains it as a fuzzy
+   * match, so that is the term that narrows the candidates down most. */
+  for (guint i = 0; terms[i]; i++) {
+    if (!needle || strlen (terms[i]) > strlen (needle))
+      needle = terms[i];
+  }
+
+  if (!needle || !*needle)
+    return NULL;
+
+  results = g_ptr_array_new_with_free_func ((GDestroyNotify)ephy_suggestion_index_entry_unref);
+  if (!index)
+    return results;
+
+  matches = dzl_fuzzy_mutable_index_match (index, needle, 0);
+  for (guint i = 0; i < matches->len; i++) {
+    EphySuggestionIndexEntry *entry = g_array_index (matches, DzlFuzzyMutableIndexMatch, i).value;
+
+    if (ephy_suggestion_index_entry_matches (entry, terms))
+      g_ptr_array_add (results, ephy_suggestion_index_entry_ref (entry));
+  }
+
+  g_ptr_array_sort (results, ephy_suggestion_index_entry_compare_rank);
+
+  return results;
+}
@@ -0,0 +1,59 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2; -*- */
+/*
+ *  Copyright © 2026 Epiphany Developers
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "dzl-fuzzy-mutable-index.h"
+
+G_BEGIN_DECLS
+
+/* An entry of an in-memory suggestion index. Entries are shared between
+ * the lookup table that owns them and the fuzzy index built from that
+ * table, so dropping one from the table only marks it stale until the
+ * fuzzy index is rebuilt. */
+typedef struct {
+  char *url;
+  char *title;
+  char *text; /* Casefolded title, URL and extra text, for substring matching. */
+  gint64 rank; /* Lower ranks come first */
+  gboolean stale;
+} EphySuggestionIndexEntry;
+
+EphySuggestionIndexEntry *ephy_suggestion_index_entry_new          (const char                *url,
+                                                                    const char                *title,
+                                                                    const char                *extra_text,
+                                                                    gint64                     rank);
+EphySuggestionIndexEntry *ephy_suggestion_index_entry_ref          (EphySuggestionIndexEntry  *entry);
+void                      ephy_suggestion_index_entry_unref        (EphySuggestionIndexEntry  *entry);
+void                      ephy_suggestion_index_entry_release      (EphySuggestionIndexEntry  *entry);
+gboolean                  ephy_suggestion_index_entry_matches      (EphySuggestionIndexEntry  *entry,
+                                                                    char                     **terms);
+int                       ephy_suggestion_index_entry_compare_rank (gconstpointer              a,
+                                                                    gconstpointer              b);
+
+DzlFuzzyMutableIndex     *ephy_suggestion_index_build              (GHashTable                *entries);
+void                      ephy_suggestion_index_insert             (DzlFuzzyMutableIndex      *index,
+                                                                    EphySuggestionIndexEntry  *entry);
+GPtrArray                *ephy_suggestion_index_lookup             (DzlFuzzyMutableIndex      *index,
+                                                                    char                     **terms);
+
+G_END_DECLS
@@ -0,0 +1,397 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2; -*- */
+/*
+ *  Copyright © 2026 Epiphany Developers
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "ephy-history-import.h"
+
+#include <glib/gi18n.h>
+
+#include "ephy-debug.h"
+#include "ephy-sqlite-connection.h"
+
+GQuark history_import_error_quark (void);
+G_DEFINE_QUARK (HistoryImportErrorQuark, history_import_error)
+#define HISTORY_IMPORT_ERROR history_import_error_quark ()
+
+typedef enum {
+  HISTORY_IMPORT_ERROR_OPEN = 1001,
+  HISTORY_IMPORT_ERROR_READ = 1002
+} HistoryImportErrorCode;
+
+/* Visits are read and handed to the history service this many at a time.
+ * The next chunk is read while the history service writes the previous one. */
+#define IMPORT_CHUNK_SIZE 10000
+
+/* Chromium counts time from 1601-01-01 instead of the Unix epoch. */
+#define CHROME_EPOCH_OFFSET G_GINT64_CONSTANT (11644473600000000)
+
+typedef struct {
+  const char *count_sql;
+  const char *select_sql;
+  EphyHistoryPageVisitType (*get_visit_type) (int source_type);
+  gint64 (*get_visit_time) (gint64 source_time);
+} ImportSourceInfo;
+
+static EphyHistoryPageVisitType
+get_firefox_visit_type (int visit_type)
+{
+  switch (visit_type) {
+    case 2: /* TRANSITION_TYPED */
+      return EPHY_PAGE_VISIT_TYPED;
+    case 3: /* TRANSITION_BOOKMARK */
+      return EPHY_PAGE_VISIT_BOOKMARK;
+    case 4: /* TRANSITION_EMBED */
+    case 7: /* TRANSITION_DOWNLOAD */
+    case 8: /* TRANSITION_FRAMED_LINK */
+      return EPHY_PAGE_VISIT_NONE;
+    default:
+      return EPHY_PAGE_VISIT_LINK;
+  }
+}
+
+static gint64
+get_firefox_visit_time (gint64 visit_date)
+{
+  return visit_date;
+}
+
+static EphyHistoryPageVisitType
+get_chrome_visit_type (int transition)
+{
+  switch (transition & 0xff) {
+    case 1: /* PAGE_TRANSITION_TYPED */
+      return EPHY_PAGE_VISIT_TYPED;
+    case 2: /* PAGE_TRANSITION_AUTO_BOOKMARK */
+      return EPHY_PAGE_VISIT_BOOKMARK;
+    case 3: /* PAGE_TRANSITION_AUTO_SUBFRAME */
+    case 4: /* PAGE_TRANSITION_MANUAL_SUBFRAME */
+      return EPHY_PAGE_VISIT_NONE;
+    default:
+      return EPHY_PAGE_VISIT_LINK;
+  }
+}
+
+static gint64
+get_chrome_visit_time (gint64 visit_time)
+{
+  return visit_time - CHROME_EPOCH_OFFSET;
+}
+
+static const ImportSourceInfo import_sources[] = {
+  [EPHY_HISTORY_IMPORT_FIREFOX] = {
+    "SELECT COUNT(*) FROM moz_historyvisits",
+    "SELECT v.id, p.url, p.title, v.visit_date, v.visit_type "
+    "FROM moz_historyvisits v JOIN moz_places p ON p.id = v.place_id "
+    "WHERE v.id > ? ORDER BY v.id LIMIT ?",
+    get_firefox_visit_type,
+    get_firefox_visit_time
+  },
+  [EPHY_HISTORY_IMPORT_CHROME] = {
+    "SELECT COUNT(*) FROM visits",
+    "SELECT v.id, u.url, u.title, v.visit_time, v.transition "
+    "FROM visits v JOIN urls u ON u.id = v.url "
+    "WHERE v.id > ? ORDER BY v.id LIMIT ?",
+    get_chrome_visit_type,
+    get_chrome_visit_time
+  },
+};
+
+typedef struct {
+  EphyHistoryImportSource source;
+  char *filename;
+  GFileProgressCallback progress_callback;
+  gpointer progress_data;
+  GMainContext *context;
+} ImportData;
+
+static void
+import_data_free (ImportData *data)
+{
+  g_free (data->filename);
+  g_main_context_unref (data->context);
+  g_free (data);
+}
+
+typedef struct {
+  GFileProgressCallback callback;
+  gpointer user_data;
+  goffset current;
+  goffset total;
+} ImportProgress;
+
+static gboolean
+report_progress_cb (ImportProgress *progress)
+{
+  progress->callback (progress->current, progress->total, progress->user_data);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+report_progress (ImportData *data,
+                 goffset     current,
+                 goffset     total)
+{
+  ImportProgress *progress;
+
+  if (!data->progress_callback)
+    return;
+
+  progress = g_new (ImportProgress, 1);
+  progress->callback = data->progress_callback;
+  progress->user_data = data->progress_data;
+  progress->current = current;
+  progress->total = total;
+
+  g_main_context_invoke_full (data->context, G_PRIORITY_DEFAULT,
+                              (GSourceFunc)report_progress_cb, progress, g_free);
+}
+
+static void
+chunk_imported_cb (GObject      *source,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  GAsyncResult **result_out = user_data;
+
+  *result_out = g_object_ref (result);
+}
+
+/* Waits for the history service to write the previous chunk. This runs in
+ * the import thread, with its own main context. */
+static gboolean
+wait_for_chunk (EphyHistoryService  *service,
+                GMainContext        *context,
+                GAsyncResult       **result,
+                GError             **error)
+{
+  gboolean success;
+
+  while (!*result)
+    g_main_context_iteration (context, TRUE);
+
+  success = ephy_history_service_import_visits_finish (service, *result, error);
+  g_clear_object (result);
+
+  return success;
+}
+
+static gboolean
+is_importable_url (const char *url)
+{
+  return url && (g_str_has_prefix (url, "http://") || g_str_has_prefix (url, "https://"));
+}
+
+static gboolean
+import_visits (EphyHistoryService    *service,
+               EphySQLiteConnection  *connection,
+               ImportData            *data,
+               GCancellable          *cancellable,
+               GError               **error)
+{
+  const ImportSourceInfo *info = &import_sources[data->source];
+  g_autoptr (GMainContext) context = g_main_context_new ();
+  g_autoptr (GAsyncResult) pending = NULL;
+  g_autoptr (EphySQLiteStatement) statement = NULL;
+  gboolean chunk_sent = FALSE;
+  GError *my_error = NULL;
+  gint64 last_id = 0;
+  goffset total = 0;
+  goffset read = 0;
+  gboolean done = FALSE;
+
+  statement = ephy_sqlite_connection_create_statement (connection, info->count_sql,
+                                                       EPHY_SQLITE_STATEMENT_SHORT_LIVED, &my_error);
+  if (statement && ephy_sqlite_statement_step (statement, &my_error))
+    total = ephy_sqlite_statement_get_column_as_int64 (statement, 0);
+  g_clear_object (&statement);
+
+  if (!my_error)
+    statement = ephy_sqlite_connection_create_statement (connection, info->select_sql,
+                                                         EPHY_SQLITE_STATEMENT_LONG_LIVED, &my_error);
+  if (my_error) {
+    g_warning ("Could not build history import statement: %s", my_error->message);
+    g_error_free (my_error);
+    g_set_error (error, HISTORY_IMPORT_ERROR, HISTORY_IMPORT_ERROR_READ,
+                 _("History could not be retrieved!"));
+    return FALSE;
+  }
+
+  g_main_context_push_thread_default (context);
+
+  report_progress (data, 0, total);
+
+  while (!done) {
+    g_autoptr (GPtrArray) visits = g_ptr_array_new_with_free_func ((GDestroyNotify)ephy_history_page_visit_free);
+    int n_rows = 0;
+
+    if (g_cancellable_set_error_if_cancelled (cancellable, error))
+      break;
+
+    ephy_sqlite_statement_reset (statement);
+    if (!ephy_sqlite_statement_bind_int64 (statement, 0, last_id, &my_error) ||
+        !ephy_sqlite_statement_bind_int (statement, 1, IMPORT_CHUNK_SIZE, &my_error))
+      break;
+
+    while (ephy_sqlite_statement_step (statement, &my_error)) {
+      const char *url = ephy_sqlite_statement_get_column_as_string (statement, 1);
+      const char *title = ephy_sqlite_statement_get_column_as_string (statement, 2);
+      EphyHistoryPageVisitType visit_type = info->get_visit_type (ephy_sqlite_statement_get_column_as_int (statement, 4));
+
+      last_id = ephy_sqlite_statement_get_column_as_int64 (statement, 0);
+      n_rows++;
+
+      if (visit_type == EPHY_PAGE_VISIT_NONE || !is_importable_url (url))
+        continue;
+
+      g_ptr_array_add (visits,
+                       ephy_history_page_visit_new_with_url (ephy_history_url_new (url, title ? title : url, 0, 0, 0),
+                                                             info->get_visit_time (ephy_sqlite_statement_get_column_as_int64 (statement, 3)),
+                                                             visit_type));
+    }
+
+    if (my_error)
+      break;
+
+    done = n_rows < IMPORT_CHUNK_SIZE;
+    read += n_rows;
+
+    if (chunk_sent && !wait_for_chunk (service, context, &pending, error)) {
+      chunk_sent = FALSE;
+      break;
+    }
+    chunk_sent = FALSE;
+
+    if (visits->len > 0) {
+      ephy_history_service_import_visits (service, visits, cancellable, chunk_imported_cb, &pending);
+      chunk_sent = TRUE;
+    }
+
+    report_progress (data, read, MAX (total, read));
+  }
+
+  if (chunk_sent) {
+    if (error && *error)
+      wait_for_chunk (service, context, &pending, NULL);
+    else
+      wait_for_chunk (service, context, &pending, error);
+  }
+
+  g_main_context_pop_thread_default (context);
+
+  if (my_error) {
+    g_warning ("Could not read history to import: %s", my_error->message);
+    g_error_free (my_error);
+    g_clear_error (error);
+    g_set_error (error, HISTORY_IMPORT_ERROR, HISTORY_IMPORT_ERROR_READ,
+                 _("History could not be retrieved!"));
+    return FALSE;
+  }
+
+  LOG ("Imported %" G_GOFFSET_FORMAT " history visits from %s", read, data->filename);
+
+  return !(error && *error);
+}
+
+static void
+import_thread (GTask        *task,
+               gpointer      source_object,
+               ImportData   *data,
+               GCancellable *cancellable)
+{
+  EphyHistoryService *service = source_object;
+  g_autoptr (EphySQLiteConnection) connection = NULL;
+  GError *error = NULL;
+
+  connection = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READONLY, data->filename);
+  if (!ephy_sqlite_connection_open (connection, &error)) {
+    g_warning ("Could not open database at %s: %s", data->filename, error->message);
+    g_error_free (error);
+    g_task_return_new_error (task, HISTORY_IMPORT_ERROR, HISTORY_IMPORT_ERROR_OPEN,
+                             data->source == EPHY_HISTORY_IMPORT_FIREFOX ?
+                             _("Firefox history database could not be opened. Close Firefox and try again.") :
+                             _("Chrome history database could not be opened. Close Chrome and try again."));
+    return;
+  }
+
+  if (import_visits (service, connection, data, cancellable, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+
+  ephy_sqlite_connection_close (connection);
+}
+
+/**
+ * ephy_history_import:
+ * @service: the #EphyHistoryService to import into
+ * @source: the browser that @filename belongs to
+ * @filename: the Firefox places.sqlite or Chrome History database
+ * @cancellable: (nullable): a #GCancellable
+ * @progress_callback: (nullable): called on the calling thread with the
+ *   number of visits read so far and the total
+ * @progress_data: data for @progress_callback
+ * @callback: a callback
+ * @user_data: data for @callback
+ *
+ * Imports the browsing history of another browser. The database is read
+ * in a separate thread, and fed to the history service in chunks through
+ * ephy_history_service_import_visits(). Importing the same database again
+ * only adds the visits made since.
+ */
+void
+ephy_history_import (EphyHistoryService      *service,
+                     EphyHistoryImportSource  source,
+                     const char              *filename,
+                     GCancellable            *cancellable,
+                     GFileProgressCallback    progress_callback,
+                     gpointer                 progress_data,
+                     GAsyncReadyCallback      callback,
+                     gpointer                 user_data)
+{
+  g_autoptr (GTask) task = NULL;
+  ImportData *data;
+
+  g_assert (EPHY_IS_HISTORY_SERVICE (service));
+  g_assert (filename);
+
+  data = g_new0 (ImportData, 1);
+  data->source = source;
+  data->filename = g_strdup (filename);
+  data->progress_callback = progress_callback;
+  data->progress_data = progress_data;
+  data->context = g_main_context_ref_thread_default ();
+
+  task = g_task_new (service, cancellable, callback, user_data);
+  g_task_set_source_tag (task, ephy_history_import);
+  g_task_set_task_data (task, data, (GDestroyNotify)import_data_free);
+  g_task_run_in_thread (task, (GTaskThreadFunc)import_thread);
+}
+
+gboolean
+ephy_history_import_finish (EphyHistoryService  *service,
+                            GAsyncResult        *result,
+                            GError             **error)
+{
+  g_assert (g_task_is_valid (result, service));
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
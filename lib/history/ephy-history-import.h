@@ -0,0 +1,50 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2; -*- */
+/*
+ *  Copyright © 2026 Epiphany Developers
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+#include "ephy-history-service.h"
+
+G_BEGIN_DECLS
+
+#define FIREFOX_HISTORY_FILE "places.sqlite"
+#define CHROME_HISTORY_FILE  "History"
+
+typedef enum {
+  EPHY_HISTORY_IMPORT_FIREFOX,
+  EPHY_HISTORY_IMPORT_CHROME
+} EphyHistoryImportSource;
+
+void        ephy_history_import         (EphyHistoryService      *service,
+                                         EphyHistoryImportSource  source,
+                                         const char              *filename,
+                                         GCancellable            *cancellable,
+                                         GFileProgressCallback    progress_callback,
+                                         gpointer                 progress_data,
+                                         GAsyncReadyCallback      callback,
+                                         gpointer                 user_data);
+
+gboolean    ephy_history_import_finish  (EphyHistoryService      *service,
+                                         GAsyncResult            *result,
+                                         GError                 **error);
+
+G_END_DECLS
@@ -0,0 +1,535 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2; -*- */
+/*
+ *  Copyright © 2026 Epiphany Developers
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-history-index.h"
+
+#include "ephy-string.h"
+
+/* An in-memory fuzzy index of the most frecent part of history, shared by
+ * everything that suggests history URLs while the user types.
+ *
+ * The index is loaded from the database once, and ranked like a query
+ * sorted by frecency. After that it follows the history service's signals:
+ * a visit reranks its URL by the frecency it was stored with, adding it if
+ * needed and evicting the lowest ranked URL to stay within the size limit,
+ * and title changes and deletions touch only the URLs concerned. Since
+ * visits are the only thing that raises frecency, the index keeps holding
+ * the most frecent URLs. Only imports, range deletions and frecency decay,
+ * which can change any part of history, reload the whole index.
+ *
+ * New entries go straight into the fuzzy index. The ones they replace, and
+ * deleted ones, stay behind as stale entries that lookups skip, until
+ * there are enough of them to make rebuilding the fuzzy index worthwhile.
+ */
+
+struct _EphyHistoryIndex {
+  GObject parent_instance;
+
+  EphyHistoryService *service;
+  guint max_entries;
+
+  GSequence *ranked_entries; /* EphySuggestionIndexEntry, by rank */
+  GHashTable *entries; /* URL -> GSequenceIter of ranked_entries */
+  DzlFuzzyMutableIndex *index;
+  guint n_stale_entries;
+  guint rebuild_id;
+
+  GCancellable *cancellable;
+  GList *visits_while_loading; /* EphyHistoryURL, newest first */
+  gboolean loaded;
+  gboolean complete;
+};
+
+enum {
+  CHANGED,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+G_DEFINE_FINAL_TYPE (EphyHistoryIndex, ephy_history_index, G_TYPE_OBJECT)
+
+/* Ranks URLs in the order of EPHY_HISTORY_SORT_FRECENCY. */
+static gint64
+get_rank (gboolean pinned,
+          int      frecency)
+{
+  return -(((gint64)!!pinned << 32) + frecency);
+}
+
+static int
+compare_rank (gconstpointer a,
+              gconstpointer b,
+              gpointer      user_data)
+{
+  const EphySuggestionIndexEntry *entry_a = a;
+  const EphySuggestionIndexEntry *entry_b = b;
+
+  if (entry_a->rank < entry_b->rank)
+    return -1;
+  if (entry_a->rank > entry_b->rank)
+    return 1;
+  return 0;
+}
+
+static EphySuggestionIndexEntry *
+lookup_entry (EphyHistoryIndex *self,
+              const char       *url)
+{
+  GSequenceIter *iter = g_hash_table_lookup (self->entries, url);
+
+  return iter ? g_sequence_get (iter) : NULL;
+}
+
+static gboolean
+rebuild_index (EphyHistoryIndex *self)
+{
+  GSequenceIter *iter;
+
+  g_clear_pointer (&self->index, dzl_fuzzy_mutable_index_unref);
+  self->index = dzl_fuzzy_mutable_index_new_with_free_func (FALSE, (GDestroyNotify)ephy_suggestion_index_entry_unref);
+
+  dzl_fuzzy_mutable_index_begin_bulk_insert (self->index);
+  for (iter = g_sequence_get_begin_iter (self->ranked_entries);
+       !g_sequence_iter_is_end (iter);
+       iter = g_sequence_iter_next (iter))
+    ephy_suggestion_index_insert (self->index, g_sequence_get (iter));
+  dzl_fuzzy_mutable_index_end_bulk_insert (self->index);
+
+  self->n_stale_entries = 0;
+  self->rebuild_id = 0;
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Records that @n_stale entries of the fuzzy index are not live anymore,
+ * and tells users of the index that their cached lookups are outdated. */
+static void
+index_changed (EphyHistoryIndex *self,
+               guint             n_stale)
+{
+  self->n_stale_entries += n_stale;
+
+  if (self->n_stale_entries > self->max_entries / 4 && self->rebuild_id == 0)
+    self->rebuild_id = g_idle_add ((GSourceFunc)rebuild_index, self);
+
+  g_signal_emit (self, signals[CHANGED], 0);
+}
+
+/* Adds @entry in place of any entry for the same URL. */
+static void
+replace_entry (EphyHistoryIndex         *self,
+               EphySuggestionIndexEntry *entry,
+               guint                    *n_stale)
+{
+  GSequenceIter *old_iter = g_hash_table_lookup (self->entries, entry->url);
+  GSequenceIter *iter;
+
+  iter = g_sequence_insert_sorted (self->ranked_entries, entry, compare_rank, NULL);
+  /* The key belongs to the entry it points to, so it has to be replaced
+   * before the old entry is freed. */
+  g_hash_table_replace (self->entries, entry->url, iter);
+  if (old_iter) {
+    g_sequence_remove (old_iter);
+    (*n_stale)++;
+  }
+
+  if (self->index)
+    ephy_suggestion_index_insert (self->index, entry);
+}
+
+static gboolean
+remove_entry (EphyHistoryIndex *self,
+              const char       *url)
+{
+  GSequenceIter *iter = g_hash_table_lookup (self->entries, url);
+
+  if (!iter)
+    return FALSE;
+
+  g_hash_table_remove (self->entries, url);
+  g_sequence_remove (iter);
+
+  return TRUE;
+}
+
+static void
+remove_all_entries (EphyHistoryIndex *self)
+{
+  g_hash_table_remove_all (self->entries);
+  g_sequence_remove_range (g_sequence_get_begin_iter (self->ranked_entries),
+                           g_sequence_get_end_iter (self->ranked_entries));
+}
+
+static void
+visit_url (EphyHistoryIndex *self,
+           EphyHistoryURL   *url,
+           guint            *n_stale)
+{
+  EphySuggestionIndexEntry *entry;
+
+  entry = ephy_suggestion_index_entry_new (url->url, url->title && *url->title ? url->title : url->url, NULL,
+                                           get_rank (url->pinned, url->frecency));
+  replace_entry (self, entry, n_stale);
+
+  if ((guint)g_sequence_get_length (self->ranked_entries) > self->max_entries) {
+    GSequenceIter *lowest = g_sequence_iter_prev (g_sequence_get_end_iter (self->ranked_entries));
+
+    remove_entry (self, ((EphySuggestionIndexEntry *)g_sequence_get (lowest))->url);
+    self->complete = FALSE;
+    (*n_stale)++;
+  }
+}
+
+static void
+index_loaded_cb (EphyHistoryService *service,
+                 GAsyncResult       *result,
+                 EphyHistoryIndex   *self)
+{
+  g_autoptr (EphyHistoryURLTable) urls = NULL;
+  GList *visits;
+  g_autoptr (GError) error = NULL;
+  guint n_stale = 0;
+  guint length;
+
+  urls = ephy_history_service_query_url_table_finish (service, result, &error);
+  if (error) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_warning ("Failed to load history for suggestions: %s", error->message);
+      g_clear_object (&self->cancellable);
+    }
+    return;
+  }
+
+  g_clear_object (&self->cancellable);
+  visits = g_list_reverse (g_steal_pointer (&self->visits_while_loading));
+
+  length = ephy_history_url_table_get_length (urls);
+
+  remove_all_entries (self);
+  for (guint i = 0; i < length; i++) {
+    const char *url = ephy_history_url_table_get_url (urls, i);
+    const char *title = ephy_history_url_table_get_title (urls, i);
+    EphySuggestionIndexEntry *entry;
+    GSequenceIter *iter;
+
+    entry = ephy_suggestion_index_entry_new (url, title[0] != '\0' ? title : url, NULL,
+                                             get_rank (ephy_history_url_table_get_pinned (urls, i),
+                                                       ephy_history_url_table_get_frecency (urls, i)));
+    iter = g_sequence_insert_sorted (self->ranked_entries, entry, compare_rank, NULL);
+    g_hash_table_replace (self->entries, entry->url, iter);
+  }
+
+  self->loaded = TRUE;
+  self->complete = length < self->max_entries;
+
+  g_clear_handle_id (&self->rebuild_id, g_source_remove);
+  rebuild_index (self);
+
+  /* The query might have been answered before these visits were written.
+   * Frecency only grows with visits, so a lower one is an older one. */
+  for (GList *l = visits; l; l = l->next) {
+    EphyHistoryURL *url = l->data;
+    EphySuggestionIndexEntry *entry = lookup_entry (self, url->url);
+
+    if (!entry || entry->rank > get_rank (url->pinned, url->frecency))
+      visit_url (self, url, &n_stale);
+  }
+  ephy_history_url_list_free (visits);
+
+  index_changed (self, n_stale);
+}
+
+static void
+load_index (EphyHistoryIndex *self)
+{
+  g_autoptr (EphyHistoryQuery) query = NULL;
+
+  g_cancellable_cancel (self->cancellable);
+  g_clear_object (&self->cancellable);
+  self->cancellable = g_cancellable_new ();
+  g_clear_pointer (&self->visits_while_loading, ephy_history_url_list_free);
+
+  query = ephy_history_query_new ();
+  query->limit = self->max_entries;
+  query->sort_type = EPHY_HISTORY_SORT_FRECENCY;
+
+  ephy_history_service_query_url_table (self->service,
+                                        query,
+                                        self->cancellable,
+                                        (GAsyncReadyCallback)index_loaded_cb,
+                                        self);
+}
+
+static void
+urls_visited_cb (EphyHistoryService *service,
+                 GList              *urls,
+                 EphyHistoryIndex   *self)
+{
+  guint n_stale = 0;
+
+  if (!urls) {
+    load_index (self);
+    g_signal_emit (self, signals[CHANGED], 0);
+    return;
+  }
+
+  for (GList *l = urls; l; l = l->next) {
+    if (self->cancellable)
+      self->visits_while_loading = g_list_prepend (self->visits_while_loading, ephy_history_url_copy (l->data));
+    visit_url (self, l->data, &n_stale);
+  }
+
+  index_changed (self, n_stale);
+}
+
+static void
+url_title_changed_cb (EphyHistoryService *service,
+                      const char         *url,
+                      const char         *title,
+                      EphyHistoryIndex   *self)
+{
+  EphySuggestionIndexEntry *entry;
+  guint n_stale = 0;
+
+  entry = lookup_entry (self, url);
+  if (entry) {
+    entry = ephy_suggestion_index_entry_new (url, title && *title ? title : url, NULL, entry->rank);
+    replace_entry (self, entry, &n_stale);
+  }
+
+  index_changed (self, n_stale);
+}
+
+static void
+url_deleted_cb (EphyHistoryService *service,
+                EphyHistoryURL     *url,
+                EphyHistoryIndex   *self)
+{
+  index_changed (self, remove_entry (self, url->url) ? 1 : 0);
+}
+
+static void
+urls_deleted_cb (EphyHistoryService *service,
+                 GList              *urls,
+                 EphyHistoryIndex   *self)
+{
+  guint n_stale = 0;
+
+  for (GList *l = urls; l; l = l->next) {
+    EphyHistoryURL *url = l->data;
+
+    if (remove_entry (self, url->url))
+      n_stale++;
+  }
+
+  index_changed (self, n_stale);
+}
+
+static void
+host_deleted_cb (EphyHistoryService *service,
+                 const char         *deleted_url,
+                 EphyHistoryIndex   *self)
+{
+  g_autofree char *host = ephy_string_get_host_name (deleted_url);
+  GHashTableIter iter;
+  const char *url;
+  GSequenceIter *sequence_iter;
+  guint n_stale = 0;
+
+  g_hash_table_iter_init (&iter, self->entries);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&url, (gpointer *)&sequence_iter)) {
+    g_autofree char *url_host = ephy_string_get_host_name (url);
+
+    if (g_strcmp0 (url_host, host) == 0) {
+      /* The key belongs to the entry, remove it first. */
+      g_hash_table_iter_remove (&iter);
+      g_sequence_remove (sequence_iter);
+      n_stale++;
+    }
+  }
+
+  index_changed (self, n_stale);
+}
+
+static void
+cleared_cb (EphyHistoryService *service,
+            EphyHistoryIndex   *self)
+{
+  remove_all_entries (self);
+  self->complete = TRUE;
+
+  g_clear_handle_id (&self->rebuild_id, g_source_remove);
+  rebuild_index (self);
+
+  index_changed (self, 0);
+}
+
+static void
+ephy_history_index_dispose (GObject *object)
+{
+  EphyHistoryIndex *self = EPHY_HISTORY_INDEX (object);
+
+  g_cancellable_cancel (self->cancellable);
+  g_clear_object (&self->cancellable);
+  g_clear_handle_id (&self->rebuild_id, g_source_remove);
+  g_clear_object (&self->service);
+
+  G_OBJECT_CLASS (ephy_history_index_parent_class)->dispose (object);
+}
+
+static void
+ephy_history_index_finalize (GObject *object)
+{
+  EphyHistoryIndex *self = EPHY_HISTORY_INDEX (object);
+
+  g_clear_pointer (&self->index, dzl_fuzzy_mutable_index_unref);
+  g_hash_table_unref (self->entries);
+  g_sequence_free (self->ranked_entries);
+  g_clear_pointer (&self->visits_while_loading, ephy_history_url_list_free);
+
+  G_OBJECT_CLASS (ephy_history_index_parent_class)->finalize (object);
+}
+
+static void
+ephy_history_index_class_init (EphyHistoryIndexClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = ephy_history_index_dispose;
+  object_class->finalize = ephy_history_index_finalize;
+
+  /**
+   * EphyHistoryIndex::changed:
+   * @index: the #EphyHistoryIndex that received the signal
+   *
+   * Emitted whenever history changed in a way that could change the
+   * results of a lookup, including for URLs that are not in the index.
+   */
+  signals[CHANGED] =
+    g_signal_new ("changed",
+                  G_OBJECT_CLASS_TYPE (object_class),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE,
+                  0);
+}
+
+static void
+ephy_history_index_init (EphyHistoryIndex *self)
+{
+  self->ranked_entries = g_sequence_new ((GDestroyNotify)ephy_suggestion_index_entry_release);
+  self->entries = g_hash_table_new (g_str_hash, g_str_equal);
+}
+
+/**
+ * ephy_history_index_new:
+ * @service: the #EphyHistoryService to index
+ * @max_entries: the maximum number of URLs to keep in the index
+ *
+ * Creates an index of the @max_entries most frecent URLs of @service, and
+ * starts loading it.
+ *
+ * Returns: (transfer full): a new #EphyHistoryIndex
+ */
+EphyHistoryIndex *
+ephy_history_index_new (EphyHistoryService *service,
+                        guint               max_entries)
+{
+  EphyHistoryIndex *self;
+
+  g_assert (EPHY_IS_HISTORY_SERVICE (service));
+  g_assert (max_entries > 0);
+
+  self = g_object_new (EPHY_TYPE_HISTORY_INDEX, NULL);
+  self->service = g_object_ref (service);
+  self->max_entries = max_entries;
+
+  g_signal_connect_object (service, "urls-visited",
+                           G_CALLBACK (urls_visited_cb), self, G_CONNECT_DEFAULT);
+  g_signal_connect_object (service, "url-title-changed",
+                           G_CALLBACK (url_title_changed_cb), self, G_CONNECT_DEFAULT);
+  g_signal_connect_object (service, "url-deleted",
+                           G_CALLBACK (url_deleted_cb), self, G_CONNECT_DEFAULT);
+  g_signal_connect_object (service, "urls-deleted",
+                           G_CALLBACK (urls_deleted_cb), self, G_CONNECT_DEFAULT);
+  g_signal_connect_object (service, "host-deleted",
+                           G_CALLBACK (host_deleted_cb), self, G_CONNECT_DEFAULT);
+  g_signal_connect_object (service, "cleared",
+                           G_CALLBACK (cleared_cb), self, G_CONNECT_DEFAULT);
+
+  load_index (self);
+
+  return self;
+}
+
+/**
+ * ephy_history_index_is_loaded:
+ * @self: an #EphyHistoryIndex
+ *
+ * Returns: whether the index has been loaded from the database yet
+ */
+gboolean
+ephy_history_index_is_loaded (EphyHistoryIndex *self)
+{
+  return self->loaded;
+}
+
+/**
+ * ephy_history_index_is_complete:
+ * @self: an #EphyHistoryIndex
+ *
+ * Returns: whether the index holds every URL of history, so that no URL
+ *   outside of it can match a lookup
+ */
+gboolean
+ephy_history_index_is_complete (EphyHistoryIndex *self)
+{
+  return self->loaded && self->complete;
+}
+
+guint
+ephy_history_index_get_n_entries (EphyHistoryIndex *self)
+{
+  return g_sequence_get_length (self->ranked_entries);
+}
+
+/**
+ * ephy_history_index_lookup:
+ * @self: an #EphyHistoryIndex
+ * @terms: the casefolded terms to look up
+ *
+ * Returns: (transfer full) (nullable) (element-type EphySuggestionIndexEntry):
+ *   the indexed URLs that contain every one of @terms, most frecent first, or
+ *   %NULL if there is no term to look up
+ */
+GPtrArray *
+ephy_history_index_lookup (EphyHistoryIndex  *self,
+                           char             **terms)
+{
+  /* Rebuilding is cheaper than going through many stale entries. */
+  if (self->rebuild_id != 0) {
+    g_clear_handle_id (&self->rebuild_id, g_source_remove);
+    rebuild_index (self);
+  }
+
+  return ephy_suggestion_index_lookup (self->index, terms);
+}
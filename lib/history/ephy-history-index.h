@@ -0,0 +1,42 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2; -*- */
+/*
+ *  Copyright © 2026 Epiphany Developers
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+#include "ephy-history-service.h"
+#include "ephy-suggestion-index.h"
+
+G_BEGIN_DECLS
+
+#define EPHY_TYPE_HISTORY_INDEX (ephy_history_index_get_type ())
+
+G_DECLARE_FINAL_TYPE (EphyHistoryIndex, ephy_history_index, EPHY, HISTORY_INDEX, GObject)
+
+EphyHistoryIndex *ephy_history_index_new           (EphyHistoryService  *service,
+                                                    guint                max_entries);
+gboolean          ephy_history_index_is_loaded     (EphyHistoryIndex    *self);
+gboolean          ephy_history_index_is_complete   (EphyHistoryIndex    *self);
+guint             ephy_history_index_get_n_entries (EphyHistoryIndex    *self);
+GPtrArray        *ephy_history_index_lookup        (EphyHistoryIndex    *self,
+                                                    char               **terms);
+
+G_END_DECLS
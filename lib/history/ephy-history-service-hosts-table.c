@@ -47,6 +47,15 @@ ephy_history_service_initialize_hosts_table (EphyHistoryService *self)
     g_error_free (error);
     return FALSE;
   }
+
+  ephy_sqlite_connection_execute (self->history_database,
+                                  "CREATE INDEX IF NOT EXISTS hosts_url_index ON hosts (url)", &error);
+
+  if (error) {
+    g_warning ("Could not create hosts table index: %s", error->message);
+    g_error_free (error);
+    return FALSE;
+  }
   return TRUE;
 }
 
@@ -83,6 +92,10 @@ ephy_history_service_add_host_row (EphyHistoryService *self,
     g_error_free (error);
   } else {
     host->id = ephy_sqlite_connection_get_last_insert_id (self->history_database);
+    /* A missing entry already means the default zoom level, and must not
+     * clobber one the UI set while this row was pending. */
+    if (host->zoom_level != 0.0)
+      ephy_history_service_cache_zoom_level (self, host->url, host->zoom_level);
   }
 }
 
@@ -121,6 +134,8 @@ ephy_history_service_update_host_row (EphyHistoryService *self,
   if (error) {
     g_warning ("Could not modify URL in urls table: %s", error->message);
     g_error_free (error);
+  } else {
+    ephy_history_service_cache_zoom_level (self, host->url, host->zoom_level);
   }
 }
 
@@ -132,8 +147,7 @@ ephy_history_service_get_host_row (EphyHistoryService *self,
   EphySQLiteStatement *statement = NULL;
   GError *error = NULL;
 
-  g_assert (self->history_thread == g_thread_self ());
-  g_assert (self->history_database);
+  g_assert (ephy_history_service_get_database (self));
 
   if (!host_string && host)
     host_string = host->url;
@@ -229,15 +243,11 @@ ephy_history_service_get_all_hosts (EphyHistoryService *self)
   return hosts;
 }
 
-GList *
-ephy_history_service_find_host_rows (EphyHistoryService *self,
-                                     EphyHistoryQuery   *query)
+static char *
+build_find_host_rows_sql (EphyHistoryQuery *query)
 {
-  EphySQLiteStatement *statement = NULL;
   GList *substring;
   GString *statement_str;
-  GList *hosts = NULL;
-  GError *error = NULL;
   const char *base_statement = ""
                                "SELECT "
                                "DISTINCT hosts.id, "
@@ -248,27 +258,17 @@ ephy_history_service_find_host_rows (EphyHistoryService *self,
                                "FROM "
                                "hosts ";
 
-  int i = 0;
-
-  g_assert (self->history_thread == g_thread_self ());
-  g_assert (self->history_database);
-
   statement_str = g_string_new (base_statement);
 
   /* In either of these cases we need to at least join with the urls table. */
   if (query->substring_list || query->from > 0 || query->to > 0)
     statement_str = g_string_append (statement_str, "JOIN urls on hosts.id = urls.host ");
 
-  /* In these cases, we additionally need to join with the visits table. */
-  if (query->from > 0 || query->to > 0) {
-    statement_str = g_string_append (statement_str, "JOIN visits on urls.id = visits.url WHERE ");
-    if (query->from > 0)
-      statement_str = g_string_append (statement_str, "visits.visit_time >= ? AND ");
-    if (query->to > 0)
-      statement_str = g_string_append (statement_str, "visits.visit_time <= ? AND ");
-  } else {
-    statement_str = g_string_append (statement_str, "WHERE ");
-  }
+  statement_str = g_string_append (statement_str, "WHERE ");
+
+  /* In these cases, we additionally need the visits. */
+  if (query->from > 0 || query->to > 0)
+    ephy_history_service_append_url_visited_filter (statement_str, query);
 
   for (substring = query->substring_list; substring; substring = substring->next)
     statement_str = g_string_append (statement_str, "(hosts.url LIKE ? OR hosts.title LIKE ? OR "
@@ -276,27 +276,43 @@ ephy_history_service_find_host_rows (EphyHistoryService *self,
 
   statement_str = g_string_append (statement_str, "1 ");
 
-  statement = ephy_sqlite_connection_create_statement (self->history_database,
-                                                       statement_str->str,
-                                                       EPHY_SQLITE_STATEMENT_SHORT_LIVED,
-                                                       &error);
-  g_string_free (statement_str, TRUE);
+  return g_string_free (statement_str, FALSE);
+}
+
+GList *
+ephy_history_service_find_host_rows (EphyHistoryService *self,
+                                     EphyHistoryQuery   *query)
+{
+  EphySQLiteConnection *database;
+  EphySQLiteStatement *statement = NULL;
+  GList *substring;
+  g_autofree char *cache_key = NULL;
+  GList *hosts = NULL;
+  GError *error = NULL;
+
+  int i = 0;
+
+  database = ephy_history_service_get_database (self);
+  g_assert (database);
+
+  cache_key = g_strdup_printf ("find_host_rows:%d:%d:%u",
+                               query->from > 0, query->to > 0,
+                               g_list_length (query->substring_list));
+
+  statement = ephy_sqlite_connection_get_cached_statement (database, cache_key);
+  if (!statement) {
+    g_autofree char *sql = build_find_host_rows_sql (query);
+
+    statement = ephy_sqlite_connection_add_cached_statement (database, cache_key, sql, &error);
+  }
 
   if (error) {
     g_warning ("Could not build hosts table query statement: %s", error->message);
     g_error_free (error);
     return NULL;
   }
-  if (query->from > 0) {
-    if (!ephy_sqlite_statement_bind_int64 (statement, i++, query->from, &error)) {
-      g_warning ("Could not build hosts table query statement: %s", error->message);
-      g_error_free (error);
-      g_object_unref (statement);
-      return NULL;
-    }
-  }
-  if (query->to > 0) {
-    if (!ephy_sqlite_statement_bind_int64 (statement, i++, query->to, &error)) {
+  if (query->from > 0 || query->to > 0) {
+    if (!ephy_history_service_bind_url_visited_filter (statement, &i, query, &error)) {
       g_warning ("Could not build hosts table query statement: %s", error->message);
       g_error_free (error);
       g_object_unref (statement);
@@ -333,9 +349,9 @@ ephy_history_service_find_host_rows (EphyHistoryService *self,
 }
 
 /* Inspired from ephy-history.c */
-static GList *
-get_hostname_and_locations (const gchar  *url,
-                            gchar       **hostname)
+GList *
+ephy_history_service_get_host_locations (const gchar  *url,
+                                         gchar       **hostname)
 {
   GList *host_locations = NULL;
   char *scheme = NULL;
@@ -392,7 +408,10 @@ ephy_history_service_get_host_row_from_url (EphyHistoryService *self,
   char *hostname;
   EphyHistoryHost *host = NULL;
 
-  host_locations = get_hostname_and_locations (url, &hostname);
+  /* A missing host row is added, which read-only connections cannot do. */
+  g_assert (self->history_thread == g_thread_self ());
+
+  host_locations = ephy_history_service_get_host_locations (url, &hostname);
   g_assert (host_locations && hostname);
 
   for (l = host_locations; l; l = l->next) {
@@ -451,6 +470,8 @@ ephy_history_service_delete_host_row (EphyHistoryService *self,
   if (error) {
     g_warning ("Could not modify host in hosts table: %s", error->message);
     g_error_free (error);
+  } else {
+    ephy_history_service_load_zoom_levels (self);
   }
 }
 
@@ -475,5 +496,74 @@ ephy_history_service_delete_orphan_hosts (EphyHistoryService *self)
   if (error) {
     g_warning ("Couldn't remove orphan hosts from database: %s", error->message);
     g_error_free (error);
+  } else if (ephy_sqlite_connection_get_changes (self->history_database) > 0) {
+    ephy_history_service_load_zoom_levels (self);
   }
 }
+
+/* The zoom levels of all hosts, by host URL, so that the UI can look them up
+ * without waiting for the history thread. The history thread keeps them in
+ * sync with the hosts table. */
+void
+ephy_history_service_load_zoom_levels (EphyHistoryService *self)
+{
+  EphySQLiteStatement *statement;
+  GHashTable *zoom_levels;
+  GError *error = NULL;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (self->history_database);
+
+  zoom_levels = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  statement = ephy_sqlite_connection_create_statement (self->history_database,
+                                                       "SELECT url, zoom_level FROM hosts",
+                                                       EPHY_SQLITE_STATEMENT_SHORT_LIVED, &error);
+  if (error) {
+    g_warning ("Could not build hosts table zoom level statement: %s", error->message);
+    g_error_free (error);
+  } else {
+    while (ephy_sqlite_statement_step (statement, &error)) {
+      const char *url = ephy_sqlite_statement_get_column_as_string (statement, 0);
+      double *zoom_level = g_new (double, 1);
+
+      *zoom_level = ephy_sqlite_statement_get_column_as_double (statement, 1);
+      if (url)
+        g_hash_table_replace (zoom_levels, g_strdup (url), zoom_level);
+      else
+        g_free (zoom_level);
+    }
+
+    if (error) {
+      g_warning ("Could not load host zoom levels: %s", error->message);
+      g_error_free (error);
+    }
+    g_object_unref (statement);
+  }
+
+  g_mutex_lock (&self->zoom_levels_mutex);
+  g_clear_pointer (&self->zoom_levels, g_hash_table_unref);
+  self->zoom_levels = zoom_levels;
+  g_mutex_unlock (&self->zoom_levels_mutex);
+}
+
+void
+ephy_history_service_cache_zoom_level (EphyHistoryService *self,
+                                       const char         *host_url,
+                                       double              zoom_level)
+{
+  double *value;
+
+  if (!host_url)
+    return;
+
+  value = g_new (double, 1);
+  *value = zoom_level;
+
+  g_mutex_lock (&self->zoom_levels_mutex);
+  if (self->zoom_levels)
+    g_hash_table_replace (self->zoom_levels, g_strdup (host_url), value);
+  else
+    g_free (value);
+  g_mutex_unlock (&self->zoom_levels_mutex);
+}
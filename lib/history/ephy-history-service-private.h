@@ -42,13 +42,17 @@ typedef enum {
   EPHY_HISTORY_STATEMENT_UPDATE_URL_ROW,
   EPHY_HISTORY_STATEMENT_DELETE_URL_FOR_ID,
   EPHY_HISTORY_STATEMENT_DELETE_URL_FOR_URL,
+  EPHY_HISTORY_STATEMENT_ADD_URL_FRECENCY,
 
   /* visits table */
   EPHY_HISTORY_STATEMENT_ADD_VISIT_ROW,
+  EPHY_HISTORY_STATEMENT_HAS_VISIT_ROW,
   
   EPHY_HISTORY_STATEMENT_LEN,
 } EphyHistoryServiceStatement;
 
+typedef struct _EphyHistoryServiceCompletion EphyHistoryServiceCompletion;
+
 struct _EphyHistoryService {
   GObject parent_instance;
   char *history_filename;
@@ -60,21 +64,102 @@ struct _EphyHistoryService {
   GAsyncQueue *queue;
   gboolean scheduled_to_quit;
   gboolean in_memory;
+  gboolean url_search_index_available;
+  gboolean url_search_index_backfill_pending;
   int queue_urls_visited_id;
+  GList *visited_urls; /* Since urls-visited was last emitted */
   EphySQLiteStatement **statements;
+
+  /* Read-only connections that answer queries off the history thread. */
+  GThreadPool *reader_pool;
+  GAsyncQueue *idle_readers;
+
+  /* Write batching statistics, only touched on the history thread. */
+  guint64 write_batch_count;
+  guint64 write_batch_message_count;
+  guint write_batch_max_size;
+  gint64 commit_duration_total;
+  gint64 commit_duration_max;
+
+  /* Queued queries by supersede key, and queue statistics, all guarded by
+   * pending_queries_mutex. */
+  GMutex pending_queries_mutex;
+  GHashTable *pending_queries;
+  guint64 queries_superseded;
+  guint queue_depth_max;
+
+  /* History retention, guarded by retention_mutex. The expiry job runs on
+   * the history thread once the queue has been idle for a while. */
+  GMutex retention_mutex;
+  int max_visit_age_days;
+  int max_visit_count;
+  char **retained_urls;
+  gboolean retained_urls_changed;
+  gboolean expiry_pending;
+  gint64 next_expiry_time;
+
+  /* When the next frecency decay pass is due, only touched on the history
+   * thread. */
+  gint64 next_frecency_decay_time;
+
+  /* When visits are next rolled up, only touched on the history thread. */
+  gint64 next_visit_rollup_time;
+
+  /* Whether a commit has been made since the last idle checkpoint, only
+   * touched on the history thread. */
+  gboolean checkpoint_pending;
+
+  /* Zoom levels by host URL, mirroring the hosts table, guarded by
+   * zoom_levels_mutex. */
+  GMutex zoom_levels_mutex;
+  GHashTable *zoom_levels;
+
+  /* Finished messages and signals to emit, pushed by the history and reader
+   * threads onto a lock-free stack and drained by completion_source. The
+   * pending queue and the signals in it by coalescing key are only touched
+   * on the main thread. */
+  EphyHistoryServiceCompletion *completions;
+  GSource *completion_source;
+  GQueue pending_completions;
+  GHashTable *pending_signals;
 };
 
+EphySQLiteConnection *   ephy_history_service_get_database            (EphyHistoryService *self);
+gboolean                 ephy_history_service_is_reader_thread        (EphyHistoryService *self);
 EphySQLiteStatement *    ephy_history_service_get_cached_statement    (EphyHistoryService *self, EphyHistoryServiceStatement stmt, GError **error);
 gboolean                 ephy_history_service_initialize_urls_table   (EphyHistoryService *self);
 EphyHistoryURL *         ephy_history_service_get_url_row             (EphyHistoryService *self, const char *url_string, EphyHistoryURL *url);
 void                     ephy_history_service_add_url_row             (EphyHistoryService *self, EphyHistoryURL *url);
 void                     ephy_history_service_update_url_row          (EphyHistoryService *self, EphyHistoryURL *url);
 GList*                   ephy_history_service_find_url_rows           (EphyHistoryService *self, EphyHistoryQuery *query);
+EphyHistoryURLTable *    ephy_history_service_find_url_table          (EphyHistoryService *self, EphyHistoryQuery *query);
+void                     ephy_history_service_initialize_url_search_index (EphyHistoryService *self);
+gboolean                 ephy_history_service_backfill_url_search_index (EphyHistoryService *self, int batch_size);
+void                     ephy_history_service_append_url_substring_filters (EphyHistoryService *self, GString *statement_str, GList *substring_list);
+guint                    ephy_history_service_get_url_substring_filters_shape (EphyHistoryService *self, GList *substring_list);
+gboolean                 ephy_history_service_bind_url_substring_filters (EphyHistoryService *self, EphySQLiteStatement *statement, int *column, GList *substring_list, GError **error);
 void                     ephy_history_service_delete_url              (EphyHistoryService *self, EphyHistoryURL *url);
+GList *                  ephy_history_service_find_orphan_url_rows    (EphyHistoryService *self, int limit);
+GList *                  ephy_history_service_delete_unvisited_url_rows (EphyHistoryService *self);
+void                     ephy_history_service_initialize_url_frecency (EphyHistoryService *self);
+void                     ephy_history_service_add_url_frecency        (EphyHistoryService *self, EphyHistoryPageVisit *visit);
+void                     ephy_history_service_add_url_frecency_points (EphyHistoryService *self, int url_id, int points);
+int                      ephy_history_service_get_visit_frecency      (EphyHistoryPageVisit *visit);
+void                     ephy_history_service_decay_url_frecency      (EphyHistoryService *self);
+void                     ephy_history_service_rescore_range_urls      (EphyHistoryService *self);
 
 gboolean                 ephy_history_service_initialize_visits_table (EphyHistoryService *self);
 void                     ephy_history_service_add_visit_row           (EphyHistoryService *self, EphyHistoryPageVisit *visit);
 GList *                  ephy_history_service_find_visit_rows         (EphyHistoryService *self, EphyHistoryQuery *query);
+int                      ephy_history_service_count_visit_rows        (EphyHistoryService *self);
+int                      ephy_history_service_expire_visit_rows       (EphyHistoryService *self, gint64 before, int limit);
+gboolean                 ephy_history_service_initialize_visit_rollups_table (EphyHistoryService *self);
+int                      ephy_history_service_roll_up_visit_rows      (EphyHistoryService *self, gint64 before);
+gboolean                 ephy_history_service_add_visit_rows          (EphyHistoryService *self, GPtrArray *visits);
+gboolean                 ephy_history_service_has_visit_row           (EphyHistoryService *self, int url_id, gint64 visit_time);
+int                      ephy_history_service_delete_visit_rows_in_range (EphyHistoryService *self, gint64 from, gint64 to);
+void                     ephy_history_service_append_url_visited_filter (GString *statement_str, EphyHistoryQuery *query);
+gboolean                 ephy_history_service_bind_url_visited_filter (EphySQLiteStatement *statement, int *column, EphyHistoryQuery *query, GError **error);
 
 gboolean                 ephy_history_service_initialize_hosts_table  (EphyHistoryService *self);
 void                     ephy_history_service_add_host_row            (EphyHistoryService *self, EphyHistoryHost *host);
@@ -85,5 +170,8 @@ GList *                  ephy_history_service_find_host_rows          (EphyHisto
 EphyHistoryHost *        ephy_history_service_get_host_row_from_url   (EphyHistoryService *self, const gchar *url);
 void                     ephy_history_service_delete_host_row         (EphyHistoryService *self, EphyHistoryHost *host);
 void                     ephy_history_service_delete_orphan_hosts     (EphyHistoryService *self);
+GList *                  ephy_history_service_get_host_locations      (const gchar *url, gchar **hostname);
+void                     ephy_history_service_load_zoom_levels        (EphyHistoryService *self);
+void                     ephy_history_service_cache_zoom_level        (EphyHistoryService *self, const char *host_url, double zoom_level);
 
 G_END_DECLS
@@ -20,6 +20,7 @@
 
 #include "config.h"
 
+#include "ephy-debug.h"
 #include "ephy-history-service-private.h"
 #include "ephy-history-service.h"
 
@@ -43,13 +44,252 @@ ephy_history_service_initialize_urls_table (EphyHistoryService *self)
                                   "last_visit_time INTEGER,"
                                   "thumbnail_update_time INTEGER DEFAULT 0," /* this column is legacy, unused */
                                   "hidden_from_overview INTEGER DEFAULT 0,"
-                                  "pinned INTEGER DEFAULT 0 NOT NULL)", &error);
+                                  "pinned INTEGER DEFAULT 0 NOT NULL,"
+                                  "frecency INTEGER DEFAULT 0 NOT NULL)", &error);
 
   if (error) {
     g_warning ("Could not create urls table: %s", error->message);
     g_error_free (error);
     return FALSE;
   }
+
+  /* Existing profiles get the first three from migrate_history_indexes() and
+   * urls_frecency_index from migrate_history_frecency() in the profile
+   * migrator; keep those in sync with this list. */
+  ephy_sqlite_connection_execute (self->history_database,
+                                  "CREATE INDEX IF NOT EXISTS urls_url_index ON urls (url);"
+                                  "CREATE INDEX IF NOT EXISTS urls_host_index ON urls (host);"
+                                  "CREATE INDEX IF NOT EXISTS urls_last_visit_time_index ON urls (last_visit_time);"
+                                  "CREATE INDEX IF NOT EXISTS urls_frecency_index ON urls (pinned DESC, frecency DESC)", &error);
+
+  if (error) {
+    g_warning ("Could not create urls table indexes: %s", error->message);
+    g_error_free (error);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* The search index mirrors the urls table so that substring searches do not
+ * need to scan every row with LIKE. The trigram tokenizer gives MATCH the same
+ * substring semantics as the LIKE patterns built by
+ * ephy_sqlite_create_match_pattern(), including matches in the middle of host
+ * labels and path segments. As with those patterns, the URL scheme is not
+ * indexed. */
+#define URL_SEARCH_INDEX_VALUES(row) \
+  "substr (" row ".url, instr (" row ".url, ':') + 1), " row ".title"
+
+/* URLs that were in the database when the search index was created are
+ * indexed in the background by ephy_history_service_backfill_url_search_index(),
+ * in ascending id order. The ids still to be indexed are the range stored in
+ * urls_fts_backfill, which the triggers leave to the backfill. */
+#define URL_SEARCH_INDEX_NOT_PENDING(id) \
+  "NOT EXISTS (SELECT 1 FROM urls_fts_backfill WHERE " id " BETWEEN next_id AND last_id)"
+
+static gboolean
+url_search_index_backfill_is_done (EphyHistoryService *self)
+{
+  EphySQLiteStatement *statement;
+  GError *error = NULL;
+  gboolean done;
+
+  /* Indexes created before the backfill was introduced are complete. */
+  if (!ephy_sqlite_connection_table_exists (self->history_database, "urls_fts_backfill"))
+    return TRUE;
+
+  statement = ephy_sqlite_connection_create_statement (self->history_database,
+                                                       "SELECT 1 FROM urls_fts_backfill",
+                                                       EPHY_SQLITE_STATEMENT_SHORT_LIVED, &error);
+  if (error) {
+    g_warning ("Could not build urls_fts_backfill query statement: %s", error->message);
+    g_error_free (error);
+    return FALSE;
+  }
+
+  done = !ephy_sqlite_statement_step (statement, &error);
+  if (error) {
+    g_warning ("Could not query urls search index backfill: %s", error->message);
+    g_error_free (error);
+    done = FALSE;
+  }
+
+  g_object_unref (statement);
+  return done;
+}
+
+void
+ephy_history_service_initialize_url_search_index (EphyHistoryService *self)
+{
+  GError *error = NULL;
+
+  self->url_search_index_available = FALSE;
+  self->url_search_index_backfill_pending = FALSE;
+
+  if (!ephy_sqlite_connection_table_exists (self->history_database, "urls_fts")) {
+    /* Trigram tokenization needs SQLite 3.34. If it is not available,
+     * searches keep using LIKE. Visits rewrite the title even when it did
+     * not change, so the update trigger checks that it did. Keep it in sync
+     * with migrate_history_search_index_trigger() in the profile migrator. */
+    ephy_sqlite_connection_execute (self->history_database,
+                                    "BEGIN TRANSACTION;"
+                                    "CREATE VIRTUAL TABLE urls_fts USING fts5 ("
+                                    "url, title, content='', tokenize='trigram');"
+                                    "CREATE TABLE urls_fts_backfill ("
+                                    "next_id INTEGER NOT NULL,"
+                                    "last_id INTEGER NOT NULL);"
+                                    "CREATE TRIGGER urls_fts_insert AFTER INSERT ON urls "
+                                    "WHEN " URL_SEARCH_INDEX_NOT_PENDING ("new.id") " BEGIN "
+                                    "INSERT INTO urls_fts (rowid, url, title) "
+                                    "VALUES (new.id, " URL_SEARCH_INDEX_VALUES ("new") "); "
+                                    "END;"
+                                    "CREATE TRIGGER urls_fts_delete AFTER DELETE ON urls "
+                                    "WHEN " URL_SEARCH_INDEX_NOT_PENDING ("old.id") " BEGIN "
+                                    "INSERT INTO urls_fts (urls_fts, rowid, url, title) "
+                                    "VALUES ('delete', old.id, " URL_SEARCH_INDEX_VALUES ("old") "); "
+                                    "END;"
+                                    "CREATE TRIGGER urls_fts_update AFTER UPDATE OF url, title ON urls "
+                                    "WHEN (old.url IS NOT new.url OR old.title IS NOT new.title) "
+                                    "AND " URL_SEARCH_INDEX_NOT_PENDING ("old.id") " BEGIN "
+                                    "INSERT INTO urls_fts (urls_fts, rowid, url, title) "
+                                    "VALUES ('delete', old.id, " URL_SEARCH_INDEX_VALUES ("old") "); "
+                                    "INSERT INTO urls_fts (rowid, url, title) "
+                                    "VALUES (new.id, " URL_SEARCH_INDEX_VALUES ("new") "); "
+                                    "END;"
+                                    "INSERT INTO urls_fts_backfill (next_id, last_id) "
+                                    "SELECT MIN(id), MAX(id) FROM urls HAVING COUNT(*) > 0;"
+                                    "COMMIT", &error);
+
+    if (error) {
+      g_warning ("Could not create urls search index, falling back to LIKE queries: %s", error->message);
+      g_error_free (error);
+      ephy_sqlite_connection_execute (self->history_database, "ROLLBACK", NULL);
+      return;
+    }
+  }
+
+  /* Until every existing URL is indexed, searches keep using LIKE. */
+  if (url_search_index_backfill_is_done (self))
+    self->url_search_index_available = TRUE;
+  else
+    self->url_search_index_backfill_pending = TRUE;
+}
+
+/* Indexes the next @batch_size ids of the URLs that predate the search index.
+ * Returns TRUE once every URL is indexed. On error, the backfill is no longer
+ * pending. */
+gboolean
+ephy_history_service_backfill_url_search_index (EphyHistoryService *self,
+                                                int                 batch_size)
+{
+  g_autofree char *sql = NULL;
+  GError *error = NULL;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (self->url_search_index_backfill_pending);
+
+  sql = g_strdup_printf ("INSERT INTO urls_fts (rowid, url, title) "
+                         "SELECT urls.id, " URL_SEARCH_INDEX_VALUES ("urls") " "
+                         "FROM urls, urls_fts_backfill "
+                         "WHERE urls.id BETWEEN next_id AND MIN(last_id, next_id + %d - 1);"
+                         "UPDATE urls_fts_backfill SET next_id = next_id + %d;"
+                         "DELETE FROM urls_fts_backfill WHERE next_id > last_id",
+                         batch_size, batch_size);
+  ephy_sqlite_connection_execute (self->history_database, sql, &error);
+  if (error) {
+    /* Searches keep using LIKE, the backfill is retried on the next start. */
+    g_warning ("Could not backfill urls search index: %s", error->message);
+    g_error_free (error);
+    self->url_search_index_backfill_pending = FALSE;
+    return FALSE;
+  }
+
+  return url_search_index_backfill_is_done (self);
+}
+
+static gboolean
+substring_uses_search_index (EphyHistoryService *self,
+                             const char         *substring)
+{
+  /* A trigram index cannot answer queries shorter than one trigram. */
+  return self->url_search_index_available && g_utf8_strlen (substring, -1) >= 3;
+}
+
+void
+ephy_history_service_append_url_substring_filters (EphyHistoryService *self,
+                                                   GString            *statement_str,
+                                                   GList              *substring_list)
+{
+  gboolean use_search_index = FALSE;
+
+  for (GList *l = substring_list; l; l = l->next) {
+    if (substring_uses_search_index (self, l->data))
+      use_search_index = TRUE;
+    else
+      g_string_append (statement_str, "(urls.url LIKE ? OR urls.title LIKE ?) AND ");
+  }
+
+  /* All indexed substrings are combined into a single MATCH expression. */
+  if (use_search_index)
+    g_string_append (statement_str, "urls.id IN (SELECT rowid FROM urls_fts WHERE urls_fts MATCH ?) AND ");
+}
+
+/* Identifies the filters that ephy_history_service_append_url_substring_filters()
+ * writes for @substring_list, for use in statement cache keys. */
+guint
+ephy_history_service_get_url_substring_filters_shape (EphyHistoryService *self,
+                                                      GList              *substring_list)
+{
+  gboolean use_search_index = FALSE;
+  guint like_filters = 0;
+
+  for (GList *l = substring_list; l; l = l->next) {
+    if (substring_uses_search_index (self, l->data))
+      use_search_index = TRUE;
+    else
+      like_filters++;
+  }
+
+  return like_filters << 1 | use_search_index;
+}
+
+gboolean
+ephy_history_service_bind_url_substring_filters (EphyHistoryService   *self,
+                                                 EphySQLiteStatement  *statement,
+                                                 int                  *column,
+                                                 GList                *substring_list,
+                                                 GError              **error)
+{
+  g_autoptr (GString) match = NULL;
+
+  for (GList *l = substring_list; l; l = l->next) {
+    const char *substring = l->data;
+
+    if (substring_uses_search_index (self, substring)) {
+      if (!match)
+        match = g_string_new (NULL);
+      else
+        g_string_append (match, " AND ");
+
+      /* Quote the substring so that it is matched literally. */
+      g_string_append_c (match, '"');
+      for (const char *p = substring; *p; p++) {
+        if (*p == '"')
+          g_string_append_c (match, '"');
+        g_string_append_c (match, *p);
+      }
+      g_string_append_c (match, '"');
+    } else {
+      g_autofree char *string = ephy_sqlite_create_match_pattern (substring);
+
+      if (!ephy_sqlite_statement_bind_string (statement, (*column)++, string, error) ||
+          !ephy_sqlite_statement_bind_string (statement, (*column)++, string + 2, error))
+        return FALSE;
+    }
+  }
+
+  if (match)
+    return ephy_sqlite_statement_bind_string (statement, (*column)++, match->str, error);
+
   return TRUE;
 }
 
@@ -61,8 +301,7 @@ ephy_history_service_get_url_row (EphyHistoryService *self,
   EphySQLiteStatement *statement = NULL;
   GError *error = NULL;
 
-  g_assert (self->history_thread == g_thread_self ());
-  g_assert (self->history_database);
+  g_assert (ephy_history_service_get_database (self));
 
   if (!url_string && url)
     url_string = url->url;
@@ -114,6 +353,7 @@ ephy_history_service_get_url_row (EphyHistoryService *self,
   url->hidden = ephy_sqlite_statement_get_column_as_int (statement, 6);
   url->sync_id = g_strdup (ephy_sqlite_statement_get_column_as_string (statement, 7));
   url->pinned = ephy_sqlite_statement_get_column_as_int (statement, 8);
+  url->frecency = ephy_sqlite_statement_get_column_as_int (statement, 9);
 
   return url;
 }
@@ -220,15 +460,11 @@ create_url_from_statement (EphySQLiteStatement *statement)
   return url;
 }
 
-GList *
-ephy_history_service_find_url_rows (EphyHistoryService *self,
-                                    EphyHistoryQuery   *query)
+static char *
+build_find_url_rows_sql (EphyHistoryService *self,
+                         EphyHistoryQuery   *query)
 {
-  EphySQLiteStatement *statement = NULL;
-  GList *substring;
   GString *statement_str;
-  GList *urls = NULL;
-  GError *error = NULL;
   const char *base_statement = ""
                                "SELECT "
                                "DISTINCT urls.id, "
@@ -240,26 +476,17 @@ ephy_history_service_find_url_rows (EphyHistoryService *self,
                                "urls.hidden_from_overview, "
                                "urls.host, "
                                "urls.sync_id, "
-                               "urls.pinned "
+                               "urls.pinned, "
+                               "urls.frecency "
                                "FROM "
                                "urls ";
 
-  int i = 0;
-
-  g_assert (self->history_thread == g_thread_self ());
-  g_assert (self->history_database);
-
   statement_str = g_string_new (base_statement);
 
-  if (query->from > 0 || query->to > 0) {
-    statement_str = g_string_append (statement_str, "JOIN visits ON visits.url = urls.id WHERE ");
-    if (query->from > 0)
-      statement_str = g_string_append (statement_str, "visits.visit_time >= ? AND ");
-    if (query->to > 0)
-      statement_str = g_string_append (statement_str, "visits.visit_time <= ? AND ");
-  } else {
-    statement_str = g_string_append (statement_str, "WHERE ");
-  }
+  statement_str = g_string_append (statement_str, "WHERE ");
+
+  if (query->from > 0 || query->to > 0)
+    ephy_history_service_append_url_visited_filter (statement_str, query);
 
   if (query->ignore_hidden)
     statement_str = g_string_append (statement_str, "urls.hidden_from_overview = 0 AND ");
@@ -270,8 +497,10 @@ ephy_history_service_find_url_rows (EphyHistoryService *self,
   if (query->host > 0)
     statement_str = g_string_append (statement_str, "urls.host = ? AND ");
 
-  for (substring = query->substring_list; substring; substring = substring->next)
-    statement_str = g_string_append (statement_str, "(urls.url LIKE ? OR urls.title LIKE ?) AND ");
+  if (query->after_id > 0)
+    statement_str = g_string_append (statement_str, "(urls.last_visit_time, urls.id) < (?, ?) AND ");
+
+  ephy_history_service_append_url_substring_filters (self, statement_str, query->substring_list);
 
   statement_str = g_string_append (statement_str, "1 ");
 
@@ -279,11 +508,14 @@ ephy_history_service_find_url_rows (EphyHistoryService *self,
     case EPHY_HISTORY_SORT_MOST_VISITED:
       statement_str = g_string_append (statement_str, "ORDER BY urls.pinned DESC, urls.visit_count DESC ");
       break;
+    case EPHY_HISTORY_SORT_FRECENCY:
+      statement_str = g_string_append (statement_str, "ORDER BY urls.pinned DESC, urls.frecency DESC ");
+      break;
     case EPHY_HISTORY_SORT_LEAST_VISITED:
       statement_str = g_string_append (statement_str, "ORDER BY urls.visit_count ");
       break;
     case EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED:
-      statement_str = g_string_append (statement_str, "ORDER BY urls.last_visit_time DESC ");
+      statement_str = g_string_append (statement_str, "ORDER BY urls.last_visit_time DESC, urls.id DESC ");
       break;
     case EPHY_HISTORY_SORT_LEAST_RECENTLY_VISITED:
       statement_str = g_string_append (statement_str, "ORDER BY urls.last_visit_time ");
@@ -309,11 +541,37 @@ ephy_history_service_find_url_rows (EphyHistoryService *self,
     statement_str = g_string_append (statement_str, "LIMIT ? ");
   }
 
-  statement = ephy_sqlite_connection_create_statement (self->history_database,
-                                                       statement_str->str,
-                                                       EPHY_SQLITE_STATEMENT_SHORT_LIVED,
-                                                       &error);
-  g_string_free (statement_str, TRUE);
+  return g_string_free (statement_str, FALSE);
+}
+
+static EphySQLiteStatement *
+prepare_find_url_rows_statement (EphyHistoryService *self,
+                                 EphyHistoryQuery   *query)
+{
+  EphySQLiteConnection *database;
+  EphySQLiteStatement *statement = NULL;
+  g_autofree char *cache_key = NULL;
+  GError *error = NULL;
+
+  int i = 0;
+
+  database = ephy_history_service_get_database (self);
+  g_assert (database);
+
+  /* Everything that changes the SQL text, but none of the bound values. */
+  cache_key = g_strdup_printf ("find_url_rows:%d:%d:%d:%d:%d:%d:%u:%d:%d",
+                               query->from > 0, query->to > 0,
+                               !!query->ignore_hidden, !!query->ignore_local,
+                               query->host > 0, query->after_id > 0,
+                               ephy_history_service_get_url_substring_filters_shape (self, query->substring_list),
+                               query->sort_type, query->limit != 0);
+
+  statement = ephy_sqlite_connection_get_cached_statement (database, cache_key);
+  if (!statement) {
+    g_autofree char *sql = build_find_url_rows_sql (self, query);
+
+    statement = ephy_sqlite_connection_add_cached_statement (database, cache_key, sql, &error);
+  }
 
   if (error) {
     g_warning ("Could not build urls table query statement: %s", error->message);
@@ -321,16 +579,8 @@ ephy_history_service_find_url_rows (EphyHistoryService *self,
     return NULL;
   }
 
-  if (query->from > 0) {
-    if (!ephy_sqlite_statement_bind_int64 (statement, i++, query->from, &error)) {
-      g_warning ("Could not build urls table query statement: %s", error->message);
-      g_error_free (error);
-      g_object_unref (statement);
-      return NULL;
-    }
-  }
-  if (query->to > 0) {
-    if (!ephy_sqlite_statement_bind_int64 (statement, i++, query->to, &error)) {
+  if (query->from > 0 || query->to > 0) {
+    if (!ephy_history_service_bind_url_visited_filter (statement, &i, query, &error)) {
       g_warning ("Could not build urls table query statement: %s", error->message);
       g_error_free (error);
       g_object_unref (statement);
@@ -345,23 +595,20 @@ ephy_history_service_find_url_rows (EphyHistoryService *self,
       return NULL;
     }
   }
-  for (substring = query->substring_list; substring; substring = substring->next) {
-    char *string = ephy_sqlite_create_match_pattern (substring->data);
-    if (!ephy_sqlite_statement_bind_string (statement, i++, string, &error)) {
-      g_warning ("Could not build urls table query statement: %s", error->message);
-      g_error_free (error);
-      g_object_unref (statement);
-      g_free (string);
-      return NULL;
-    }
-    if (!ephy_sqlite_statement_bind_string (statement, i++, string + 2, &error)) {
+  if (query->after_id > 0) {
+    if (!ephy_sqlite_statement_bind_int64 (statement, i++, query->after_last_visit_time, &error) ||
+        !ephy_sqlite_statement_bind_int (statement, i++, query->after_id, &error)) {
       g_warning ("Could not build urls table query statement: %s", error->message);
       g_error_free (error);
       g_object_unref (statement);
-      g_free (string);
       return NULL;
     }
-    g_free (string);
+  }
+  if (!ephy_history_service_bind_url_substring_filters (self, statement, &i, query->substring_list, &error)) {
+    g_warning ("Could not build urls table query statement: %s", error->message);
+    g_error_free (error);
+    g_object_unref (statement);
+    return NULL;
   }
 
   if (query->limit)
@@ -372,6 +619,21 @@ ephy_history_service_find_url_rows (EphyHistoryService *self,
       return NULL;
     }
 
+  return statement;
+}
+
+GList *
+ephy_history_service_find_url_rows (EphyHistoryService *self,
+                                    EphyHistoryQuery   *query)
+{
+  EphySQLiteStatement *statement;
+  GList *urls = NULL;
+  GError *error = NULL;
+
+  statement = prepare_find_url_rows_statement (self, query);
+  if (!statement)
+    return NULL;
+
   while (ephy_sqlite_statement_step (statement, &error))
     urls = g_list_prepend (urls, create_url_from_statement (statement));
 
@@ -389,6 +651,46 @@ ephy_history_service_find_url_rows (EphyHistoryService *self,
   return urls;
 }
 
+/* Like ephy_history_service_find_url_rows(), but returns the rows as one
+ * #EphyHistoryURLTable. Sync IDs and hosts are not included. */
+EphyHistoryURLTable *
+ephy_history_service_find_url_table (EphyHistoryService *self,
+                                     EphyHistoryQuery   *query)
+{
+  EphySQLiteStatement *statement;
+  EphyHistoryURLTable *table;
+  GError *error = NULL;
+
+  statement = prepare_find_url_rows_statement (self, query);
+  if (!statement)
+    return NULL;
+
+  table = ephy_history_url_table_new (query->limit ? MIN (query->limit, 1024) : 64);
+  while (ephy_sqlite_statement_step (statement, &error)) {
+    ephy_history_url_table_append (table,
+                                   ephy_sqlite_statement_get_column_as_int (statement, 0),
+                                   ephy_sqlite_statement_get_column_as_string (statement, 1),
+                                   ephy_sqlite_statement_get_column_as_string (statement, 2),
+                                   ephy_sqlite_statement_get_column_as_int (statement, 3),
+                                   ephy_sqlite_statement_get_column_as_int (statement, 4),
+                                   ephy_sqlite_statement_get_column_as_int64 (statement, 5),
+                                   ephy_sqlite_statement_get_column_as_int (statement, 6),
+                                   ephy_sqlite_statement_get_column_as_int (statement, 9),
+                                   ephy_sqlite_statement_get_column_as_int (statement, 10));
+  }
+
+  g_object_unref (statement);
+
+  if (error) {
+    g_warning ("Could not execute urls table query statement: %s", error->message);
+    g_error_free (error);
+    ephy_history_url_table_unref (table);
+    return NULL;
+  }
+
+  return table;
+}
+
 void
 ephy_history_service_delete_url (EphyHistoryService *self,
                                  EphyHistoryURL     *url)
@@ -429,3 +731,356 @@ ephy_history_service_delete_url (EphyHistoryService *self,
     g_error_free (error);
   }
 }
+
+/* Finds URLs left without any visits by history expiry. Pinned URLs and the
+ * URLs in temp.retained_urls are kept even without visits. */
+GList *
+ephy_history_service_find_orphan_url_rows (EphyHistoryService *self,
+                                           int                 limit)
+{
+  EphySQLiteStatement *statement = NULL;
+  GList *urls = NULL;
+  GError *error = NULL;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (self->history_database);
+
+  statement = ephy_sqlite_connection_create_statement (self->history_database,
+                                                       "SELECT id, url, title, visit_count, typed_count, "
+                                                       "last_visit_time, hidden_from_overview, host, sync_id, pinned "
+                                                       "FROM urls WHERE pinned = 0 "
+                                                       "AND NOT EXISTS (SELECT 1 FROM visits WHERE visits.url = urls.id) "
+                                                       "AND NOT EXISTS (SELECT 1 FROM visit_rollups WHERE visit_rollups.url = urls.id) "
+                                                       "AND url NOT IN (SELECT url FROM temp.retained_urls) "
+                                                       "LIMIT ?",
+                                                       EPHY_SQLITE_STATEMENT_SHORT_LIVED, &error);
+  if (error) {
+    g_warning ("Could not build orphan urls query statement: %s", error->message);
+    g_error_free (error);
+    return NULL;
+  }
+
+  if (!ephy_sqlite_statement_bind_int (statement, 0, limit, &error)) {
+    g_warning ("Could not build orphan urls query statement: %s", error->message);
+    g_error_free (error);
+    g_object_unref (statement);
+    return NULL;
+  }
+
+  while (ephy_sqlite_statement_step (statement, &error))
+    urls = g_list_prepend (urls, create_url_from_statement (statement));
+
+  if (error) {
+    g_warning ("Could not execute orphan urls query statement: %s", error->message);
+    g_error_free (error);
+  }
+
+  g_object_unref (statement);
+
+  return g_list_reverse (urls);
+}
+
+#define RANGE_UNVISITED_URLS_CONDITION \
+  "id IN (SELECT id FROM temp.range_urls) AND pinned = 0 " \
+  "AND NOT EXISTS (SELECT 1 FROM visits WHERE visits.url = urls.id) " \
+  "AND NOT EXISTS (SELECT 1 FROM visit_rollups WHERE visit_rollups.url = urls.id)"
+
+/* Deletes the URLs in temp.range_urls that ephy_history_service_delete_visit_rows_in_range()
+ * left without visits, except pinned ones, and recounts and rescores the
+ * visits of the others. Returns the deleted URLs. */
+GList *
+ephy_history_service_delete_unvisited_url_rows (EphyHistoryService *self)
+{
+  EphySQLiteStatement *statement = NULL;
+  GList *urls = NULL;
+  GError *error = NULL;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (self->history_database);
+
+  statement = ephy_sqlite_connection_create_statement (self->history_database,
+                                                       "SELECT id, url, title, visit_count, typed_count, "
+                                                       "last_visit_time, hidden_from_overview, host, sync_id, pinned "
+                                                       "FROM urls WHERE " RANGE_UNVISITED_URLS_CONDITION,
+                                                       EPHY_SQLITE_STATEMENT_SHORT_LIVED, &error);
+  if (statement) {
+    while (ephy_sqlite_statement_step (statement, &error))
+      urls = g_list_prepend (urls, create_url_from_statement (statement));
+    g_clear_object (&statement);
+  }
+
+  if (!error && urls)
+    ephy_sqlite_connection_execute (self->history_database,
+                                    "DELETE FROM urls WHERE " RANGE_UNVISITED_URLS_CONDITION,
+                                    &error);
+
+  if (!error)
+    ephy_sqlite_connection_execute (self->history_database,
+                                    "UPDATE urls SET "
+                                    "visit_count = (SELECT COUNT(*) FROM visits WHERE visits.url = urls.id) + "
+                                    "(SELECT IFNULL(SUM(visit_count), 0) FROM visit_rollups WHERE visit_rollups.url = urls.id), "
+                                    "last_visit_time = MAX((SELECT IFNULL(MAX(visit_time), 0) FROM visits WHERE visits.url = urls.id), "
+                                    "(SELECT IFNULL(MAX(last_visit_time), 0) FROM visit_rollups WHERE visit_rollups.url = urls.id)) "
+                                    "WHERE id IN (SELECT id FROM temp.range_urls)",
+                                    &error);
+
+  if (error) {
+    g_warning ("Could not delete unvisited URLs: %s", error->message);
+    g_error_free (error);
+    ephy_history_url_list_free (urls);
+    return NULL;
+  }
+
+  ephy_history_service_rescore_range_urls (self);
+
+  return g_list_reverse (urls);
+}
+
+/* Every visit adds to the frecency of its URL, weighted by how long ago the
+ * visit was made and how the user got there. A daily decay pass scales all
+ * scores down, so that old visits count for less and less over time.
+ *
+ * Keep in sync with migrate_history_frecency() in the profile migrator. */
+#define FRECENCY_TYPED_URL_BONUS 50
+#define FRECENCY_DECAY_RATE 0.975
+#define FRECENCY_DECAY_INTERVAL G_TIME_SPAN_DAY
+
+static int
+get_frecency_recency_weight (gint64 age)
+{
+  if (age <= 4 * G_TIME_SPAN_DAY)
+    return 100;
+  if (age <= 14 * G_TIME_SPAN_DAY)
+    return 70;
+  if (age <= 31 * G_TIME_SPAN_DAY)
+    return 50;
+  if (age <= 90 * G_TIME_SPAN_DAY)
+    return 30;
+  return 10;
+}
+
+static int
+get_frecency_visit_type_bonus (EphyHistoryPageVisitType visit_type)
+{
+  switch (visit_type) {
+    case EPHY_PAGE_VISIT_TYPED:
+      return 200;
+    case EPHY_PAGE_VISIT_BOOKMARK:
+      return 140;
+    case EPHY_PAGE_VISIT_HOMEPAGE:
+      return 50;
+    case EPHY_PAGE_VISIT_LINK:
+    case EPHY_PAGE_VISIT_NONE:
+    default:
+      return 100;
+  }
+}
+
+void
+ephy_history_service_initialize_url_frecency (EphyHistoryService *self)
+{
+  EphySQLiteStatement *statement;
+  gint64 last_decay_time;
+  GError *error = NULL;
+
+  g_assert (self->history_thread == g_thread_self ());
+
+  /* Missing the decay pass for a while is harmless, so a failure here only
+   * postpones it. */
+  self->next_frecency_decay_time = g_get_real_time () + FRECENCY_DECAY_INTERVAL;
+
+  ephy_sqlite_connection_execute (self->history_database,
+                                  "CREATE TABLE IF NOT EXISTS frecency_decay ("
+                                  "last_decay_time INTEGER NOT NULL)", &error);
+  if (error) {
+    g_warning ("Could not create frecency_decay table: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  statement = ephy_sqlite_connection_create_statement (self->history_database,
+                                                       "SELECT last_decay_time FROM frecency_decay",
+                                                       EPHY_SQLITE_STATEMENT_SHORT_LIVED, &error);
+  if (error) {
+    g_warning ("Could not build frecency_decay query statement: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  if (ephy_sqlite_statement_step (statement, &error)) {
+    last_decay_time = ephy_sqlite_statement_get_column_as_int64 (statement, 0);
+    self->next_frecency_decay_time = last_decay_time + FRECENCY_DECAY_INTERVAL;
+  } else if (!error) {
+    g_object_unref (statement);
+    statement = ephy_sqlite_connection_create_statement (self->history_database,
+                                                         "INSERT INTO frecency_decay (last_decay_time) VALUES (?)",
+                                                         EPHY_SQLITE_STATEMENT_SHORT_LIVED, &error);
+    if (statement && ephy_sqlite_statement_bind_int64 (statement, 0, g_get_real_time (), &error))
+      ephy_sqlite_statement_step (statement, &error);
+  }
+
+  if (error) {
+    g_warning ("Could not initialize frecency decay: %s", error->message);
+    g_error_free (error);
+  }
+
+  g_clear_object (&statement);
+}
+
+/* The frecency points @visit adds to its URL, as of now. */
+int
+ephy_history_service_get_visit_frecency (EphyHistoryPageVisit *visit)
+{
+  int bonus;
+
+  bonus = get_frecency_visit_type_bonus (visit->visit_type);
+  if (visit->url->typed_count > 0)
+    bonus += FRECENCY_TYPED_URL_BONUS;
+
+  return get_frecency_recency_weight (g_get_real_time () - visit->visit_time) * bonus / 100;
+}
+
+void
+ephy_history_service_add_url_frecency_points (EphyHistoryService *self,
+                                              int                 url_id,
+                                              int                 points)
+{
+  EphySQLiteStatement *statement;
+  GError *error = NULL;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (self->history_database);
+
+  if (self->in_memory)
+    return;
+
+  statement = ephy_history_service_get_cached_statement (self, EPHY_HISTORY_STATEMENT_ADD_URL_FRECENCY, &error);
+  if (error) {
+    g_warning ("Could not build urls table frecency statement: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  if (!ephy_sqlite_statement_bind_int (statement, 0, points, &error) ||
+      !ephy_sqlite_statement_bind_int (statement, 1, url_id, &error)) {
+    g_warning ("Could not update URL frecency: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  ephy_sqlite_statement_step (statement, &error);
+  if (error) {
+    g_warning ("Could not update URL frecency: %s", error->message);
+    g_error_free (error);
+  }
+}
+
+void
+ephy_history_service_add_url_frecency (EphyHistoryService   *self,
+                                       EphyHistoryPageVisit *visit)
+{
+  int points = ephy_history_service_get_visit_frecency (visit);
+
+  ephy_history_service_add_url_frecency_points (self, visit->url->id, points);
+  visit->url->frecency += points;
+}
+
+/* Appends the SQL for the frecency points of the rows of @table, as of @now,
+ * like ephy_history_service_get_visit_frecency() would score them. */
+static void
+append_frecency_points_sql (GString    *sql,
+                            const char *table,
+                            const char *time_column,
+                            gint64      now)
+{
+  g_string_append (sql, "CASE ");
+  g_string_append_printf (sql, "WHEN %" G_GINT64_FORMAT " - %s.%s <= 4 * %" G_GINT64_FORMAT " THEN 100 ",
+                          now, table, time_column, G_TIME_SPAN_DAY);
+  g_string_append_printf (sql, "WHEN %" G_GINT64_FORMAT " - %s.%s <= 14 * %" G_GINT64_FORMAT " THEN 70 ",
+                          now, table, time_column, G_TIME_SPAN_DAY);
+  g_string_append_printf (sql, "WHEN %" G_GINT64_FORMAT " - %s.%s <= 31 * %" G_GINT64_FORMAT " THEN 50 ",
+                          now, table, time_column, G_TIME_SPAN_DAY);
+  g_string_append_printf (sql, "WHEN %" G_GINT64_FORMAT " - %s.%s <= 90 * %" G_GINT64_FORMAT " THEN 30 ",
+                          now, table, time_column, G_TIME_SPAN_DAY);
+  g_string_append (sql, "ELSE 10 END * ");
+  g_string_append_printf (sql, "(CASE %s.visit_type WHEN %d THEN 200 WHEN %d THEN 140 WHEN %d THEN 50 ELSE 100 END + "
+                          "CASE WHEN urls.typed_count > 0 THEN %d ELSE 0 END) / 100",
+                          table, EPHY_PAGE_VISIT_TYPED, EPHY_PAGE_VISIT_BOOKMARK, EPHY_PAGE_VISIT_HOMEPAGE,
+                          FRECENCY_TYPED_URL_BONUS);
+}
+
+/* Scores the URLs in temp.range_urls again from the visits and rollups they
+ * have left, the way migrate_history_frecency() scores existing history. */
+void
+ephy_history_service_rescore_range_urls (EphyHistoryService *self)
+{
+  g_autoptr (GString) sql = g_string_new ("UPDATE urls SET frecency = IFNULL ((SELECT SUM (");
+  gint64 now = g_get_real_time ();
+  GError *error = NULL;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (self->history_database);
+
+  append_frecency_points_sql (sql, "visits", "visit_time", now);
+  g_string_append (sql, ") FROM visits WHERE visits.url = urls.id), 0) + IFNULL ((SELECT SUM ((");
+  append_frecency_points_sql (sql, "visit_rollups", "last_visit_time", now);
+  g_string_append (sql, ") * visit_rollups.visit_count) FROM visit_rollups WHERE visit_rollups.url = urls.id), 0) "
+                   "WHERE id IN (SELECT id FROM temp.range_urls)");
+
+  ephy_sqlite_connection_execute (self->history_database, sql->str, &error);
+  if (error) {
+    g_warning ("Could not recompute URL frecency: %s", error->message);
+    g_error_free (error);
+  }
+}
+
+void
+ephy_history_service_decay_url_frecency (EphyHistoryService *self)
+{
+  EphySQLiteStatement *statement = NULL;
+  gint64 last_decay_time;
+  gint64 days;
+  double factor = 1.0;
+  GError *error = NULL;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (self->history_database);
+
+  last_decay_time = self->next_frecency_decay_time - FRECENCY_DECAY_INTERVAL;
+  days = (g_get_real_time () - last_decay_time) / FRECENCY_DECAY_INTERVAL;
+  if (days <= 0)
+    return;
+
+  /* Catch up on the days the browser was not running. After a year or so
+   * nothing is left of the old scores anyway. */
+  for (gint64 i = 0; i < MIN (days, 365); i++)
+    factor *= FRECENCY_DECAY_RATE;
+
+  last_decay_time += days * FRECENCY_DECAY_INTERVAL;
+  self->next_frecency_decay_time = last_decay_time + FRECENCY_DECAY_INTERVAL;
+
+  statement = ephy_sqlite_connection_create_statement (self->history_database,
+                                                       "UPDATE urls SET frecency = CAST(ROUND(frecency * ?) AS INTEGER) "
+                                                       "WHERE frecency > 0",
+                                                       EPHY_SQLITE_STATEMENT_SHORT_LIVED, &error);
+  if (statement && ephy_sqlite_statement_bind_double (statement, 0, factor, &error))
+    ephy_sqlite_statement_step (statement, &error);
+  g_clear_object (&statement);
+
+  if (!error) {
+    statement = ephy_sqlite_connection_create_statement (self->history_database,
+                                                         "UPDATE frecency_decay SET last_decay_time = ?",
+                                                         EPHY_SQLITE_STATEMENT_SHORT_LIVED, &error);
+    if (statement && ephy_sqlite_statement_bind_int64 (statement, 0, last_decay_time, &error))
+      ephy_sqlite_statement_step (statement, &error);
+    g_clear_object (&statement);
+  }
+
+  if (error) {
+    g_warning ("Could not decay URL frecency: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  LOG ("Decayed URL frecency by %f", factor);
+}
@@ -45,6 +45,49 @@ ephy_history_service_initialize_visits_table (EphyHistoryService *self)
     return FALSE;
   }
 
+  ephy_sqlite_connection_execute (self->history_database,
+                                  "CREATE INDEX IF NOT EXISTS visits_url_visit_time_index ON visits (url, visit_time);"
+                                  "CREATE INDEX IF NOT EXISTS visits_visit_time_index ON visits (visit_time)", &error);
+
+  if (error) {
+    g_warning ("Could not create visits table indexes: %s", error->message);
+    g_error_free (error);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Visits older than a few weeks are rolled up into one row per URL and day,
+ * which keeps the first and last visit time of that day. Every query with a
+ * time range reads both tables. */
+gboolean
+ephy_history_service_initialize_visit_rollups_table (EphyHistoryService *self)
+{
+  GError *error = NULL;
+
+  if (ephy_sqlite_connection_table_exists (self->history_database, "visit_rollups"))
+    return TRUE;
+
+  /* Keep in sync with migrate_history_visit_rollups() in the profile
+   * migrator. */
+  ephy_sqlite_connection_execute (self->history_database,
+                                  "CREATE TABLE visit_rollups ("
+                                  "url INTEGER NOT NULL REFERENCES urls(id) ON DELETE CASCADE,"
+                                  "day TEXT NOT NULL,"
+                                  "visit_count INTEGER NOT NULL,"
+                                  "first_visit_time INTEGER NOT NULL,"
+                                  "last_visit_time INTEGER NOT NULL,"
+                                  "visit_type INTEGER NOT NULL,"
+                                  "PRIMARY KEY (url, day));"
+                                  "CREATE INDEX IF NOT EXISTS visit_rollups_last_visit_time_index ON visit_rollups (last_visit_time)", &error);
+
+  if (error) {
+    g_warning ("Could not create visit_rollups table: %s", error->message);
+    g_error_free (error);
+    return FALSE;
+  }
+
   return TRUE;
 }
 
@@ -86,6 +129,112 @@ ephy_history_service_add_visit_row (EphyHistoryService   *self,
   }
 }
 
+/* Whether @url_id has a visit at @visit_time, either as a visit row or in a
+ * day rolled up since, whose visit times are no longer known. */
+gboolean
+ephy_history_service_has_visit_row (EphyHistoryService *self,
+                                    int                 url_id,
+                                    gint64              visit_time)
+{
+  EphySQLiteStatement *statement;
+  GError *error = NULL;
+  gboolean found;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (self->history_database);
+
+  statement = ephy_history_service_get_cached_statement (self, EPHY_HISTORY_STATEMENT_HAS_VISIT_ROW, &error);
+  if (error) {
+    g_warning ("Could not build visits table query statement: %s", error->message);
+    g_error_free (error);
+    return FALSE;
+  }
+
+  if (!ephy_sqlite_statement_bind_int (statement, 0, url_id, &error) ||
+      !ephy_sqlite_statement_bind_int64 (statement, 1, visit_time, &error)) {
+    g_warning ("Could not build visits table query statement: %s", error->message);
+    g_error_free (error);
+    return FALSE;
+  }
+
+  found = ephy_sqlite_statement_step (statement, &error);
+  if (error) {
+    g_warning ("Could not query visits table: %s", error->message);
+    g_error_free (error);
+  }
+
+  return found;
+}
+
+/* Visits are inserted this many rows per statement by
+ * ephy_history_service_add_visit_rows(). */
+#define VISIT_ROWS_PER_INSERT 100
+
+static EphySQLiteStatement *
+get_add_visit_rows_statement (EphyHistoryService  *self,
+                              guint                n_rows,
+                              GError             **error)
+{
+  EphySQLiteStatement *statement;
+  g_autofree char *key = g_strdup_printf ("add-visit-rows:%u", n_rows);
+  g_autoptr (GString) sql = NULL;
+
+  statement = ephy_sqlite_connection_get_cached_statement (self->history_database, key);
+  if (statement)
+    return statement;
+
+  sql = g_string_new ("INSERT INTO visits (url, visit_time, visit_type) VALUES ");
+  for (guint i = 0; i < n_rows; i++)
+    g_string_append (sql, i == 0 ? "(?, ?, ?)" : ", (?, ?, ?)");
+
+  return ephy_sqlite_connection_add_cached_statement (self->history_database, key, sql->str, error);
+}
+
+/* Adds @visits, whose URLs must already have rows, with multi-row inserts.
+ * Unlike ephy_history_service_add_visit_row(), the visit IDs are not set. */
+gboolean
+ephy_history_service_add_visit_rows (EphyHistoryService *self,
+                                     GPtrArray          *visits)
+{
+  GError *error = NULL;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (self->history_database);
+
+  if (self->in_memory)
+    return TRUE;
+
+  for (guint i = 0; i < visits->len && !error; i += VISIT_ROWS_PER_INSERT) {
+    guint n_rows = MIN (visits->len - i, VISIT_ROWS_PER_INSERT);
+    EphySQLiteStatement *statement;
+
+    statement = get_add_visit_rows_statement (self, n_rows, &error);
+    if (!statement)
+      break;
+
+    for (guint row = 0; row < n_rows; row++) {
+      EphyHistoryPageVisit *visit = g_ptr_array_index (visits, i + row);
+
+      if (!ephy_sqlite_statement_bind_int (statement, row * 3, visit->url->id, &error) ||
+          !ephy_sqlite_statement_bind_int64 (statement, row * 3 + 1, visit->visit_time, &error) ||
+          !ephy_sqlite_statement_bind_int (statement, row * 3 + 2, visit->visit_type, &error))
+        break;
+    }
+
+    if (!error)
+      ephy_sqlite_statement_step (statement, &error);
+    g_object_unref (statement);
+  }
+
+  if (error) {
+    g_warning ("Could not add visit rows: %s", error->message);
+    g_error_free (error);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
 static EphyHistoryPageVisit *
 create_page_visit_from_statement (EphySQLiteStatement *statement)
 {
@@ -97,60 +246,96 @@ create_page_visit_from_statement (EphySQLiteStatement *statement)
   return visit;
 }
 
-GList *
-ephy_history_service_find_visit_rows (EphyHistoryService *self,
-                                      EphyHistoryQuery   *query)
+static void
+append_find_visit_rows_select (EphyHistoryService *self,
+                               GString            *statement_str,
+                               EphyHistoryQuery   *query,
+                               const char         *table,
+                               const char         *from_column,
+                               const char         *to_column)
 {
-  EphySQLiteStatement *statement = NULL;
-  GList *substring;
-  GString *statement_str;
-  GList *visits = NULL;
-  GError *error = NULL;
-  const char *base_statement = ""
-                               "SELECT "
-                               "visits.url, "
-                               "visits.visit_time, "
-                               "visits.visit_type ";
-  const char *from_join_statement = ""
-                                    "FROM "
-                                    "visits JOIN urls ON visits.url = urls.id ";
-  const char *from_visits_statement = ""
-                                      "FROM "
-                                      "visits ";
-
-  int i = 0;
-
-  g_assert (self->history_thread == g_thread_self ());
-  g_assert (self->history_database);
-
-  statement_str = g_string_new (base_statement);
+  g_string_append_printf (statement_str, "SELECT %s.url, %s.%s, %s.visit_type ",
+                          table, table, to_column, table);
 
   if (query->substring_list)
-    statement_str = g_string_append (statement_str, from_join_statement);
+    g_string_append_printf (statement_str, "FROM %s JOIN urls ON %s.url = urls.id ", table, table);
   else
-    statement_str = g_string_append (statement_str, from_visits_statement);
+    g_string_append_printf (statement_str, "FROM %s ", table);
 
   statement_str = g_string_append (statement_str, "WHERE ");
 
   if (query->from >= 0)
-    statement_str = g_string_append (statement_str, "visits.visit_time >= ? AND ");
+    g_string_append_printf (statement_str, "%s.%s >= ? AND ", table, to_column);
   if (query->to >= 0)
-    statement_str = g_string_append (statement_str, "visits.visit_time <= ? AND ");
+    g_string_append_printf (statement_str, "%s.%s <= ? AND ", table, from_column);
 
   if (query->host > 0)
     statement_str = g_string_append (statement_str, "urls.host = ? AND ");
 
-  for (substring = query->substring_list; substring; substring = substring->next) {
-    statement_str = g_string_append (statement_str, "(urls.url LIKE ? OR urls.title LIKE ?) AND ");
-  }
+  ephy_history_service_append_url_substring_filters (self, statement_str, query->substring_list);
 
   statement_str = g_string_append (statement_str, "1");
+}
 
-  statement = ephy_sqlite_connection_create_statement (self->history_database,
-                                                       statement_str->str,
-                                                       EPHY_SQLITE_STATEMENT_SHORT_LIVED,
-                                                       &error);
-  g_string_free (statement_str, TRUE);
+static char *
+build_find_visit_rows_sql (EphyHistoryService *self,
+                           EphyHistoryQuery   *query)
+{
+  GString *statement_str = g_string_new (NULL);
+
+  /* A rolled up day is returned as a single visit at the last visit time
+   * of that day, if any part of the day is in the range. */
+  append_find_visit_rows_select (self, statement_str, query, "visits", "visit_time", "visit_time");
+  statement_str = g_string_append (statement_str, " UNION ALL ");
+  append_find_visit_rows_select (self, statement_str, query, "visit_rollups", "first_visit_time", "last_visit_time");
+
+  return g_string_free (statement_str, FALSE);
+}
+
+static gboolean
+bind_find_visit_rows_select (EphyHistoryService   *self,
+                             EphySQLiteStatement  *statement,
+                             int                  *column,
+                             EphyHistoryQuery     *query,
+                             GError              **error)
+{
+  if (query->from >= 0 && !ephy_sqlite_statement_bind_int64 (statement, (*column)++, query->from, error))
+    return FALSE;
+  if (query->to >= 0 && !ephy_sqlite_statement_bind_int64 (statement, (*column)++, query->to, error))
+    return FALSE;
+  if (query->host > 0 && !ephy_sqlite_statement_bind_int (statement, (*column)++, (int)query->host, error))
+    return FALSE;
+
+  return ephy_history_service_bind_url_substring_filters (self, statement, column, query->substring_list, error);
+}
+
+GList *
+ephy_history_service_find_visit_rows (EphyHistoryService *self,
+                                      EphyHistoryQuery   *query)
+{
+  EphySQLiteConnection *database;
+  EphySQLiteStatement *statement = NULL;
+  g_autofree char *cache_key = NULL;
+  GList *visits = NULL;
+  GError *error = NULL;
+
+  int i = 0;
+
+  database = ephy_history_service_get_database (self);
+  g_assert (database);
+
+  cache_key = g_strdup_printf ("find_visit_rows:%d:%d:%d:%d:%u",
+                               query->substring_list != NULL,
+                               query->from >= 0, query->to >= 0,
+                               query->host > 0,
+                               ephy_history_service_get_url_substring_filters_shape (self, query->substring_list));
+
+  statement = ephy_sqlite_connection_get_cached_statement (database, cache_key);
+  if (!statement) {
+    g_autofree char *sql = build_find_visit_rows_sql (self, query);
+
+    statement = ephy_sqlite_connection_add_cached_statement (database, cache_key, sql, &error);
+  }
 
   if (error) {
     g_warning ("Could not build visits table query statement: %s", error->message);
@@ -158,47 +343,13 @@ ephy_history_service_find_visit_rows (EphyHistoryService *self,
     return NULL;
   }
 
-  if (query->from >= 0) {
-    if (!ephy_sqlite_statement_bind_int64 (statement, i++, query->from, &error)) {
-      g_warning ("Could not build urls table query statement: %s", error->message);
-      g_error_free (error);
-      g_object_unref (statement);
-      return NULL;
-    }
-  }
-  if (query->to >= 0) {
-    if (!ephy_sqlite_statement_bind_int64 (statement, i++, query->to, &error)) {
-      g_warning ("Could not build urls table query statement: %s", error->message);
-      g_error_free (error);
-      g_object_unref (statement);
-      return NULL;
-    }
-  }
-  if (query->host > 0) {
-    if (!ephy_sqlite_statement_bind_int (statement, i++, (int)query->host, &error)) {
-      g_warning ("Could not build urls table query statement: %s", error->message);
-      g_error_free (error);
-      g_object_unref (statement);
-      return NULL;
-    }
-  }
-  for (substring = query->substring_list; substring; substring = substring->next) {
-    char *string = ephy_sqlite_create_match_pattern (substring->data);
-    if (!ephy_sqlite_statement_bind_string (statement, i++, string, &error)) {
-      g_warning ("Could not build urls table query statement: %s", error->message);
-      g_error_free (error);
-      g_object_unref (statement);
-      g_free (string);
-      return NULL;
-    }
-    if (!ephy_sqlite_statement_bind_string (statement, i++, string + 2, &error)) {
-      g_warning ("Could not build urls table query statement: %s", error->message);
-      g_error_free (error);
-      g_object_unref (statement);
-      g_free (string);
-      return NULL;
-    }
-    g_free (string);
+  /* Once for the visits and once for the rollups. */
+  if (!bind_find_visit_rows_select (self, statement, &i, query, &error) ||
+      !bind_find_visit_rows_select (self, statement, &i, query, &error)) {
+    g_warning ("Could not build visits table query statement: %s", error->message);
+    g_error_free (error);
+    g_object_unref (statement);
+    return NULL;
   }
 
   while (ephy_sqlite_statement_step (statement, &error))
@@ -217,3 +368,283 @@ ephy_history_service_find_visit_rows (EphyHistoryService *self,
   g_object_unref (statement);
   return visits;
 }
+
+int
+ephy_history_service_count_visit_rows (EphyHistoryService *self)
+{
+  EphySQLiteStatement *statement = NULL;
+  GError *error = NULL;
+  int count = 0;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (self->history_database);
+
+  statement = ephy_sqlite_connection_create_statement (self->history_database,
+                                                       "SELECT (SELECT COUNT(*) FROM visits) + "
+                                                       "(SELECT COUNT(*) FROM visit_rollups)",
+                                                       EPHY_SQLITE_STATEMENT_SHORT_LIVED, &error);
+  if (error) {
+    g_warning ("Could not build visits table count statement: %s", error->message);
+    g_error_free (error);
+    return 0;
+  }
+
+  if (ephy_sqlite_statement_step (statement, &error))
+    count = ephy_sqlite_statement_get_column_as_int (statement, 0);
+
+  if (error) {
+    g_warning ("Could not count visits: %s", error->message);
+    g_error_free (error);
+  }
+
+  g_object_unref (statement);
+
+  return count;
+}
+
+static int
+expire_rows (EphyHistoryService *self,
+             const char         *sql,
+             gint64              before,
+             int                 limit)
+{
+  EphySQLiteStatement *statement = NULL;
+  GError *error = NULL;
+  int deleted = 0;
+
+  statement = ephy_sqlite_connection_create_statement (self->history_database, sql,
+                                                       EPHY_SQLITE_STATEMENT_SHORT_LIVED, &error);
+  if (error) {
+    g_warning ("Could not build visits table expiry statement: %s", error->message);
+    g_error_free (error);
+    return 0;
+  }
+
+  if (!ephy_sqlite_statement_bind_int64 (statement, 0, before, &error) ||
+      !ephy_sqlite_statement_bind_int (statement, 1, limit, &error)) {
+    g_warning ("Could not build visits table expiry statement: %s", error->message);
+    g_error_free (error);
+    g_object_unref (statement);
+    return 0;
+  }
+
+  ephy_sqlite_statement_step (statement, &error);
+  if (error) {
+    g_warning ("Could not expire visits: %s", error->message);
+    g_error_free (error);
+  } else {
+    deleted = ephy_sqlite_connection_get_changes (self->history_database);
+  }
+
+  g_object_unref (statement);
+
+  return deleted;
+}
+
+/* Deletes up to @limit of the oldest visits made before @before, except for
+ * visits to pinned URLs and to the URLs in temp.retained_urls. Rolled up days
+ * are older than any visit, so they go first, and each counts as one visit.
+ * Returns the number of visits deleted. */
+int
+ephy_history_service_expire_visit_rows (EphyHistoryService *self,
+                                        gint64              before,
+                                        int                 limit)
+{
+  int deleted;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (self->history_database);
+
+  deleted = expire_rows (self,
+                         "DELETE FROM visit_rollups WHERE rowid IN "
+                         "(SELECT visit_rollups.rowid FROM visit_rollups JOIN urls ON urls.id = visit_rollups.url "
+                         "WHERE visit_rollups.last_visit_time < ? AND urls.pinned = 0 "
+                         "AND urls.url NOT IN (SELECT url FROM temp.retained_urls) "
+                         "ORDER BY visit_rollups.last_visit_time LIMIT ?)",
+                         before, limit);
+
+  if (deleted < limit) {
+    deleted += expire_rows (self,
+                            "DELETE FROM visits WHERE id IN "
+                            "(SELECT visits.id FROM visits JOIN urls ON urls.id = visits.url "
+                            "WHERE visits.visit_time < ? AND urls.pinned = 0 "
+                            "AND urls.url NOT IN (SELECT url FROM temp.retained_urls) "
+                            "ORDER BY visits.visit_time LIMIT ?)",
+                            before, limit - deleted);
+  }
+
+  return deleted;
+}
+
+/* Restricts urls.id to the URLs visited between query->from and query->to,
+ * according to either the visits or the rollups. */
+void
+ephy_history_service_append_url_visited_filter (GString          *statement_str,
+                                                EphyHistoryQuery *query)
+{
+  statement_str = g_string_append (statement_str, "urls.id IN (SELECT visits.url FROM visits WHERE ");
+  if (query->from > 0)
+    statement_str = g_string_append (statement_str, "visits.visit_time >= ? AND ");
+  if (query->to > 0)
+    statement_str = g_string_append (statement_str, "visits.visit_time <= ? AND ");
+  statement_str = g_string_append (statement_str, "1 UNION SELECT visit_rollups.url FROM visit_rollups WHERE ");
+  if (query->from > 0)
+    statement_str = g_string_append (statement_str, "visit_rollups.last_visit_time >= ? AND ");
+  if (query->to > 0)
+    statement_str = g_string_append (statement_str, "visit_rollups.first_visit_time <= ? AND ");
+  statement_str = g_string_append (statement_str, "1) AND ");
+}
+
+gboolean
+ephy_history_service_bind_url_visited_filter (EphySQLiteStatement  *statement,
+                                              int                  *column,
+                                              EphyHistoryQuery     *query,
+                                              GError              **error)
+{
+  for (int i = 0; i < 2; i++) {
+    if (query->from > 0 && !ephy_sqlite_statement_bind_int64 (statement, (*column)++, query->from, error))
+      return FALSE;
+    if (query->to > 0 && !ephy_sqlite_statement_bind_int64 (statement, (*column)++, query->to, error))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Ranks visit types from weakest to strongest, as frecency weighs them, so
+ * that a rolled up day keeps the strongest type among its visits. Types fit
+ * in four bits, so MAX(rank << 4 | type) & 15 is the type with the highest
+ * rank. Followed by VISIT_TYPE_RANK_ARGS in the format arguments. */
+#define VISIT_TYPE_RANK(type) \
+  "(CASE " type " WHEN %d THEN 4 WHEN %d THEN 3 WHEN %d THEN 2 WHEN %d THEN 1 ELSE 0 END)"
+#define VISIT_TYPE_RANK_ARGS \
+  EPHY_PAGE_VISIT_TYPED, EPHY_PAGE_VISIT_BOOKMARK, EPHY_PAGE_VISIT_LINK, EPHY_PAGE_VISIT_HOMEPAGE
+
+/* Replaces the visits made before @before by one row per URL and local day
+ * in visit_rollups, merging them into rows rolled up before. Returns the
+ * number of visits rolled up.
+ *
+ * Keep in sync with migrate_history_visit_rollups() in the profile
+ * migrator. */
+int
+ephy_history_service_roll_up_visit_rows (EphyHistoryService *self,
+                                         gint64              before)
+{
+  EphySQLiteStatement *statement = NULL;
+  g_autofree char *sql = NULL;
+  GError *error = NULL;
+  int rolled_up = 0;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (self->history_database);
+
+  sql = g_strdup_printf ("INSERT INTO visit_rollups "
+                         "(url, day, visit_count, first_visit_time, last_visit_time, visit_type) "
+                         "SELECT url, date (visit_time / 1000000, 'unixepoch', 'localtime'), "
+                         "COUNT(*), MIN(visit_time), MAX(visit_time), "
+                         "MAX(" VISIT_TYPE_RANK ("visit_type") " << 4 | visit_type) & 15 "
+                         "FROM visits WHERE visit_time < ?1 "
+                         "GROUP BY url, date (visit_time / 1000000, 'unixepoch', 'localtime') "
+                         "ON CONFLICT (url, day) DO UPDATE SET "
+                         "visit_count = visit_count + excluded.visit_count, "
+                         "first_visit_time = MIN(first_visit_time, excluded.first_visit_time), "
+                         "last_visit_time = MAX(last_visit_time, excluded.last_visit_time), "
+                         "visit_type = CASE WHEN " VISIT_TYPE_RANK ("excluded.visit_type") " > " VISIT_TYPE_RANK ("visit_type") " "
+                         "THEN excluded.visit_type ELSE visit_type END",
+                         VISIT_TYPE_RANK_ARGS, VISIT_TYPE_RANK_ARGS, VISIT_TYPE_RANK_ARGS);
+  statement = ephy_sqlite_connection_create_statement (self->history_database, sql,
+                                                       EPHY_SQLITE_STATEMENT_SHORT_LIVED, &error);
+  if (statement && ephy_sqlite_statement_bind_int64 (statement, 0, before, &error))
+    ephy_sqlite_statement_step (statement, &error);
+  g_clear_object (&statement);
+
+  if (!error) {
+    statement = ephy_sqlite_connection_create_statement (self->history_database,
+                                                         "DELETE FROM visits WHERE visit_time < ?",
+                                                         EPHY_SQLITE_STATEMENT_SHORT_LIVED, &error);
+    if (statement && ephy_sqlite_statement_bind_int64 (statement, 0, before, &error))
+      ephy_sqlite_statement_step (statement, &error);
+    g_clear_object (&statement);
+  }
+
+  if (error) {
+    g_warning ("Could not roll up visits: %s", error->message);
+    g_error_free (error);
+    return 0;
+  }
+
+  rolled_up = ephy_sqlite_connection_get_changes (self->history_database);
+
+  return rolled_up;
+}
+
+static gboolean
+run_visit_range_statement (EphyHistoryService  *self,
+                           const char          *sql,
+                           gint64               from,
+                           gint64               to,
+                           GError             **error)
+{
+  EphySQLiteStatement *statement;
+  gboolean success = FALSE;
+
+  statement = ephy_sqlite_connection_create_statement (self->history_database, sql,
+                                                       EPHY_SQLITE_STATEMENT_SHORT_LIVED, error);
+  if (statement &&
+      ephy_sqlite_statement_bind_int64 (statement, 0, from, error) &&
+      ephy_sqlite_statement_bind_int64 (statement, 1, to, error)) {
+    ephy_sqlite_statement_step (statement, error);
+    success = !*error;
+  }
+  g_clear_object (&statement);
+
+  return success;
+}
+
+/* Deletes the visits between @from and @to, inclusive, and the rollups
+ * whose visits all lie in the range. A rolled up day that the range only
+ * partly covers is kept whole, since the visits it stands for cannot be told
+ * apart any more. The URLs they belonged to are left in
+ * temp.range_urls for ephy_history_service_delete_unvisited_url_rows().
+ * Returns the number of visits deleted, not counting rollups. */
+int
+ephy_history_service_delete_visit_rows_in_range (EphyHistoryService *self,
+                                                 gint64              from,
+                                                 gint64              to)
+{
+  GError *error = NULL;
+  int deleted = 0;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (self->history_database);
+
+  ephy_sqlite_connection_execute (self->history_database,
+                                  "CREATE TEMP TABLE IF NOT EXISTS range_urls (id INTEGER PRIMARY KEY);"
+                                  "DELETE FROM temp.range_urls",
+                                  &error);
+
+  if (!error)
+    run_visit_range_statement (self,
+                               "INSERT OR IGNORE INTO temp.range_urls (id) "
+                               "SELECT url FROM visits WHERE visit_time BETWEEN ?1 AND ?2 "
+                               "UNION SELECT url FROM visit_rollups "
+                               "WHERE first_visit_time >= ?1 AND last_visit_time <= ?2",
+                               from, to, &error);
+
+  if (!error)
+    run_visit_range_statement (self,
+                               "DELETE FROM visit_rollups WHERE first_visit_time >= ?1 AND last_visit_time <= ?2",
+                               from, to, &error);
+
+  if (!error &&
+      run_visit_range_statement (self, "DELETE FROM visits WHERE visit_time BETWEEN ?1 AND ?2",
+                                 from, to, &error))
+    deleted = ephy_sqlite_connection_get_changes (self->history_database);
+
+  if (error) {
+    g_warning ("Could not delete visits in range: %s", error->message);
+    g_error_free (error);
+  }
+
+  return deleted;
+}
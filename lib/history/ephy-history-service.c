@@ -28,6 +28,7 @@
 #include <glib.h>
 #include <glib/gstdio.h>
 
+#include "ephy-debug.h"
 #include "ephy-history-types.h"
 #include "ephy-lib-type-builtins.h"
 #include "ephy-prefs.h"
@@ -47,8 +48,12 @@ typedef enum {
   SET_URL_PINNED,
   ADD_VISIT,
   ADD_VISITS,
+  IMPORT_VISITS,
   DELETE_URLS,
+  DELETE_VISITS_IN_RANGE,
   DELETE_HOST,
+  EXPIRE,
+  ROLL_UP_VISITS,
   CLEAR,
   /* QUIT */
   QUIT,
@@ -56,6 +61,7 @@ typedef enum {
   GET_URL,
   GET_HOST_FOR_URL,
   QUERY_URLS,
+  QUERY_URL_TABLE,
   QUERY_VISITS,
   GET_HOSTS,
   QUERY_HOSTS
@@ -67,6 +73,7 @@ enum {
   CLEARED,
   URL_TITLE_CHANGED,
   URL_DELETED,
+  URLS_DELETED,
   HOST_DELETED,
   LAST_SIGNAL
 };
@@ -82,16 +89,68 @@ typedef struct _EphyHistoryServiceMessage {
   gboolean success;
   gpointer result;
   GTask *task;
+  char *supersede_key;
+  gboolean superseded;
 } EphyHistoryServiceMessage;
 
+/* Write messages that are already queued are committed together, but a batch
+ * is cut short after this many messages or this much time so that reads
+ * queued behind it are not starved. */
+#define WRITE_BATCH_MAX_MESSAGES 256
+#define WRITE_BATCH_MAX_DURATION (50 * G_TIME_SPAN_MILLISECOND)
+
+/* Background maintenance such as expiry and frecency decay only runs once
+ * nothing else has been queued for IDLE_MAINTENANCE_DELAY. */
+#define IDLE_MAINTENANCE_DELAY (30 * G_TIME_SPAN_SECOND)
+
+/* Expired history is deleted in batches of this many rows, each in its own
+ * transaction. New visits only trigger expiry again after EXPIRY_INTERVAL. */
+#define EXPIRY_BATCH_SIZE 500
+#define EXPIRY_INTERVAL G_TIME_SPAN_HOUR
+
+/* Databases created before incremental auto-vacuum only give space back to
+ * the file system after a full VACUUM, which rewrites the whole file. Idle
+ * expiry runs it once at least this share of the file is free pages. */
+#define FULL_VACUUM_MIN_FREE_PERCENT 25
+
+/* Visits older than VISIT_ROLLUP_AGE are rolled up into one row per URL and
+ * day, once every VISIT_ROLLUP_INTERVAL. */
+#define VISIT_ROLLUP_AGE (30 * G_TIME_SPAN_DAY)
+#define VISIT_ROLLUP_INTERVAL G_TIME_SPAN_DAY
+
+/* URLs that predate the search index are indexed this many at a time, each
+ * batch in its own transaction, whenever the history thread has nothing
+ * else to do. */
+#define URL_SEARCH_INDEX_BATCH_SIZE 1000
+
+/* The history database checkpoints its WAL once the history thread has been
+ * idle for IDLE_CHECKPOINT_DELAY after a commit, rather than in the middle of
+ * a burst of writes. The WAL is also truncated when it grows past
+ * WAL_SIZE_LIMIT. */
+#define IDLE_CHECKPOINT_DELAY (2 * G_TIME_SPAN_SECOND)
+#define WAL_SIZE_LIMIT (16 * 1024 * 1024)
+
+/* Finished messages and signal emissions are dispatched on the main thread
+ * for at most this long per main loop iteration. */
+#define COMPLETION_TIME_SLICE (4 * G_TIME_SPAN_MILLISECOND)
+
 static gpointer run_history_service_thread (EphyHistoryService *self);
-static void ephy_history_service_complete_task_in_idle_cb (EphyHistoryServiceMessage *message);
+static void ephy_history_service_complete_task (EphyHistoryServiceMessage *message);
 static void ephy_history_service_process_message (EphyHistoryService        *self,
                                                   EphyHistoryServiceMessage *message);
+static EphyHistoryServiceMessage *ephy_history_service_process_write_batch (EphyHistoryService        *self,
+                                                                           EphyHistoryServiceMessage *message);
+static void ephy_history_service_run_read (EphyHistoryServiceMessage *message,
+                                           EphyHistoryService        *self);
+static gboolean ephy_history_service_message_is_write (EphyHistoryServiceMessage *message);
+static gboolean ephy_history_service_message_can_use_reader (EphyHistoryServiceMessage *message);
 static gboolean ephy_history_service_execute_quit (EphyHistoryService *self,
                                                    gpointer            data,
                                                    gpointer           *result);
 static void ephy_history_service_quit (EphyHistoryService *self);
+static gint64 ephy_history_service_get_maintenance_delay (EphyHistoryService *self);
+static void ephy_history_service_schedule_expiry (EphyHistoryService *self);
+static void ephy_history_service_run_idle_maintenance (EphyHistoryService *self);
 
 typedef enum {
   PROP_HISTORY_FILENAME = 1,
@@ -155,6 +214,22 @@ ephy_history_service_finalize (GObject *object)
       g_object_unref (self->statements[i]);
   g_free (self->statements);
 
+  g_hash_table_unref (self->pending_queries);
+  g_mutex_clear (&self->pending_queries_mutex);
+
+  g_strfreev (self->retained_urls);
+  g_mutex_clear (&self->retention_mutex);
+
+  g_clear_pointer (&self->zoom_levels, g_hash_table_unref);
+  g_mutex_clear (&self->zoom_levels_mutex);
+
+  /* Pending tasks keep the service alive, so only signals can be left. */
+  g_source_destroy (self->completion_source);
+  g_source_unref (self->completion_source);
+  ephy_history_service_collect_completions (self);
+  g_queue_clear_full (&self->pending_completions, (GDestroyNotify)ephy_history_service_completion_free);
+  g_hash_table_unref (self->pending_signals);
+
   G_OBJECT_CLASS (ephy_history_service_parent_class)->finalize (object);
 }
 
@@ -164,6 +239,7 @@ ephy_history_service_dispose (GObject *object)
   EphyHistoryService *self = EPHY_HISTORY_SERVICE (object);
 
   g_clear_handle_id (&self->queue_urls_visited_id, g_source_remove);
+  g_clear_pointer (&self->visited_urls, ephy_history_url_list_free);
 
   G_OBJECT_CLASS (ephy_history_service_parent_class)->dispose (object);
 }
@@ -177,6 +253,19 @@ ephy_history_service_constructed (GObject *object)
 
   self->statements = g_malloc0_n (EPHY_HISTORY_STATEMENT_LEN, sizeof (EphySQLiteStatement *));
   self->queue = g_async_queue_new ();
+  self->pending_queries = g_hash_table_new (g_str_hash, g_str_equal);
+
+  self->pending_signals = g_hash_table_new (g_str_hash, g_str_equal);
+  self->completion_source = g_source_new (&completion_source_funcs, sizeof (GSource));
+  g_source_set_callback (self->completion_source,
+                         (GSourceFunc)ephy_history_service_dispatch_completions,
+                         self, NULL);
+  g_source_set_priority (self->completion_source, G_PRIORITY_DEFAULT_IDLE);
+  g_source_set_static_name (self->completion_source, "[epiphany] history completions");
+  g_source_attach (self->completion_source, NULL);
+
+  /* The expiry queries need the retained URLs table even if it is empty. */
+  self->retained_urls_changed = TRUE;
 
   /* This value is checked in several functions to verify that they are only
    * ever run on the history thread. Accordingly, we'd better be sure it's set
@@ -202,15 +291,24 @@ ephy_history_service_constructed (GObject *object)
 static gboolean
 emit_urls_visited (EphyHistoryService *self)
 {
-  g_signal_emit (self, signals[URLS_VISITED], 0);
+  GList *urls = g_steal_pointer (&self->visited_urls);
+
   self->queue_urls_visited_id = 0;
 
+  g_signal_emit (self, signals[URLS_VISITED], 0, urls);
+  ephy_history_url_list_free (urls);
+
   return G_SOURCE_REMOVE;
 }
 
+/* Takes ownership of @urls, and emits them with any other URLs visited
+ * until the main loop is idle. */
 static void
-ephy_history_service_queue_urls_visited (EphyHistoryService *self)
+ephy_history_service_queue_urls_visited (EphyHistoryService *self,
+                                         GList              *urls)
 {
+  self->visited_urls = g_list_concat (self->visited_urls, urls);
+
   if (self->queue_urls_visited_id)
     return;
 
@@ -241,12 +339,16 @@ ephy_history_service_class_init (EphyHistoryServiceClass *klass)
 /**
  * EphyHistoryService::urls-visited:
  * @service: the #EphyHistoryService that received the signal
+ * @urls: (nullable) (element-type EphyHistoryURL): the visited URLs as
+ *   stored after each visit, oldest visit first, or %NULL if they are not
+ *   known
  *
  * The ::urls-visited signal is emitted after one or more visits to
- * URLS have taken place. This signal is intended for use-cases when
- * precise information of the actual URLS visited is not important and
- * there is only interest in the fact that there have been changes in
- * the history. For more precise information, you can use ::visit-url
+ * URLS have been written. @urls may contain the same URL more than once,
+ * the last copy being the current one. After an import, a range deletion,
+ * or when the frecency of every URL has decayed, @urls is %NULL and any
+ * part of the history may have changed. For more precise information, you can use
+ * ::visit-url
  **/
   signals[URLS_VISITED] =
     g_signal_new ("urls-visited",
@@ -254,7 +356,8 @@ ephy_history_service_class_init (EphyHistoryServiceClass *klass)
                   G_SIGNAL_RUN_LAST,
                   0, NULL, NULL, NULL,
                   G_TYPE_NONE,
-                  0);
+                  1,
+                  G_TYPE_POINTER | G_SIGNAL_TYPE_STATIC_SCOPE);
 
   signals[CLEARED] =
     g_signal_new ("cleared",
@@ -283,6 +386,23 @@ ephy_history_service_class_init (EphyHistoryServiceClass *klass)
                   1,
                   G_TYPE_POINTER | G_SIGNAL_TYPE_STATIC_SCOPE);
 
+/**
+ * EphyHistoryService::urls-deleted:
+ * @service: the #EphyHistoryService that received the signal
+ * @urls: (element-type EphyHistoryURL): the deleted URLs
+ *
+ * The ::urls-deleted signal is emitted once after a range of history has
+ * been deleted, with all the URLs that were left without visits.
+ **/
+  signals[URLS_DELETED] =
+    g_signal_new ("urls-deleted",
+                  G_OBJECT_CLASS_TYPE (gobject_class),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE,
+                  1,
+                  G_TYPE_POINTER | G_SIGNAL_TYPE_STATIC_SCOPE);
+
   signals[HOST_DELETED] =
     g_signal_new ("host-deleted",
                   G_OBJECT_CLASS_TYPE (gobject_class),
@@ -361,6 +481,18 @@ ephy_history_service_message_free (EphyHistoryServiceMessage *message)
 
   g_clear_object (&message->task);
 
+  /* The pending queries table borrows the key from the message, so it must
+   * not outlive it, e.g. when the message is dropped without being claimed. */
+  if (message->supersede_key) {
+    EphyHistoryService *self = message->service;
+
+    g_mutex_lock (&self->pending_queries_mutex);
+    if (g_hash_table_lookup (self->pending_queries, message->supersede_key) == message)
+      g_hash_table_remove (self->pending_queries, message->supersede_key);
+    g_mutex_unlock (&self->pending_queries_mutex);
+  }
+
+  g_free (message->supersede_key);
   g_free (message);
 }
 
@@ -368,7 +500,60 @@ static void
 ephy_history_service_send_message (EphyHistoryService        *self,
                                    EphyHistoryServiceMessage *message)
 {
+  EphyHistoryServiceMessage *pending;
+  guint queue_depth;
+
+  g_mutex_lock (&self->pending_queries_mutex);
+
+  /* A query that has not started yet is not worth running once a newer one
+   * with the same key has been sent. It stays in the queue, but is skipped
+   * when its turn comes. */
+  if (message->supersede_key) {
+    pending = g_hash_table_lookup (self->pending_queries, message->supersede_key);
+    if (pending) {
+      pending->superseded = TRUE;
+      self->queries_superseded++;
+    }
+
+    /* Replace the key too, since it belongs to the message. */
+    g_hash_table_replace (self->pending_queries, message->supersede_key, message);
+  }
+
   g_async_queue_push_sorted (self->queue, message, (GCompareDataFunc)sort_messages, NULL);
+
+  queue_depth = g_async_queue_length (self->queue);
+  if (queue_depth > self->queue_depth_max) {
+    self->queue_depth_max = queue_depth;
+    LOG ("History queue depth reached %u messages", queue_depth);
+  }
+
+  g_mutex_unlock (&self->pending_queries_mutex);
+}
+
+/* Returns FALSE if a newer query with the same supersede key was sent while
+ * this one was queued, in which case it must not be run. */
+static gboolean
+ephy_history_service_claim_message (EphyHistoryService        *self,
+                                    EphyHistoryServiceMessage *message)
+{
+  gboolean superseded;
+
+  if (!message->supersede_key)
+    return TRUE;
+
+  g_mutex_lock (&self->pending_queries_mutex);
+
+  superseded = message->superseded;
+  if (!superseded)
+    g_hash_table_remove (self->pending_queries, message->supersede_key);
+  else
+    LOG ("Skipping superseded history query (%" G_GUINT64_FORMAT " skipped so far, "
+         "queue depth %d, deepest %u)",
+         self->queries_superseded, g_async_queue_length (self->queue), self->queue_depth_max);
+
+  g_mutex_unlock (&self->pending_queries_mutex);
+
+  return !superseded;
 }
 
 static void
@@ -401,6 +586,8 @@ ephy_history_service_commit_transaction (EphyHistoryService *self)
     g_warning ("Could not commit history database transaction: %s", error->message);
     g_error_free (error);
   }
+
+  self->checkpoint_pending = !self->in_memory;
 }
 
 static gboolean
@@ -428,11 +615,26 @@ ephy_history_service_open_database_connections (EphyHistoryService *self)
     return FALSE;
   } else {
     ephy_sqlite_connection_enable_foreign_keys (self->history_database);
+    if (!self->in_memory)
+      ephy_sqlite_connection_enable_manual_checkpoints (self->history_database, WAL_SIZE_LIMIT);
   }
 
-  return (ephy_history_service_initialize_hosts_table (self) &&
-          ephy_history_service_initialize_urls_table (self) &&
-          ephy_history_service_initialize_visits_table (self));
+  /* Lets expiry give space back to the file system. This only has an effect
+   * before the first table is created, older databases are converted by
+   * ephy_history_service_convert_to_incremental_vacuum(). */
+  ephy_sqlite_connection_execute (self->history_database, "PRAGMA auto_vacuum=INCREMENTAL", NULL);
+
+  if (!ephy_history_service_initialize_hosts_table (self) ||
+      !ephy_history_service_initialize_urls_table (self) ||
+      !ephy_history_service_initialize_visits_table (self) ||
+      !ephy_history_service_initialize_visit_rollups_table (self))
+    return FALSE;
+
+  ephy_history_service_initialize_url_search_index (self);
+  ephy_history_service_initialize_url_frecency (self);
+  ephy_history_service_load_zoom_levels (self);
+
+  return TRUE;
 }
 
 static void
@@ -444,6 +646,118 @@ ephy_history_service_close_database_connections (EphyHistoryService *self)
   g_clear_object (&self->history_database);
 }
 
+/* Queries that only read the database are answered by this many read-only
+ * connections on a thread pool, so that a slow query does not hold up the
+ * others. The database is in WAL mode, so they do not block the writer. */
+#define READER_POOL_SIZE 2
+
+typedef struct {
+  EphySQLiteConnection *database;
+  EphySQLiteStatement **statements;
+} EphyHistoryServiceReader;
+
+/* The reader in use by the current pool thread, while it runs a query. */
+static GPrivate current_reader;
+
+static void
+ephy_history_service_reader_free (EphyHistoryServiceReader *reader)
+{
+  /* Statements must be finalized before the connection can be closed. */
+  for (size_t i = 0; i < EPHY_HISTORY_STATEMENT_LEN; ++i)
+    g_clear_object (&reader->statements[i]);
+  g_free (reader->statements);
+
+  ephy_sqlite_connection_close (reader->database);
+  g_object_unref (reader->database);
+  g_free (reader);
+}
+
+static EphyHistoryServiceReader *
+ephy_history_service_reader_new (EphyHistoryService *self)
+{
+  EphyHistoryServiceReader *reader;
+  EphySQLiteConnection *database;
+  GError *error = NULL;
+
+  database = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READONLY, self->history_filename);
+  if (!ephy_sqlite_connection_open (database, &error)) {
+    g_warning ("Could not open read-only history database connection: %s", error->message);
+    g_error_free (error);
+    g_object_unref (database);
+    return NULL;
+  }
+  g_clear_error (&error);
+
+  reader = g_new0 (EphyHistoryServiceReader, 1);
+  reader->database = database;
+  reader->statements = g_malloc0_n (EPHY_HISTORY_STATEMENT_LEN, sizeof (EphySQLiteStatement *));
+
+  return reader;
+}
+
+static void
+ephy_history_service_start_readers (EphyHistoryService *self)
+{
+  guint n_readers;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (!self->reader_pool);
+
+  /* An in-memory database cannot be shared between connections. */
+  if (self->in_memory || !self->history_database)
+    return;
+
+  self->idle_readers = g_async_queue_new_full ((GDestroyNotify)ephy_history_service_reader_free);
+  for (int i = 0; i < READER_POOL_SIZE; i++) {
+    EphyHistoryServiceReader *reader = ephy_history_service_reader_new (self);
+    if (reader)
+      g_async_queue_push (self->idle_readers, reader);
+  }
+
+  n_readers = g_async_queue_length (self->idle_readers);
+  if (n_readers == 0) {
+    g_clear_pointer (&self->idle_readers, g_async_queue_unref);
+    return;
+  }
+
+  /* There are as many threads as readers, so a thread never waits for one. */
+  self->reader_pool = g_thread_pool_new ((GFunc)ephy_history_service_run_read, self, n_readers, TRUE, NULL);
+  if (!self->reader_pool)
+    g_clear_pointer (&self->idle_readers, g_async_queue_unref);
+}
+
+static void
+ephy_history_service_stop_readers (EphyHistoryService *self)
+{
+  g_assert (self->history_thread == g_thread_self ());
+
+  /* This waits for the queries that have already been dispatched. */
+  if (self->reader_pool) {
+    g_thread_pool_free (self->reader_pool, FALSE, TRUE);
+    self->reader_pool = NULL;
+  }
+
+  g_clear_pointer (&self->idle_readers, g_async_queue_unref);
+}
+
+EphySQLiteConnection *
+ephy_history_service_get_database (EphyHistoryService *self)
+{
+  EphyHistoryServiceReader *reader = g_private_get (&current_reader);
+
+  if (reader)
+    return reader->database;
+
+  g_assert (self->history_thread == g_thread_self ());
+  return self->history_database;
+}
+
+gboolean
+ephy_history_service_is_reader_thread (EphyHistoryService *self)
+{
+  return g_private_get (&current_reader) != NULL;
+}
+
 static gboolean
 ephy_history_service_execute_quit (EphyHistoryService *self,
                                    gpointer            data,
@@ -481,34 +795,247 @@ run_history_service_thread (EphyHistoryService *self)
   if (!success)
     return NULL;
 
+  ephy_history_service_start_readers (self);
+
+  message = NULL;
   do {
-    message = g_async_queue_try_pop (self->queue);
     if (!message) {
-      /* Block the thread until there's data in the queue. */
-      message = g_async_queue_pop (self->queue);
+      gint64 maintenance_delay = ephy_history_service_get_maintenance_delay (self);
+
+      /* Block the thread until there's data in the queue, or until it has
+       * been idle long enough for background maintenance. */
+      if (maintenance_delay < 0) {
+        message = g_async_queue_pop (self->queue);
+      } else {
+        message = g_async_queue_timeout_pop (self->queue, maintenance_delay);
+        if (!message) {
+          ephy_history_service_run_idle_maintenance (self);
+          continue;
+        }
+      }
     }
 
-    /* Process item. */
-    ephy_history_service_process_message (self, message);
+    /* Process item. A write batch hands back the first message it did not
+     * take, which is the next one to process. */
+    if (ephy_history_service_message_is_write (message)) {
+      message = ephy_history_service_process_write_batch (self, message);
+    } else if (self->reader_pool && ephy_history_service_message_can_use_reader (message)) {
+      /* Writes sort first in the queue and a write batch commits before
+       * handing back the next message, so every write queued before this
+       * read is already visible to the readers. */
+      g_thread_pool_push (self->reader_pool, message, NULL);
+      message = NULL;
+    } else {
+      ephy_history_service_process_message (self, message);
+      message = NULL;
+    }
   } while (!self->scheduled_to_quit);
 
+  ephy_history_service_stop_readers (self);
   ephy_history_service_close_database_connections (self);
 
   return NULL;
 }
 
+/* A finished message, or a signal to emit, on its way to the main thread.
+ * The history and reader threads push these onto a lock-free stack; a
+ * single main loop source collects them and dispatches them in time slices,
+ * so bulk operations do not flood the main loop with idle sources. */
+struct _EphyHistoryServiceCompletion {
+  EphyHistoryServiceCompletion *next;
+
+  /* The message whose task to complete, or NULL to emit a signal. */
+  EphyHistoryServiceMessage *message;
+
+  guint signal;
+  char *coalesce_key;
+  gpointer data;
+  GDestroyNotify destroy_func;
+};
+
+static void
+ephy_history_service_completion_free (EphyHistoryServiceCompletion *completion)
+{
+  if (completion->message)
+    ephy_history_service_message_free (completion->message);
+  if (completion->destroy_func && completion->data)
+    completion->destroy_func (completion->data);
+  g_free (completion->coalesce_key);
+  g_free (completion);
+}
+
+static void
+ephy_history_service_push_completion (EphyHistoryService           *self,
+                                      EphyHistoryServiceCompletion *completion)
+{
+  EphyHistoryServiceCompletion *head;
+
+  do {
+    head = g_atomic_pointer_get (&self->completions);
+    completion->next = head;
+  } while (!g_atomic_pointer_compare_and_exchange (&self->completions, head, completion));
+
+  /* Whoever pushed onto the empty stack already woke up the main loop. */
+  if (!head)
+    g_source_set_ready_time (self->completion_source, 0);
+}
+
+/* Queues @signal for emission on the main thread. Signals with the same
+ * @coalesce_key that have not been emitted yet are dropped in favor of the
+ * newest one. */
+static void
+ephy_history_service_queue_signal (EphyHistoryService *self,
+                                   guint               signal,
+                                   const char         *coalesce_key,
+                                   gpointer            data,
+                                   GDestroyNotify      destroy_func)
+{
+  EphyHistoryServiceCompletion *completion = g_new0 (EphyHistoryServiceCompletion, 1);
+
+  completion->signal = signal;
+  if (coalesce_key)
+    completion->coalesce_key = g_strdup_printf ("%u:%s", signal, coalesce_key);
+  completion->data = data;
+  completion->destroy_func = destroy_func;
+
+  ephy_history_service_push_completion (self, completion);
+}
+
+/* Moves everything pushed so far onto the pending queue, in the order it was
+ * pushed, coalescing signals as it goes. */
+static void
+ephy_history_service_collect_completions (EphyHistoryService *self)
+{
+  EphyHistoryServiceCompletion *completion;
+  EphyHistoryServiceCompletion *reversed = NULL;
+
+  completion = g_atomic_pointer_exchange (&self->completions, NULL);
+  while (completion) {
+    EphyHistoryServiceCompletion *next = completion->next;
+
+    completion->next = reversed;
+    reversed = completion;
+    completion = next;
+  }
+
+  for (completion = reversed; completion;) {
+    EphyHistoryServiceCompletion *next = completion->next;
+
+    completion->next = NULL;
+    g_queue_push_tail (&self->pending_completions, completion);
+
+    if (completion->coalesce_key) {
+      GList *superseded = g_hash_table_lookup (self->pending_signals, completion->coalesce_key);
+
+      /* The table does not own its keys, replace the superseded one before
+       * freeing it. */
+      g_hash_table_replace (self->pending_signals, completion->coalesce_key,
+                            g_queue_peek_tail_link (&self->pending_completions));
+      if (superseded) {
+        ephy_history_service_completion_free (superseded->data);
+        g_queue_delete_link (&self->pending_completions, superseded);
+      }
+    }
+
+    completion = next;
+  }
+}
+
 static void
-emit_cleared_signal_cb (EphyHistoryService *self)
+ephy_history_service_emit_signal (EphyHistoryService           *self,
+                                  EphyHistoryServiceCompletion *completion)
+{
+  switch (completion->signal) {
+    case URL_TITLE_CHANGED: {
+      EphyHistoryURL *url = completion->data;
+
+      g_signal_emit (self, signals[URL_TITLE_CHANGED], 0, url->url, url->title);
+      break;
+    }
+    case URL_DELETED:
+      g_signal_emit (self, signals[URL_DELETED], 0, completion->data);
+      break;
+    case URLS_DELETED:
+      g_signal_emit (self, signals[URLS_DELETED], 0, completion->data);
+      break;
+    case HOST_DELETED:
+      g_signal_emit (self, signals[HOST_DELETED], 0, completion->data);
+      break;
+    case CLEARED:
+      g_signal_emit (self, signals[CLEARED], 0);
+      break;
+    case URLS_VISITED:
+      if (completion->data)
+        ephy_history_service_queue_urls_visited (self, g_steal_pointer (&completion->data));
+      else
+        g_signal_emit (self, signals[URLS_VISITED], 0, NULL);
+      break;
+    default:
+      g_assert_not_reached ();
+  }
+}
+
+static gboolean
+ephy_history_service_dispatch_completions (EphyHistoryService *self)
 {
-  g_signal_emit (self, signals[CLEARED], 0);
+  EphyHistoryServiceCompletion *completion;
+  gint64 deadline = g_get_monotonic_time () + COMPLETION_TIME_SLICE;
+
+  g_object_ref (self);
+
+  ephy_history_service_collect_completions (self);
+
+  while ((completion = g_queue_pop_head (&self->pending_completions))) {
+    if (completion->coalesce_key)
+      g_hash_table_remove (self->pending_signals, completion->coalesce_key);
+
+    if (completion->message) {
+      ephy_history_service_complete_task (g_steal_pointer (&completion->message));
+    } else {
+      ephy_history_service_emit_signal (self, completion);
+    }
+    ephy_history_service_completion_free (completion);
+
+    if (g_get_monotonic_time () >= deadline)
+      break;
+  }
+
+  /* Go to sleep unless there is more to do. Anything pushed after the
+   * check wakes the source up again. */
+  g_source_set_ready_time (self->completion_source, -1);
+  if (!g_queue_is_empty (&self->pending_completions) ||
+      g_atomic_pointer_get (&self->completions))
+    g_source_set_ready_time (self->completion_source, 0);
+
   g_object_unref (self);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+completion_source_dispatch (GSource     *source,
+                            GSourceFunc  callback,
+                            gpointer     user_data)
+{
+  return callback (user_data);
 }
 
+static GSourceFuncs completion_source_funcs = {
+  .dispatch = completion_source_dispatch,
+};
+
 static void
-ephy_history_service_complete_task_in_idle_cb (EphyHistoryServiceMessage *message)
+ephy_history_service_complete_task (EphyHistoryServiceMessage *message)
 {
   gboolean is_pointer_method;
 
+  if (message->superseded) {
+    g_task_return_new_error (message->task, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                             "Superseded by a newer query");
+    ephy_history_service_message_free (message);
+    return;
+  }
+
   if (g_task_return_error_if_cancelled (message->task)) {
     ephy_history_service_message_free (message);
     return;
@@ -517,6 +1044,7 @@ ephy_history_service_complete_task_in_idle_cb (EphyHistoryServiceMessage *messag
   is_pointer_method = (message->type == GET_URL ||
                        message->type == GET_HOST_FOR_URL ||
                        message->type == QUERY_URLS ||
+                       message->type == QUERY_URL_TABLE ||
                        message->type == QUERY_VISITS ||
                        message->type == GET_HOSTS ||
                        message->type == QUERY_HOSTS);
@@ -528,35 +1056,6 @@ ephy_history_service_complete_task_in_idle_cb (EphyHistoryServiceMessage *messag
   ephy_history_service_message_free (message);
 }
 
-typedef struct {
-  EphyHistoryService *service;
-  gpointer user_data;
-  GDestroyNotify destroy_func;
-} SignalEmissionContext;
-
-static void
-signal_emission_context_free (SignalEmissionContext *ctx)
-{
-  g_object_unref (ctx->service);
-  if (ctx->destroy_func && ctx->user_data)
-    ctx->destroy_func (ctx->user_data);
-  g_free (ctx);
-}
-
-static SignalEmissionContext *
-signal_emission_context_new (EphyHistoryService *service,
-                             gpointer            user_data,
-                             GDestroyNotify      destroy_func)
-{
-  SignalEmissionContext *ctx = g_new0 (SignalEmissionContext, 1);
-
-  ctx->service = g_object_ref (service);
-  ctx->user_data = user_data;
-  ctx->destroy_func = destroy_func;
-
-  return ctx;
-}
-
 static gboolean
 ephy_history_service_execute_add_visit_helper (EphyHistoryService   *self,
                                                EphyHistoryPageVisit *visit)
@@ -582,6 +1081,7 @@ ephy_history_service_execute_add_visit_helper (EphyHistoryService   *self,
   if (!ephy_history_service_get_url_row (self, visit->url->url, visit->url)) {
     visit->url->last_visit_time = visit->visit_time;
     visit->url->visit_count = 1;
+    visit->url->typed_count = visit->visit_type == EPHY_PAGE_VISIT_TYPED;
 
     if (!visit->url->sync_id)
       visit->url->sync_id = ephy_sync_utils_get_random_sync_id ();
@@ -594,6 +1094,8 @@ ephy_history_service_execute_add_visit_helper (EphyHistoryService   *self,
     }
   } else {
     visit->url->visit_count++;
+    if (visit->visit_type == EPHY_PAGE_VISIT_TYPED)
+      visit->url->typed_count++;
 
     if (visit->visit_time > visit->url->last_visit_time)
       visit->url->last_visit_time = visit->visit_time;
@@ -604,6 +1106,8 @@ ephy_history_service_execute_add_visit_helper (EphyHistoryService   *self,
     ephy_history_service_update_url_row (self, visit->url);
   }
 
+  ephy_history_service_add_url_frecency (self, visit);
+
   if (visit->url->notify_visit)
     g_signal_emit (self, signals[VISIT_URL], 0, visit->url);
 
@@ -620,6 +1124,10 @@ ephy_history_service_execute_add_visit (EphyHistoryService   *self,
   g_assert (self->history_thread == g_thread_self ());
 
   success = ephy_history_service_execute_add_visit_helper (self, visit);
+  if (success)
+    ephy_history_service_queue_signal (self, URLS_VISITED, NULL,
+                                       g_list_prepend (NULL, ephy_history_url_copy (visit->url)),
+                                       (GDestroyNotify)ephy_history_url_list_free);
   return success;
 }
 
@@ -629,16 +1137,187 @@ ephy_history_service_execute_add_visits (EphyHistoryService *self,
                                          gpointer           *result)
 {
   gboolean success = TRUE;
+  GList *visited_urls = NULL;
   g_assert (self->history_thread == g_thread_self ());
 
   while (visits) {
-    success = success && ephy_history_service_execute_add_visit_helper (self, (EphyHistoryPageVisit *)visits->data);
+    EphyHistoryPageVisit *visit = visits->data;
+
+    success = success && ephy_history_service_execute_add_visit_helper (self, visit);
+    if (success)
+      visited_urls = g_list_prepend (visited_urls, ephy_history_url_copy (visit->url));
     visits = visits->next;
   }
 
+  if (visited_urls)
+    ephy_history_service_queue_signal (self, URLS_VISITED, NULL, g_list_reverse (visited_urls),
+                                       (GDestroyNotify)ephy_history_url_list_free);
+
   return success;
 }
 
+typedef struct {
+  EphyHistoryURL *url;
+  EphyHistoryHost *host;
+  gboolean exists;
+  int visit_count;
+  int typed_count;
+  gint64 last_visit_time;
+  int frecency;
+} ImportedURL;
+
+static EphyHistoryHost *
+get_imported_url_host (EphyHistoryService *self,
+                       GHashTable         *hosts,
+                       const char         *url)
+{
+  g_autofree char *hostname = NULL;
+  GList *host_locations;
+  EphyHistoryHost *host;
+
+  host_locations = ephy_history_service_get_host_locations (url, &hostname);
+  host = g_hash_table_lookup (hosts, host_locations->data);
+  if (!host) {
+    host = ephy_history_service_get_host_row_from_url (self, url);
+    g_hash_table_insert (hosts, g_strdup (host_locations->data), host);
+  }
+  g_list_free_full (host_locations, g_free);
+
+  return host;
+}
+
+/* Whether @visit is already in the database or earlier in the chunk, as
+ * happens when the same file is imported twice. */
+static gboolean
+is_duplicate_imported_visit (EphyHistoryService   *self,
+                             GHashTable           *seen_visits,
+                             ImportedURL          *imported,
+                             EphyHistoryPageVisit *visit)
+{
+  char *key = g_strdup_printf ("%" G_GINT64_FORMAT " %s", visit->visit_time, visit->url->url);
+
+  if (!g_hash_table_add (seen_visits, key))
+    return TRUE;
+
+  return imported->exists && ephy_history_service_has_visit_row (self, imported->url->id, visit->visit_time);
+}
+
+/* Adds a chunk of imported visits with one update per URL and host, instead
+ * of the several statements per visit that ADD_VISITS runs. Visits that are
+ * already in the database are skipped. Imported visits do not emit
+ * ::visit-url. */
+static gboolean
+ephy_history_service_execute_import_visits (EphyHistoryService *self,
+                                            GPtrArray          *visits,
+                                            gpointer           *result)
+{
+  g_autoptr (GHashTable) urls = NULL;
+  g_autoptr (GHashTable) hosts = NULL;
+  g_autoptr (GHashTable) seen_visits = NULL;
+  g_autoptr (GPtrArray) new_visits = NULL;
+  GHashTableIter iter;
+  ImportedURL *imported;
+  EphyHistoryHost *host;
+
+  g_assert (self->history_thread == g_thread_self ());
+
+  if (!self->history_database)
+    return FALSE;
+
+  urls = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  hosts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)ephy_history_host_free);
+  seen_visits = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  new_visits = g_ptr_array_sized_new (visits->len);
+
+  for (guint i = 0; i < visits->len; i++) {
+    EphyHistoryPageVisit *visit = g_ptr_array_index (visits, i);
+
+    if (!g_hash_table_contains (urls, visit->url->url)) {
+      imported = g_new0 (ImportedURL, 1);
+      imported->url = visit->url;
+      imported->exists = ephy_history_service_get_url_row (self, NULL, visit->url) != NULL;
+      g_hash_table_insert (urls, g_strdup (visit->url->url), imported);
+    }
+  }
+
+  for (guint i = 0; i < visits->len; i++) {
+    EphyHistoryPageVisit *visit = g_ptr_array_index (visits, i);
+
+    imported = g_hash_table_lookup (urls, visit->url->url);
+    if (is_duplicate_imported_visit (self, seen_visits, imported, visit))
+      continue;
+
+    imported->visit_count++;
+    if (visit->visit_type == EPHY_PAGE_VISIT_TYPED)
+      imported->typed_count++;
+    imported->last_visit_time = MAX (imported->last_visit_time, visit->visit_time);
+    g_ptr_array_add (new_visits, visit);
+  }
+
+  if (new_visits->len == 0)
+    return TRUE;
+
+  g_hash_table_iter_init (&iter, urls);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&imported)) {
+    EphyHistoryURL *url = imported->url;
+
+    if (imported->visit_count == 0)
+      continue;
+
+    imported->host = get_imported_url_host (self, hosts, url->url);
+    imported->host->visit_count += imported->visit_count;
+
+    if (imported->exists) {
+      url->visit_count += imported->visit_count;
+      url->typed_count += imported->typed_count;
+      url->last_visit_time = MAX (url->last_visit_time, imported->last_visit_time);
+      if (!url->sync_id)
+        url->sync_id = ephy_sync_utils_get_random_sync_id ();
+      ephy_history_service_update_url_row (self, url);
+    } else {
+      if (!url->host)
+        url->host = ephy_history_host_copy (imported->host);
+      url->visit_count = imported->visit_count;
+      url->typed_count = imported->typed_count;
+      url->last_visit_time = imported->last_visit_time;
+      if (!url->sync_id)
+        url->sync_id = ephy_sync_utils_get_random_sync_id ();
+      ephy_history_service_add_url_row (self, url);
+
+      if (!self->in_memory && url->id == -1) {
+        g_warning ("Importing visits failed after failed URL addition.");
+        return FALSE;
+      }
+    }
+  }
+
+  g_hash_table_iter_init (&iter, hosts);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&host))
+    ephy_history_service_update_host_row (self, host);
+
+  for (guint i = 0; i < new_visits->len; i++) {
+    EphyHistoryPageVisit *visit = g_ptr_array_index (new_visits, i);
+
+    imported = g_hash_table_lookup (urls, visit->url->url);
+    visit->url->id = imported->url->id;
+    visit->url->typed_count = imported->url->typed_count;
+    imported->frecency += ephy_history_service_get_visit_frecency (visit);
+  }
+
+  g_hash_table_iter_init (&iter, urls);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&imported)) {
+    if (imported->visit_count > 0)
+      ephy_history_service_add_url_frecency_points (self, imported->url->id, imported->frecency);
+  }
+
+  if (!ephy_history_service_add_visit_rows (self, new_visits))
+    return FALSE;
+
+  ephy_history_service_queue_signal (self, URLS_VISITED, NULL, NULL, NULL);
+
+  return TRUE;
+}
+
 static gboolean
 ephy_history_service_execute_find_visits (EphyHistoryService *self,
                                           EphyHistoryQuery   *query,
@@ -694,13 +1373,15 @@ ephy_history_service_get_cached_statement (EphyHistoryService           *self,
                                            EphyHistoryServiceStatement   stmt,
                                            GError                      **error)
 {
+  EphyHistoryServiceReader *reader = g_private_get (&current_reader);
+  EphySQLiteStatement **statements = reader ? reader->statements : self->statements;
   EphySQLiteStatement *statement;
   const char *sql = NULL;
 
   g_assert (stmt < EPHY_HISTORY_STATEMENT_LEN);
 
-  if (self->statements[stmt]) {
-    ephy_sqlite_statement_reset ((statement = self->statements[stmt]));
+  if (statements[stmt]) {
+    ephy_sqlite_statement_reset ((statement = statements[stmt]));
     return statement;
   }
 
@@ -731,11 +1412,11 @@ ephy_history_service_get_cached_statement (EphyHistoryService           *self,
       sql = "DELETE FROM hosts WHERE url=?";
       break;
     case EPHY_HISTORY_STATEMENT_GET_URL_ROW_FOR_ID:
-      sql = "SELECT id, url, title, visit_count, typed_count, last_visit_time, hidden_from_overview, sync_id, pinned FROM urls "
+      sql = "SELECT id, url, title, visit_count, typed_count, last_visit_time, hidden_from_overview, sync_id, pinned, frecency FROM urls "
             "WHERE id=?";
       break;
     case EPHY_HISTORY_STATEMENT_GET_URL_ROW_FOR_URL:
-      sql = "SELECT id, url, title, visit_count, typed_count, last_visit_time, hidden_from_overview, sync_id, pinned FROM urls "
+      sql = "SELECT id, url, title, visit_count, typed_count, last_visit_time, hidden_from_overview, sync_id, pinned, frecency FROM urls "
             "WHERE url=?";
       break;
     case EPHY_HISTORY_STATEMENT_ADD_URL_ROW:
@@ -752,18 +1433,27 @@ ephy_history_service_get_cached_statement (EphyHistoryService           *self,
     case EPHY_HISTORY_STATEMENT_DELETE_URL_FOR_URL:
       sql = "DELETE FROM urls WHERE url=?";
       break;
+    case EPHY_HISTORY_STATEMENT_ADD_URL_FRECENCY:
+      sql = "UPDATE urls SET frecency = frecency + ? WHERE id=?";
+      break;
     case EPHY_HISTORY_STATEMENT_ADD_VISIT_ROW:
       sql = "INSERT INTO visits (url, visit_time, visit_type) "
             " VALUES (?, ?, ?) ";
       break;
+    case EPHY_HISTORY_STATEMENT_HAS_VISIT_ROW:
+      sql = "SELECT 1 FROM visits WHERE url=?1 AND visit_time=?2 "
+            "UNION ALL SELECT 1 FROM visit_rollups WHERE url=?1 AND ?2 BETWEEN first_visit_time AND last_visit_time "
+            "LIMIT 1";
+      break;
     case EPHY_HISTORY_STATEMENT_LEN:
       break;
   }
 
   g_assert (sql);
 
-  self->statements[stmt] = statement =
-    ephy_sqlite_connection_create_statement (self->history_database, sql, EPHY_SQLITE_STATEMENT_LONG_LIVED, error);
+  statements[stmt] = statement =
+    ephy_sqlite_connection_create_statement (ephy_history_service_get_database (self),
+                                             sql, EPHY_SQLITE_STATEMENT_LONG_LIVED, error);
 
   return statement;
 }
@@ -844,9 +1534,61 @@ ephy_history_service_add_visits_finish (EphyHistoryService  *self,
   return GPOINTER_TO_INT (g_task_propagate_pointer (G_TASK (result), error));
 }
 
+/**
+ * ephy_history_service_import_visits:
+ * @self: an #EphyHistoryService
+ * @visits: (element-type EphyHistoryPageVisit): the visits to add
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: (nullable): a callback
+ * @user_data: data for @callback
+ *
+ * Adds a large number of visits, typically imported from another browser,
+ * with far fewer statements than ephy_history_service_add_visits(). Visits
+ * that history already has for the same URL and time are skipped. Feed
+ * large imports in chunks of a few thousand visits. @visits is referenced,
+ * and must not be modified afterwards.
+ */
 void
-ephy_history_service_find_visits_in_time (EphyHistoryService  *self,
-                                          gint64               from,
+ephy_history_service_import_visits (EphyHistoryService  *self,
+                                    GPtrArray           *visits,
+                                    GCancellable        *cancellable,
+                                    GAsyncReadyCallback  callback,
+                                    gpointer             user_data)
+{
+  GTask *task;
+  EphyHistoryServiceMessage *message;
+
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+  g_assert (visits);
+
+  task = callback ? g_task_new (self, cancellable, callback, user_data) : NULL;
+  if (task)
+    g_task_set_source_tag (task, ephy_history_service_import_visits);
+
+  message = ephy_history_service_message_new (self, IMPORT_VISITS,
+                                              g_ptr_array_ref (visits),
+                                              (GDestroyNotify)g_ptr_array_unref,
+                                              NULL,
+                                              task);
+  if (task)
+    g_object_unref (task);
+  ephy_history_service_send_message (self, message);
+}
+
+gboolean
+ephy_history_service_import_visits_finish (EphyHistoryService  *self,
+                                           GAsyncResult        *result,
+                                           GError             **error)
+{
+  g_return_val_if_fail (EPHY_IS_HISTORY_SERVICE (self), FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+
+  return GPOINTER_TO_INT (g_task_propagate_pointer (G_TASK (result), error));
+}
+
+void
+ephy_history_service_find_visits_in_time (EphyHistoryService  *self,
+                                          gint64               from,
                                           gint64               to,
                                           GCancellable        *cancellable,
                                           GAsyncReadyCallback  callback,
@@ -894,6 +1636,7 @@ ephy_history_service_query_visits (EphyHistoryService  *self,
                                               (GDestroyNotify)ephy_history_query_free,
                                               (GDestroyNotify)ephy_history_page_visit_list_free,
                                               task);
+  message->supersede_key = g_strdup (query->supersede_key);
   if (task)
     g_object_unref (task);
   ephy_history_service_send_message (self, message);
@@ -944,6 +1687,7 @@ ephy_history_service_query_urls (EphyHistoryService  *self,
                                               (GDestroyNotify)ephy_history_query_free,
                                               (GDestroyNotify)ephy_history_url_list_free,
                                               task);
+  message->supersede_key = g_strdup (query->supersede_key);
   if (task)
     g_object_unref (task);
   ephy_history_service_send_message (self, message);
@@ -960,6 +1704,72 @@ ephy_history_service_query_urls_finish (EphyHistoryService  *self,
   return g_task_propagate_pointer (G_TASK (result), error);
 }
 
+static gboolean
+ephy_history_service_execute_query_url_table (EphyHistoryService *self,
+                                              EphyHistoryQuery   *query,
+                                              gpointer           *result)
+{
+  *result = ephy_history_service_find_url_table (self, query);
+
+  return *result != NULL;
+}
+
+/**
+ * ephy_history_service_query_url_table:
+ * @self: an #EphyHistoryService
+ * @query: the query
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a callback
+ * @user_data: data for @callback
+ *
+ * Like ephy_history_service_query_urls(), but the result is a single
+ * #EphyHistoryURLTable, which is cheaper to build, keep and share than a
+ * list of #EphyHistoryURL. The URLs have no sync ID or host.
+ */
+void
+ephy_history_service_query_url_table (EphyHistoryService  *self,
+                                      EphyHistoryQuery    *query,
+                                      GCancellable        *cancellable,
+                                      GAsyncReadyCallback  callback,
+                                      gpointer             user_data)
+{
+  GTask *task;
+  EphyHistoryServiceMessage *message;
+
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+  g_assert (query);
+
+  task = callback ? g_task_new (self, cancellable, callback, user_data) : NULL;
+  if (task)
+    g_task_set_source_tag (task, ephy_history_service_query_url_table);
+
+  message = ephy_history_service_message_new (self, QUERY_URL_TABLE,
+                                              ephy_history_query_copy (query),
+                                              (GDestroyNotify)ephy_history_query_free,
+                                              (GDestroyNotify)ephy_history_url_table_unref,
+                                              task);
+  message->supersede_key = g_strdup (query->supersede_key);
+  if (task)
+    g_object_unref (task);
+  ephy_history_service_send_message (self, message);
+}
+
+/**
+ * ephy_history_service_query_url_table_finish:
+ *
+ * Returns: (transfer full): the URLs, or %NULL on error
+ */
+EphyHistoryURLTable *
+ephy_history_service_query_url_table_finish (EphyHistoryService  *self,
+                                             GAsyncResult        *result,
+                                             GError             **error)
+{
+  g_return_val_if_fail (EPHY_IS_HISTORY_SERVICE (self), NULL);
+  g_return_val_if_fail (g_task_is_valid (result, self), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
 void
 ephy_history_service_get_hosts (EphyHistoryService  *self,
                                 GCancellable        *cancellable,
@@ -1016,6 +1826,7 @@ ephy_history_service_query_hosts (EphyHistoryService  *self,
                                               (GDestroyNotify)ephy_history_query_free,
                                               (GDestroyNotify)ephy_history_host_list_free,
                                               task);
+  message->supersede_key = g_strdup (query->supersede_key);
   if (task)
     g_object_unref (task);
   ephy_history_service_send_message (self, message);
@@ -1032,16 +1843,6 @@ ephy_history_service_query_hosts_finish (EphyHistoryService  *self,
   return g_task_propagate_pointer (G_TASK (result), error);
 }
 
-static gboolean
-set_url_title_signal_emit (SignalEmissionContext *ctx)
-{
-  EphyHistoryURL *url = (EphyHistoryURL *)ctx->user_data;
-
-  g_signal_emit (ctx->service, signals[URL_TITLE_CHANGED], 0, url->url, url->title);
-
-  return G_SOURCE_REMOVE;
-}
-
 static gboolean
 ephy_history_service_execute_set_url_title (EphyHistoryService *self,
                                             EphyHistoryURL     *url,
@@ -1054,18 +1855,13 @@ ephy_history_service_execute_set_url_title (EphyHistoryService *self,
     g_free (title);
     return FALSE;
   } else {
-    SignalEmissionContext *ctx;
-
     g_free (url->title);
     url->title = title;
     ephy_history_service_update_url_row (self, url);
 
-    ctx = signal_emission_context_new (self,
+    ephy_history_service_queue_signal (self, URL_TITLE_CHANGED, url->url,
                                        ephy_history_url_copy (url),
                                        (GDestroyNotify)ephy_history_url_free);
-    g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
-                     (GSourceFunc)set_url_title_signal_emit,
-                     ctx, (GDestroyNotify)signal_emission_context_free);
     return TRUE;
   }
 }
@@ -1111,6 +1907,86 @@ ephy_history_service_set_url_title_finish (EphyHistoryService  *self,
   return GPOINTER_TO_INT (g_task_propagate_pointer (G_TASK (result), error));
 }
 
+/* Finds the cached zoom level of the host row that
+ * ephy_history_service_get_host_row_from_url() would find for @url. Call with
+ * zoom_levels_mutex held. */
+static double *
+lookup_cached_url_zoom_level (EphyHistoryService *self,
+                              GList              *host_locations)
+{
+  double *zoom_level = NULL;
+
+  if (!self->zoom_levels)
+    return NULL;
+
+  for (GList *l = host_locations; l && !zoom_level; l = l->next)
+    zoom_level = g_hash_table_lookup (self->zoom_levels, l->data);
+
+  return zoom_level;
+}
+
+static void
+update_cached_url_zoom_level (EphyHistoryService *self,
+                              const char         *url,
+                              double              zoom_level)
+{
+  g_autofree char *hostname = NULL;
+  GList *host_locations;
+  double *cached;
+
+  host_locations = ephy_history_service_get_host_locations (url, &hostname);
+
+  g_mutex_lock (&self->zoom_levels_mutex);
+  cached = lookup_cached_url_zoom_level (self, host_locations);
+  if (cached) {
+    *cached = zoom_level;
+  } else if (self->zoom_levels) {
+    /* The history thread is going to add a row for the first location. */
+    double *value = g_new (double, 1);
+
+    *value = zoom_level;
+    g_hash_table_replace (self->zoom_levels, g_strdup (host_locations->data), value);
+  }
+  g_mutex_unlock (&self->zoom_levels_mutex);
+
+  g_list_free_full (host_locations, g_free);
+}
+
+/**
+ * ephy_history_service_get_url_zoom_level:
+ * @self: an #EphyHistoryService
+ * @url: a URL
+ *
+ * Looks up the zoom level stored for the host of @url, without waiting for
+ * the history thread.
+ *
+ * Returns: the zoom level, or 0.0 if the default zoom level is used
+ */
+double
+ephy_history_service_get_url_zoom_level (EphyHistoryService *self,
+                                         const char         *url)
+{
+  g_autofree char *hostname = NULL;
+  GList *host_locations;
+  double *cached;
+  double zoom_level = 0.0;
+
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+  g_assert (url);
+
+  host_locations = ephy_history_service_get_host_locations (url, &hostname);
+
+  g_mutex_lock (&self->zoom_levels_mutex);
+  cached = lookup_cached_url_zoom_level (self, host_locations);
+  if (cached)
+    zoom_level = *cached;
+  g_mutex_unlock (&self->zoom_levels_mutex);
+
+  g_list_free_full (host_locations, g_free);
+
+  return zoom_level;
+}
+
 static gboolean
 ephy_history_service_execute_set_url_zoom_level (EphyHistoryService *self,
                                                  GVariant           *variant,
@@ -1156,6 +2032,10 @@ ephy_history_service_set_url_zoom_level (EphyHistoryService  *self,
   if (zoom_level == g_settings_get_double (EPHY_SETTINGS_WEB, EPHY_PREFS_WEB_DEFAULT_ZOOM_LEVEL))
     zoom_level = 0.0f;
 
+  /* Restoring the zoom level must not wait until the history thread gets to
+   * this message. */
+  update_cached_url_zoom_level (self, url, zoom_level);
+
   variant = g_variant_new ("(sd)", url, zoom_level);
 
   message = ephy_history_service_message_new (self, SET_URL_ZOOM_LEVEL,
@@ -1398,16 +2278,6 @@ ephy_history_service_get_host_for_url_finish (EphyHistoryService  *self,
   return g_task_propagate_pointer (G_TASK (result), error);
 }
 
-static gboolean
-delete_urls_signal_emit (SignalEmissionContext *ctx)
-{
-  EphyHistoryURL *url = (EphyHistoryURL *)ctx->user_data;
-
-  g_signal_emit (ctx->service, signals[URL_DELETED], 0, url);
-
-  return G_SOURCE_REMOVE;
-}
-
 static gboolean
 ephy_history_service_execute_delete_urls (EphyHistoryService *self,
                                           GList              *urls,
@@ -1415,20 +2285,15 @@ ephy_history_service_execute_delete_urls (EphyHistoryService *self,
 {
   GList *l;
   EphyHistoryURL *url;
-  SignalEmissionContext *ctx;
 
   for (l = urls; l; l = l->next) {
     url = l->data;
     ephy_history_service_delete_url (self, url);
 
-    if (url->notify_delete) {
-      ctx = signal_emission_context_new (self, ephy_history_url_copy (url),
+    if (url->notify_delete)
+      ephy_history_service_queue_signal (self, URL_DELETED, url->url,
+                                         ephy_history_url_copy (url),
                                          (GDestroyNotify)ephy_history_url_free);
-      g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
-                       (GSourceFunc)delete_urls_signal_emit,
-                       ctx,
-                       (GDestroyNotify)signal_emission_context_free);
-    }
   }
 
   ephy_history_service_delete_orphan_hosts (self);
@@ -1437,13 +2302,32 @@ ephy_history_service_execute_delete_urls (EphyHistoryService *self,
 }
 
 static gboolean
-delete_host_signal_emit (SignalEmissionContext *ctx)
+ephy_history_service_execute_delete_visits_in_range (EphyHistoryService *self,
+                                                     EphyHistoryQuery   *query,
+                                                     gpointer           *result)
 {
-  char *host = (char *)ctx->user_data;
+  GList *deleted_urls;
+  int deleted_visits;
 
-  g_signal_emit (ctx->service, signals[HOST_DELETED], 0, host);
+  if (!self->history_database)
+    return FALSE;
 
-  return G_SOURCE_REMOVE;
+  deleted_visits = ephy_history_service_delete_visit_rows_in_range (self, query->from, query->to);
+  deleted_urls = ephy_history_service_delete_unvisited_url_rows (self);
+
+  LOG ("Deleted %d history visits and %u URLs", deleted_visits, g_list_length (deleted_urls));
+
+  if (deleted_urls) {
+    ephy_history_service_delete_orphan_hosts (self);
+    ephy_history_service_queue_signal (self, URLS_DELETED, NULL, deleted_urls,
+                                       (GDestroyNotify)ephy_history_url_list_free);
+  }
+
+  /* The URLs that are left have been rescored. */
+  if (deleted_visits > 0)
+    ephy_history_service_queue_signal (self, URLS_VISITED, NULL, NULL, NULL);
+
+  return TRUE;
 }
 
 static gboolean
@@ -1451,141 +2335,589 @@ ephy_history_service_execute_delete_host (EphyHistoryService *self,
                                           EphyHistoryHost    *host,
                                           gpointer           *result)
 {
-  SignalEmissionContext *ctx;
-
   ephy_history_service_delete_host_row (self, host);
 
-  ctx = signal_emission_context_new (self, g_strdup (host->url),
-                                     (GDestroyNotify)g_free);
-  g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
-                   (GSourceFunc)delete_host_signal_emit,
-                   ctx,
-                   (GDestroyNotify)signal_emission_context_free);
+  ephy_history_service_queue_signal (self, HOST_DELETED, host->url,
+                                     g_strdup (host->url), g_free);
 
   return TRUE;
 }
 
-static gboolean
-ephy_history_service_execute_clear (EphyHistoryService *self,
-                                    gpointer            pointer,
-                                    gpointer           *result)
+static void
+ephy_history_service_update_retained_urls (EphyHistoryService *self,
+                                           char              **urls)
 {
-  if (!self->history_database)
-    return FALSE;
+  EphySQLiteStatement *statement;
+  GError *error = NULL;
 
-  ephy_history_service_commit_transaction (self);
-  ephy_sqlite_connection_close (self->history_database);
-  ephy_sqlite_connection_delete_database (self->history_database);
+  ephy_sqlite_connection_execute (self->history_database,
+                                  "CREATE TEMP TABLE IF NOT EXISTS retained_urls (url TEXT PRIMARY KEY);"
+                                  "DELETE FROM temp.retained_urls",
+                                  &error);
+  if (error) {
+    g_warning ("Could not update retained history URLs: %s", error->message);
+    g_error_free (error);
+    return;
+  }
 
-  ephy_history_service_open_database_connections (self);
-  ephy_history_service_open_transaction (self);
+  if (!urls)
+    return;
+
+  statement = ephy_sqlite_connection_create_statement (self->history_database,
+                                                       "INSERT OR IGNORE INTO temp.retained_urls (url) VALUES (?)",
+                                                       EPHY_SQLITE_STATEMENT_SHORT_LIVED, &error);
+  if (error) {
+    g_warning ("Could not update retained history URLs: %s", error->message);
+    g_error_free (error);
+    return;
+  }
 
-  g_idle_add_once ((GSourceOnceFunc)emit_cleared_signal_cb, g_object_ref (self));
+  for (guint i = 0; urls[i]; i++) {
+    ephy_sqlite_statement_reset (statement);
+    if (ephy_sqlite_statement_bind_string (statement, 0, urls[i], &error))
+      ephy_sqlite_statement_step (statement, &error);
 
-  return TRUE;
+    if (error) {
+      g_warning ("Could not update retained history URLs: %s", error->message);
+      g_clear_error (&error);
+    }
+  }
+
+  g_object_unref (statement);
 }
 
-void
-ephy_history_service_delete_urls (EphyHistoryService  *self,
-                                  GList               *urls,
-                                  GCancellable        *cancellable,
-                                  GAsyncReadyCallback  callback,
-                                  gpointer             user_data)
+/* Deletes one batch of expired visits and the URLs and hosts they leave
+ * behind. Returns TRUE once there is nothing left to expire. */
+static gboolean
+ephy_history_service_expire_batch (EphyHistoryService *self)
 {
-  EphyHistoryServiceMessage *message;
-  GTask *task;
+  g_auto (GStrv) retained_urls = NULL;
+  gboolean update_retained_urls;
+  int max_age_days;
+  int max_visits;
+  int requested = 0;
+  int expired = 0;
+  GList *orphans;
+  guint n_orphans;
 
-  g_assert (EPHY_IS_HISTORY_SERVICE (self));
-  g_assert (urls);
+  g_assert (self->history_thread == g_thread_self ());
 
-  task = callback ? g_task_new (self, cancellable, callback, user_data) : NULL;
-  if (task)
-    g_task_set_source_tag (task, ephy_history_service_delete_urls);
+  if (!self->history_database)
+    return TRUE;
 
-  message = ephy_history_service_message_new (self, DELETE_URLS,
-                                              ephy_history_url_list_copy (urls), (GDestroyNotify)ephy_history_url_list_free,
-                                              NULL, task);
-  if (task)
-    g_object_unref (task);
-  ephy_history_service_send_message (self, message);
-}
+  g_mutex_lock (&self->retention_mutex);
+  max_age_days = self->max_visit_age_days;
+  max_visits = self->max_visit_count;
+  update_retained_urls = self->retained_urls_changed;
+  if (update_retained_urls)
+    retained_urls = g_strdupv (self->retained_urls);
+  self->retained_urls_changed = FALSE;
+  g_mutex_unlock (&self->retention_mutex);
+
+  if (update_retained_urls)
+    ephy_history_service_update_retained_urls (self, retained_urls);
+
+  if (max_age_days > 0) {
+    requested = EXPIRY_BATCH_SIZE;
+    expired = ephy_history_service_expire_visit_rows (self,
+                                                      g_get_real_time () - max_age_days * G_TIME_SPAN_DAY,
+                                                      requested);
+  }
 
-gboolean
-ephy_history_service_delete_urls_finish (EphyHistoryService  *self,
-                                         GAsyncResult        *result,
-                                         GError             **error)
-{
-  g_return_val_if_fail (EPHY_IS_HISTORY_SERVICE (self), FALSE);
-  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+  if (max_visits > 0 && expired < EXPIRY_BATCH_SIZE) {
+    int excess = ephy_history_service_count_visit_rows (self) - max_visits;
 
-  return GPOINTER_TO_INT (g_task_propagate_pointer (G_TASK (result), error));
-}
+    if (excess > 0) {
+      int limit = MIN (excess, EXPIRY_BATCH_SIZE - expired);
 
-void
-ephy_history_service_delete_host (EphyHistoryService  *self,
-                                  EphyHistoryHost     *host,
-                                  GCancellable        *cancellable,
-                                  GAsyncReadyCallback  callback,
-                                  gpointer             user_data)
-{
-  GTask *task;
-  EphyHistoryServiceMessage *message;
+      requested = expired + limit;
+      expired += ephy_history_service_expire_visit_rows (self, G_MAXINT64, limit);
+    }
+  }
 
-  task = callback ? g_task_new (self, cancellable, callback, user_data) : NULL;
-  if (task)
-    g_task_set_source_tag (task, ephy_history_service_delete_host);
+  orphans = ephy_history_service_find_orphan_url_rows (self, EXPIRY_BATCH_SIZE);
+  n_orphans = g_list_length (orphans);
+  for (GList *l = orphans; l; l = l->next) {
+    EphyHistoryURL *url = l->data;
 
-  message = ephy_history_service_message_new (self, DELETE_HOST,
-                                              ephy_history_host_copy (host), (GDestroyNotify)ephy_history_host_free,
-                                              NULL, task);
-  if (task)
-    g_object_unref (task);
-  ephy_history_service_send_message (self, message);
+    ephy_history_service_delete_url (self, url);
+
+    ephy_history_service_queue_signal (self, URL_DELETED, url->url,
+                                       url, (GDestroyNotify)ephy_history_url_free);
+  }
+  g_list_free (orphans);
+
+  if (n_orphans > 0)
+    ephy_history_service_delete_orphan_hosts (self);
+
+  LOG ("Expired %d history visits and %u URLs", expired, n_orphans);
+
+  /* A batch that came back full means there may be more to expire. */
+  if (expired > 0 && expired == requested)
+    return FALSE;
+
+  return n_orphans < EXPIRY_BATCH_SIZE;
 }
 
-gboolean
-ephy_history_service_delete_host_finish (EphyHistoryService  *self,
-                                         GAsyncResult        *result,
-                                         GError             **error)
+static void
+ephy_history_service_vacuum (EphyHistoryService *self)
 {
-  g_return_val_if_fail (EPHY_IS_HISTORY_SERVICE (self), FALSE);
-  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+  GError *error = NULL;
 
-  return GPOINTER_TO_INT (g_task_propagate_pointer (G_TASK (result), error));
+  ephy_sqlite_connection_execute (self->history_database, "PRAGMA incremental_vacuum", &error);
+  if (error) {
+    g_warning ("Could not vacuum history database: %s", error->message);
+    g_error_free (error);
+  }
 }
 
-void
-ephy_history_service_clear (EphyHistoryService  *self,
-                            GCancellable        *cancellable,
-                            GAsyncReadyCallback  callback,
-                            gpointer             user_data)
+static gint64
+ephy_history_service_get_pragma (EphyHistoryService *self,
+                                 const char         *pragma)
 {
-  EphyHistoryServiceMessage *message;
-  GTask *task;
+  g_autofree char *sql = g_strdup_printf ("PRAGMA %s", pragma);
+  EphySQLiteStatement *statement;
+  GError *error = NULL;
+  gint64 value = -1;
 
-  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+  statement = ephy_sqlite_connection_create_statement (self->history_database, sql,
+                                                       EPHY_SQLITE_STATEMENT_SHORT_LIVED, &error);
+  if (statement && ephy_sqlite_statement_step (statement, &error))
+    value = ephy_sqlite_statement_get_column_as_int64 (statement, 0);
 
-  task = callback ? g_task_new (self, cancellable, callback, user_data) : NULL;
-  if (task)
-    g_task_set_source_tag (task, ephy_history_service_clear);
+  if (error) {
+    g_warning ("Could not query history database %s: %s", pragma, error->message);
+    g_error_free (error);
+  }
 
-  message = ephy_history_service_message_new (self, CLEAR,
-                                              NULL, NULL, NULL,
-                                              task);
-  if (task)
-    g_object_unref (task);
-  ephy_history_service_send_message (self, message);
+  g_clear_object (&statement);
+  return value;
 }
 
-gboolean
-ephy_history_service_clear_finish (EphyHistoryService  *self,
-                                   GAsyncResult        *result,
-                                   GError             **error)
+/* Converts a database without auto-vacuum to incremental auto-vacuum, once
+ * enough of it is free to be worth rewriting. Must be called outside of a
+ * transaction. The readers keep answering queries from the WAL meanwhile. */
+static void
+ephy_history_service_convert_to_incremental_vacuum (EphyHistoryService *self)
 {
-  g_return_val_if_fail (EPHY_IS_HISTORY_SERVICE (self), FALSE);
-  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+  gint64 page_count;
+  gint64 freelist_count;
+  GError *error = NULL;
 
-  return GPOINTER_TO_INT (g_task_propagate_pointer (G_TASK (result), error));
+  g_assert (self->history_thread == g_thread_self ());
+
+  if (self->in_memory || ephy_history_service_get_pragma (self, "auto_vacuum") != 0)
+    return;
+
+  page_count = ephy_history_service_get_pragma (self, "page_count");
+  freelist_count = ephy_history_service_get_pragma (self, "freelist_count");
+  if (page_count <= 0 || freelist_count * 100 < page_count * FULL_VACUUM_MIN_FREE_PERCENT)
+    return;
+
+  LOG ("Converting history database to incremental vacuum, %" G_GINT64_FORMAT " of %" G_GINT64_FORMAT " pages are free",
+       freelist_count, page_count);
+
+  /* The auto_vacuum setting of the connection is applied by VACUUM. */
+  ephy_sqlite_connection_execute (self->history_database,
+                                  "PRAGMA auto_vacuum=INCREMENTAL;"
+                                  "VACUUM",
+                                  &error);
+  if (error) {
+    g_warning ("Could not convert history database to incremental vacuum: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  self->checkpoint_pending = TRUE;
+}
+
+static gboolean
+ephy_history_service_execute_expire (EphyHistoryService *self,
+                                     gpointer            data,
+                                     gpointer           *result)
+{
+  if (!self->history_database)
+    return FALSE;
+
+  while (!ephy_history_service_expire_batch (self))
+    continue;
+
+  ephy_history_service_vacuum (self);
+
+  return TRUE;
+}
+
+static void
+ephy_history_service_run_visit_rollup (EphyHistoryService *self)
+{
+  int rolled_up;
+
+  g_assert (self->history_thread == g_thread_self ());
+
+  rolled_up = ephy_history_service_roll_up_visit_rows (self, g_get_real_time () - VISIT_ROLLUP_AGE);
+
+  LOG ("Rolled up %d history visits", rolled_up);
+}
+
+static gboolean
+ephy_history_service_execute_roll_up_visits (EphyHistoryService *self,
+                                             gpointer            data,
+                                             gpointer           *result)
+{
+  if (!self->history_database)
+    return FALSE;
+
+  ephy_history_service_run_visit_rollup (self);
+
+  return TRUE;
+}
+
+static gboolean
+ephy_history_service_retention_policy_is_set (EphyHistoryService *self)
+{
+  return self->max_visit_age_days > 0 || self->max_visit_count > 0;
+}
+
+/* Returns how long the history thread should wait for messages before
+ * running the maintenance jobs, or -1 if there is nothing to do. */
+static gint64
+ephy_history_service_get_maintenance_delay (EphyHistoryService *self)
+{
+  gint64 delay = -1;
+
+  g_mutex_lock (&self->retention_mutex);
+  if (self->expiry_pending)
+    delay = MAX (IDLE_MAINTENANCE_DELAY, self->next_expiry_time - g_get_monotonic_time ());
+  g_mutex_unlock (&self->retention_mutex);
+
+  if (self->history_database) {
+    gint64 decay_delay = MAX (IDLE_MAINTENANCE_DELAY, self->next_frecency_decay_time - g_get_real_time ());
+    gint64 rollup_delay = MAX (IDLE_MAINTENANCE_DELAY, self->next_visit_rollup_time - g_get_monotonic_time ());
+
+    if (delay < 0 || decay_delay < delay)
+      delay = decay_delay;
+    if (rollup_delay < delay)
+      delay = rollup_delay;
+    if (self->url_search_index_backfill_pending)
+      delay = 0;
+    if (self->checkpoint_pending && IDLE_CHECKPOINT_DELAY < delay)
+      delay = IDLE_CHECKPOINT_DELAY;
+  }
+
+  return delay;
+}
+
+static void
+ephy_history_service_schedule_expiry (EphyHistoryService *self)
+{
+  g_mutex_lock (&self->retention_mutex);
+  if (ephy_history_service_retention_policy_is_set (self))
+    self->expiry_pending = TRUE;
+  g_mutex_unlock (&self->retention_mutex);
+}
+
+static void
+ephy_history_service_run_idle_expiry (EphyHistoryService *self)
+{
+  gboolean done;
+
+  g_assert (self->history_thread == g_thread_self ());
+
+  /* Cleared first so that a policy change made while the batch runs is not
+   * lost. */
+  g_mutex_lock (&self->retention_mutex);
+  self->expiry_pending = FALSE;
+  g_mutex_unlock (&self->retention_mutex);
+
+  ephy_history_service_open_transaction (self);
+  done = ephy_history_service_expire_batch (self);
+  ephy_history_service_commit_transaction (self);
+
+  g_mutex_lock (&self->retention_mutex);
+  if (!done)
+    self->expiry_pending = TRUE;
+  else
+    self->next_expiry_time = g_get_monotonic_time () + EXPIRY_INTERVAL;
+  g_mutex_unlock (&self->retention_mutex);
+
+  if (done && self->history_database) {
+    ephy_history_service_vacuum (self);
+    ephy_history_service_convert_to_incremental_vacuum (self);
+  }
+}
+
+static void
+ephy_history_service_checkpoint (EphyHistoryService *self)
+{
+  GError *error = NULL;
+  gint64 wal_size;
+  gint64 duration;
+  guint64 count;
+
+  g_assert (self->history_thread == g_thread_self ());
+
+  self->checkpoint_pending = FALSE;
+
+  wal_size = ephy_sqlite_connection_get_wal_size (self->history_database);
+  ephy_sqlite_connection_checkpoint (self->history_database, EPHY_SQLITE_CHECKPOINT_PASSIVE, &error);
+  if (error) {
+    g_warning ("Could not checkpoint history database: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  ephy_sqlite_connection_get_checkpoint_stats (self->history_database, &count, &duration, NULL);
+  LOG ("Checkpointed %" G_GINT64_FORMAT " KiB of history WAL in %.3f ms (%" G_GUINT64_FORMAT " checkpoints)",
+       wal_size / 1024, duration / 1000.0, count);
+}
+
+static void
+ephy_history_service_run_url_search_index_backfill (EphyHistoryService *self)
+{
+  gboolean done;
+
+  g_assert (self->history_thread == g_thread_self ());
+
+  ephy_history_service_open_transaction (self);
+  done = ephy_history_service_backfill_url_search_index (self, URL_SEARCH_INDEX_BATCH_SIZE);
+  ephy_history_service_commit_transaction (self);
+
+  if (!done)
+    return;
+
+  /* The readers decide whether to use the index while they build their
+   * queries, so it is only switched on while none of them is running. */
+  ephy_history_service_stop_readers (self);
+  self->url_search_index_backfill_pending = FALSE;
+  self->url_search_index_available = TRUE;
+  ephy_history_service_start_readers (self);
+
+  LOG ("Finished indexing history URLs for search");
+}
+
+static void
+ephy_history_service_run_idle_maintenance (EphyHistoryService *self)
+{
+  gboolean expiry_due;
+
+  g_assert (self->history_thread == g_thread_self ());
+
+  g_mutex_lock (&self->retention_mutex);
+  expiry_due = self->expiry_pending && self->next_expiry_time <= g_get_monotonic_time ();
+  g_mutex_unlock (&self->retention_mutex);
+
+  if (self->history_database && self->url_search_index_backfill_pending)
+    ephy_history_service_run_url_search_index_backfill (self);
+
+  if (expiry_due)
+    ephy_history_service_run_idle_expiry (self);
+
+  if (self->history_database && self->next_frecency_decay_time <= g_get_real_time ()) {
+    ephy_history_service_open_transaction (self);
+    ephy_history_service_decay_url_frecency (self);
+    ephy_history_service_commit_transaction (self);
+
+    /* Rankings kept from earlier frecencies are outdated now. */
+    ephy_history_service_queue_signal (self, URLS_VISITED, NULL, NULL, NULL);
+  }
+
+  if (self->history_database && self->next_visit_rollup_time <= g_get_monotonic_time ()) {
+    ephy_history_service_open_transaction (self);
+    ephy_history_service_run_visit_rollup (self);
+    ephy_history_service_commit_transaction (self);
+    self->next_visit_rollup_time = g_get_monotonic_time () + VISIT_ROLLUP_INTERVAL;
+  }
+
+  /* Last, so that it also covers whatever the jobs above wrote. */
+  if (self->history_database && self->checkpoint_pending)
+    ephy_history_service_checkpoint (self);
+}
+
+static gboolean
+ephy_history_service_execute_clear (EphyHistoryService *self,
+                                    gpointer            pointer,
+                                    gpointer           *result)
+{
+  if (!self->history_database)
+    return FALSE;
+
+  ephy_history_service_commit_transaction (self);
+  ephy_history_service_stop_readers (self);
+  ephy_sqlite_connection_close (self->history_database);
+  ephy_sqlite_connection_delete_database (self->history_database);
+
+  ephy_history_service_open_database_connections (self);
+  ephy_history_service_start_readers (self);
+  ephy_history_service_open_transaction (self);
+
+  /* The retained URLs were stored in a temporary table of the old
+   * connection. */
+  g_mutex_lock (&self->retention_mutex);
+  self->retained_urls_changed = TRUE;
+  g_mutex_unlock (&self->retention_mutex);
+
+  ephy_history_service_queue_signal (self, CLEARED, NULL, NULL, NULL);
+
+  return TRUE;
+}
+
+void
+ephy_history_service_delete_urls (EphyHistoryService  *self,
+                                  GList               *urls,
+                                  GCancellable        *cancellable,
+                                  GAsyncReadyCallback  callback,
+                                  gpointer             user_data)
+{
+  EphyHistoryServiceMessage *message;
+  GTask *task;
+
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+  g_assert (urls);
+
+  task = callback ? g_task_new (self, cancellable, callback, user_data) : NULL;
+  if (task)
+    g_task_set_source_tag (task, ephy_history_service_delete_urls);
+
+  message = ephy_history_service_message_new (self, DELETE_URLS,
+                                              ephy_history_url_list_copy (urls), (GDestroyNotify)ephy_history_url_list_free,
+                                              NULL, task);
+  if (task)
+    g_object_unref (task);
+  ephy_history_service_send_message (self, message);
+}
+
+gboolean
+ephy_history_service_delete_urls_finish (EphyHistoryService  *self,
+                                         GAsyncResult        *result,
+                                         GError             **error)
+{
+  g_return_val_if_fail (EPHY_IS_HISTORY_SERVICE (self), FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+
+  return GPOINTER_TO_INT (g_task_propagate_pointer (G_TASK (result), error));
+}
+
+/**
+ * ephy_history_service_delete_visits_in_range:
+ * @self: an #EphyHistoryService
+ * @from: the start of the range, in microseconds since the epoch
+ * @to: the end of the range, inclusive
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: (nullable): a callback
+ * @user_data: data for @callback
+ *
+ * Deletes all the visits between @from and @to, and the URLs that are left
+ * without visits, except pinned ones. Rolled-up visits are deleted a day at
+ * a time, and only for the days whose visits all lie in the range. Emits
+ * ::urls-deleted once with the deleted URLs.
+ */
+void
+ephy_history_service_delete_visits_in_range (EphyHistoryService  *self,
+                                             gint64               from,
+                                             gint64               to,
+                                             GCancellable        *cancellable,
+                                             GAsyncReadyCallback  callback,
+                                             gpointer             user_data)
+{
+  EphyHistoryServiceMessage *message;
+  EphyHistoryQuery *query;
+  GTask *task;
+
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+  g_assert (from <= to);
+
+  task = callback ? g_task_new (self, cancellable, callback, user_data) : NULL;
+  if (task)
+    g_task_set_source_tag (task, ephy_history_service_delete_visits_in_range);
+
+  query = ephy_history_query_new ();
+  query->from = from;
+  query->to = to;
+
+  message = ephy_history_service_message_new (self, DELETE_VISITS_IN_RANGE,
+                                              query, (GDestroyNotify)ephy_history_query_free,
+                                              NULL, task);
+  if (task)
+    g_object_unref (task);
+  ephy_history_service_send_message (self, message);
+}
+
+gboolean
+ephy_history_service_delete_visits_in_range_finish (EphyHistoryService  *self,
+                                                    GAsyncResult        *result,
+                                                    GError             **error)
+{
+  g_return_val_if_fail (EPHY_IS_HISTORY_SERVICE (self), FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+
+  return GPOINTER_TO_INT (g_task_propagate_pointer (G_TASK (result), error));
+}
+
+void
+ephy_history_service_delete_host (EphyHistoryService  *self,
+                                  EphyHistoryHost     *host,
+                                  GCancellable        *cancellable,
+                                  GAsyncReadyCallback  callback,
+                                  gpointer             user_data)
+{
+  GTask *task;
+  EphyHistoryServiceMessage *message;
+
+  task = callback ? g_task_new (self, cancellable, callback, user_data) : NULL;
+  if (task)
+    g_task_set_source_tag (task, ephy_history_service_delete_host);
+
+  message = ephy_history_service_message_new (self, DELETE_HOST,
+                                              ephy_history_host_copy (host), (GDestroyNotify)ephy_history_host_free,
+                                              NULL, task);
+  if (task)
+    g_object_unref (task);
+  ephy_history_service_send_message (self, message);
+}
+
+gboolean
+ephy_history_service_delete_host_finish (EphyHistoryService  *self,
+                                         GAsyncResult        *result,
+                                         GError             **error)
+{
+  g_return_val_if_fail (EPHY_IS_HISTORY_SERVICE (self), FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+
+  return GPOINTER_TO_INT (g_task_propagate_pointer (G_TASK (result), error));
+}
+
+void
+ephy_history_service_clear (EphyHistoryService  *self,
+                            GCancellable        *cancellable,
+                            GAsyncReadyCallback  callback,
+                            gpointer             user_data)
+{
+  EphyHistoryServiceMessage *message;
+  GTask *task;
+
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+
+  task = callback ? g_task_new (self, cancellable, callback, user_data) : NULL;
+  if (task)
+    g_task_set_source_tag (task, ephy_history_service_clear);
+
+  message = ephy_history_service_message_new (self, CLEAR,
+                                              NULL, NULL, NULL,
+                                              task);
+  if (task)
+    g_object_unref (task);
+  ephy_history_service_send_message (self, message);
+}
+
+gboolean
+ephy_history_service_clear_finish (EphyHistoryService  *self,
+                                   GAsyncResult        *result,
+                                   GError             **error)
+{
+  g_return_val_if_fail (EPHY_IS_HISTORY_SERVICE (self), FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+
+  return GPOINTER_TO_INT (g_task_propagate_pointer (G_TASK (result), error));
 }
 
 static void
@@ -1605,13 +2937,18 @@ static EphyHistoryServiceMethod methods[] = {
   (EphyHistoryServiceMethod)ephy_history_service_execute_set_url_pinned,
   (EphyHistoryServiceMethod)ephy_history_service_execute_add_visit,
   (EphyHistoryServiceMethod)ephy_history_service_execute_add_visits,
+  (EphyHistoryServiceMethod)ephy_history_service_execute_import_visits,
   (EphyHistoryServiceMethod)ephy_history_service_execute_delete_urls,
+  (EphyHistoryServiceMethod)ephy_history_service_execute_delete_visits_in_range,
   (EphyHistoryServiceMethod)ephy_history_service_execute_delete_host,
+  (EphyHistoryServiceMethod)ephy_history_service_execute_expire,
+  (EphyHistoryServiceMethod)ephy_history_service_execute_roll_up_visits,
   (EphyHistoryServiceMethod)ephy_history_service_execute_clear,
   (EphyHistoryServiceMethod)ephy_history_service_execute_quit,
   (EphyHistoryServiceMethod)ephy_history_service_execute_get_url,
   (EphyHistoryServiceMethod)ephy_history_service_execute_get_host_for_url,
   (EphyHistoryServiceMethod)ephy_history_service_execute_query_urls,
+  (EphyHistoryServiceMethod)ephy_history_service_execute_query_url_table,
   (EphyHistoryServiceMethod)ephy_history_service_execute_find_visits,
   (EphyHistoryServiceMethod)ephy_history_service_execute_get_hosts,
   (EphyHistoryServiceMethod)ephy_history_service_execute_query_hosts
@@ -1623,6 +2960,39 @@ ephy_history_service_message_is_write (EphyHistoryServiceMessage *message)
   return message->type < QUIT;
 }
 
+/* GET_HOST_FOR_URL adds the host row when it is missing, so it stays on the
+ * history thread with the writes. */
+static gboolean
+ephy_history_service_message_can_use_reader (EphyHistoryServiceMessage *message)
+{
+  switch (message->type) {
+    case GET_URL:
+    case QUERY_URLS:
+    case QUERY_URL_TABLE:
+    case QUERY_VISITS:
+    case QUERY_HOSTS:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+static void
+ephy_history_service_complete_message (EphyHistoryService        *self,
+                                       EphyHistoryServiceMessage *message)
+{
+  EphyHistoryServiceCompletion *completion;
+
+  if (!message->task) {
+    ephy_history_service_message_free (message);
+    return;
+  }
+
+  completion = g_new0 (EphyHistoryServiceCompletion, 1);
+  completion->message = message;
+  ephy_history_service_push_completion (self, completion);
+}
+
 static void
 ephy_history_service_process_message (EphyHistoryService        *self,
                                       EphyHistoryServiceMessage *message)
@@ -1631,10 +3001,15 @@ ephy_history_service_process_message (EphyHistoryService        *self,
 
   g_assert (self->history_thread == g_thread_self ());
 
+  if (!ephy_history_service_claim_message (self, message)) {
+    ephy_history_service_complete_message (self, message);
+    return;
+  }
+
   if (message->task && message->type != QUIT &&
       g_cancellable_is_cancelled (g_task_get_cancellable (message->task)) &&
       !ephy_history_service_message_is_write (message)) {
-    g_idle_add_once ((GSourceOnceFunc)ephy_history_service_complete_task_in_idle_cb, message);
+    ephy_history_service_complete_message (self, message);
     return;
   }
 
@@ -1647,12 +3022,104 @@ ephy_history_service_process_message (EphyHistoryService        *self,
     message->success = FALSE;
   }
 
-  if (message->task)
-    g_idle_add_once ((GSourceOnceFunc)ephy_history_service_complete_task_in_idle_cb, message);
-  else
-    ephy_history_service_message_free (message);
+  ephy_history_service_complete_message (self, message);
+}
+
+static EphyHistoryServiceMessage *
+ephy_history_service_process_write_batch (EphyHistoryService        *self,
+                                          EphyHistoryServiceMessage *message)
+{
+  g_autoptr (GPtrArray) batch = g_ptr_array_new ();
+  gboolean added_visits = FALSE;
+  gint64 start_time;
+  gint64 commit_start_time;
+  gint64 commit_duration;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (ephy_history_service_message_is_write (message));
 
-  return;
+  start_time = g_get_monotonic_time ();
+  ephy_history_service_open_transaction (self);
+
+  /* Messages are sorted by type with writes first, so the first message that
+   * is not a write means there are no more writes queued. */
+  while (message && ephy_history_service_message_is_write (message)) {
+    EphyHistoryServiceMethod method = methods[message->type];
+
+    /* CLEAR may reopen the database, so check it for every message. */
+    if (self->history_database)
+      message->success = method (self, message->method_argument, &message->result);
+    else
+      message->success = FALSE;
+
+    if (message->type == ADD_VISIT || message->type == ADD_VISITS)
+      added_visits = TRUE;
+
+    g_ptr_array_add (batch, message);
+    message = NULL;
+
+    if (batch->len >= WRITE_BATCH_MAX_MESSAGES ||
+        g_get_monotonic_time () - start_time >= WRITE_BATCH_MAX_DURATION)
+      break;
+
+    message = g_async_queue_try_pop (self->queue);
+  }
+
+  commit_start_time = g_get_monotonic_time ();
+  ephy_history_service_commit_transaction (self);
+  commit_duration = g_get_monotonic_time () - commit_start_time;
+
+  self->write_batch_count++;
+  self->write_batch_message_count += batch->len;
+  self->write_batch_max_size = MAX (self->write_batch_max_size, batch->len);
+  self->commit_duration_total += commit_duration;
+  self->commit_duration_max = MAX (self->commit_duration_max, commit_duration);
+
+  LOG ("Committed %u history writes in %.3f ms "
+       "(%" G_GUINT64_FORMAT " batches, %.1f writes per batch, largest %u, "
+       "commit average %.3f ms, slowest %.3f ms)",
+       batch->len, commit_duration / 1000.0,
+       self->write_batch_count,
+       (double)self->write_batch_message_count / self->write_batch_count,
+       self->write_batch_max_size,
+       self->commit_duration_total / 1000.0 / self->write_batch_count,
+       self->commit_duration_max / 1000.0);
+
+  /* Only report results once they have been committed. */
+  for (guint i = 0; i < batch->len; i++)
+    ephy_history_service_complete_message (self, g_ptr_array_index (batch, i));
+
+  if (added_visits)
+    ephy_history_service_schedule_expiry (self);
+
+  return message;
+}
+
+static void
+ephy_history_service_run_read (EphyHistoryServiceMessage *message,
+                               EphyHistoryService        *self)
+{
+  EphyHistoryServiceReader *reader;
+
+  if (!ephy_history_service_claim_message (self, message) ||
+      (message->task &&
+       g_cancellable_is_cancelled (g_task_get_cancellable (message->task)))) {
+    ephy_history_service_complete_message (self, message);
+    return;
+  }
+
+  reader = g_async_queue_pop (self->idle_readers);
+  g_private_set (&current_reader, reader);
+
+  /* Queries that take several statements should see a single snapshot. */
+  ephy_sqlite_connection_begin_transaction (reader->database, NULL);
+  message->success = methods[message->type] (self, message->method_argument, &message->result);
+  ephy_sqlite_connection_commit_transaction (reader->database, NULL);
+
+  g_private_set (&current_reader, NULL);
+  g_async_queue_push (self->idle_readers, reader);
+
+  ephy_history_service_complete_message (self, message);
 }
 
 /* Public API. */
@@ -1716,8 +3183,6 @@ ephy_history_service_visit_url (EphyHistoryService       *self,
   visit->url->notify_visit = should_notify;
   ephy_history_service_add_visit (self, visit, NULL, NULL, NULL);
   ephy_history_page_visit_free (visit);
-
-  ephy_history_service_queue_urls_visited (self);
 }
 
 void
@@ -1749,3 +3214,208 @@ ephy_history_service_find_hosts_finish (EphyHistoryService  *self,
 {
   return ephy_history_service_query_hosts_finish (self, result, error);
 }
+
+/**
+ * ephy_history_service_set_retention_policy:
+ * @self: an #EphyHistoryService
+ * @max_age_days: how many days visits are kept, or 0 to keep them forever
+ * @max_visits: how many visits are kept, or 0 for no limit
+ *
+ * Sets how much history is kept. Visits beyond these limits are deleted in
+ * the background, oldest first, when the history service is idle. URLs left
+ * without visits are deleted as well, unless they are pinned or retained
+ * with ephy_history_service_set_retained_urls().
+ */
+void
+ephy_history_service_set_retention_policy (EphyHistoryService *self,
+                                           int                 max_age_days,
+                                           int                 max_visits)
+{
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+
+  g_mutex_lock (&self->retention_mutex);
+  self->max_visit_age_days = MAX (max_age_days, 0);
+  self->max_visit_count = MAX (max_visits, 0);
+  self->expiry_pending = ephy_history_service_retention_policy_is_set (self);
+  self->next_expiry_time = 0;
+  g_mutex_unlock (&self->retention_mutex);
+}
+
+/**
+ * ephy_history_service_set_retained_urls:
+ * @self: an #EphyHistoryService
+ * @urls: (nullable) (array zero-terminated=1): URLs whose history is never
+ *   expired
+ *
+ * Replaces the set of URLs that history expiry must keep, such as
+ * bookmarks.
+ */
+void
+ephy_history_service_set_retained_urls (EphyHistoryService *self,
+                                        const char * const *urls)
+{
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+
+  g_mutex_lock (&self->retention_mutex);
+  g_strfreev (self->retained_urls);
+  self->retained_urls = g_strdupv ((char **)urls);
+  self->retained_urls_changed = TRUE;
+  g_mutex_unlock (&self->retention_mutex);
+}
+
+/**
+ * ephy_history_service_expire:
+ * @self: an #EphyHistoryService
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: (nullable): a #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Expires all history beyond the retention policy now, instead of waiting
+ * for the history service to be idle.
+ */
+void
+ephy_history_service_expire (EphyHistoryService  *self,
+                             GCancellable        *cancellable,
+                             GAsyncReadyCallback  callback,
+                             gpointer             user_data)
+{
+  EphyHistoryServiceMessage *message;
+  GTask *task;
+
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+
+  task = callback ? g_task_new (self, cancellable, callback, user_data) : NULL;
+  if (task)
+    g_task_set_source_tag (task, ephy_history_service_expire);
+
+  message = ephy_history_service_message_new (self, EXPIRE,
+                                              NULL, NULL, NULL,
+                                              task);
+  if (task)
+    g_object_unref (task);
+  ephy_history_service_send_message (self, message);
+}
+
+gboolean
+ephy_history_service_expire_finish (EphyHistoryService  *self,
+                                    GAsyncResult        *result,
+                                    GError             **error)
+{
+  g_return_val_if_fail (EPHY_IS_HISTORY_SERVICE (self), FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+
+  return GPOINTER_TO_INT (g_task_propagate_pointer (G_TASK (result), error));
+}
+
+static void
+cursor_page_cb (EphyHistoryService *self,
+                GAsyncResult       *result,
+                GTask              *task)
+{
+  EphyHistoryCursor *cursor = g_task_get_task_data (task);
+  GError *error = NULL;
+  GList *urls;
+
+  urls = ephy_history_service_query_urls_finish (self, result, &error);
+  if (error) {
+    g_task_return_error (task, error);
+  } else {
+    ephy_history_cursor_advance (cursor, urls);
+    g_task_return_pointer (task, urls, (GDestroyNotify)ephy_history_url_list_free);
+  }
+
+  g_object_unref (task);
+}
+
+/**
+ * ephy_history_service_cursor_next_page:
+ * @self: an #EphyHistoryService
+ * @cursor: an #EphyHistoryCursor
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Fetches the next page of URLs from @cursor, and moves the cursor past it
+ * once it has been fetched. Only one page of a cursor may be requested at a
+ * time. Once the cursor is done, the pages are empty.
+ */
+void
+ephy_history_service_cursor_next_page (EphyHistoryService  *self,
+                                       EphyHistoryCursor   *cursor,
+                                       GCancellable        *cancellable,
+                                       GAsyncReadyCallback  callback,
+                                       gpointer             user_data)
+{
+  GTask *task;
+
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+  g_assert (cursor);
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, ephy_history_service_cursor_next_page);
+  g_task_set_task_data (task, ephy_history_cursor_ref (cursor), (GDestroyNotify)ephy_history_cursor_unref);
+
+  if (ephy_history_cursor_is_done (cursor)) {
+    g_task_return_pointer (task, NULL, NULL);
+    g_object_unref (task);
+    return;
+  }
+
+  ephy_history_service_query_urls (self, ephy_history_cursor_get_query (cursor), cancellable,
+                                   (GAsyncReadyCallback)cursor_page_cb, task);
+}
+
+GList *
+ephy_history_service_cursor_next_page_finish (EphyHistoryService  *self,
+                                              GAsyncResult        *result,
+                                              GError             **error)
+{
+  g_return_val_if_fail (EPHY_IS_HISTORY_SERVICE (self), NULL);
+  g_return_val_if_fail (g_task_is_valid (result, self), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * ephy_history_service_roll_up_visits:
+ * @self: an #EphyHistoryService
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: (nullable): a #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Rolls up the visits older than a few weeks into one visit per URL and day
+ * now, instead of waiting for the history service to be idle.
+ */
+void
+ephy_history_service_roll_up_visits (EphyHistoryService  *self,
+                                     GCancellable        *cancellable,
+                                     GAsyncReadyCallback  callback,
+                                     gpointer             user_data)
+{
+  EphyHistoryServiceMessage *message;
+  GTask *task;
+
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+
+  task = callback ? g_task_new (self, cancellable, callback, user_data) : NULL;
+  if (task)
+    g_task_set_source_tag (task, ephy_history_service_roll_up_visits);
+
+  message = ephy_history_service_message_new (self, ROLL_UP_VISITS,
+                                              NULL, NULL, NULL,
+                                              task);
+  if (task)
+    g_object_unref (task);
+  ephy_history_service_send_message (self, message);
+}
+
+gboolean
+ephy_history_service_roll_up_visits_finish (EphyHistoryService  *self,
+                                            GAsyncResult        *result,
+                                            GError             **error)
+{
+  g_return_val_if_fail (EPHY_IS_HISTORY_SERVICE (self), FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+
+  return GPOINTER_TO_INT (g_task_propagate_pointer (G_TASK (result), error));
+}
@@ -52,6 +52,14 @@ gboolean                 ephy_history_service_add_visits_finish       (EphyHisto
                                                                        GAsyncResult         *result,
                                                                        GError              **error);
 
+void                     ephy_history_service_import_visits           (EphyHistoryService   *self,
+                                                                       GPtrArray            *visits,
+                                                                       GCancellable         *cancellable,
+                                                                       GAsyncReadyCallback   callback,
+                                                                       gpointer              user_data);
+gboolean                 ephy_history_service_import_visits_finish    (EphyHistoryService   *self,
+                                                                       GAsyncResult         *result,
+                                                                       GError              **error);
 void                     ephy_history_service_find_visits_in_time     (EphyHistoryService   *self,
                                                                        gint64                from,
                                                                        gint64                to,
@@ -80,6 +88,15 @@ GList *                  ephy_history_service_query_urls_finish       (EphyHisto
                                                                        GAsyncResult         *result,
                                                                        GError              **error);
 
+void                     ephy_history_service_query_url_table         (EphyHistoryService   *self,
+                                                                       EphyHistoryQuery     *query,
+                                                                       GCancellable         *cancellable,
+                                                                       GAsyncReadyCallback   callback,
+                                                                       gpointer              user_data);
+EphyHistoryURLTable *    ephy_history_service_query_url_table_finish  (EphyHistoryService   *self,
+                                                                       GAsyncResult         *result,
+                                                                       GError              **error);
+
 void                     ephy_history_service_set_url_title           (EphyHistoryService   *self,
                                                                        const char           *url,
                                                                        const char           *title,
@@ -110,6 +127,8 @@ gboolean                 ephy_history_service_set_url_pinned_finish   (EphyHisto
                                                                        GAsyncResult         *result,
                                                                        GError              **error);
 
+double                   ephy_history_service_get_url_zoom_level      (EphyHistoryService   *self,
+                                                                       const char           *url);
 void                     ephy_history_service_set_url_zoom_level      (EphyHistoryService   *self,
                                                                        const char           *url,
                                                                        double                zoom_level,
@@ -173,6 +192,16 @@ gboolean                 ephy_history_service_delete_urls_finish      (EphyHisto
                                                                        GAsyncResult         *result,
                                                                        GError              **error);
 
+void                     ephy_history_service_delete_visits_in_range  (EphyHistoryService   *self,
+                                                                       gint64                from,
+                                                                       gint64                to,
+                                                                       GCancellable         *cancellable,
+                                                                       GAsyncReadyCallback   callback,
+                                                                       gpointer              user_data);
+gboolean                 ephy_history_service_delete_visits_in_range_finish (EphyHistoryService *self,
+                                                                       GAsyncResult         *result,
+                                                                       GError              **error);
+
 void                     ephy_history_service_find_urls               (EphyHistoryService   *self,
                                                                        gint64                from,
                                                                        gint64                to,
@@ -202,6 +231,37 @@ gboolean                 ephy_history_service_clear_finish            (EphyHisto
                                                                        GAsyncResult         *result,
                                                                        GError              **error);
 
+void                     ephy_history_service_set_retention_policy    (EphyHistoryService   *self,
+                                                                       int                   max_age_days,
+                                                                       int                   max_visits);
+void                     ephy_history_service_set_retained_urls       (EphyHistoryService   *self,
+                                                                       const char * const   *urls);
+
+void                     ephy_history_service_expire                  (EphyHistoryService   *self,
+                                                                       GCancellable         *cancellable,
+                                                                       GAsyncReadyCallback   callback,
+                                                                       gpointer              user_data);
+gboolean                 ephy_history_service_expire_finish           (EphyHistoryService   *self,
+                                                                       GAsyncResult         *result,
+                                                                       GError              **error);
+
+void                     ephy_history_service_roll_up_visits          (EphyHistoryService   *self,
+                                                                       GCancellable         *cancellable,
+                                                                       GAsyncReadyCallback   callback,
+                                                                       gpointer              user_data);
+gboolean                 ephy_history_service_roll_up_visits_finish   (EphyHistoryService   *self,
+                                                                       GAsyncResult         *result,
+                                                                       GError              **error);
+
+void                     ephy_history_service_cursor_next_page        (EphyHistoryService   *self,
+                                                                       EphyHistoryCursor    *cursor,
+                                                                       GCancellable         *cancellable,
+                                                                       GAsyncReadyCallback   callback,
+                                                                       gpointer              user_data);
+GList *                  ephy_history_service_cursor_next_page_finish (EphyHistoryService   *self,
+                                                                       GAsyncResult         *result,
+                                                                       GError              **error);
+
 void                     ephy_history_service_find_hosts              (EphyHistoryService   *self,
                                                                        gint64                from,
                                                                        gint64                to,
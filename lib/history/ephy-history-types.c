@@ -170,6 +170,7 @@ ephy_history_url_copy (EphyHistoryURL *url)
   copy->sync_id = g_strdup (url->sync_id);
   copy->hidden = url->hidden;
   copy->pinned = url->pinned;
+  copy->frecency = url->frecency;
   copy->host = ephy_history_host_copy (url->host);
   copy->notify_visit = url->notify_visit;
   copy->notify_delete = url->notify_delete;
@@ -225,6 +226,7 @@ void
 ephy_history_query_free (EphyHistoryQuery *query)
 {
   g_list_free_full (query->substring_list, g_free);
+  g_free (query->supersede_key);
   g_free (query);
 }
 
@@ -240,6 +242,9 @@ ephy_history_query_copy (EphyHistoryQuery *query)
   copy->ignore_hidden = query->ignore_hidden;
   copy->ignore_local = query->ignore_local;
   copy->host = query->host;
+  copy->supersede_key = g_strdup (query->supersede_key);
+  copy->after_last_visit_time = query->after_last_visit_time;
+  copy->after_id = query->after_id;
 
   for (iter = query->substring_list; iter; iter = iter->next) {
     copy->substring_list = g_list_prepend (copy->substring_list, g_strdup (iter->data));
@@ -248,3 +253,246 @@ ephy_history_query_copy (EphyHistoryQuery *query)
 
   return copy;
 }
+
+/* A cursor pages through the URLs matching a query, most recently visited
+ * first. Each page continues after the last URL of the previous one, keyed
+ * by (last_visit_time, id), so fetching a page costs the same at any depth. */
+struct _EphyHistoryCursor {
+  EphyHistoryQuery *query;
+  gboolean done;
+};
+
+EphyHistoryCursor *
+ephy_history_cursor_new (EphyHistoryQuery *query,
+                         guint             page_size)
+{
+  EphyHistoryCursor *cursor = g_rc_box_new0 (EphyHistoryCursor);
+
+  g_assert (page_size > 0);
+
+  cursor->query = ephy_history_query_copy (query);
+  cursor->query->sort_type = EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED;
+  cursor->query->limit = page_size;
+  cursor->query->after_id = 0;
+
+  return cursor;
+}
+
+EphyHistoryCursor *
+ephy_history_cursor_ref (EphyHistoryCursor *cursor)
+{
+  return g_rc_box_acquire (cursor);
+}
+
+static void
+ephy_history_cursor_clear (EphyHistoryCursor *cursor)
+{
+  ephy_history_query_free (cursor->query);
+}
+
+void
+ephy_history_cursor_unref (EphyHistoryCursor *cursor)
+{
+  g_rc_box_release_full (cursor, (GDestroyNotify)ephy_history_cursor_clear);
+}
+
+/* The query for the next page. */
+EphyHistoryQuery *
+ephy_history_cursor_get_query (EphyHistoryCursor *cursor)
+{
+  return cursor->query;
+}
+
+/* Moves the cursor past @page, which was returned for its current query. */
+void
+ephy_history_cursor_advance (EphyHistoryCursor *cursor,
+                             GList             *page)
+{
+  GList *last = g_list_last (page);
+  EphyHistoryURL *url;
+
+  if (g_list_length (page) < cursor->query->limit) {
+    cursor->done = TRUE;
+    return;
+  }
+
+  url = last->data;
+  cursor->query->after_last_visit_time = url->last_visit_time;
+  cursor->query->after_id = url->id;
+}
+
+gboolean
+ephy_history_cursor_is_done (EphyHistoryCursor *cursor)
+{
+  return cursor->done;
+}
+
+/* A URL table holds query results as one array of fixed-size records, with
+ * the strings of all rows packed into a single buffer, so a result of any
+ * size takes three allocations and can be shared by reference. */
+typedef struct {
+  int id;
+  int visit_count;
+  int typed_count;
+  int frecency;
+  guint url_offset;
+  guint title_offset;
+  guint hidden : 1;
+  guint pinned : 1;
+  gint64 last_visit_time;
+} EphyHistoryURLRecord;
+
+struct _EphyHistoryURLTable {
+  GArray *records;
+  GString *strings;
+};
+
+EphyHistoryURLTable *
+ephy_history_url_table_new (guint reserved_size)
+{
+  EphyHistoryURLTable *table = g_rc_box_new0 (EphyHistoryURLTable);
+
+  table->records = g_array_sized_new (FALSE, FALSE, sizeof (EphyHistoryURLRecord), reserved_size);
+  table->strings = g_string_sized_new (reserved_size * 64);
+
+  return table;
+}
+
+EphyHistoryURLTable *
+ephy_history_url_table_ref (EphyHistoryURLTable *table)
+{
+  return g_rc_box_acquire (table);
+}
+
+static void
+ephy_history_url_table_clear (EphyHistoryURLTable *table)
+{
+  g_array_unref (table->records);
+  g_string_free (table->strings, TRUE);
+}
+
+void
+ephy_history_url_table_unref (EphyHistoryURLTable *table)
+{
+  g_rc_box_release_full (table, (GDestroyNotify)ephy_history_url_table_clear);
+}
+
+static guint
+ephy_history_url_table_add_string (EphyHistoryURLTable *table,
+                                   const char          *string)
+{
+  guint offset = table->strings->len;
+
+  g_string_append (table->strings, string ? string : "");
+  g_string_append_c (table->strings, '\0');
+
+  return offset;
+}
+
+/* Only called while the table is built, before it is shared. */
+void
+ephy_history_url_table_append (EphyHistoryURLTable *table,
+                               int                  id,
+                               const char          *url,
+                               const char          *title,
+                               int                  visit_count,
+                               int                  typed_count,
+                               gint64               last_visit_time,
+                               gboolean             hidden,
+                               gboolean             pinned,
+                               int                  frecency)
+{
+  EphyHistoryURLRecord record;
+
+  record.id = id;
+  record.visit_count = visit_count;
+  record.typed_count = typed_count;
+  record.frecency = frecency;
+  record.url_offset = ephy_history_url_table_add_string (table, url);
+  record.title_offset = ephy_history_url_table_add_string (table, title);
+  record.hidden = !!hidden;
+  record.pinned = !!pinned;
+  record.last_visit_time = last_visit_time;
+
+  g_array_append_val (table->records, record);
+}
+
+guint
+ephy_history_url_table_get_length (EphyHistoryURLTable *table)
+{
+  return table->records->len;
+}
+
+static inline EphyHistoryURLRecord *
+ephy_history_url_table_get_record (EphyHistoryURLTable *table,
+                                   guint                index)
+{
+  g_assert (index < table->records->len);
+
+  return &g_array_index (table->records, EphyHistoryURLRecord, index);
+}
+
+int
+ephy_history_url_table_get_id (EphyHistoryURLTable *table,
+                               guint                index)
+{
+  return ephy_history_url_table_get_record (table, index)->id;
+}
+
+/* Valid for as long as the table is. */
+const char *
+ephy_history_url_table_get_url (EphyHistoryURLTable *table,
+                                guint                index)
+{
+  return table->strings->str + ephy_history_url_table_get_record (table, index)->url_offset;
+}
+
+/* Valid for as long as the table is. Never %NULL, but may be empty. */
+const char *
+ephy_history_url_table_get_title (EphyHistoryURLTable *table,
+                                  guint                index)
+{
+  return table->strings->str + ephy_history_url_table_get_record (table, index)->title_offset;
+}
+
+int
+ephy_history_url_table_get_visit_count (EphyHistoryURLTable *table,
+                                        guint                index)
+{
+  return ephy_history_url_table_get_record (table, index)->visit_count;
+}
+
+int
+ephy_history_url_table_get_typed_count (EphyHistoryURLTable *table,
+                                        guint                index)
+{
+  return ephy_history_url_table_get_record (table, index)->typed_count;
+}
+
+gint64
+ephy_history_url_table_get_last_visit_time (EphyHistoryURLTable *table,
+                                            guint                index)
+{
+  return ephy_history_url_table_get_record (table, index)->last_visit_time;
+}
+
+gboolean
+ephy_history_url_table_get_hidden (EphyHistoryURLTable *table,
+                                   guint                index)
+{
+  return ephy_history_url_table_get_record (table, index)->hidden;
+}
+
+gboolean
+ephy_history_url_table_get_pinned (EphyHistoryURLTable *table,
+                                   guint                index)
+{
+  return ephy_history_url_table_get_record (table, index)->pinned;
+}
+
+int
+ephy_history_url_table_get_frecency (EphyHistoryURLTable *table,
+                                     guint                index)
+{
+  return ephy_history_url_table_get_record (table, index)->frecency;
+}
@@ -47,7 +47,8 @@ typedef enum {
   EPHY_HISTORY_SORT_TITLE_ASCENDING,
   EPHY_HISTORY_SORT_TITLE_DESCENDING,
   EPHY_HISTORY_SORT_URL_ASCENDING,
-  EPHY_HISTORY_SORT_URL_DESCENDING
+  EPHY_HISTORY_SORT_URL_DESCENDING,
+  EPHY_HISTORY_SORT_FRECENCY
 } EphyHistorySortType;
 
 typedef struct
@@ -70,6 +71,7 @@ typedef struct _EphyHistoryURL
   gint64 last_visit_time; /* Microseconds */
   gboolean hidden;
   gboolean pinned;
+  int frecency;
   EphyHistoryHost *host;
   gboolean notify_visit;
   gboolean notify_delete;
@@ -93,8 +95,17 @@ typedef struct _EphyHistoryQuery
   gboolean ignore_local;
   gint host;
   EphyHistorySortType sort_type;
+  /* Queries sharing a supersede key replace each other while still queued. */
+  char *supersede_key;
+  /* Keyset for EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED: if after_id is set,
+   * only URLs that sort after this last_visit_time and id are returned. */
+  gint64 after_last_visit_time;
+  int after_id;
 } EphyHistoryQuery;
 
+typedef struct _EphyHistoryCursor EphyHistoryCursor;
+typedef struct _EphyHistoryURLTable EphyHistoryURLTable;
+
 EphyHistoryPageVisit *          ephy_history_page_visit_new (const char *url, gint64 visit_time, EphyHistoryPageVisitType visit_type);
 EphyHistoryPageVisit *          ephy_history_page_visit_new_with_url (EphyHistoryURL *url, gint64 visit_time, EphyHistoryPageVisitType visit_type);
 EphyHistoryPageVisit *          ephy_history_page_visit_copy (EphyHistoryPageVisit *visit);
@@ -119,9 +130,33 @@ EphyHistoryQuery *              ephy_history_query_new (void);
 void                            ephy_history_query_free (EphyHistoryQuery *query);
 EphyHistoryQuery *              ephy_history_query_copy (EphyHistoryQuery *query);
 
+EphyHistoryCursor *             ephy_history_cursor_new (EphyHistoryQuery *query, guint page_size);
+EphyHistoryCursor *             ephy_history_cursor_ref (EphyHistoryCursor *cursor);
+void                            ephy_history_cursor_unref (EphyHistoryCursor *cursor);
+EphyHistoryQuery *              ephy_history_cursor_get_query (EphyHistoryCursor *cursor);
+void                            ephy_history_cursor_advance (EphyHistoryCursor *cursor, GList *page);
+gboolean                        ephy_history_cursor_is_done (EphyHistoryCursor *cursor);
+
+EphyHistoryURLTable *           ephy_history_url_table_new (guint reserved_size);
+EphyHistoryURLTable *           ephy_history_url_table_ref (EphyHistoryURLTable *table);
+void                            ephy_history_url_table_unref (EphyHistoryURLTable *table);
+void                            ephy_history_url_table_append (EphyHistoryURLTable *table, int id, const char *url, const char *title, int visit_count, int typed_count, gint64 last_visit_time, gboolean hidden, gboolean pinned, int frecency);
+guint                           ephy_history_url_table_get_length (EphyHistoryURLTable *table);
+int                             ephy_history_url_table_get_id (EphyHistoryURLTable *table, guint index);
+const char *                    ephy_history_url_table_get_url (EphyHistoryURLTable *table, guint index);
+const char *                    ephy_history_url_table_get_title (EphyHistoryURLTable *table, guint index);
+int                             ephy_history_url_table_get_visit_count (EphyHistoryURLTable *table, guint index);
+int                             ephy_history_url_table_get_typed_count (EphyHistoryURLTable *table, guint index);
+gint64                          ephy_history_url_table_get_last_visit_time (EphyHistoryURLTable *table, guint index);
+gboolean                        ephy_history_url_table_get_hidden (EphyHistoryURLTable *table, guint index);
+gboolean                        ephy_history_url_table_get_pinned (EphyHistoryURLTable *table, guint index);
+int                             ephy_history_url_table_get_frecency (EphyHistoryURLTable *table, guint index);
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(EphyHistoryHost, ephy_history_host_free)
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(EphyHistoryURL, ephy_history_url_free)
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(EphyHistoryPageVisit, ephy_history_page_visit_free)
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(EphyHistoryQuery, ephy_history_query_free)
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(EphyHistoryCursor, ephy_history_cursor_unref)
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(EphyHistoryURLTable, ephy_history_url_table_unref)
 
 G_END_DECLS
@@ -120,6 +120,15 @@ url_deleted_cb (EphyHistoryService *service,
   g_object_unref (record);
 }
 
+static void
+urls_deleted_cb (EphyHistoryService *service,
+                 GList              *urls,
+                 EphyHistoryManager *self)
+{
+  for (GList *l = urls; l; l = l->next)
+    url_deleted_cb (service, l->data, self);
+}
+
 static void
 ephy_history_manager_set_property (GObject      *object,
                                    guint         prop_id,
@@ -160,6 +169,7 @@ ephy_history_manager_dispose (GObject *object)
   if (self->service) {
     g_signal_handlers_disconnect_by_func (self->service, url_visited_cb, self);
     g_signal_handlers_disconnect_by_func (self->service, url_deleted_cb, self);
+    g_signal_handlers_disconnect_by_func (self->service, urls_deleted_cb, self);
   }
 
   g_clear_object (&self->service);
@@ -176,6 +186,7 @@ ephy_history_manager_constructed (GObject *object)
 
   g_signal_connect (self->service, "visit-url", G_CALLBACK (url_visited_cb), self);
   g_signal_connect (self->service, "url-deleted", G_CALLBACK (url_deleted_cb), self);
+  g_signal_connect (self->service, "urls-deleted", G_CALLBACK (urls_deleted_cb), self);
 }
 
 static void
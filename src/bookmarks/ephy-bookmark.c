@@ -250,7 +250,7 @@ ephy_bookmark_class_init (EphyBookmarkClass *klass)
     g_param_spec_string ("bmkUri",
                          NULL, NULL,
                          "about:overview",
-                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS);
+                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
 
   obj_properties[PROP_TAGS] =
     g_param_spec_pointer ("tags",
@@ -414,6 +414,8 @@ ephy_bookmark_set_url (EphyBookmark *self,
       g_object_notify_by_pspec (G_OBJECT (self), obj_properties[PROP_ICON]);
 
     ephy_bookmark_start_loading_icon (self);
+
+    g_object_notify_by_pspec (G_OBJECT (self), obj_properties[PROP_BMK_URI]);
   }
 }
 
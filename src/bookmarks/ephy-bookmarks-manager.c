@@ -42,6 +42,14 @@ struct _EphyBookmarksManager {
 
   GSequence *bookmarks;
   GSequence *tags;
+
+  /* Indexes of @bookmarks, kept up to date as bookmarks are added, removed
+   * or change URL. Several bookmarks can share the same ID or URL, in which
+   * case lookups return the first one in @bookmarks, as a scan would. */
+  GHashTable *ids; /* ID -> GPtrArray of GSequenceIter in @bookmarks */
+  GHashTable *urls; /* URL -> GPtrArray of GSequenceIter in @bookmarks */
+  GHashTable *indexed_urls; /* EphyBookmark -> URL it is found under in @urls */
+
   GSequence *bookmarks_order;
   GSequence *tags_order;
 
@@ -122,6 +130,9 @@ ephy_bookmarks_manager_finalize (GObject *object)
 {
   EphyBookmarksManager *self = EPHY_BOOKMARKS_MANAGER (object);
 
+  g_hash_table_unref (self->ids);
+  g_hash_table_unref (self->urls);
+  g_hash_table_unref (self->indexed_urls);
   g_sequence_free (self->bookmarks);
   g_sequence_free (self->tags);
   g_free (self->gvdb_filename);
@@ -260,6 +271,9 @@ ephy_bookmarks_manager_init (EphyBookmarksManager *self)
 
   self->bookmarks = g_sequence_new (g_object_unref);
   self->tags = g_sequence_new (g_free);
+  self->ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_ptr_array_unref);
+  self->urls = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_ptr_array_unref);
+  self->indexed_urls = g_hash_table_new_full (NULL, NULL, NULL, g_free);
   self->bookmarks_order = g_sequence_new (g_free);
   self->tags_order = g_sequence_new (g_free);
 
@@ -291,6 +305,118 @@ ephy_bookmarks_manager_init (EphyBookmarksManager *self)
   }
 }
 
+static void
+bookmark_index_add (GHashTable    *index,
+                    const char    *key,
+                    GSequenceIter *iter)
+{
+  GPtrArray *iters = g_hash_table_lookup (index, key);
+
+  if (!iters) {
+    iters = g_ptr_array_new ();
+    g_hash_table_insert (index, g_strdup (key), iters);
+  }
+
+  g_ptr_array_add (iters, iter);
+}
+
+static void
+bookmark_index_remove (GHashTable    *index,
+                       const char    *key,
+                       GSequenceIter *iter)
+{
+  GPtrArray *iters = g_hash_table_lookup (index, key);
+
+  g_ptr_array_remove_fast (iters, iter);
+  if (iters->len == 0)
+    g_hash_table_remove (index, key);
+}
+
+/* Returns the iter of @bookmark itself among the ones indexed under @key. */
+static GSequenceIter *
+bookmark_index_find (GHashTable   *index,
+                     const char   *key,
+                     EphyBookmark *bookmark)
+{
+  GPtrArray *iters = g_hash_table_lookup (index, key);
+
+  for (guint i = 0; iters && i < iters->len; i++) {
+    GSequenceIter *iter = g_ptr_array_index (iters, i);
+
+    if (g_sequence_get (iter) == bookmark)
+      return iter;
+  }
+
+  return NULL;
+}
+
+/* Returns the first of the iters indexed under @key, in sequence order. */
+static GSequenceIter *
+bookmark_index_lookup (GHashTable *index,
+                       const char *key)
+{
+  GPtrArray *iters = g_hash_table_lookup (index, key);
+  GSequenceIter *first = NULL;
+
+  for (guint i = 0; iters && i < iters->len; i++) {
+    GSequenceIter *iter = g_ptr_array_index (iters, i);
+
+    if (!first || g_sequence_iter_compare (iter, first) < 0)
+      first = iter;
+  }
+
+  return first;
+}
+
+static void
+unindex_bookmark_url (EphyBookmarksManager *self,
+                      EphyBookmark         *bookmark)
+{
+  const char *url = g_hash_table_lookup (self->indexed_urls, bookmark);
+
+  if (!url)
+    return;
+
+  bookmark_index_remove (self->urls, url, bookmark_index_find (self->urls, url, bookmark));
+  g_hash_table_remove (self->indexed_urls, bookmark);
+}
+
+static void
+index_bookmark_url (EphyBookmarksManager *self,
+                    EphyBookmark         *bookmark)
+{
+  const char *url = ephy_bookmark_get_url (bookmark);
+  GSequenceIter *iter;
+
+  unindex_bookmark_url (self, bookmark);
+
+  if (!url)
+    return;
+
+  iter = bookmark_index_find (self->ids, ephy_bookmark_get_id (bookmark), bookmark);
+  g_assert (iter);
+
+  bookmark_index_add (self->urls, url, iter);
+  g_hash_table_insert (self->indexed_urls, bookmark, g_strdup (url));
+}
+
+/* The bookmark does not tell when its ID changes, so the manager changes it
+ * itself, keeping the ID index in sync. */
+static void
+ephy_bookmarks_manager_set_bookmark_id (EphyBookmarksManager *self,
+                                        EphyBookmark         *bookmark,
+                                        const char           *id)
+{
+  GSequenceIter *iter;
+
+  iter = bookmark_index_find (self->ids, ephy_bookmark_get_id (bookmark), bookmark);
+  g_assert (iter);
+
+  bookmark_index_remove (self->ids, ephy_bookmark_get_id (bookmark), iter);
+  ephy_bookmark_set_id (bookmark, id);
+  bookmark_index_add (self->ids, id, iter);
+}
+
 static void
 bookmark_title_changed_cb (EphyBookmark         *bookmark,
                            GParamSpec           *pspec,
@@ -304,6 +430,8 @@ bookmark_url_changed_cb (EphyBookmark         *bookmark,
                          GParamSpec           *pspec,
                          EphyBookmarksManager *self)
 {
+  index_bookmark_url (self, bookmark);
+
   g_signal_emit (self, signals[BOOKMARK_URL_CHANGED], 0, bookmark);
 }
 
@@ -368,6 +496,9 @@ ephy_bookmarks_manager_add_bookmark_internal (EphyBookmarksManager *self,
                                    (GCompareDataFunc)ephy_bookmark_bookmarks_compare_func,
                                    NULL);
   if (iter) {
+    bookmark_index_add (self->ids, ephy_bookmark_get_id (bookmark), iter);
+    index_bookmark_url (self, bookmark);
+
     /* Update list */
     position = g_sequence_iter_get_position (iter);
     g_list_model_items_changed (G_LIST_MODEL (self), position, 0, 1);
@@ -421,14 +552,14 @@ ephy_bookmarks_manager_remove_bookmark_internal (EphyBookmarksManager *self,
   g_assert (EPHY_IS_BOOKMARKS_MANAGER (self));
   g_assert (EPHY_IS_BOOKMARK (bookmark));
 
-  for (iter = g_sequence_get_begin_iter (self->bookmarks);
-       !g_sequence_iter_is_end (iter);
-       iter = g_sequence_iter_next (iter)) {
-    if (g_strcmp0 (ephy_bookmark_get_id (g_sequence_get (iter)),
-                   ephy_bookmark_get_id (bookmark)) == 0)
-      break;
-  }
-  g_assert (!g_sequence_iter_is_end (iter));
+  /* @bookmark may only be a copy of the managed one, with the same ID. */
+  iter = bookmark_index_find (self->ids, ephy_bookmark_get_id (bookmark), bookmark);
+  if (!iter)
+    iter = bookmark_index_lookup (self->ids, ephy_bookmark_get_id (bookmark));
+  g_assert (iter);
+
+  unindex_bookmark_url (self, g_sequence_get (iter));
+  bookmark_index_remove (self->ids, ephy_bookmark_get_id (bookmark), iter);
 
   /* Ensure the bookmark is removed from our list before the signal is emitted,
    * because this is the bookmark REMOVED signal after all, so callers expect
@@ -467,16 +598,9 @@ ephy_bookmarks_manager_get_bookmark_by_url (EphyBookmarksManager *self,
   g_assert (EPHY_IS_BOOKMARKS_MANAGER (self));
   g_assert (url);
 
-  for (iter = g_sequence_get_begin_iter (self->bookmarks);
-       !g_sequence_iter_is_end (iter);
-       iter = g_sequence_iter_next (iter)) {
-    EphyBookmark *bookmark = g_sequence_get (iter);
+  iter = bookmark_index_lookup (self->urls, url);
 
-    if (g_strcmp0 (ephy_bookmark_get_url (bookmark), url) == 0)
-      return bookmark;
-  }
-
-  return NULL;
+  return iter ? g_sequence_get (iter) : NULL;
 }
 
 EphyBookmark *
@@ -488,16 +612,9 @@ ephy_bookmarks_manager_get_bookmark_by_id (EphyBookmarksManager *self,
   g_assert (EPHY_IS_BOOKMARKS_MANAGER (self));
   g_assert (id);
 
-  for (iter = g_sequence_get_begin_iter (self->bookmarks);
-       !g_sequence_iter_is_end (iter);
-       iter = g_sequence_iter_next (iter)) {
-    EphyBookmark *bookmark = g_sequence_get (iter);
-
-    if (g_strcmp0 (ephy_bookmark_get_id (bookmark), id) == 0)
-      return bookmark;
-  }
+  iter = bookmark_index_lookup (self->ids, id);
 
-  return NULL;
+  return iter ? g_sequence_get (iter) : NULL;
 }
 
 void
@@ -1044,7 +1161,7 @@ ephy_bookmarks_manager_handle_initial_merge (EphyBookmarksManager *self,
       } else {
         /* Same id, different url. Keep both and upload local one with new id. */
         char *new_id = ephy_sync_utils_get_random_sync_id ();
-        ephy_bookmark_set_id (bookmark, new_id);
+        ephy_bookmarks_manager_set_bookmark_id (self, bookmark, new_id);
         ephy_bookmarks_manager_add_bookmark_internal (self, l->data, FALSE);
         g_hash_table_add (dont_upload, g_strdup (id));
         g_free (new_id);
@@ -1053,7 +1170,7 @@ ephy_bookmarks_manager_handle_initial_merge (EphyBookmarksManager *self,
       bookmark = ephy_bookmarks_manager_get_bookmark_by_url (self, url);
       if (bookmark) {
         /* Different id, same url. Keep remote id, merge tags and reupload. */
-        ephy_bookmark_set_id (bookmark, id);
+        ephy_bookmarks_manager_set_bookmark_id (self, bookmark, id);
         ephy_bookmarks_manager_copy_tags_from_bookmark (self, bookmark, l->data);
         timestamp = ephy_synchronizable_get_server_time_modified (l->data);
         ephy_synchronizable_set_server_time_modified (EPHY_SYNCHRONIZABLE (bookmark), timestamp);
@@ -1139,7 +1256,7 @@ ephy_bookmarks_manager_handle_regular_merge (EphyBookmarksManager *self,
       bookmark = ephy_bookmarks_manager_get_bookmark_by_url (self, url);
       if (bookmark) {
         /* Different id, same url. Keep remote id, merge tags and reupload. */
-        ephy_bookmark_set_id (bookmark, id);
+        ephy_bookmarks_manager_set_bookmark_id (self, bookmark, id);
         ephy_bookmarks_manager_copy_tags_from_bookmark (self, bookmark, l->data);
         timestamp = ephy_synchronizable_get_server_time_modified (l->data);
         ephy_synchronizable_set_server_time_modified (EPHY_SYNCHRONIZABLE (bookmark), timestamp);
@@ -48,6 +48,17 @@
 
 #define NUM_FETCH_LIMIT 15
 
+static const struct {
+  const char *label;
+  GTimeSpan span;
+} clear_time_ranges[] = {
+  { N_("Last Hour"), G_TIME_SPAN_HOUR },
+  { N_("Last Day"), G_TIME_SPAN_DAY },
+  { N_("Last Week"), 7 * G_TIME_SPAN_DAY },
+  { N_("Last 4 Weeks"), 28 * G_TIME_SPAN_DAY },
+  { N_("All Time"), 0 },
+};
+
 struct _EphyHistoryDialog {
   AdwDialog parent_instance;
 
@@ -80,11 +91,14 @@ struct _EphyHistoryDialog {
 
   GActionGroup *action_group;
 
+  EphyHistoryCursor *cursor;
+  GCancellable *page_cancellable;
+  gboolean is_fetching_page;
+  gboolean clear_on_next_page;
   GList *urls;
   guint sorter_source;
 
   EphyWindow *parent_window;
-  gint num_fetch;
   gboolean shift_modifier_active;
   gboolean is_loading;
   gboolean selection_active;
@@ -287,7 +301,7 @@ on_select_all_button_clicked (GtkButton         *button,
 }
 
 static void
-on_find_urls_cb (EphyHistoryService *service,
+on_next_page_cb (EphyHistoryService *service,
                  GAsyncResult       *result,
                  gpointer            user_data)
 {
@@ -295,21 +309,40 @@ on_find_urls_cb (EphyHistoryService *service,
   g_autoptr (GError) error = NULL;
   GList *urls;
 
-  urls = ephy_history_service_find_urls_finish (service, result, &error);
+  urls = ephy_history_service_cursor_next_page_finish (service, result, &error);
   if (error) {
-    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    /* Cancelled when the cursor was replaced, which also reset the rest. */
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
       g_warning ("Failed to find URLs: %s", error->message);
+      self->is_fetching_page = FALSE;
+    }
     return;
   }
 
-  if (self->urls)
-    ephy_history_url_list_free (self->urls);
-  self->urls = urls;
+  self->is_fetching_page = FALSE;
+
+  if (self->clear_on_next_page) {
+    gtk_list_box_remove_all (GTK_LIST_BOX (self->listbox));
+    self->clear_on_next_page = FALSE;
+  }
 
-  gtk_list_box_remove_all (GTK_LIST_BOX (self->listbox));
+  self->urls = g_list_concat (self->urls, urls);
 
-  self->num_fetch = NUM_FETCH_LIMIT;
-  self->sorter_source = g_idle_add ((GSourceFunc)add_urls_source, self);
+  if (!self->sorter_source)
+    self->sorter_source = g_idle_add ((GSourceFunc)add_urls_source, self);
+}
+
+static void
+fetch_next_page (EphyHistoryDialog *self)
+{
+  if (!self->cursor || self->is_fetching_page || ephy_history_cursor_is_done (self->cursor))
+    return;
+
+  self->is_fetching_page = TRUE;
+  ephy_history_service_cursor_next_page (self->history_service,
+                                         self->cursor,
+                                         self->page_cancellable,
+                                         (GAsyncReadyCallback)on_next_page_cb, self);
 }
 
 static GList *
@@ -345,26 +378,32 @@ remove_pending_sorter_source (EphyHistoryDialog *self,
 }
 
 static void
-filter_now (EphyHistoryDialog *self)
+cancel_page_fetch (EphyHistoryDialog *self)
 {
-  gint64 from, to;
-  GList *substrings;
-  EphyHistorySortType type;
-  substrings = substrings_filter (self);
+  g_cancellable_cancel (self->page_cancellable);
+  g_clear_object (&self->page_cancellable);
+  self->is_fetching_page = FALSE;
+}
 
-  from = to = -1;       /* all */
+static void
+filter_now (EphyHistoryDialog *self)
+{
+  g_autoptr (EphyHistoryQuery) query = ephy_history_query_new ();
 
-  type = EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED;
+  query->substring_list = substrings_filter (self);
 
   remove_pending_sorter_source (self, TRUE);
+  cancel_page_fetch (self);
 
-  ephy_history_service_find_urls (self->history_service,
-                                  from, to,
-                                  -1, 0,
-                                  substrings,
-                                  type,
-                                  self->cancellable,
-                                  (GAsyncReadyCallback)on_find_urls_cb, self);
+  /* The rows shown so far stay until the first page of the new cursor
+   * replaces them. */
+  g_clear_pointer (&self->cursor, ephy_history_cursor_unref);
+  self->cursor = ephy_history_cursor_new (query, NUM_FETCH_LIMIT);
+  self->page_cancellable = g_cancellable_new ();
+  self->clear_on_next_page = TRUE;
+
+  if (self->history_service)
+    fetch_next_page (self);
 }
 
 static GList *
@@ -584,7 +623,7 @@ add_urls_source (EphyHistoryDialog *self)
   if (!has_results)
     set_has_data (self, FALSE);
 
-  if (!self->urls || !self->num_fetch) {
+  if (!self->urls) {
     self->sorter_source = 0;
     gtk_widget_queue_draw (self->listbox);
 
@@ -608,35 +647,43 @@ add_urls_source (EphyHistoryDialog *self)
   ephy_history_url_free (url);
   g_list_free_1 (element);
 
-  self->num_fetch--;
-
   if (prev_is_loading != self->is_loading ||
       prev_has_data != self->has_data ||
       prev_has_results != has_results)
     update_ui_state (self);
 
-  if (!self->num_fetch) {
-    self->sorter_source = 0;
-    return G_SOURCE_REMOVE;
-  }
-
   return G_SOURCE_CONTINUE;
 }
 
 static void
-confirmation_dialog_response_cb (EphyHistoryDialog *self)
+confirmation_dialog_response_cb (EphyHistoryDialog *self,
+                                 const char        *response,
+                                 AdwAlertDialog    *dialog)
 {
-  const char *search_text = gtk_editable_get_text (GTK_EDITABLE (self->search_entry));
+  GtkWidget *time_range_dropdown = adw_alert_dialog_get_extra_child (dialog);
   g_autoptr (GList) visible_rows = NULL;
   GtkListBoxRow *row;
   int i = 0;
   g_autolist (EphyHistoryURL) deleted_urls = NULL;
   GList *iter = NULL;
 
-  if (g_strcmp0 (search_text, "") == 0) {
-    ephy_history_service_clear (self->history_service,
-                                NULL, NULL, NULL);
-    ephy_snapshot_service_delete_all_snapshots (self->snapshot_service);
+  if (time_range_dropdown) {
+    guint selected = gtk_drop_down_get_selected (GTK_DROP_DOWN (time_range_dropdown));
+    GTimeSpan span = selected < G_N_ELEMENTS (clear_time_ranges) ? clear_time_ranges[selected].span : 0;
+
+    if (span == 0) {
+      ephy_history_service_clear (self->history_service,
+                                  NULL, NULL, NULL);
+      ephy_snapshot_service_delete_all_snapshots (self->snapshot_service);
+    } else {
+      gint64 now = g_get_real_time ();
+
+      /* The snapshots of the deleted URLs go away when the history service
+       * reports them as deleted. */
+      ephy_history_service_delete_visits_in_range (self->history_service,
+                                                   now - span, G_MAXINT64,
+                                                   NULL, NULL, NULL);
+    }
   } else {
     while ((row = gtk_list_box_get_row_at_index (GTK_LIST_BOX (self->listbox), i++)))
       visible_rows = g_list_prepend (visible_rows, row);
@@ -669,10 +716,7 @@ on_search_entry_changed (GtkSearchEntry    *search_entry,
 static void
 load_further_data (EphyHistoryDialog *self)
 {
-  remove_pending_sorter_source (self, FALSE);
-
-  self->num_fetch += NUM_FETCH_LIMIT;
-  self->sorter_source = g_idle_add ((GSourceFunc)add_urls_source, self);
+  fetch_next_page (self);
 }
 
 static gboolean
@@ -844,6 +888,8 @@ ephy_history_dialog_dispose (GObject *object)
   g_clear_object (&self->history_service);
 
   remove_pending_sorter_source (self, TRUE);
+  cancel_page_fetch (self);
+  g_clear_pointer (&self->cursor, ephy_history_cursor_unref);
 
   G_OBJECT_CLASS (ephy_history_dialog_parent_class)->dispose (object);
 }
@@ -864,10 +910,26 @@ static void
 on_clear_button_clicked (GtkButton         *button,
                          EphyHistoryDialog *self)
 {
+  const char *search_text = gtk_editable_get_text (GTK_EDITABLE (self->search_entry));
   AdwDialog *dialog;
 
-  dialog = adw_alert_dialog_new (_("Clear Browsing History?"),
-                                 _("All visible links will be permanently deleted"));
+  if (g_strcmp0 (search_text, "") == 0) {
+    GtkStringList *time_ranges = gtk_string_list_new (NULL);
+    GtkWidget *time_range_dropdown;
+
+    for (guint i = 0; i < G_N_ELEMENTS (clear_time_ranges); i++)
+      gtk_string_list_append (time_ranges, _(clear_time_ranges[i].label));
+
+    dialog = adw_alert_dialog_new (_("Clear Browsing History?"),
+                                   _("History from the selected time range will be permanently deleted"));
+
+    time_range_dropdown = gtk_drop_down_new (G_LIST_MODEL (time_ranges), NULL);
+    gtk_drop_down_set_selected (GTK_DROP_DOWN (time_range_dropdown), G_N_ELEMENTS (clear_time_ranges) - 1);
+    adw_alert_dialog_set_extra_child (ADW_ALERT_DIALOG (dialog), time_range_dropdown);
+  } else {
+    dialog = adw_alert_dialog_new (_("Clear Browsing History?"),
+                                   _("All visible links will be permanently deleted"));
+  }
 
   adw_alert_dialog_add_responses (ADW_ALERT_DIALOG (dialog),
                                   "cancel", _("_Cancel"),
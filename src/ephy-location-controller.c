@@ -32,6 +32,8 @@
 #include "ephy-embed-utils.h"
 #include "ephy-link.h"
 #include "ephy-location-entry.h"
+#include "ephy-prefs.h"
+#include "ephy-settings.h"
 #include "ephy-shell.h"
 #include "ephy-suggestion-model.h"
 #include "ephy-title-widget.h"
@@ -238,6 +240,43 @@ get_title_cb (EphyLocationEntry      *entry,
   return g_strdup (ephy_embed_get_title (embed));
 }
 
+static void
+preconnect_cb (EphySearchSuggestionsCache *cache,
+               GAsyncResult               *result,
+               gpointer                    user_data)
+{
+  g_autoptr (GError) error = NULL;
+
+  if (!ephy_search_suggestions_cache_preconnect_finish (cache, result, &error))
+    LOG ("Failed to preconnect to the search suggestions server: %s", error->message);
+}
+
+/* The user is likely about to type a search, so warm up the connection to
+ * the suggestions server while they do. */
+static void
+preconnect_search_suggestions (void)
+{
+  EphyEmbedShell *shell = ephy_embed_shell_get_default ();
+  EphyEmbedShellMode mode = ephy_embed_shell_get_mode (shell);
+  EphySearchEngineManager *manager;
+  EphySearchEngine *engine;
+
+  if (mode == EPHY_EMBED_SHELL_MODE_PRIVATE || mode == EPHY_EMBED_SHELL_MODE_INCOGNITO)
+    return;
+
+  if (!g_settings_get_boolean (EPHY_SETTINGS_MAIN, EPHY_PREFS_USE_SEARCH_SUGGESTIONS))
+    return;
+
+  manager = ephy_embed_shell_get_search_engine_manager (shell);
+  engine = ephy_search_engine_manager_get_default_engine (manager);
+  if (!ephy_search_engine_get_suggestions_url (engine))
+    return;
+
+  ephy_search_suggestions_cache_preconnect_async (ephy_embed_shell_get_search_suggestions_cache (shell),
+                                                  engine, NULL,
+                                                  (GAsyncReadyCallback)preconnect_cb, NULL);
+}
+
 static void
 focus_enter_cb (EphyLocationController *controller)
 {
@@ -250,6 +289,9 @@ focus_enter_cb (EphyLocationController *controller)
     controller->sync_address_is_blocked = TRUE;
     g_signal_handlers_block_by_func (controller, G_CALLBACK (sync_address), controller->title_widget);
   }
+
+  if (controller->editable)
+    preconnect_search_suggestions ();
 }
 
 static void
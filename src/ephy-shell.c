@@ -73,6 +73,7 @@ struct _EphyShell {
   EphyShellStartupContext *local_startup_context;
   EphyShellStartupContext *remote_startup_context;
   GSList *open_uris_idle_ids;
+  guint update_retained_urls_id;
   EphyWebApplication *webapp;
 
   gchar *open_notification_id;
@@ -564,6 +565,67 @@ run_in_background_set_mapping (const GValue       *value,
   return g_variant_new_boolean (g_variant_get_boolean (var));
 }
 
+static gboolean
+update_history_retained_urls (EphyShell *shell)
+{
+  EphyEmbedShell *embed_shell = EPHY_EMBED_SHELL (shell);
+  EphyHistoryService *service = ephy_embed_shell_get_global_history_service (embed_shell);
+  GSequence *bookmarks = ephy_bookmarks_manager_get_bookmarks (ephy_shell_get_bookmarks_manager (shell));
+  g_autoptr (GPtrArray) urls = g_ptr_array_new ();
+
+  shell->update_retained_urls_id = 0;
+
+  /* Bookmarked pages are never removed by history expiry. */
+  for (GSequenceIter *iter = g_sequence_get_begin_iter (bookmarks);
+       !g_sequence_iter_is_end (iter);
+       iter = g_sequence_iter_next (iter))
+    g_ptr_array_add (urls, (char *)ephy_bookmark_get_url (g_sequence_get (iter)));
+  g_ptr_array_add (urls, NULL);
+
+  ephy_history_service_set_retained_urls (service, (const char * const *)urls->pdata);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+bookmarks_changed_cb (EphyShell *shell)
+{
+  /* Importing or syncing adds bookmarks one at a time. */
+  if (!shell->update_retained_urls_id)
+    shell->update_retained_urls_id = g_idle_add ((GSourceFunc)update_history_retained_urls, shell);
+}
+
+static void
+update_history_retention_policy (EphyShell *shell)
+{
+  EphyHistoryService *service = ephy_embed_shell_get_global_history_service (EPHY_EMBED_SHELL (shell));
+
+  ephy_history_service_set_retention_policy (service,
+                                             MIN (g_settings_get_uint (EPHY_SETTINGS_MAIN, EPHY_PREFS_HISTORY_MAX_AGE), G_MAXINT),
+                                             MIN (g_settings_get_uint (EPHY_SETTINGS_MAIN, EPHY_PREFS_HISTORY_MAX_VISITS), G_MAXINT));
+}
+
+static void
+setup_history_retention (EphyShell *shell)
+{
+  EphyBookmarksManager *manager = ephy_shell_get_bookmarks_manager (shell);
+
+  g_signal_connect_object (manager, "bookmark-added",
+                           G_CALLBACK (bookmarks_changed_cb), shell, G_CONNECT_SWAPPED);
+  g_signal_connect_object (manager, "bookmark-removed",
+                           G_CALLBACK (bookmarks_changed_cb), shell, G_CONNECT_SWAPPED);
+  g_signal_connect_object (manager, "bookmark-url-changed",
+                           G_CALLBACK (bookmarks_changed_cb), shell, G_CONNECT_SWAPPED);
+  g_signal_connect_object (EPHY_SETTINGS_MAIN, "changed::" EPHY_PREFS_HISTORY_MAX_AGE,
+                           G_CALLBACK (update_history_retention_policy), shell, G_CONNECT_SWAPPED);
+  g_signal_connect_object (EPHY_SETTINGS_MAIN, "changed::" EPHY_PREFS_HISTORY_MAX_VISITS,
+                           G_CALLBACK (update_history_retention_policy), shell, G_CONNECT_SWAPPED);
+
+  /* The retained URLs must be known before anything can expire. */
+  update_history_retained_urls (shell);
+  update_history_retention_policy (shell);
+}
+
 static void
 ephy_shell_startup (GApplication *application)
 {
@@ -635,6 +697,8 @@ ephy_shell_startup (GApplication *application)
         /* Create the sync service. */
         ephy_shell_get_sync_service (shell);
       }
+
+      setup_history_retention (shell);
     }
 
     /* Actions that are disabled in app mode */
@@ -1044,6 +1108,7 @@ ephy_shell_dispose (GObject *object)
   }
 
   g_clear_slist (&shell->open_uris_idle_ids, remove_open_uris_idle_cb);
+  g_clear_handle_id (&shell->update_retained_urls_id, g_source_remove);
 
 #if USE_GRANITE
   g_clear_object (&shell->style_provider);
@@ -29,11 +29,25 @@
 #include "ephy-search-engine-manager.h"
 #include "ephy-settings.h"
 #include "ephy-suggestion.h"
-#include "ephy-user-agent.h"
+#include "ephy-suggestion-index.h"
 #include "ephy-window.h"
 
 #define MAX_SEARCH_ENGINES_SUGGESTIONS 5
 #define MAX_URL_ENTRIES             25
+#define MAX_BANG_COMPLETIONS        5
+
+/* The candidates that matched the previous query. As long as the user keeps
+ * typing, every new query extends the previous one and can only match a
+ * subset of them. */
+typedef struct {
+  char *query; /* Casefolded */
+  GPtrArray *entries; /* Every match, ordered by rank */
+  gboolean complete; /* Whether no entry outside of the set can match, so refining is safe */
+} CandidateSet;
+
+typedef struct _QueryData QueryData;
+
+static void query_data_unref (QueryData *data);
 
 struct _EphySuggestionModel {
   GObject parent;
@@ -43,7 +57,18 @@ struct _EphySuggestionModel {
   GSequence *items;
   GCancellable *icon_cancellable;
   guint num_custom_entries;
-  SoupSession *session;
+
+  EphyHistoryIndex *history_index;
+
+  GHashTable *bookmark_entries; /* EphyBookmark -> EphySuggestionIndexEntry */
+  DzlFuzzyMutableIndex *bookmark_index;
+  guint bookmark_index_rebuild_id;
+
+  CandidateSet *history_candidates;
+  CandidateSet *bookmark_candidates;
+
+  QueryData *shown_query; /* Whose results the model holds */
+  guint query_serial;
 };
 
 #define QUERY_SCOPE_ALL         ' '
@@ -65,16 +90,178 @@ G_DEFINE_FINAL_TYPE_WITH_CODE (EphySuggestionModel, ephy_suggestion_model, G_TYP
 
 static GParamSpec *properties[PROP_HISTORY_SERVICE + 1];
 
+static CandidateSet *
+candidate_set_new (const char *query,
+                   GPtrArray  *entries,
+                   gboolean    complete)
+{
+  CandidateSet *set = g_new (CandidateSet, 1);
+
+  set->query = g_strdup (query);
+  set->entries = g_ptr_array_ref (entries);
+  set->complete = complete;
+
+  return set;
+}
+
+static void
+candidate_set_free (CandidateSet *set)
+{
+  g_free (set->query);
+  g_ptr_array_unref (set->entries);
+  g_free (set);
+}
+
+/* Narrows @set down to the matches of @query, or returns %NULL if @query
+ * does not extend the query the set was made for. The result keeps the
+ * set's rank order, and is complete if the set was. */
+static GPtrArray *
+refine_candidate_set (CandidateSet  *set,
+                      const char    *query,
+                      char         **terms)
+{
+  GPtrArray *results;
+
+  if (!set || !g_str_has_prefix (query, set->query))
+    return NULL;
+
+  results = g_ptr_array_new_with_free_func ((GDestroyNotify)ephy_suggestion_index_entry_unref);
+  for (guint i = 0; i < set->entries->len; i++) {
+    EphySuggestionIndexEntry *entry = g_ptr_array_index (set->entries, i);
+
+    if (ephy_suggestion_index_entry_matches (entry, terms))
+      g_ptr_array_add (results, ephy_suggestion_index_entry_ref (entry));
+  }
+
+  return results;
+}
+
+static void
+history_index_changed_cb (EphySuggestionModel *self)
+{
+  g_clear_pointer (&self->history_candidates, candidate_set_free);
+}
+
+static gboolean
+rebuild_bookmark_index (gpointer user_data)
+{
+  EphySuggestionModel *self = EPHY_SUGGESTION_MODEL (user_data);
+  GSequence *bookmarks;
+  GSequenceIter *iter;
+  int rank = 0;
+
+  bookmarks = ephy_bookmarks_manager_get_bookmarks (self->bookmarks_manager);
+
+  g_hash_table_remove_all (self->bookmark_entries);
+  for (iter = g_sequence_get_begin_iter (bookmarks);
+       !g_sequence_iter_is_end (iter);
+       iter = g_sequence_iter_next (iter)) {
+    EphyBookmark *bookmark = g_sequence_get (iter);
+    g_autoptr (GStrvBuilder) builder = g_strv_builder_new ();
+    g_auto (GStrv) tags = NULL;
+    g_autofree char *tag_string = NULL;
+    const char *url, *title;
+
+    url = ephy_bookmark_get_url (bookmark);
+    title = ephy_bookmark_get_title (bookmark);
+    if (strlen (title) == 0)
+      title = url;
+
+    for (GSequenceIter *tag_iter = g_sequence_get_begin_iter (ephy_bookmark_get_tags (bookmark));
+         !g_sequence_iter_is_end (tag_iter);
+         tag_iter = g_sequence_iter_next (tag_iter)) {
+      g_strv_builder_add (builder, g_sequence_get (tag_iter));
+    }
+
+    tags = g_strv_builder_end (builder);
+    tag_string = g_strjoinv (" ", tags);
+
+    g_hash_table_insert (self->bookmark_entries, bookmark,
+                         ephy_suggestion_index_entry_new (url, title, tag_string, rank++));
+  }
+
+  g_clear_pointer (&self->bookmark_index, dzl_fuzzy_mutable_index_unref);
+  self->bookmark_index = ephy_suggestion_index_build (self->bookmark_entries);
+  self->bookmark_index_rebuild_id = 0;
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+bookmarks_changed_cb (EphySuggestionModel *self)
+{
+  g_clear_pointer (&self->bookmark_candidates, candidate_set_free);
+
+  if (self->bookmark_index_rebuild_id == 0)
+    self->bookmark_index_rebuild_id = g_idle_add (rebuild_bookmark_index, self);
+}
+
+static void
+bookmark_removed_cb (EphyBookmarksManager *manager,
+                     EphyBookmark         *bookmark,
+                     EphySuggestionModel  *self)
+{
+  /* Stop suggesting it right away, the rebuild can wait. */
+  g_hash_table_remove (self->bookmark_entries, bookmark);
+  bookmarks_changed_cb (self);
+}
+
+static void
+ephy_suggestion_model_constructed (GObject *object)
+{
+  EphySuggestionModel *self = EPHY_SUGGESTION_MODEL (object);
+  const char * const bookmark_signals[] = {
+    "bookmark-added",
+    "bookmark-title-changed",
+    "bookmark-url-changed",
+    "bookmark-tag-added",
+    "bookmark-tag-removed",
+  };
+
+  G_OBJECT_CLASS (ephy_suggestion_model_parent_class)->constructed (object);
+
+  /* Every window shares the shell's index, which follows the history
+   * service by itself. */
+  self->history_index = g_object_ref (ephy_embed_shell_get_history_index (ephy_embed_shell_get_default ()));
+  g_signal_connect_object (self->history_index, "changed",
+                           G_CALLBACK (history_index_changed_cb), self, G_CONNECT_SWAPPED);
+
+  for (guint i = 0; i < G_N_ELEMENTS (bookmark_signals); i++) {
+    g_signal_connect_object (self->bookmarks_manager, bookmark_signals[i],
+                             G_CALLBACK (bookmarks_changed_cb), self, G_CONNECT_SWAPPED);
+  }
+  g_signal_connect_object (self->bookmarks_manager, "bookmark-removed",
+                           G_CALLBACK (bookmark_removed_cb), self, 0);
+
+  rebuild_bookmark_index (self);
+}
+
+static void
+ephy_suggestion_model_dispose (GObject *object)
+{
+  EphySuggestionModel *self = (EphySuggestionModel *)object;
+
+  g_clear_handle_id (&self->bookmark_index_rebuild_id, g_source_remove);
+
+  G_OBJECT_CLASS (ephy_suggestion_model_parent_class)->dispose (object);
+}
+
 static void
 ephy_suggestion_model_finalize (GObject *object)
 {
   EphySuggestionModel *self = (EphySuggestionModel *)object;
 
+  g_clear_object (&self->history_index);
+  g_clear_pointer (&self->bookmark_index, dzl_fuzzy_mutable_index_unref);
+  g_clear_pointer (&self->bookmark_entries, g_hash_table_unref);
+  g_clear_pointer (&self->history_candidates, candidate_set_free);
+  g_clear_pointer (&self->bookmark_candidates, candidate_set_free);
+  g_clear_pointer (&self->shown_query, query_data_unref);
+
   g_clear_object (&self->bookmarks_manager);
   g_clear_object (&self->history_service);
   g_clear_pointer (&self->urls, g_sequence_free);
   g_clear_pointer (&self->items, g_sequence_free);
-  g_clear_object (&self->session);
 
   g_cancellable_cancel (self->icon_cancellable);
   g_clear_object (&self->icon_cancellable);
@@ -123,6 +310,8 @@ ephy_suggestion_model_class_init (EphySuggestionModelClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+  object_class->constructed = ephy_suggestion_model_constructed;
+  object_class->dispose = ephy_suggestion_model_dispose;
   object_class->finalize = ephy_suggestion_model_finalize;
   object_class->get_property = ephy_suggestion_model_get_property;
   object_class->set_property = ephy_suggestion_model_set_property;
@@ -131,13 +320,13 @@ ephy_suggestion_model_class_init (EphySuggestionModelClass *klass)
     g_param_spec_object ("bookmarks-manager",
                          NULL, NULL,
                          EPHY_TYPE_BOOKMARKS_MANAGER,
-                         (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+                         (G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
 
   properties [PROP_HISTORY_SERVICE] =
     g_param_spec_object ("history-service",
                          NULL, NULL,
                          EPHY_TYPE_HISTORY_SERVICE,
-                         (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+                         (G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
 
   g_object_class_install_properties (object_class, G_N_ELEMENTS (properties), properties);
 }
@@ -146,7 +335,8 @@ static void
 ephy_suggestion_model_init (EphySuggestionModel *self)
 {
   self->items = g_sequence_new (g_object_unref);
-  self->session = soup_session_new_with_options ("user-agent", ephy_user_agent_get (), NULL);
+  self->bookmark_entries = g_hash_table_new_full (NULL, NULL,
+                                                  NULL, (GDestroyNotify)ephy_suggestion_index_entry_release);
 }
 
 static GType
@@ -200,50 +390,6 @@ ephy_suggestion_model_new (EphyHistoryService   *history_service,
                        NULL);
 }
 
-static gboolean
-should_add_bookmark_to_model (EphySuggestionModel *self,
-                              const char          *search_string,
-                              const char          *title,
-                              const char          *location,
-                              GSequence           *tags)
-{
-  g_autofree gchar *search_casefold = g_utf8_casefold (search_string, -1);
-  g_autofree gchar *title_casefold = g_utf8_casefold (title, -1);
-  g_autofree gchar *location_casefold = g_utf8_casefold (location, -1);
-  g_autofree char *tag_string = NULL;
-  g_autofree char *tag_string_casefold = NULL;
-  char **tag_array = NULL;
-  g_auto (GStrv) search_terms = NULL;
-  GSequenceIter *tag_iter;
-  guint i;
-  gboolean ret = TRUE;
-
-  tag_array = g_malloc0 ((g_sequence_get_length (tags) + 1) * sizeof (char *));
-
-  for (i = 0, tag_iter = g_sequence_get_begin_iter (tags);
-       !g_sequence_iter_is_end (tag_iter);
-       i++, tag_iter = g_sequence_iter_next (tag_iter)) {
-    tag_array[i] = g_sequence_get (tag_iter);
-  }
-
-  tag_string = g_strjoinv (" ", tag_array);
-  tag_string_casefold = g_utf8_casefold (tag_string, -1);
-  search_terms = g_strsplit (search_casefold, " ", -1);
-
-  for (i = 0; i < g_strv_length (search_terms); i++) {
-    if (!strstr (title_casefold, search_terms[i]) &&
-        !strstr (location_casefold, search_terms[i]) &&
-        (tag_string_casefold && !strstr (tag_string_casefold, search_terms[i]))) {
-      ret = FALSE;
-      break;
-    }
-  }
-
-  g_free (tag_array);
-
-  return ret;
-}
-
 static void
 icon_loaded_cb (GObject      *source,
                 GAsyncResult *result,
@@ -354,16 +500,65 @@ add_search_engines (EphySuggestionModel *self,
   return added;
 }
 
-typedef struct {
+static guint
+add_bang_completions (EphySuggestionModel *self,
+                      const char          *query)
+{
+  EphyEmbedShell *shell;
+  EphySearchEngineManager *manager;
+  g_autoptr (GPtrArray) engines = NULL;
+  guint added = 0;
+
+  /* Only offer to complete a bang while it is the only word typed. */
+  if (strchr (query, ' '))
+    return 0;
+
+  shell = ephy_embed_shell_get_default ();
+  manager = ephy_embed_shell_get_search_engine_manager (shell);
+  engines = ephy_search_engine_manager_complete_bang (manager, query);
+
+  for (guint i = 0; i < engines->len && added < MAX_BANG_COMPLETIONS; i++) {
+    EphySearchEngine *engine = g_ptr_array_index (engines, i);
+    const char *bang = ephy_search_engine_get_bang (engine);
+    EphySuggestion *suggestion;
+    g_autofree char *title = NULL;
+    g_autofree char *escaped_title = NULL;
+    g_autofree char *markup = NULL;
+    g_autofree char *completion = NULL;
+    g_autofree char *address = NULL;
+
+    /* Translators: a search engine bang suggestion, the first %s is the
+     * bang (e.g. "!ddg") and the second one the search engine's name. */
+    title = g_strdup_printf (_("%s — %s"), bang, ephy_search_engine_get_name (engine));
+    escaped_title = g_markup_escape_text (title, -1);
+    markup = dzl_fuzzy_highlight (escaped_title, query, FALSE);
+
+    /* Selecting it completes the bang, so that the search can be typed right away. */
+    completion = g_strconcat (bang, " ", NULL);
+    address = ephy_search_engine_build_search_address (engine, "");
+    suggestion = ephy_suggestion_new (markup, completion, address, TRUE);
+    ephy_suggestion_set_icon (suggestion, "ephy-loupe-plus-symbolic");
+
+    g_sequence_append (self->items, suggestion);
+    added++;
+  }
+
+  return added;
+}
+
+struct _QueryData {
   char *query;
+  char *query_casefold;
+  char **terms;
   char scope;
   gboolean include_search_engines;
+  guint serial;
   GSequence *tabs;
   GSequence *bookmarks;
   GSequence *history;
   GSequence *search_engine_suggestions;
   int active_sources;
-} QueryData;
+};
 
 static QueryData *
 query_data_new (const char *query,
@@ -371,7 +566,7 @@ query_data_new (const char *query,
 {
   QueryData *data;
 
-  data = g_new0 (QueryData, 1);
+  data = g_rc_box_new0 (QueryData);
   data->include_search_engines = include_search_engines;
   data->tabs = g_sequence_new (g_object_unref);
   data->bookmarks = g_sequence_new (g_object_unref);
@@ -393,35 +588,43 @@ query_data_new (const char *query,
     data->active_sources = MAX_QUERY_SCOPES;
   }
 
+  data->query_casefold = g_utf8_casefold (data->query, -1);
+  data->terms = g_strsplit (data->query_casefold, " ", -1);
+
   return data;
 }
 
 static void
-query_data_free (QueryData *data)
+query_data_clear (QueryData *data)
 {
-  g_assert (data);
   g_clear_pointer (&data->tabs, g_sequence_free);
   g_clear_pointer (&data->bookmarks, g_sequence_free);
   g_clear_pointer (&data->history, g_sequence_free);
   g_clear_pointer (&data->search_engine_suggestions, g_sequence_free);
   g_clear_pointer (&data->query, g_free);
-  g_free (data);
+  g_clear_pointer (&data->query_casefold, g_free);
+  g_clear_pointer (&data->terms, g_strfreev);
+}
+
+static QueryData *
+query_data_ref (QueryData *data)
+{
+  return g_rc_box_acquire (data);
 }
 
 static void
-query_collection_done (EphySuggestionModel *self,
-                       GTask               *task)
+query_data_unref (QueryData *data)
+{
+  g_rc_box_release_full (data, (GDestroyNotify)query_data_clear);
+}
+
+static void
+show_query_results (EphySuggestionModel *self,
+                    QueryData           *data)
 {
-  QueryData *data;
   guint removed;
   guint added = 0;
 
-  self = g_task_get_source_object (task);
-  data = g_task_get_task_data (task);
-
-  if (--data->active_sources)
-    return;
-
   g_cancellable_cancel (self->icon_cancellable);
   g_clear_object (&self->icon_cancellable);
 
@@ -437,12 +640,16 @@ query_collection_done (EphySuggestionModel *self,
 
   if (strlen (data->query) > 0) {
     /* Search results have the following order:
+     * - Bang completions
      * - Open Tabs
      * - Search Suggestions
      * - Bookmarks
      * - History
      * - Search Engines
      */
+    if (data->scope == QUERY_SCOPE_ALL && data->include_search_engines)
+      added += add_bang_completions (self, data->query);
+
     for (GSequenceIter *iter = g_sequence_get_begin_iter (data->tabs); !g_sequence_iter_is_end (iter); iter = g_sequence_iter_next (iter)) {
       EphySuggestion *tmp = g_sequence_get (iter);
 
@@ -482,11 +689,116 @@ query_collection_done (EphySuggestionModel *self,
   }
 
   g_list_model_items_changed (G_LIST_MODEL (self), 0, removed, added);
+}
+
+static void
+query_collection_done (EphySuggestionModel *self,
+                       GTask               *task)
+{
+  QueryData *data;
+
+  self = g_task_get_source_object (task);
+  data = g_task_get_task_data (task);
+
+  if (--data->active_sources)
+    return;
+
+  /* A newer query has been started since, don't let this one replace its
+   * results if it finishes last. */
+  if (data->serial == self->query_serial) {
+    g_clear_pointer (&self->shown_query, query_data_unref);
+    self->shown_query = query_data_ref (data);
+    show_query_results (self, data);
+  }
 
   g_task_return_boolean (task, TRUE);
   g_object_unref (task);
 }
 
+/* The casefolded title and address of an open tab, kept on its web view
+ * so that matching the tabs does not casefold all of them on every
+ * keystroke. */
+typedef struct {
+  char *text; /* NULL when it needs to be computed again */
+} TabKey;
+
+static void
+tab_key_free (TabKey *key)
+{
+  g_free (key->text);
+  g_free (key);
+}
+
+static void
+tab_key_invalidate (EphyWebView *webview,
+                    GParamSpec  *pspec,
+                    TabKey      *key)
+{
+  g_clear_pointer (&key->text, g_free);
+}
+
+static const char *
+get_tab_key (EphyWebView *webview)
+{
+  static GQuark tab_key_quark = 0;
+  TabKey *key;
+
+  if (G_UNLIKELY (tab_key_quark == 0))
+    tab_key_quark = g_quark_from_static_string ("ephy-suggestion-model-tab-key");
+
+  key = g_object_get_qdata (G_OBJECT (webview), tab_key_quark);
+  if (!key) {
+    key = g_new0 (TabKey, 1);
+    g_object_set_qdata_full (G_OBJECT (webview), tab_key_quark, key, (GDestroyNotify)tab_key_free);
+    g_signal_connect (webview, "notify::title", G_CALLBACK (tab_key_invalidate), key);
+    g_signal_connect (webview, "notify::display-address", G_CALLBACK (tab_key_invalidate), key);
+  }
+
+  if (!key->text) {
+    const char *title = webkit_web_view_get_title (WEBKIT_WEB_VIEW (webview));
+    g_autofree char *text = NULL;
+
+    /* The query never contains a newline, so it cannot match across both. */
+    text = g_strconcat (title ? title : "", "\n", ephy_web_view_get_display_address (webview), NULL);
+    key->text = g_utf8_casefold (text, -1);
+  }
+
+  return key->text;
+}
+
+static EphySuggestion *
+create_tab_suggestion (EphyWebView *webview,
+                       const char  *query,
+                       int          tab_idx,
+                       guint        win_idx)
+{
+  EphySuggestion *suggestion;
+  g_autofree char *escaped_address = NULL;
+  g_autofree char *escaped_title = NULL;
+  g_autofree char *markup = NULL;
+  g_autofree char *address = NULL;
+  const char *title;
+
+  title = webkit_web_view_get_title (WEBKIT_WEB_VIEW (webview));
+  if (!title)
+    title = "";
+
+  escaped_address = g_markup_escape_text (ephy_web_view_get_display_address (webview), -1);
+  if (g_str_has_prefix (escaped_address, EPHY_ABOUT_SCHEME)) {
+    g_autofree char *pretty_address = g_strconcat ("about", escaped_address + EPHY_ABOUT_SCHEME_LEN, NULL);
+    g_free (escaped_address);
+    escaped_address = g_steal_pointer (&pretty_address);
+  }
+
+  address = g_strdup_printf ("ephy-tab://%d@%u", tab_idx, win_idx);
+  escaped_title = g_markup_escape_text (title, -1);
+  markup = dzl_fuzzy_highlight (escaped_title, query, FALSE);
+  suggestion = ephy_suggestion_new_with_custom_subtitle (markup, title, escaped_address, address);
+  ephy_suggestion_set_secondary_icon (suggestion, "go-jump-symbolic");
+
+  return suggestion;
+}
+
 static void
 tabs_query (EphySuggestionModel *self,
             QueryData           *data,
@@ -494,118 +806,145 @@ tabs_query (EphySuggestionModel *self,
 {
   GApplication *application;
   EphyEmbedShell *shell;
-  EphyWindow *window;
-  EphyTabView *tab_view;
   GList *windows;
-  gint n_pages, selected;
+  guint win_idx = 0;
 
   shell = ephy_embed_shell_get_default ();
   application = G_APPLICATION (shell);
   windows = gtk_application_get_windows (GTK_APPLICATION (application));
 
-  for (guint win_idx = 0; win_idx < g_list_length (windows); win_idx++) {
-    window = EPHY_WINDOW (g_list_nth_data (windows, win_idx));
-
-    tab_view = ephy_window_get_tab_view (window);
-    n_pages = ephy_tab_view_get_n_pages (tab_view);
-    selected = ephy_tab_view_get_selected_index (tab_view);
+  for (GList *l = windows; l; l = l->next, win_idx++) {
+    EphyTabView *tab_view = ephy_window_get_tab_view (EPHY_WINDOW (l->data));
+    int n_pages = ephy_tab_view_get_n_pages (tab_view);
+    int selected = ephy_tab_view_get_selected_index (tab_view);
 
     for (int i = 0; i < n_pages; i++) {
       EphyEmbed *embed;
       EphyWebView *webview;
-      EphySuggestion *suggestion;
-      g_autofree gchar *escaped_title = NULL;
-      g_autofree gchar *markup = NULL;
-      const gchar *display_address;
-      g_autofree gchar *address = NULL;
-      const gchar *title;
-      g_autofree gchar *title_casefold = NULL;
-      g_autofree gchar *display_address_casefold = NULL;
-      g_autofree gchar *query_casefold = NULL;
 
       if (win_idx == 0 && i == selected)
         continue;
 
       embed = EPHY_EMBED (ephy_tab_view_get_nth_page (tab_view, i));
       webview = ephy_embed_get_web_view (embed);
-      display_address = ephy_web_view_get_display_address (webview);
-      address = g_strdup_printf ("ephy-tab://%d@%d", i, win_idx);
-      title = webkit_web_view_get_title (WEBKIT_WEB_VIEW (webview));
 
-      display_address_casefold = g_utf8_casefold (display_address, -1);
-      query_casefold = g_utf8_casefold (data->query, -1);
-      if (!title)
-        title = "";
+      /* Only the matching tabs need a suggestion with markup. */
+      if (strstr (get_tab_key (webview), data->query_casefold))
+        g_sequence_append (data->tabs, create_tab_suggestion (webview, data->query, i, win_idx));
+    }
+  }
 
-      title_casefold = g_utf8_casefold (title, -1);
+  query_collection_done (self, g_steal_pointer (&task));
+}
 
-      if ((title_casefold && strstr (title_casefold, query_casefold)) || strstr (display_address_casefold, query_casefold)) {
-        char *escaped_address = g_markup_escape_text (display_address, -1);
+static void
+bookmarks_query (EphySuggestionModel *self,
+                 QueryData           *data,
+                 GTask               *task)
+{
+  g_autoptr (GPtrArray) entries = NULL;
 
-        if (g_str_has_prefix (escaped_address, EPHY_ABOUT_SCHEME)) {
-          g_autofree char *pretty_address = g_strconcat ("about", escaped_address + EPHY_ABOUT_SCHEME_LEN, NULL);
-          g_free (escaped_address);
-          escaped_address = g_steal_pointer (&pretty_address);
-        }
+  if (self->bookmark_index_rebuild_id != 0) {
+    g_clear_handle_id (&self->bookmark_index_rebuild_id, g_source_remove);
+    rebuild_bookmark_index (self);
+  }
+
+  entries = refine_candidate_set (self->bookmark_candidates, data->query_casefold, data->terms);
+  if (!entries)
+    entries = ephy_suggestion_index_lookup (self->bookmark_index, data->terms);
+  if (!entries) {
+    /* Nothing to narrow the bookmarks down with, so all of them match. */
+    entries = g_hash_table_get_values_as_ptr_array (self->bookmark_entries);
+    g_ptr_array_set_free_func (entries, (GDestroyNotify)ephy_suggestion_index_entry_unref);
+    for (guint i = 0; i < entries->len; i++)
+      ephy_suggestion_index_entry_ref (g_ptr_array_index (entries, i));
+    g_ptr_array_sort (entries, ephy_suggestion_index_entry_compare_rank);
+  }
 
-        escaped_title = g_markup_escape_text (title, -1);
-        markup = dzl_fuzzy_highlight (escaped_title, data->query, FALSE);
-        suggestion = ephy_suggestion_new_with_custom_subtitle (markup, title, escaped_address, address);
-        ephy_suggestion_set_secondary_icon (suggestion, "go-jump-symbolic");
+  g_clear_pointer (&self->bookmark_candidates, candidate_set_free);
+  self->bookmark_candidates = candidate_set_new (data->query_casefold, entries, TRUE);
 
-        g_sequence_append (data->tabs, g_object_ref (suggestion));
-      }
+  /* The candidates keep every match for refining, but only the best ranked
+   * ones are worth highlighting. */
+  for (guint i = 0; i < entries->len && i < MAX_URL_ENTRIES; i++) {
+    EphySuggestionIndexEntry *entry = g_ptr_array_index (entries, i);
+    EphySuggestion *suggestion;
+    g_autofree gchar *escaped_title = NULL;
+    g_autofree gchar *markup = NULL;
+    g_autofree gchar *pretty_url = NULL;
+    const char *url = entry->url;
+
+    if (g_str_has_prefix (url, EPHY_ABOUT_SCHEME)) {
+      pretty_url = g_strconcat ("about", url + EPHY_ABOUT_SCHEME_LEN, NULL);
+      url = pretty_url;
     }
+
+    escaped_title = g_markup_escape_text (entry->title, -1);
+    markup = dzl_fuzzy_highlight (escaped_title, data->query, FALSE);
+    suggestion = ephy_suggestion_new (markup, entry->title, url, FALSE);
+    ephy_suggestion_set_secondary_icon (suggestion, "ephy-starred-symbolic");
+
+    g_sequence_append (data->bookmarks, suggestion);
   }
 
   query_collection_done (self, g_steal_pointer (&task));
 }
 
 static void
-bookmarks_query (EphySuggestionModel *self,
-                 QueryData           *data,
-                 GTask               *task)
+append_history_suggestion (QueryData  *data,
+                           const char *url,
+                           const char *title)
 {
-  GSequence *bookmarks;
+  EphySuggestion *suggestion;
+  g_autofree gchar *escaped_title = NULL;
+  g_autofree gchar *markup = NULL;
 
-  bookmarks = ephy_bookmarks_manager_get_bookmarks (self->bookmarks_manager);
+  escaped_title = g_markup_escape_text (title, -1);
+  markup = dzl_fuzzy_highlight (escaped_title, data->query, FALSE);
+  suggestion = ephy_suggestion_new (markup, title, url, FALSE);
 
-  for (GSequenceIter *iter = g_sequence_get_begin_iter (bookmarks);
-       !g_sequence_iter_is_end (iter);
-       iter = g_sequence_iter_next (iter)) {
-    EphyBookmark *bookmark;
-    GSequence *tags;
-    const char *url, *title;
+  g_sequence_append (data->history, suggestion);
+}
 
-    bookmark = g_sequence_get (iter);
+/* Answers a history query from the previous query's candidates or from the
+ * in-memory index. Returns %FALSE when neither can tell for sure, because
+ * the index is not loaded yet or because URLs outside of it might match. */
+static gboolean
+history_index_query (EphySuggestionModel *self,
+                     QueryData           *data)
+{
+  g_autoptr (GPtrArray) entries = NULL;
+  gboolean complete;
 
-    url = ephy_bookmark_get_url (bookmark);
-    title = ephy_bookmark_get_title (bookmark);
-    if (strlen (title) == 0)
-      title = url;
+  entries = refine_candidate_set (self->history_candidates, data->query_casefold, data->terms);
+  if (entries) {
+    complete = self->history_candidates->complete;
+  } else {
+    if (!ephy_history_index_is_loaded (self->history_index))
+      return FALSE;
 
-    tags = ephy_bookmark_get_tags (bookmark);
-    if (should_add_bookmark_to_model (self, data->query, title, url, tags)) {
-      EphySuggestion *suggestion;
-      g_autofree gchar *escaped_title = NULL;
-      g_autofree gchar *markup = NULL;
-      g_autofree gchar *pretty_url = NULL;
+    entries = ephy_history_index_lookup (self->history_index, data->terms);
+    if (!entries)
+      return FALSE;
 
-      if (g_str_has_prefix (url, EPHY_ABOUT_SCHEME)) {
-        pretty_url = g_strconcat ("about", url + EPHY_ABOUT_SCHEME_LEN, NULL);
-        url = pretty_url;
-      }
+    complete = ephy_history_index_is_complete (self->history_index);
+  }
 
-      escaped_title = g_markup_escape_text (title, -1);
-      markup = dzl_fuzzy_highlight (escaped_title, data->query, FALSE);
-      suggestion = ephy_suggestion_new (markup, title, url, FALSE);
-      ephy_suggestion_set_secondary_icon (suggestion, "ephy-starred-symbolic");
+  g_clear_pointer (&self->history_candidates, candidate_set_free);
+  self->history_candidates = candidate_set_new (data->query_casefold, entries, complete);
 
-      g_sequence_append (data->bookmarks, g_object_ref (suggestion));
-    }
+  /* The candidates are the most frecent matches, so they have the right
+   * answer as long as there are enough of them. */
+  if (entries->len < MAX_URL_ENTRIES && !complete)
+    return FALSE;
+
+  for (guint i = 0; i < entries->len && i < MAX_URL_ENTRIES; i++) {
+    EphySuggestionIndexEntry *entry = g_ptr_array_index (entries, i);
+
+    append_history_suggestion (data, entry->url, entry->title);
   }
 
-  query_collection_done (self, g_steal_pointer (&task));
+  return TRUE;
 }
 
 static void
@@ -616,13 +955,13 @@ history_query_completed_cb (EphyHistoryService *service,
   GTask *task = user_data;
   EphySuggestionModel *self;
   QueryData *data;
-  g_autolist (EphyHistoryURL) urls = NULL;
+  g_autoptr (EphyHistoryURLTable) urls = NULL;
   g_autoptr (GError) error = NULL;
 
   self = g_task_get_source_object (task);
   data = g_task_get_task_data (task);
 
-  urls = ephy_history_service_find_urls_finish (service, result, &error);
+  urls = ephy_history_service_query_url_table_finish (service, result, &error);
   if (error) {
     if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
       g_warning ("Failed to query history suggestions: %s", error->message);
@@ -631,32 +970,46 @@ history_query_completed_cb (EphyHistoryService *service,
   }
 
   if (strlen (data->query) > 0) {
-    for (const GList *p = urls; p; p = p->next) {
-      EphyHistoryURL *url = (EphyHistoryURL *)p->data;
-      EphySuggestion *suggestion;
-      g_autofree gchar *escaped_title = NULL;
-      g_autofree gchar *markup = NULL;
-      const gchar *title = url->title;
+    g_autoptr (GPtrArray) entries = g_ptr_array_new_with_free_func ((GDestroyNotify)ephy_suggestion_index_entry_unref);
+    guint length = ephy_history_url_table_get_length (urls);
 
-      if (strlen (url->title) == 0)
-        title = url->url;
+    for (guint i = 0; i < length; i++) {
+      const gchar *url = ephy_history_url_table_get_url (urls, i);
+      const gchar *title = ephy_history_url_table_get_title (urls, i);
 
-      escaped_title = g_markup_escape_text (title, -1);
+      if (title[0] == '\0')
+        title = url;
 
-      markup = dzl_fuzzy_highlight (escaped_title, data->query, FALSE);
-      suggestion = ephy_suggestion_new (markup, title, url->url, FALSE);
-
-      g_sequence_append (data->history, g_steal_pointer (&suggestion));
+      append_history_suggestion (data, url, title);
+      g_ptr_array_add (entries, ephy_suggestion_index_entry_new (url, title, NULL, i));
     }
+
+    /* If the database had fewer matches than asked for, they are all of
+     * them, and refining this query will not need the database again. */
+    g_clear_pointer (&self->history_candidates, candidate_set_free);
+    self->history_candidates = candidate_set_new (data->query_casefold, entries,
+                                                  length < MAX_URL_ENTRIES);
   }
 
   query_collection_done (self, g_steal_pointer (&task));
 }
 
 static void
-search_engine_suggestions_loaded_cb (SoupSession  *session,
-                                     GAsyncResult *result,
-                                     gpointer      user_data)
+append_search_engine_suggestions (QueryData *data,
+                                  GSequence *suggestions)
+{
+  g_assert (g_sequence_get_length (data->search_engine_suggestions) == 0);
+  g_assert (suggestions);
+  /* Nicer than looping manually. */
+  g_sequence_move_range (g_sequence_get_end_iter (data->search_engine_suggestions),
+                         g_sequence_get_begin_iter (suggestions),
+                         g_sequence_get_iter_at_pos (suggestions, MAX_SEARCH_ENGINES_SUGGESTIONS));
+}
+
+static void
+search_engine_suggestions_loaded_cb (EphySearchSuggestionsCache *cache,
+                                     GAsyncResult               *result,
+                                     gpointer                    user_data)
 {
   GTask *task = G_TASK (user_data);
   EphySuggestionModel *self = g_task_get_source_object (task);
@@ -664,7 +1017,7 @@ search_engine_suggestions_loaded_cb (SoupSession  *session,
   g_autoptr (GError) error = NULL;
   QueryData *data = g_task_get_task_data (task);
 
-  suggestions = ephy_search_engine_load_suggestions_finish (result, &error);
+  suggestions = ephy_search_suggestions_cache_load_finish (cache, result, &error);
   if (error) {
     if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
       g_warning (_("Could not load search engines suggestions: %s"), error->message);
@@ -672,47 +1025,98 @@ search_engine_suggestions_loaded_cb (SoupSession  *session,
     return;
   }
 
-  g_assert (g_sequence_get_length (data->search_engine_suggestions) == 0);
-  g_assert (suggestions);
-  /* Nicer than looping manually. */
-  g_sequence_move_range (g_sequence_get_end_iter (data->search_engine_suggestions),
-                         g_sequence_get_begin_iter (suggestions),
-                         g_sequence_get_iter_at_pos (suggestions, MAX_SEARCH_ENGINES_SUGGESTIONS));
+  append_search_engine_suggestions (data, suggestions);
   query_collection_done (self, task);
 }
 
+typedef struct {
+  EphySuggestionModel *model;
+  QueryData *query;
+} RefinedSuggestionsData;
+
+static void
+refined_search_engine_suggestions_loaded_cb (EphySearchSuggestionsCache *cache,
+                                             GAsyncResult               *result,
+                                             RefinedSuggestionsData     *refined)
+{
+  EphySuggestionModel *self = refined->model;
+  QueryData *data = refined->query;
+  g_autoptr (GSequence) suggestions = NULL;
+  g_autoptr (GError) error = NULL;
+
+  suggestions = ephy_search_suggestions_cache_load_finish (cache, result, &error);
+
+  /* If the user is still looking at this query, replace the guess with the
+   * answer, and show it if the other results are in already. */
+  if (suggestions && data->serial == self->query_serial) {
+    g_sequence_remove_range (g_sequence_get_begin_iter (data->search_engine_suggestions),
+                             g_sequence_get_end_iter (data->search_engine_suggestions));
+    append_search_engine_suggestions (data, suggestions);
+
+    if (self->shown_query == data)
+      show_query_results (self, data);
+  } else if (error && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    g_warning (_("Could not load search engines suggestions: %s"), error->message);
+  }
+
+  g_object_unref (refined->model);
+  query_data_unref (refined->query);
+  g_free (refined);
+}
+
 static void
 search_engine_suggestions_query (EphySuggestionModel *self,
                                  const gchar         *query,
                                  GTask               *task)
 {
-  EphySearchEngineManager *manager = ephy_embed_shell_get_search_engine_manager (ephy_embed_shell_get_default ());
-  g_autofree char *built_suggestions_url = NULL;
+  EphyEmbedShell *shell = ephy_embed_shell_get_default ();
+  EphySearchEngineManager *manager = ephy_embed_shell_get_search_engine_manager (shell);
+  EphySearchSuggestionsCache *cache = ephy_embed_shell_get_search_suggestions_cache (shell);
+  g_autoptr (GSequence) suggestions = NULL;
+  g_autofree char *engine_query = NULL;
   EphySearchEngine *engine = NULL;
+  RefinedSuggestionsData *refined;
+  gboolean is_exact;
 
-  built_suggestions_url = ephy_search_engine_manager_parse_bang_suggestions (manager, query, &engine);
+  engine_query = ephy_search_engine_manager_parse_bang_suggestions_query (manager, query, &engine);
   /* If it was not a bang search, then use the default search engine. */
-  if (!built_suggestions_url) {
+  if (!engine_query) {
     engine = ephy_search_engine_manager_get_default_engine (manager);
-    if (!ephy_search_engine_get_suggestions_url (engine)) {
-      query_collection_done (self, task);
-      return;
-    }
+    engine_query = g_strdup (query);
+  }
 
-    built_suggestions_url = ephy_search_engine_build_suggestions_address (engine, query);
-  } else {
-    /* Finding a matching engine from the bang doesn't mean the engine has
-     * suggestions support, so make sure we stop here if it doesn't.
-     */
-    if (!ephy_search_engine_get_suggestions_url (engine)) {
-      query_collection_done (self, task);
-      return;
-    }
+  /* Finding a matching engine from the bang doesn't mean the engine has
+   * suggestions support, so make sure we stop here if it doesn't.
+   */
+  if (!ephy_search_engine_get_suggestions_url (engine)) {
+    query_collection_done (self, task);
+    return;
   }
-  ephy_search_engine_load_suggestions_async (built_suggestions_url, engine,
-                                             g_task_get_cancellable (task),
-                                             (GAsyncReadyCallback)search_engine_suggestions_loaded_cb,
-                                             task);
+
+  suggestions = ephy_search_suggestions_cache_lookup (cache, engine, engine_query, &is_exact);
+  if (!suggestions) {
+    ephy_search_suggestions_cache_load_async (cache, engine, engine_query,
+                                              g_task_get_cancellable (task),
+                                              (GAsyncReadyCallback)search_engine_suggestions_loaded_cb,
+                                              task);
+    return;
+  }
+
+  append_search_engine_suggestions (g_task_get_task_data (task), suggestions);
+  query_collection_done (self, task);
+
+  if (is_exact)
+    return;
+
+  /* What we have is the answer to a shorter query. Show it right away and
+   * load the real answer in the background. */
+  refined = g_new (RefinedSuggestionsData, 1);
+  refined->model = g_object_ref (self);
+  refined->query = query_data_ref (g_task_get_task_data (task));
+  ephy_search_suggestions_cache_load_async (cache, engine, engine_query,
+                                            g_task_get_cancellable (task),
+                                            (GAsyncReadyCallback)refined_search_engine_suggestions_loaded_cb,
+                                            refined);
 }
 
 void
@@ -735,7 +1139,8 @@ ephy_suggestion_model_query_async (EphySuggestionModel *self,
   g_task_set_source_tag (task, ephy_suggestion_model_query_async);
 
   data = query_data_new (query, include_search_engines);
-  g_task_set_task_data (task, data, (GDestroyNotify)query_data_free);
+  data->serial = ++self->query_serial;
+  g_task_set_task_data (task, data, (GDestroyNotify)query_data_unref);
 
   if (data->scope == QUERY_SCOPE_ALL || data->scope == QUERY_SCOPE_SUGGESTIONS) {
     gboolean is_possible_url = FALSE;
@@ -749,23 +1154,31 @@ ephy_suggestion_model_query_async (EphySuggestionModel *self,
       query_collection_done (self, task);
   }
 
-  if (data->scope == QUERY_SCOPE_ALL || data->scope == QUERY_SCOPE_HISTORY) {
-    GList *qlist = NULL;
+  if ((data->scope == QUERY_SCOPE_ALL || data->scope == QUERY_SCOPE_HISTORY) &&
+      history_index_query (self, data)) {
+    query_collection_done (self, task);
+  } else if (data->scope == QUERY_SCOPE_ALL || data->scope == QUERY_SCOPE_HISTORY) {
+    g_autoptr (EphyHistoryQuery) history_query = NULL;
     g_auto (GStrv) strings = NULL;
 
+    history_query = ephy_history_query_new ();
+    history_query->limit = MAX_URL_ENTRIES;
+    history_query->sort_type = EPHY_HISTORY_SORT_FRECENCY;
+
+    /* Every keystroke sends a new query, so let it replace the previous one
+     * if the history service has not got to that yet. */
+    history_query->supersede_key = g_strdup_printf ("suggestion-model-%p", self);
+
     strings = g_strsplit (data->query, " ", -1);
 
     for (guint i = 0; strings[i]; i++)
-      qlist = g_list_append (qlist, g_strdup (strings[i]));
-
-    ephy_history_service_find_urls (self->history_service,
-                                    0, 0,
-                                    MAX_URL_ENTRIES, 0,
-                                    qlist,
-                                    EPHY_HISTORY_SORT_MOST_VISITED,
-                                    cancellable,
-                                    (GAsyncReadyCallback)history_query_completed_cb,
-                                    task);
+      history_query->substring_list = g_list_append (history_query->substring_list, g_strdup (strings[i]));
+
+    ephy_history_service_query_url_table (self->history_service,
+                                          history_query,
+                                          cancellable,
+                                          (GAsyncReadyCallback)history_query_completed_cb,
+                                          task);
   }
 
   if (data->scope == QUERY_SCOPE_ALL || data->scope == QUERY_SCOPE_TABS)
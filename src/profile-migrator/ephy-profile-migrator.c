@@ -27,6 +27,7 @@
 
 #include "ephy-debug.h"
 #include "ephy-file-helpers.h"
+#include "ephy-history-types.h"
 #include "ephy-profile-utils.h"
 #include "ephy-settings.h"
 #include "ephy-sqlite-connection.h"
@@ -301,6 +302,261 @@ migrate_add_pinned_column (void)
   g_object_unref (db);
 }
 
+static void
+migrate_history_indexes (void)
+{
+  g_autofree char *filename = g_build_filename (ephy_default_profile_dir (), EPHY_HISTORY_FILE, NULL);
+  EphySQLiteConnection *db;
+  GError *error = NULL;
+
+  if (!g_file_test (filename, G_FILE_TEST_EXISTS))
+    return;
+
+  db = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READWRITE, filename);
+  if (!ephy_sqlite_connection_open (db, &error)) {
+    g_warning ("Failed to open history database: %s", error->message);
+    g_clear_error (&error);
+    g_object_unref (db);
+    return;
+  }
+
+  /* New databases get these from the history service when the tables are
+   * created, so only profiles created before that need them built here. */
+  ephy_sqlite_connection_execute (db,
+                                  "CREATE INDEX IF NOT EXISTS urls_url_index ON urls (url);"
+                                  "CREATE INDEX IF NOT EXISTS urls_host_index ON urls (host);"
+                                  "CREATE INDEX IF NOT EXISTS urls_last_visit_time_index ON urls (last_visit_time);"
+                                  "CREATE INDEX IF NOT EXISTS visits_url_visit_time_index ON visits (url, visit_time);"
+                                  "CREATE INDEX IF NOT EXISTS hosts_url_index ON hosts (url);"
+                                  "ANALYZE",
+                                  &error);
+  if (error) {
+    g_warning ("Failed to create history indexes: %s", error->message);
+    g_clear_error (&error);
+  }
+
+  ephy_sqlite_connection_close (db);
+  g_object_unref (db);
+}
+
+static void
+migrate_history_visit_time_index (void)
+{
+  g_autofree char *filename = g_build_filename (ephy_default_profile_dir (), EPHY_HISTORY_FILE, NULL);
+  EphySQLiteConnection *db;
+  GError *error = NULL;
+
+  if (!g_file_test (filename, G_FILE_TEST_EXISTS))
+    return;
+
+  db = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READWRITE, filename);
+  if (!ephy_sqlite_connection_open (db, &error)) {
+    g_warning ("Failed to open history database: %s", error->message);
+    g_clear_error (&error);
+    g_object_unref (db);
+    return;
+  }
+
+  /* History expiry deletes visits oldest first. The switch to incremental
+   * vacuum needs the whole file to be rewritten, so it is left to the
+   * history service, which does it when idle once expiry has freed enough
+   * space to be worth it. */
+  ephy_sqlite_connection_execute (db,
+                                  "CREATE INDEX IF NOT EXISTS visits_visit_time_index ON visits (visit_time)",
+                                  &error);
+  if (error) {
+    g_warning ("Failed to create history visit time index: %s", error->message);
+    g_clear_error (&error);
+  }
+
+  ephy_sqlite_connection_close (db);
+  g_object_unref (db);
+}
+
+static void
+migrate_history_frecency (void)
+{
+  g_autofree char *filename = g_build_filename (ephy_default_profile_dir (), EPHY_HISTORY_FILE, NULL);
+  g_autofree char *sql = NULL;
+  EphySQLiteConnection *db;
+  GError *error = NULL;
+  gint64 now = g_get_real_time ();
+
+  if (!g_file_test (filename, G_FILE_TEST_EXISTS))
+    return;
+
+  db = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READWRITE, filename);
+  if (!ephy_sqlite_connection_open (db, &error)) {
+    g_warning ("Failed to open history database: %s", error->message);
+    g_clear_error (&error);
+    g_object_unref (db);
+    return;
+  }
+
+  ephy_sqlite_connection_execute (db,
+                                  "ALTER TABLE urls ADD COLUMN frecency INTEGER DEFAULT 0 NOT NULL",
+                                  &error);
+  /* Ignore duplicate column errors — the column may already exist. */
+  g_clear_error (&error);
+
+  /* Score the existing visits the way the history service scores new ones.
+   * typed_count was never maintained before, so it is rebuilt first. Keep in
+   * sync with ephy_history_service_add_url_frecency() and
+   * ephy_history_service_rescore_range_urls(). */
+  sql = g_strdup_printf ("BEGIN TRANSACTION;"
+                         "UPDATE urls SET typed_count = "
+                         "(SELECT COUNT(*) FROM visits WHERE visits.url = urls.id AND visits.visit_type = %d);"
+                         "UPDATE urls SET frecency = IFNULL ((SELECT SUM ("
+                         "CASE "
+                         "WHEN %" G_GINT64_FORMAT " - visits.visit_time <= 4 * %" G_GINT64_FORMAT " THEN 100 "
+                         "WHEN %" G_GINT64_FORMAT " - visits.visit_time <= 14 * %" G_GINT64_FORMAT " THEN 70 "
+                         "WHEN %" G_GINT64_FORMAT " - visits.visit_time <= 31 * %" G_GINT64_FORMAT " THEN 50 "
+                         "WHEN %" G_GINT64_FORMAT " - visits.visit_time <= 90 * %" G_GINT64_FORMAT " THEN 30 "
+                         "ELSE 10 END * "
+                         "(CASE visits.visit_type WHEN %d THEN 200 WHEN %d THEN 140 WHEN %d THEN 50 ELSE 100 END + "
+                         "CASE WHEN urls.typed_count > 0 THEN 50 ELSE 0 END) / 100) "
+                         "FROM visits WHERE visits.url = urls.id), 0);"
+                         "CREATE INDEX IF NOT EXISTS urls_frecency_index ON urls (pinned DESC, frecency DESC);"
+                         "COMMIT",
+                         EPHY_PAGE_VISIT_TYPED,
+                         now, G_TIME_SPAN_DAY,
+                         now, G_TIME_SPAN_DAY,
+                         now, G_TIME_SPAN_DAY,
+                         now, G_TIME_SPAN_DAY,
+                         EPHY_PAGE_VISIT_TYPED, EPHY_PAGE_VISIT_BOOKMARK, EPHY_PAGE_VISIT_HOMEPAGE);
+  ephy_sqlite_connection_execute (db, sql, &error);
+  if (error) {
+    g_warning ("Failed to compute history frecency: %s", error->message);
+    g_clear_error (&error);
+    ephy_sqlite_connection_execute (db, "ROLLBACK", NULL);
+  }
+
+  ephy_sqlite_connection_close (db);
+  g_object_unref (db);
+}
+
+/* Ranks visit types from weakest to strongest, as frecency weighs them. Keep
+ * in sync with VISIT_TYPE_RANK in the history service. */
+#define VISIT_TYPE_RANK(type) \
+  "(CASE " type " WHEN %d THEN 4 WHEN %d THEN 3 WHEN %d THEN 2 WHEN %d THEN 1 ELSE 0 END)"
+#define VISIT_TYPE_RANK_ARGS \
+  EPHY_PAGE_VISIT_TYPED, EPHY_PAGE_VISIT_BOOKMARK, EPHY_PAGE_VISIT_LINK, EPHY_PAGE_VISIT_HOMEPAGE
+
+static void
+migrate_history_visit_rollups (void)
+{
+  g_autofree char *filename = g_build_filename (ephy_default_profile_dir (), EPHY_HISTORY_FILE, NULL);
+  g_autofree char *sql = NULL;
+  EphySQLiteConnection *db;
+  GError *error = NULL;
+  gint64 before = g_get_real_time () - 30 * G_TIME_SPAN_DAY;
+
+  if (!g_file_test (filename, G_FILE_TEST_EXISTS))
+    return;
+
+  db = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READWRITE, filename);
+  if (!ephy_sqlite_connection_open (db, &error)) {
+    g_warning ("Failed to open history database: %s", error->message);
+    g_clear_error (&error);
+    g_object_unref (db);
+    return;
+  }
+
+  /* Roll up the visits older than 30 days into one row per URL and day, as
+   * the history service does from now on. Keep in sync with
+   * ephy_history_service_initialize_visit_rollups_table() and
+   * ephy_history_service_roll_up_visit_rows(). */
+  sql = g_strdup_printf ("BEGIN TRANSACTION;"
+                         "CREATE TABLE IF NOT EXISTS visit_rollups ("
+                         "url INTEGER NOT NULL REFERENCES urls(id) ON DELETE CASCADE,"
+                         "day TEXT NOT NULL,"
+                         "visit_count INTEGER NOT NULL,"
+                         "first_visit_time INTEGER NOT NULL,"
+                         "last_visit_time INTEGER NOT NULL,"
+                         "visit_type INTEGER NOT NULL,"
+                         "PRIMARY KEY (url, day));"
+                         "CREATE INDEX IF NOT EXISTS visit_rollups_last_visit_time_index ON visit_rollups (last_visit_time);"
+                         "INSERT INTO visit_rollups "
+                         "(url, day, visit_count, first_visit_time, last_visit_time, visit_type) "
+                         "SELECT url, date (visit_time / 1000000, 'unixepoch', 'localtime'), "
+                         "COUNT(*), MIN(visit_time), MAX(visit_time), "
+                         "MAX(" VISIT_TYPE_RANK ("visit_type") " << 4 | visit_type) & 15 "
+                         "FROM visits WHERE visit_time < %" G_GINT64_FORMAT " "
+                         "GROUP BY url, date (visit_time / 1000000, 'unixepoch', 'localtime') "
+                         "ON CONFLICT (url, day) DO UPDATE SET "
+                         "visit_count = visit_count + excluded.visit_count, "
+                         "first_visit_time = MIN(first_visit_time, excluded.first_visit_time), "
+                         "last_visit_time = MAX(last_visit_time, excluded.last_visit_time), "
+                         "visit_type = CASE WHEN " VISIT_TYPE_RANK ("excluded.visit_type") " > " VISIT_TYPE_RANK ("visit_type") " "
+                         "THEN excluded.visit_type ELSE visit_type END;"
+                         "DELETE FROM visits WHERE visit_time < %" G_GINT64_FORMAT ";"
+                         "COMMIT;"
+                         "PRAGMA incremental_vacuum",
+                         VISIT_TYPE_RANK_ARGS, before,
+                         VISIT_TYPE_RANK_ARGS, VISIT_TYPE_RANK_ARGS,
+                         before);
+  ephy_sqlite_connection_execute (db, sql, &error);
+  if (error) {
+    g_warning ("Failed to roll up history visits: %s", error->message);
+    g_clear_error (&error);
+    ephy_sqlite_connection_execute (db, "ROLLBACK", NULL);
+  }
+
+  ephy_sqlite_connection_close (db);
+  g_object_unref (db);
+}
+
+static void
+migrate_history_search_index_trigger (void)
+{
+  g_autofree char *filename = g_build_filename (ephy_default_profile_dir (), EPHY_HISTORY_FILE, NULL);
+  EphySQLiteConnection *db;
+  GError *error = NULL;
+
+  if (!g_file_test (filename, G_FILE_TEST_EXISTS))
+    return;
+
+  db = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READWRITE, filename);
+  if (!ephy_sqlite_connection_open (db, &error)) {
+    g_warning ("Failed to open history database: %s", error->message);
+    g_clear_error (&error);
+    g_object_unref (db);
+    return;
+  }
+
+  /* The search index used to be rewritten on every visit, which sets the
+   * title even when it is unchanged. Only databases that have the index need
+   * the trigger, and those from before the backfill get an empty backfill
+   * table, which means that every URL is indexed. Keep in sync with
+   * ephy_history_service_initialize_url_search_index(). */
+  if (ephy_sqlite_connection_table_exists (db, "urls_fts")) {
+    ephy_sqlite_connection_execute (db,
+                                    "BEGIN TRANSACTION;"
+                                    "CREATE TABLE IF NOT EXISTS urls_fts_backfill ("
+                                    "next_id INTEGER NOT NULL,"
+                                    "last_id INTEGER NOT NULL);"
+                                    "DROP TRIGGER IF EXISTS urls_fts_update;"
+                                    "CREATE TRIGGER urls_fts_update AFTER UPDATE OF url, title ON urls "
+                                    "WHEN (old.url IS NOT new.url OR old.title IS NOT new.title) "
+                                    "AND NOT EXISTS (SELECT 1 FROM urls_fts_backfill WHERE old.id BETWEEN next_id AND last_id) BEGIN "
+                                    "INSERT INTO urls_fts (urls_fts, rowid, url, title) "
+                                    "VALUES ('delete', old.id, substr (old.url, instr (old.url, ':') + 1), old.title); "
+                                    "INSERT INTO urls_fts (rowid, url, title) "
+                                    "VALUES (new.id, substr (new.url, instr (new.url, ':') + 1), new.title); "
+                                    "END;"
+                                    "COMMIT",
+                                    &error);
+    if (error) {
+      g_warning ("Failed to update history search index trigger: %s", error->message);
+      g_clear_error (&error);
+      ephy_sqlite_connection_execute (db, "ROLLBACK", NULL);
+    }
+  }
+
+  ephy_sqlite_connection_close (db);
+  g_object_unref (db);
+}
+
 /* If adding anything here, you need to edit EPHY_PROFILE_MIGRATION_VERSION
  * in ephy-profile-utils.h. */
 const int EPHY_MINIMUM_MIGRATION_VERSION = 37;
@@ -310,6 +566,11 @@ const EphyProfileMigrator migrators[] = {
   /* 38 */ migrate_gsb_db,
   /* 39 */ migrate_search_engines,
   /* 40 */ migrate_add_pinned_column,
+  /* 41 */ migrate_history_indexes,
+  /* 42 */ migrate_history_visit_time_index,
+  /* 43 */ migrate_history_frecency,
+  /* 44 */ migrate_history_visit_rollups,
+  /* 45 */ migrate_history_search_index_trigger,
 };
 
 static gboolean
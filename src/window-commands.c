@@ -2999,7 +2999,9 @@ window_cmd_add_search_engine (GSimpleAction *action,
 
   autodiscovery_link = ephy_opensearch_autodiscovery_link_new (search_engine_info[0],
                                                                search_engine_info[1]);
-  ephy_opensearch_engine_load_from_link_async (autodiscovery_link, NULL,
+  ephy_opensearch_engine_load_from_link_async (autodiscovery_link,
+                                               ephy_embed_shell_get_soup_session (ephy_embed_shell_get_default ()),
+                                               NULL,
                                                (GAsyncReadyCallback)on_opensearch_engine_loaded,
                                                window);
 }
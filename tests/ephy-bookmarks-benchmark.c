@@ -0,0 +1,274 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2; -*- */
+/*
+ *  Copyright © 2026 Epiphany Developers
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measures merging synced bookmarks into a profile that already has as many
+ * local ones. A third of the remote bookmarks match a local one by ID, a
+ * third only by URL and the rest are new, which exercises every branch of
+ * the initial merge. A regular merge then updates every remote bookmark and
+ * deletes a tenth of them. The time taken is printed as JSON, so that
+ * results can be compared across releases.
+ *
+ * Run it with `meson test --benchmark`, or directly to change the scale:
+ *
+ *   benchmark-ephy-bookmarks --bookmarks 50000 --output results.json
+ */
+
+#include "config.h"
+
+#include <gtk/gtk.h>
+#include <json-glib/json-glib.h>
+
+#include "ephy-bookmarks-manager.h"
+#include "ephy-debug.h"
+#include "ephy-embed-shell.h"
+#include "ephy-file-helpers.h"
+#include "ephy-shell.h"
+#include "ephy-synchronizable-manager.h"
+
+static int n_bookmarks = 20000;
+static char *output_filename;
+
+static const GOptionEntry option_entries[] = {
+  { "bookmarks", 0, 0, G_OPTION_ARG_INT, &n_bookmarks, "Number of local and of remote bookmarks", "N" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_filename, "Write the results to FILE instead of standard output", "FILE" },
+  { NULL }
+};
+
+static double
+elapsed_ms (gint64 start_time)
+{
+  return (g_get_monotonic_time () - start_time) / 1000.0;
+}
+
+static char *
+local_url (int i)
+{
+  return g_strdup_printf ("https://example.com/local/%d", i);
+}
+
+static EphyBookmark *
+create_bookmark (const char *url,
+                 const char *id)
+{
+  return ephy_bookmark_new (url, url, g_sequence_new (g_free), id);
+}
+
+static void
+merge_cb (GPtrArray *to_upload,
+          guint     *n_to_upload)
+{
+  *n_to_upload = to_upload->len;
+  g_ptr_array_unref (to_upload);
+}
+
+static void
+add_result (JsonBuilder *builder,
+            const char  *name,
+            double       ms,
+            gint64       n_to_upload)
+{
+  json_builder_set_member_name (builder, name);
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "ms");
+  json_builder_add_double_value (builder, ms);
+  if (n_to_upload >= 0) {
+    json_builder_set_member_name (builder, "to_upload");
+    json_builder_add_int_value (builder, n_to_upload);
+  }
+  json_builder_end_object (builder);
+}
+
+static void
+benchmark_add_local (EphyBookmarksManager *manager,
+                     JsonBuilder          *builder)
+{
+  g_autoptr (GSequence) bookmarks = g_sequence_new (g_object_unref);
+  gint64 start_time;
+
+  for (int i = 0; i < n_bookmarks; i++) {
+    g_autofree char *url = local_url (i);
+    g_autofree char *id = g_strdup_printf ("local-%d", i);
+
+    g_sequence_append (bookmarks, create_bookmark (url, id));
+  }
+
+  start_time = g_get_monotonic_time ();
+  ephy_bookmarks_manager_add_bookmarks (manager, bookmarks);
+  add_result (builder, "add_local", elapsed_ms (start_time), -1);
+}
+
+static void
+benchmark_lookup_by_url (EphyBookmarksManager *manager,
+                         JsonBuilder          *builder)
+{
+  gint64 start_time = g_get_monotonic_time ();
+
+  /* What the star button does on every navigation. */
+  for (int i = 0; i < n_bookmarks; i++) {
+    g_autofree char *url = local_url (i);
+
+    if (!ephy_bookmarks_manager_get_bookmark_by_url (manager, url))
+      g_error ("Bookmark %s not found", url);
+  }
+
+  add_result (builder, "lookup_by_url", elapsed_ms (start_time), -1);
+}
+
+static void
+benchmark_initial_merge (EphyBookmarksManager *manager,
+                         JsonBuilder          *builder)
+{
+  GList *remotes = NULL;
+  guint n_to_upload = 0;
+  gint64 start_time;
+
+  for (int i = 0; i < n_bookmarks; i++) {
+    g_autofree char *url = NULL;
+    g_autofree char *id = NULL;
+
+    switch (i % 3) {
+      case 0:
+        url = local_url (i);
+        id = g_strdup_printf ("local-%d", i);
+        break;
+      case 1:
+        url = local_url (i);
+        id = g_strdup_printf ("remote-%d", i);
+        break;
+      default:
+        url = g_strdup_printf ("https://example.com/remote/%d", i);
+        id = g_strdup_printf ("remote-%d", i);
+        break;
+    }
+
+    remotes = g_list_prepend (remotes, create_bookmark (url, id));
+  }
+  remotes = g_list_reverse (remotes);
+
+  start_time = g_get_monotonic_time ();
+  ephy_synchronizable_manager_merge (EPHY_SYNCHRONIZABLE_MANAGER (manager), TRUE,
+                                     NULL, remotes,
+                                     (EphySynchronizableManagerMergeCallback)merge_cb, &n_to_upload);
+  add_result (builder, "initial_merge", elapsed_ms (start_time), n_to_upload);
+
+  g_list_free_full (remotes, g_object_unref);
+}
+
+static void
+benchmark_regular_merge (EphyBookmarksManager *manager,
+                         JsonBuilder          *builder)
+{
+  GList *updated = NULL;
+  GList *deleted = NULL;
+  guint n_to_upload = 0;
+  gint64 start_time;
+
+  for (int i = 0; i < n_bookmarks; i++) {
+    g_autofree char *url = g_strdup_printf ("https://example.com/updated/%d", i);
+    g_autofree char *id = g_strdup_printf (i % 3 == 0 ? "local-%d" : "remote-%d", i);
+    EphyBookmark *bookmark = create_bookmark (url, id);
+
+    if (i % 10 == 0)
+      deleted = g_list_prepend (deleted, bookmark);
+    else
+      updated = g_list_prepend (updated, bookmark);
+  }
+
+  start_time = g_get_monotonic_time ();
+  ephy_synchronizable_manager_merge (EPHY_SYNCHRONIZABLE_MANAGER (manager), FALSE,
+                                     deleted, updated,
+                                     (EphySynchronizableManagerMergeCallback)merge_cb, &n_to_upload);
+  add_result (builder, "regular_merge", elapsed_ms (start_time), n_to_upload);
+
+  g_list_free_full (updated, g_object_unref);
+  g_list_free_full (deleted, g_object_unref);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_autoptr (GOptionContext) context = NULL;
+  g_autoptr (EphyBookmarksManager) manager = NULL;
+  g_autoptr (JsonBuilder) builder = NULL;
+  g_autoptr (JsonNode) root = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree char *json = NULL;
+
+  context = g_option_context_new (NULL);
+  g_option_context_set_summary (context, "Measures merging synced bookmarks.");
+  g_option_context_add_main_entries (context, option_entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    return 1;
+  }
+
+  if (n_bookmarks <= 0) {
+    g_printerr ("The number of bookmarks must be positive.\n");
+    return 1;
+  }
+
+  gtk_init ();
+  ephy_debug_init ();
+
+  if (!ephy_file_helpers_init (NULL, EPHY_FILE_HELPERS_TESTING_MODE | EPHY_FILE_HELPERS_ENSURE_EXISTS, NULL)) {
+    g_printerr ("Could not create a temporary profile.\n");
+    return 1;
+  }
+
+  /* Bookmarks load their icon from the shell's favicon database. */
+  _ephy_shell_create_instance (EPHY_EMBED_SHELL_MODE_TEST);
+  g_application_register (G_APPLICATION (ephy_embed_shell_get_default ()), NULL, NULL);
+
+  manager = ephy_bookmarks_manager_new ();
+
+  builder = json_builder_new ();
+  json_builder_begin_object (builder);
+
+  json_builder_set_member_name (builder, "bookmarks");
+  json_builder_add_int_value (builder, n_bookmarks);
+
+  json_builder_set_member_name (builder, "results");
+  json_builder_begin_object (builder);
+  benchmark_add_local (manager, builder);
+  benchmark_lookup_by_url (manager, builder);
+  benchmark_initial_merge (manager, builder);
+  benchmark_regular_merge (manager, builder);
+  json_builder_end_object (builder);
+
+  json_builder_end_object (builder);
+
+  root = json_builder_get_root (builder);
+  json = json_to_string (root, TRUE);
+  if (output_filename) {
+    if (!g_file_set_contents (output_filename, json, -1, &error)) {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+  } else {
+    g_print ("%s\n", json);
+  }
+
+  g_clear_object (&manager);
+  g_object_unref (ephy_embed_shell_get_default ());
+  ephy_file_helpers_shutdown ();
+
+  return 0;
+}
@@ -0,0 +1,172 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2; -*- */
+/*
+ *  Copyright © 2026 Epiphany Developers
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <gtk/gtk.h>
+
+#include "ephy-bookmarks-manager.h"
+#include "ephy-debug.h"
+#include "ephy-embed-shell.h"
+#include "ephy-file-helpers.h"
+#include "ephy-shell.h"
+#include "ephy-synchronizable-manager.h"
+
+/* Each test uses its own URLs and IDs, as the bookmarks saved by the
+ * previous ones are loaded again by the next manager. */
+
+static EphyBookmark *
+create_bookmark (const char *url,
+                 const char *title,
+                 const char *id)
+{
+  return ephy_bookmark_new (url, title, g_sequence_new (g_free), id);
+}
+
+static void
+merge_cb (GPtrArray *to_upload,
+          gboolean  *done)
+{
+  g_ptr_array_unref (to_upload);
+  *done = TRUE;
+}
+
+static void
+test_url_change (void)
+{
+  g_autoptr (EphyBookmarksManager) manager = ephy_bookmarks_manager_new ();
+  g_autoptr (EphyBookmark) bookmark = create_bookmark ("https://example.com/url-change/old", "Old", "url-change");
+
+  ephy_bookmarks_manager_add_bookmark (manager, bookmark);
+  g_assert_true (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://example.com/url-change/old") == bookmark);
+
+  ephy_bookmark_set_url (bookmark, "https://example.com/url-change/new");
+  g_assert_null (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://example.com/url-change/old"));
+  g_assert_true (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://example.com/url-change/new") == bookmark);
+  g_assert_true (ephy_bookmarks_manager_get_bookmark_by_id (manager, "url-change") == bookmark);
+
+  ephy_bookmarks_manager_remove_bookmark (manager, bookmark);
+  g_assert_null (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://example.com/url-change/new"));
+  g_assert_null (ephy_bookmarks_manager_get_bookmark_by_id (manager, "url-change"));
+}
+
+static void
+test_id_change (void)
+{
+  g_autoptr (EphyBookmarksManager) manager = ephy_bookmarks_manager_new ();
+  g_autoptr (EphyBookmark) local = create_bookmark ("https://example.com/id-change", "Local", "id-change-local");
+  GList *remotes;
+  gboolean done = FALSE;
+
+  ephy_bookmarks_manager_add_bookmark (manager, local);
+
+  /* A remote bookmark with the same URL gives its ID to the local one. */
+  remotes = g_list_prepend (NULL, create_bookmark ("https://example.com/id-change", "Remote", "id-change-remote"));
+  ephy_synchronizable_manager_merge (EPHY_SYNCHRONIZABLE_MANAGER (manager), TRUE, NULL, remotes,
+                                     (EphySynchronizableManagerMergeCallback)merge_cb, &done);
+  g_list_free_full (remotes, g_object_unref);
+  g_assert_true (done);
+
+  g_assert_cmpstr (ephy_bookmark_get_id (local), ==, "id-change-remote");
+  g_assert_null (ephy_bookmarks_manager_get_bookmark_by_id (manager, "id-change-local"));
+  g_assert_true (ephy_bookmarks_manager_get_bookmark_by_id (manager, "id-change-remote") == local);
+  g_assert_true (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://example.com/id-change") == local);
+
+  ephy_bookmarks_manager_remove_bookmark (manager, local);
+  g_assert_null (ephy_bookmarks_manager_get_bookmark_by_id (manager, "id-change-remote"));
+  g_assert_null (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://example.com/id-change"));
+}
+
+static void
+test_shared_url (void)
+{
+  g_autoptr (EphyBookmarksManager) manager = ephy_bookmarks_manager_new ();
+  g_autoptr (EphyBookmark) beta = create_bookmark ("https://example.com/shared-url", "Beta", "shared-url-beta");
+  g_autoptr (EphyBookmark) alpha = create_bookmark ("https://example.com/shared-url", "Alpha", "shared-url-alpha");
+
+  /* Lookups find the first bookmark in title order, not the first added. */
+  ephy_bookmarks_manager_add_bookmark (manager, beta);
+  ephy_bookmarks_manager_add_bookmark (manager, alpha);
+  g_assert_true (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://example.com/shared-url") == alpha);
+
+  ephy_bookmarks_manager_remove_bookmark (manager, alpha);
+  g_assert_true (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://example.com/shared-url") == beta);
+  g_assert_true (ephy_bookmarks_manager_get_bookmark_by_id (manager, "shared-url-beta") == beta);
+  g_assert_null (ephy_bookmarks_manager_get_bookmark_by_id (manager, "shared-url-alpha"));
+
+  ephy_bookmarks_manager_remove_bookmark (manager, beta);
+  g_assert_null (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://example.com/shared-url"));
+}
+
+static void
+test_duplicate_id (void)
+{
+  g_autoptr (EphyBookmarksManager) manager = ephy_bookmarks_manager_new ();
+  g_autoptr (EphyBookmark) beta = create_bookmark ("https://example.com/duplicate-id/beta", "Beta", "duplicate-id");
+  g_autoptr (EphyBookmark) alpha = create_bookmark ("https://example.com/duplicate-id/alpha", "Alpha", "duplicate-id");
+
+  ephy_bookmarks_manager_add_bookmark (manager, beta);
+  ephy_bookmarks_manager_add_bookmark (manager, alpha);
+  g_assert_true (ephy_bookmarks_manager_get_bookmark_by_id (manager, "duplicate-id") == alpha);
+
+  /* Removing one of them leaves the other one indexed. */
+  ephy_bookmarks_manager_remove_bookmark (manager, alpha);
+  g_assert_true (ephy_bookmarks_manager_get_bookmark_by_id (manager, "duplicate-id") == beta);
+  g_assert_null (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://example.com/duplicate-id/alpha"));
+  g_assert_true (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://example.com/duplicate-id/beta") == beta);
+
+  ephy_bookmarks_manager_remove_bookmark (manager, beta);
+  g_assert_null (ephy_bookmarks_manager_get_bookmark_by_id (manager, "duplicate-id"));
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  int ret;
+
+  gtk_init ();
+  ephy_debug_init ();
+
+  g_test_init (&argc, &argv, NULL);
+
+  if (!ephy_file_helpers_init (NULL,
+                               EPHY_FILE_HELPERS_TESTING_MODE | EPHY_FILE_HELPERS_ENSURE_EXISTS,
+                               NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  /* Bookmarks load their icon from the shell's favicon database. */
+  _ephy_shell_create_instance (EPHY_EMBED_SHELL_MODE_TEST);
+  g_application_register (G_APPLICATION (ephy_embed_shell_get_default ()), NULL, NULL);
+
+  g_test_add_func ("/src/bookmarks/manager/url_change", test_url_change);
+  g_test_add_func ("/src/bookmarks/manager/id_change", test_id_change);
+  g_test_add_func ("/src/bookmarks/manager/shared_url", test_shared_url);
+  g_test_add_func ("/src/bookmarks/manager/duplicate_id", test_duplicate_id);
+
+  ret = g_test_run ();
+
+  g_object_unref (ephy_embed_shell_get_default ());
+  ephy_file_helpers_shutdown ();
+
+  return ret;
+}
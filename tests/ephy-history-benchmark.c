@@ -0,0 +1,488 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2; -*- */
+/*
+ *  Copyright © 2026 Epiphany Developers
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measures the history service against a generated profile. The profile has
+ * a configurable number of hosts, URLs and visits spread over several years,
+ * with both hosts and URLs visited following a Zipf distribution, as browsing
+ * history does. The latency of each operation is printed as JSON, so that
+ * results can be compared across releases.
+ *
+ * Run it with `meson test --benchmark`, or directly to change the scale:
+ *
+ *   benchmark-ephy-history --urls 100000 --visits 1000000 --output results.json
+ */
+
+#include "config.h"
+
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+#include <math.h>
+
+#include "ephy-history-service.h"
+
+static int n_hosts = 2000;
+static int n_urls = 20000;
+static int n_visits = 200000;
+static int n_years = 3;
+static int n_iterations = 200;
+static double zipf_exponent = 1.0;
+static int seed = 42;
+static char *output_filename;
+
+static const GOptionEntry option_entries[] = {
+  { "hosts", 0, 0, G_OPTION_ARG_INT, &n_hosts, "Number of hosts in the profile", "N" },
+  { "urls", 0, 0, G_OPTION_ARG_INT, &n_urls, "Number of URLs in the profile", "N" },
+  { "visits", 0, 0, G_OPTION_ARG_INT, &n_visits, "Number of visits in the profile", "N" },
+  { "years", 0, 0, G_OPTION_ARG_INT, &n_years, "Years of history the visits are spread over", "N" },
+  { "iterations", 0, 0, G_OPTION_ARG_INT, &n_iterations, "Number of runs of each operation", "N" },
+  { "zipf-exponent", 0, 0, G_OPTION_ARG_DOUBLE, &zipf_exponent, "Skew of host and URL popularity", "S" },
+  { "seed", 0, 0, G_OPTION_ARG_INT, &seed, "Random seed", "N" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_filename, "Write the results to FILE instead of standard output", "FILE" },
+  { NULL }
+};
+
+static const char * const database_suffixes[] = { "", "-wal", "-shm" };
+
+static const char * const words[] = {
+  "news", "video", "recipe", "linux", "release", "weather", "forum", "music",
+  "review", "guide", "sport", "travel", "photo", "science", "garden", "code",
+  "market", "health", "movie", "book", "school", "radio", "game", "design"
+};
+
+typedef struct {
+  GRand *rand;
+  double *cumulative;
+  int n;
+} Zipf;
+
+static void
+zipf_init (Zipf  *zipf,
+           GRand *rand,
+           int    n)
+{
+  double total = 0;
+
+  zipf->rand = rand;
+  zipf->n = n;
+  zipf->cumulative = g_new (double, n);
+  for (int k = 0; k < n; k++) {
+    total += 1.0 / pow (k + 1, zipf_exponent);
+    zipf->cumulative[k] = total;
+  }
+  for (int k = 0; k < n; k++)
+    zipf->cumulative[k] /= total;
+}
+
+static int
+zipf_sample (Zipf *zipf)
+{
+  double u = g_rand_double (zipf->rand);
+  int low = 0;
+  int high = zipf->n - 1;
+
+  while (low < high) {
+    int middle = (low + high) / 2;
+
+    if (zipf->cumulative[middle] < u)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  return low;
+}
+
+static void
+zipf_clear (Zipf *zipf)
+{
+  g_free (zipf->cumulative);
+}
+
+typedef struct {
+  EphyHistoryService *service;
+  GRand *rand;
+  Zipf url_popularity;
+  char **urls;
+  char **titles;
+} Profile;
+
+static const char *
+random_word (GRand *rand)
+{
+  return words[g_rand_int_range (rand, 0, G_N_ELEMENTS (words))];
+}
+
+static void
+store_result_cb (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  GAsyncResult **result_out = user_data;
+
+  *result_out = g_object_ref (result);
+}
+
+static GAsyncResult *
+wait_for_result (GAsyncResult **result)
+{
+  while (!*result)
+    g_main_context_iteration (NULL, TRUE);
+
+  return *result;
+}
+
+static void
+generate_profile (Profile *profile)
+{
+  g_autoptr (GPtrArray) visits = NULL;
+  Zipf host_popularity;
+  gint64 now = g_get_real_time ();
+  gint64 span = n_years * 365 * G_TIME_SPAN_DAY;
+
+  zipf_init (&host_popularity, profile->rand, n_hosts);
+  zipf_init (&profile->url_popularity, profile->rand, n_urls);
+
+  /* The most popular URLs are spread over the most popular hosts. */
+  profile->urls = g_new0 (char *, n_urls + 1);
+  profile->titles = g_new0 (char *, n_urls + 1);
+  for (int i = 0; i < n_urls; i++) {
+    int host = zipf_sample (&host_popularity);
+    const char *word = words[host % G_N_ELEMENTS (words)];
+
+    profile->urls[i] = g_strdup_printf ("https://www.%s%d.example.com/%s/%d", word, host, random_word (profile->rand), i);
+    profile->titles[i] = g_strdup_printf ("%s %s %s %d", random_word (profile->rand), word, random_word (profile->rand), i);
+  }
+
+  for (int i = 0; i < n_visits;) {
+    g_autoptr (GAsyncResult) result = NULL;
+    g_autoptr (GError) error = NULL;
+    int chunk_end = MIN (i + 10000, n_visits);
+
+    visits = g_ptr_array_new_with_free_func ((GDestroyNotify)ephy_history_page_visit_free);
+    for (; i < chunk_end; i++) {
+      int url = zipf_sample (&profile->url_popularity);
+      EphyHistoryPageVisitType type = g_rand_int_range (profile->rand, 0, 10) == 0 ? EPHY_PAGE_VISIT_TYPED : EPHY_PAGE_VISIT_LINK;
+
+      g_ptr_array_add (visits,
+                       ephy_history_page_visit_new_with_url (ephy_history_url_new (profile->urls[url], profile->titles[url], 0, 0, 0),
+                                                             now - span + span / n_visits * i,
+                                                             type));
+    }
+
+    ephy_history_service_import_visits (profile->service, visits, NULL, store_result_cb, &result);
+    if (!ephy_history_service_import_visits_finish (profile->service, wait_for_result (&result), &error))
+      g_error ("Could not generate history: %s", error ? error->message : "unknown error");
+    g_clear_pointer (&visits, g_ptr_array_unref);
+  }
+
+  zipf_clear (&host_popularity);
+}
+
+static int
+compare_doubles (gconstpointer a,
+                 gconstpointer b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static void
+add_latencies (JsonBuilder *builder,
+               const char  *name,
+               GArray      *latencies)
+{
+  double total = 0;
+
+  g_array_sort (latencies, compare_doubles);
+  for (guint i = 0; i < latencies->len; i++)
+    total += g_array_index (latencies, double, i);
+
+#define PERCENTILE(p) g_array_index (latencies, double, MIN (latencies->len - 1, latencies->len * (p) / 100))
+
+  json_builder_set_member_name (builder, name);
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "iterations");
+  json_builder_add_int_value (builder, latencies->len);
+  json_builder_set_member_name (builder, "mean_ms");
+  json_builder_add_double_value (builder, total / latencies->len);
+  json_builder_set_member_name (builder, "p50_ms");
+  json_builder_add_double_value (builder, PERCENTILE (50));
+  json_builder_set_member_name (builder, "p90_ms");
+  json_builder_add_double_value (builder, PERCENTILE (90));
+  json_builder_set_member_name (builder, "p99_ms");
+  json_builder_add_double_value (builder, PERCENTILE (99));
+  json_builder_set_member_name (builder, "max_ms");
+  json_builder_add_double_value (builder, g_array_index (latencies, double, latencies->len - 1));
+  json_builder_end_object (builder);
+
+#undef PERCENTILE
+}
+
+static double
+elapsed_ms (gint64 start_time)
+{
+  return (g_get_monotonic_time () - start_time) / 1000.0;
+}
+
+static void
+benchmark_add_visit (Profile     *profile,
+                     JsonBuilder *builder)
+{
+  g_autoptr (GArray) latencies = g_array_sized_new (FALSE, FALSE, sizeof (double), n_iterations);
+
+  for (int i = 0; i < n_iterations; i++) {
+    g_autoptr (EphyHistoryPageVisit) visit = NULL;
+    g_autoptr (GAsyncResult) result = NULL;
+    int url = zipf_sample (&profile->url_popularity);
+    gint64 start_time = g_get_monotonic_time ();
+    double latency;
+
+    visit = ephy_history_page_visit_new (profile->urls[url], g_get_real_time (), EPHY_PAGE_VISIT_LINK);
+    ephy_history_service_add_visit (profile->service, visit, NULL, store_result_cb, &result);
+    ephy_history_service_add_visit_finish (profile->service, wait_for_result (&result), NULL);
+    latency = elapsed_ms (start_time);
+    g_array_append_val (latencies, latency);
+  }
+
+  add_latencies (builder, "add_visit", latencies);
+}
+
+static void
+benchmark_find_urls (Profile     *profile,
+                     JsonBuilder *builder,
+                     int          n_substrings)
+{
+  g_autoptr (GArray) latencies = g_array_sized_new (FALSE, FALSE, sizeof (double), n_iterations);
+  g_autofree char *name = g_strdup_printf ("find_urls_%d_substrings", n_substrings);
+
+  for (int i = 0; i < n_iterations; i++) {
+    g_autoptr (GAsyncResult) result = NULL;
+    g_autoptr (GError) error = NULL;
+    GList *substrings = NULL;
+    GList *urls;
+    gint64 start_time;
+    double latency;
+
+    /* The first word is often enough a host, as when typing an address. */
+    for (int j = 0; j < n_substrings; j++)
+      substrings = g_list_append (substrings, g_strdup (j == 0 && i % 2 ? "www." : random_word (profile->rand)));
+
+    start_time = g_get_monotonic_time ();
+    ephy_history_service_find_urls (profile->service, 0, 0, 10, 0, substrings,
+                                    EPHY_HISTORY_SORT_FRECENCY, NULL, store_result_cb, &result);
+    urls = ephy_history_service_find_urls_finish (profile->service, wait_for_result (&result), &error);
+    latency = elapsed_ms (start_time);
+    g_array_append_val (latencies, latency);
+
+    ephy_history_url_list_free (urls);
+    g_list_free_full (substrings, g_free);
+  }
+
+  add_latencies (builder, name, latencies);
+}
+
+static void
+benchmark_query_overview (Profile     *profile,
+                          JsonBuilder *builder)
+{
+  g_autoptr (GArray) latencies = g_array_sized_new (FALSE, FALSE, sizeof (double), n_iterations);
+  g_autoptr (EphyHistoryQuery) query = ephy_history_query_new ();
+
+  /* The same query as the overview page. */
+  query->sort_type = EPHY_HISTORY_SORT_FRECENCY;
+  query->limit = 9;
+  query->ignore_hidden = TRUE;
+  query->ignore_local = TRUE;
+
+  for (int i = 0; i < n_iterations; i++) {
+    g_autoptr (GAsyncResult) result = NULL;
+    gint64 start_time = g_get_monotonic_time ();
+    GList *urls;
+    double latency;
+
+    ephy_history_service_query_urls (profile->service, query, NULL, store_result_cb, &result);
+    urls = ephy_history_service_query_urls_finish (profile->service, wait_for_result (&result), NULL);
+    latency = elapsed_ms (start_time);
+    g_array_append_val (latencies, latency);
+
+    ephy_history_url_list_free (urls);
+  }
+
+  add_latencies (builder, "query_urls_overview", latencies);
+}
+
+static void
+benchmark_get_host_for_url (Profile     *profile,
+                            JsonBuilder *builder)
+{
+  g_autoptr (GArray) latencies = g_array_sized_new (FALSE, FALSE, sizeof (double), n_iterations);
+
+  for (int i = 0; i < n_iterations; i++) {
+    g_autoptr (GAsyncResult) result = NULL;
+    g_autoptr (EphyHistoryHost) host = NULL;
+    int url = zipf_sample (&profile->url_popularity);
+    gint64 start_time = g_get_monotonic_time ();
+    double latency;
+
+    ephy_history_service_get_host_for_url (profile->service, profile->urls[url], NULL, store_result_cb, &result);
+    host = ephy_history_service_get_host_for_url_finish (profile->service, wait_for_result (&result), NULL);
+    latency = elapsed_ms (start_time);
+    g_array_append_val (latencies, latency);
+  }
+
+  add_latencies (builder, "get_host_for_url", latencies);
+}
+
+static void
+benchmark_delete_urls (Profile     *profile,
+                       JsonBuilder *builder)
+{
+  g_autoptr (GArray) latencies = g_array_sized_new (FALSE, FALSE, sizeof (double), n_iterations);
+
+  for (int i = 0; i < n_iterations; i++) {
+    g_autoptr (GAsyncResult) result = NULL;
+    g_autoptr (EphyHistoryURL) url = NULL;
+    GList *urls;
+    gint64 start_time;
+    double latency;
+
+    /* Distinct URLs across the popularity range, each deleted once. */
+    url = ephy_history_url_new (profile->urls[(gint64)i * n_urls / n_iterations], NULL, 0, 0, 0);
+    urls = g_list_prepend (NULL, url);
+
+    start_time = g_get_monotonic_time ();
+    ephy_history_service_delete_urls (profile->service, urls, NULL, store_result_cb, &result);
+    ephy_history_service_delete_urls_finish (profile->service, wait_for_result (&result), NULL);
+    latency = elapsed_ms (start_time);
+    g_array_append_val (latencies, latency);
+
+    g_list_free (urls);
+  }
+
+  add_latencies (builder, "delete_urls", latencies);
+}
+
+static void
+add_int_member (JsonBuilder *builder,
+                const char  *name,
+                gint64       value)
+{
+  json_builder_set_member_name (builder, name);
+  json_builder_add_int_value (builder, value);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_autoptr (GOptionContext) context = NULL;
+  g_autoptr (JsonBuilder) builder = NULL;
+  g_autoptr (JsonNode) root = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree char *directory = NULL;
+  g_autofree char *filename = NULL;
+  g_autofree char *json = NULL;
+  Profile profile = { 0 };
+  gint64 start_time;
+
+  context = g_option_context_new (NULL);
+  g_option_context_set_summary (context, "Measures the history service on a generated profile.");
+  g_option_context_add_main_entries (context, option_entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    return 1;
+  }
+
+  if (n_hosts <= 0 || n_urls <= 0 || n_visits <= 0 || n_years <= 0 || n_iterations <= 0 || n_iterations > n_urls) {
+    g_printerr ("Sizes must be positive, with no more iterations than URLs.\n");
+    return 1;
+  }
+
+  directory = g_dir_make_tmp ("epiphany-history-benchmark-XXXXXX", &error);
+  if (!directory) {
+    g_printerr ("%s\n", error->message);
+    return 1;
+  }
+  filename = g_build_filename (directory, "ephy-history.db", NULL);
+
+  profile.rand = g_rand_new_with_seed (seed);
+  profile.service = ephy_history_service_new (filename, EPHY_SQLITE_CONNECTION_MODE_READWRITE);
+
+  builder = json_builder_new ();
+  json_builder_begin_object (builder);
+
+  json_builder_set_member_name (builder, "profile");
+  json_builder_begin_object (builder);
+  add_int_member (builder, "hosts", n_hosts);
+  add_int_member (builder, "urls", n_urls);
+  add_int_member (builder, "visits", n_visits);
+  add_int_member (builder, "years", n_years);
+  add_int_member (builder, "seed", seed);
+  json_builder_set_member_name (builder, "zipf_exponent");
+  json_builder_add_double_value (builder, zipf_exponent);
+
+  start_time = g_get_monotonic_time ();
+  generate_profile (&profile);
+  json_builder_set_member_name (builder, "generation_ms");
+  json_builder_add_double_value (builder, elapsed_ms (start_time));
+  json_builder_end_object (builder);
+
+  json_builder_set_member_name (builder, "results");
+  json_builder_begin_object (builder);
+  benchmark_add_visit (&profile, builder);
+  for (int n_substrings = 1; n_substrings <= 4; n_substrings++)
+    benchmark_find_urls (&profile, builder, n_substrings);
+  benchmark_query_overview (&profile, builder);
+  benchmark_get_host_for_url (&profile, builder);
+  /* Last, as it changes the profile. */
+  benchmark_delete_urls (&profile, builder);
+  json_builder_end_object (builder);
+
+  json_builder_end_object (builder);
+
+  root = json_builder_get_root (builder);
+  json = json_to_string (root, TRUE);
+  if (output_filename) {
+    if (!g_file_set_contents (output_filename, json, -1, &error)) {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+  } else {
+    g_print ("%s\n", json);
+  }
+
+  g_object_unref (profile.service);
+  g_rand_free (profile.rand);
+  zipf_clear (&profile.url_popularity);
+  g_strfreev (profile.urls);
+  g_strfreev (profile.titles);
+
+  /* The history thread has finished with the database by now. */
+  for (guint i = 0; i < G_N_ELEMENTS (database_suffixes); i++) {
+    g_autofree char *path = g_strconcat (filename, database_suffixes[i], NULL);
+
+    g_unlink (path);
+  }
+  g_rmdir (directory);
+
+  return 0;
+}
@@ -0,0 +1,270 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2; -*- */
+/*
+ *  Copyright © 2026 Epiphany Developers
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-debug.h"
+#include "ephy-file-helpers.h"
+#include "ephy-history-index.h"
+#include "ephy-history-service.h"
+
+#include <glib/gstdio.h>
+
+static void
+store_result_cb (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  GAsyncResult **result_out = user_data;
+
+  *result_out = g_object_ref (result);
+}
+
+static EphyHistoryService *
+create_history_service (guint n_urls)
+{
+  g_autofree char *filename = g_build_filename (ephy_profile_dir (), "history-index-test.db", NULL);
+  g_autoptr (EphyHistoryService) service = NULL;
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  GList *visits = NULL;
+
+  g_unlink (filename);
+  service = ephy_history_service_new (filename, EPHY_SQLITE_CONNECTION_MODE_READWRITE);
+
+  for (guint i = 0; i < n_urls; i++) {
+    g_autofree char *url = g_strdup_printf ("https://example.com/%u", i);
+
+    visits = g_list_prepend (visits, ephy_history_page_visit_new (url, i + 1, EPHY_PAGE_VISIT_TYPED));
+  }
+
+  ephy_history_service_add_visits (service, visits, NULL, store_result_cb, &result);
+  ephy_history_page_visit_list_free (visits);
+
+  while (!result)
+    g_main_context_iteration (NULL, TRUE);
+  g_assert_true (ephy_history_service_add_visits_finish (service, result, &error));
+  g_assert_no_error (error);
+
+  return g_steal_pointer (&service);
+}
+
+static void
+changed_cb (gboolean *changed)
+{
+  *changed = TRUE;
+}
+
+static void
+wait_for_change (EphyHistoryIndex *index)
+{
+  gboolean changed = FALSE;
+  gulong id;
+
+  id = g_signal_connect_swapped (index, "changed", G_CALLBACK (changed_cb), &changed);
+  while (!changed)
+    g_main_context_iteration (NULL, TRUE);
+  g_signal_handler_disconnect (index, id);
+}
+
+static GPtrArray *
+lookup (EphyHistoryIndex *index,
+        const char       *term)
+{
+  char *terms[] = { (char *)term, NULL };
+
+  return ephy_history_index_lookup (index, terms);
+}
+
+static gboolean
+has_url (GPtrArray  *entries,
+         const char *url)
+{
+  for (guint i = 0; i < entries->len; i++) {
+    EphySuggestionIndexEntry *entry = g_ptr_array_index (entries, i);
+
+    if (g_strcmp0 (entry->url, url) == 0)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+visit_url (EphyHistoryService *service,
+           const char         *url)
+{
+  ephy_history_service_visit_url (service, url, NULL, g_get_real_time (),
+                                  EPHY_PAGE_VISIT_TYPED, FALSE);
+}
+
+static void
+test_load (void)
+{
+  g_autoptr (EphyHistoryService) service = create_history_service (2);
+  g_autoptr (EphyHistoryIndex) index = ephy_history_index_new (service, 3);
+  g_autoptr (GPtrArray) entries = NULL;
+
+  g_assert_false (ephy_history_index_is_loaded (index));
+  wait_for_change (index);
+  g_assert_true (ephy_history_index_is_loaded (index));
+
+  /* The whole history fits, so nothing else can match. */
+  g_assert_cmpuint (ephy_history_index_get_n_entries (index), ==, 2);
+  g_assert_true (ephy_history_index_is_complete (index));
+
+  entries = lookup (index, "example");
+  g_assert_cmpuint (entries->len, ==, 2);
+  g_clear_pointer (&entries, g_ptr_array_unref);
+
+  entries = lookup (index, "gnome");
+  g_assert_cmpuint (entries->len, ==, 0);
+}
+
+static void
+test_load_cap (void)
+{
+  g_autoptr (EphyHistoryService) service = create_history_service (5);
+  g_autoptr (EphyHistoryIndex) index = ephy_history_index_new (service, 3);
+  g_autoptr (GPtrArray) entries = NULL;
+
+  wait_for_change (index);
+
+  g_assert_cmpuint (ephy_history_index_get_n_entries (index), ==, 3);
+  g_assert_false (ephy_history_index_is_complete (index));
+
+  entries = lookup (index, "example");
+  g_assert_cmpuint (entries->len, ==, 3);
+}
+
+static void
+test_visits (void)
+{
+  g_autoptr (EphyHistoryService) service = create_history_service (2);
+  g_autoptr (EphyHistoryIndex) index = ephy_history_index_new (service, 3);
+  g_autoptr (GPtrArray) entries = NULL;
+
+  wait_for_change (index);
+
+  /* A visit adds its URL by frecency, without reloading anything. The old
+   * visits are worth much less than a new one. */
+  visit_url (service, "https://example.com/new");
+  wait_for_change (index);
+  g_assert_cmpuint (ephy_history_index_get_n_entries (index), ==, 3);
+  g_assert_true (ephy_history_index_is_complete (index));
+
+  entries = lookup (index, "example");
+  g_assert_cmpuint (entries->len, ==, 3);
+  g_assert_cmpstr (((EphySuggestionIndexEntry *)g_ptr_array_index (entries, 0))->url, ==, "https://example.com/new");
+  g_clear_pointer (&entries, g_ptr_array_unref);
+
+  /* Going over the cap evicts the least frecent URL. */
+  visit_url (service, "https://example.com/newer");
+  wait_for_change (index);
+  g_assert_cmpuint (ephy_history_index_get_n_entries (index), ==, 3);
+  g_assert_false (ephy_history_index_is_complete (index));
+
+  entries = lookup (index, "example");
+  g_assert_cmpuint (entries->len, ==, 3);
+  g_assert_true (has_url (entries, "https://example.com/new"));
+  g_assert_true (has_url (entries, "https://example.com/newer"));
+  g_clear_pointer (&entries, g_ptr_array_unref);
+
+  /* A second visit adds to the frecency of a URL, and ranks it first. */
+  visit_url (service, "https://example.com/newer");
+  wait_for_change (index);
+  g_assert_cmpuint (ephy_history_index_get_n_entries (index), ==, 3);
+
+  entries = lookup (index, "example");
+  g_assert_cmpuint (entries->len, ==, 3);
+  g_assert_cmpstr (((EphySuggestionIndexEntry *)g_ptr_array_index (entries, 0))->url, ==, "https://example.com/newer");
+  g_assert_cmpstr (((EphySuggestionIndexEntry *)g_ptr_array_index (entries, 1))->url, ==, "https://example.com/new");
+}
+
+static void
+test_title_change (void)
+{
+  g_autoptr (EphyHistoryService) service = create_history_service (2);
+  g_autoptr (EphyHistoryIndex) index = ephy_history_index_new (service, 3);
+  g_autoptr (GPtrArray) entries = NULL;
+  EphySuggestionIndexEntry *entry;
+
+  wait_for_change (index);
+
+  ephy_history_service_set_url_title (service, "https://example.com/1", "Kittens", NULL, NULL, NULL);
+  wait_for_change (index);
+
+  entries = lookup (index, "kittens");
+  g_assert_cmpuint (entries->len, ==, 1);
+  entry = g_ptr_array_index (entries, 0);
+  g_assert_cmpstr (entry->url, ==, "https://example.com/1");
+  g_assert_cmpstr (entry->title, ==, "Kittens");
+}
+
+static void
+test_deletion (void)
+{
+  g_autoptr (EphyHistoryService) service = create_history_service (2);
+  g_autoptr (EphyHistoryIndex) index = ephy_history_index_new (service, 3);
+  g_autoptr (GPtrArray) entries = NULL;
+  GList *urls;
+
+  wait_for_change (index);
+
+  urls = g_list_prepend (NULL, ephy_history_url_new ("https://example.com/0", "", 0, 0, 0));
+  ephy_history_service_delete_urls (service, urls, NULL, NULL, NULL);
+  ephy_history_url_list_free (urls);
+  wait_for_change (index);
+
+  g_assert_cmpuint (ephy_history_index_get_n_entries (index), ==, 1);
+
+  entries = lookup (index, "example");
+  g_assert_cmpuint (entries->len, ==, 1);
+  g_assert_false (has_url (entries, "https://example.com/0"));
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  int ret;
+
+  ephy_debug_init ();
+
+  g_test_init (&argc, &argv, NULL);
+
+  if (!ephy_file_helpers_init (NULL,
+                               EPHY_FILE_HELPERS_TESTING_MODE | EPHY_FILE_HELPERS_ENSURE_EXISTS,
+                               NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  g_test_add_func ("/lib/history-index/load", test_load);
+  g_test_add_func ("/lib/history-index/load_cap", test_load_cap);
+  g_test_add_func ("/lib/history-index/visits", test_visits);
+  g_test_add_func ("/lib/history-index/title_change", test_title_change);
+  g_test_add_func ("/lib/history-index/deletion", test_deletion);
+
+  ret = g_test_run ();
+
+  ephy_file_helpers_shutdown ();
+
+  return ret;
+}
@@ -22,10 +22,15 @@
 
 #include <glib/gstdio.h>
 #include <gtk/gtk.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 #include "ephy-debug.h"
 #include "ephy-file-helpers.h"
+#include "ephy-history-import.h"
 #include "ephy-history-service.h"
+#include "ephy-sqlite-connection.h"
 
 static const char *
 test_db_filename (void)
@@ -394,6 +399,25 @@ test_get_url_not_existent (void)
   test_get_url_helper (FALSE);
 }
 
+static void
+test_get_url_read_after_write (void)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  EphyHistoryPageVisit *visit;
+
+  /* The read is queued right behind the write without waiting for it, and
+   * must see it even though reads use their own connections. */
+  visit = ephy_history_page_visit_new ("http://www.gnome.org", 0, EPHY_PAGE_VISIT_TYPED);
+  ephy_history_service_add_visit (service, visit, NULL, NULL, NULL);
+  ephy_history_page_visit_free (visit);
+
+  ephy_history_service_get_url (service, "http://www.gnome.org", NULL, (GAsyncReadyCallback)test_get_url_done, GINT_TO_POINTER (TRUE));
+
+  g_object_set_data (G_OBJECT (service), "main-loop", loop);
+  g_main_loop_run (loop);
+}
+
 static GList *
 create_visits_for_complex_tests (void)
 {
@@ -624,37 +648,1571 @@ test_cancellation (void)
   g_main_loop_run (loop);
 }
 
-int
-main (int   argc,
-      char *argv[])
+static void
+perform_indexed_substring_query (EphyHistoryService *service,
+                                 GAsyncResult       *result,
+                                 gpointer            user_data)
 {
-  int ret;
+  EphyHistoryQuery *query;
+  EphyHistoryURL *url;
+  g_autoptr (GError) error = NULL;
+  gboolean success;
 
-  gtk_test_init (&argc, &argv);
+  success = ephy_history_service_add_visits_finish (service, result, &error);
+  g_assert_no_error (error);
+  g_assert_true (success);
 
-  ephy_debug_init ();
+  /* Long enough to go through the search index, and in the middle of a host
+   * label so that a prefix match would not find it. */
+  query = ephy_history_query_new ();
+  query->substring_list = g_list_prepend (query->substring_list, g_strdup ("ikiped"));
+  query->substring_list = g_list_prepend (query->substring_list, g_strdup ("w"));
+  query->limit = 10;
+  query->sort_type = EPHY_HISTORY_SORT_MOST_VISITED;
 
-  if (!ephy_file_helpers_init (NULL,
-                               EPHY_FILE_HELPERS_TESTING_MODE | EPHY_FILE_HELPERS_ENSURE_EXISTS,
-                               NULL)) {
-    g_debug ("Something wrong happened with ephy_file_helpers_init()");
-    return -1;
+  url = ephy_history_url_new ("http://www.wikipedia.org",
+                              "Wikipedia",
+                              30, 30, 0);
+
+  ephy_history_service_query_urls (service, query, NULL, (GAsyncReadyCallback)verify_complex_url_query, url);
+  ephy_history_query_free (query);
+}
+
+static void
+test_indexed_substring_query (void)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  GList *visits;
+
+  visits = create_visits_for_complex_tests ();
+  ephy_history_service_add_visits (service, visits, NULL, (GAsyncReadyCallback)perform_indexed_substring_query, NULL);
+  ephy_history_page_visit_list_free (visits);
+
+  g_object_set_data (G_OBJECT (service), "main-loop", loop);
+  g_main_loop_run (loop);
+}
+
+static guint
+count_urls_matching (EphyHistoryService *service,
+                     const char         *substring)
+{
+  g_autoptr (EphyHistoryQuery) query = ephy_history_query_new ();
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  GList *urls;
+  guint n_urls;
+
+  query->substring_list = g_list_prepend (query->substring_list, g_strdup (substring));
+  ephy_history_service_query_urls (service, query, NULL, store_result_cb, &result);
+  urls = ephy_history_service_query_urls_finish (service, wait_for_result (&result), &error);
+  g_assert_no_error (error);
+
+  n_urls = g_list_length (urls);
+  ephy_history_url_list_free (urls);
+
+  return n_urls;
+}
+
+static gboolean
+url_search_index_backfill_is_done (EphySQLiteConnection *connection)
+{
+  g_autoptr (EphySQLiteStatement) statement = NULL;
+  g_autoptr (GError) error = NULL;
+  gboolean done;
+
+  statement = ephy_sqlite_connection_create_statement (connection, "SELECT 1 FROM urls_fts_backfill",
+                                                       EPHY_SQLITE_STATEMENT_SHORT_LIVED, &error);
+  g_assert_no_error (error);
+  done = !ephy_sqlite_statement_step (statement, &error);
+  g_assert_no_error (error);
+
+  return done;
+}
+
+static void
+test_url_search_index_backfill (void)
+{
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  EphySQLiteConnection *connection;
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autoptr (EphyHistoryURL) deleted_url = NULL;
+  GList *visits = NULL;
+  GList *urls;
+  gint64 now = g_get_real_time ();
+  gint64 deadline;
+
+  /* More URLs than fit in one backfill batch. */
+  for (int i = 0; i < 2500; i++) {
+    g_autofree char *url = g_strdup_printf ("http://www.example.org/page/%d", i);
+    visits = g_list_prepend (visits, ephy_history_page_visit_new (url, now - i * G_TIME_SPAN_SECOND, EPHY_PAGE_VISIT_LINK));
   }
+  ephy_history_service_add_visits (service, visits, NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_service_add_visits_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+  ephy_history_page_visit_list_free (visits);
+  g_clear_object (&result);
+  g_object_unref (service);
 
-  g_test_add_func ("/embed/history/test_create_history_service", test_create_history_service);
-  g_test_add_func ("/embed/history/test_create_history_service_and_destroy_later", test_create_history_service_and_destroy_later);
-  g_test_add_func ("/embed/history/test_create_history_entry", test_create_history_entry);
-  g_test_add_func ("/embed/history/test_readonly_mode", test_readonly_mode);
-  g_test_add_func ("/embed/history/test_create_history_entries", test_create_history_entries);
-  g_test_add_func ("/embed/history/test_set_url_title", test_set_url_title);
-  g_test_add_func ("/embed/history/test_set_url_title_is_correct", test_set_url_title_is_correct);
-  g_test_add_func ("/embed/history/test_set_url_title_url_not_existent", test_set_url_title_url_not_existent);
-  g_test_add_func ("/embed/history/test_get_url", test_get_url);
-  g_test_add_func ("/embed/history/test_get_url_not_existent", test_get_url_not_existent);
-  g_test_add_func ("/embed/history/test_complex_url_query", test_complex_url_query);
-  g_test_add_func ("/embed/history/test_complex_url_query_with_time_range", test_complex_url_query_with_time_range);
-  g_test_add_func ("/embed/history/test_clear", test_clear);
-  g_test_add_func ("/embed/history/test_cancellation", test_cancellation);
+  /* Turn the database back into one from before the search index. */
+  connection = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READWRITE, test_db_filename ());
+  g_assert_true (ephy_sqlite_connection_open (connection, &error));
+  ephy_sqlite_connection_execute (connection,
+                                  "DROP TRIGGER urls_fts_insert;"
+                                  "DROP TRIGGER urls_fts_delete;"
+                                  "DROP TRIGGER urls_fts_update;"
+                                  "DROP TABLE urls_fts;"
+                                  "DROP TABLE urls_fts_backfill",
+                                  &error);
+  g_assert_no_error (error);
+
+  /* Changes made while the backfill runs end up in the index too. */
+  service = ephy_history_service_new (test_db_filename (), EPHY_SQLITE_CONNECTION_MODE_READWRITE);
+
+  deleted_url = ephy_history_url_new ("http://www.example.org/page/1234", "", 0, 0, 0);
+  urls = g_list_prepend (NULL, deleted_url);
+  ephy_history_service_delete_urls (service, urls, NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_service_delete_urls_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+  g_list_free (urls);
+  g_clear_object (&result);
+
+  ephy_history_service_set_url_title (service, "http://www.example.org/page/7", "Needle", NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_service_set_url_title_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+  g_clear_object (&result);
+
+  deadline = g_get_monotonic_time () + 10 * G_TIME_SPAN_SECOND;
+  while (!url_search_index_backfill_is_done (connection)) {
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+  }
+
+  /* page/12, page/120 to page/129 and page/1200 to page/1299, less the
+   * deleted one. */
+  g_assert_cmpuint (count_urls_matching (service, "page/12"), ==, 110);
+  g_assert_cmpuint (count_urls_matching (service, "Needle"), ==, 1);
+
+  ephy_sqlite_connection_close (connection);
+  g_object_unref (connection);
+  g_object_unref (service);
+}
+
+typedef struct {
+  GMainLoop *loop;
+  int pending;
+  int succeeded;
+  int failed;
+} BatchedWritesData;
+
+static void
+batched_write_done (BatchedWritesData *data)
+{
+  if (--data->pending == 0)
+    g_main_loop_quit (data->loop);
+}
+
+static void
+batched_visit_added (EphyHistoryService *service,
+                     GAsyncResult       *result,
+                     BatchedWritesData  *data)
+{
+  g_autoptr (GError) error = NULL;
+
+  if (ephy_history_service_add_visit_finish (service, result, &error))
+    data->succeeded++;
+  g_assert_no_error (error);
+
+  batched_write_done (data);
+}
+
+static void
+batched_title_set (EphyHistoryService *service,
+                   GAsyncResult       *result,
+                   BatchedWritesData  *data)
+{
+  g_autoptr (GError) error = NULL;
+
+  if (!ephy_history_service_set_url_title_finish (service, result, &error))
+    data->failed++;
+  g_assert_no_error (error);
+
+  batched_write_done (data);
+}
+
+static void
+test_batched_writes (void)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  BatchedWritesData data = { loop, 0, 0, 0 };
+
+  /* These are all queued before the history thread gets to them, so they end
+   * up in the same transaction, but each still gets its own result. */
+  for (int i = 0; i < 100; i++) {
+    g_autofree char *url = g_strdup_printf ("http://www.example.org/%d", i);
+    EphyHistoryPageVisit *visit = ephy_history_page_visit_new (url, 10 * (i + 1), EPHY_PAGE_VISIT_TYPED);
+
+    data.pending++;
+    ephy_history_service_add_visit (service, visit, NULL, (GAsyncReadyCallback)batched_visit_added, &data);
+    ephy_history_page_visit_free (visit);
+
+    if (i % 10 == 0) {
+      data.pending++;
+      ephy_history_service_set_url_title (service, "http://www.example.com/not-visited", "Title", NULL,
+                                          (GAsyncReadyCallback)batched_title_set, &data);
+    }
+  }
+
+  g_main_loop_run (loop);
+
+  g_assert_cmpint (data.succeeded, ==, 100);
+  g_assert_cmpint (data.failed, ==, 10);
+
+  g_object_unref (service);
+}
+
+typedef struct {
+  GMainLoop *loop;
+  int pending;
+  int completed;
+  int superseded;
+  gboolean last_completed;
+} SupersededQueriesData;
+
+static void
+superseded_query_done (EphyHistoryService    *service,
+                       GAsyncResult          *result,
+                       SupersededQueriesData *data)
+{
+  g_autoptr (GError) error = NULL;
+  GList *urls;
+
+  urls = ephy_history_service_query_urls_finish (service, result, &error);
+  if (error) {
+    g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+    data->superseded++;
+  } else {
+    data->completed++;
+  }
+  ephy_history_url_list_free (urls);
+
+  if (--data->pending == 0)
+    g_main_loop_quit (data->loop);
+}
+
+static void
+last_superseding_query_done (EphyHistoryService    *service,
+                             GAsyncResult          *result,
+                             SupersededQueriesData *data)
+{
+  int completed = data->completed;
+
+  superseded_query_done (service, result, data);
+
+  /* The newest query is never superseded. */
+  data->last_completed = data->completed > completed;
+}
+
+static void
+test_superseded_queries (void)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  SupersededQueriesData data = { loop, 0, 0, 0, FALSE };
+  const char *typed = "http://www.example.org/some/rather/long/path/typed/into/the/location/entry/";
+  GList *visits = NULL;
+
+  /* Keep the history thread busy so the queries pile up behind the write. */
+  for (int i = 0; i < 2000; i++) {
+    g_autofree char *url = g_strdup_printf ("http://www.example.org/%d", i);
+    visits = g_list_prepend (visits, ephy_history_page_visit_new (url, i + 1, EPHY_PAGE_VISIT_TYPED));
+  }
+  ephy_history_service_add_visits (service, visits, NULL, NULL, NULL);
+  ephy_history_page_visit_list_free (visits);
+
+  /* One query per keystroke, as the location entry does. */
+  for (int i = 0; i < 200; i++) {
+    g_autoptr (EphyHistoryQuery) query = ephy_history_query_new ();
+    g_autofree char *prefix = g_strndup (typed, (i % strlen (typed)) + 1);
+
+    query->substring_list = g_list_prepend (NULL, g_steal_pointer (&prefix));
+    query->limit = 25;
+    query->sort_type = EPHY_HISTORY_SORT_MOST_VISITED;
+    query->supersede_key = g_strdup ("location-entry");
+
+    data.pending++;
+    ephy_history_service_query_urls (service, query, NULL,
+                                     i == 199 ? (GAsyncReadyCallback)last_superseding_query_done : (GAsyncReadyCallback)superseded_query_done,
+                                     &data);
+  }
+
+  g_main_loop_run (loop);
+
+  g_test_message ("%d of 200 queries ran", data.completed);
+  g_assert_cmpint (data.completed + data.superseded, ==, 200);
+  g_assert_cmpint (data.completed, <=, 5);
+  g_assert_true (data.last_completed);
+
+  g_object_unref (service);
+}
+
+static void
+store_result_cb (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  GAsyncResult **result_out = user_data;
+
+  *result_out = g_object_ref (result);
+}
+
+static GAsyncResult *
+wait_for_result (GAsyncResult **result)
+{
+  while (!*result)
+    g_main_context_iteration (NULL, TRUE);
+
+  return *result;
+}
+
+static GList *
+query_all_urls (EphyHistoryService *service)
+{
+  g_autoptr (EphyHistoryQuery) query = ephy_history_query_new ();
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  GList *urls;
+
+  query->sort_type = EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED;
+  ephy_history_service_query_urls (service, query, NULL, store_result_cb, &result);
+  urls = ephy_history_service_query_urls_finish (service, wait_for_result (&result), &error);
+  g_assert_no_error (error);
+
+  return urls;
+}
+
+static void
+expire_history (EphyHistoryService *service)
+{
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+
+  ephy_history_service_expire (service, NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_service_expire_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+}
+
+static gboolean
+url_list_contains (GList      *urls,
+                   const char *url)
+{
+  for (GList *l = urls; l; l = l->next) {
+    if (g_strcmp0 (((EphyHistoryURL *)l->data)->url, url) == 0)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+test_expire_old_visits (void)
+{
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  const char *retained_urls[] = { "http://www.example.org/bookmarked", NULL };
+  gint64 now = g_get_real_time ();
+  gint64 long_ago = now - 100 * G_TIME_SPAN_DAY;
+  GList *visits = NULL;
+  GList *urls;
+
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.org/old", long_ago, EPHY_PAGE_VISIT_TYPED));
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.org/pinned", long_ago, EPHY_PAGE_VISIT_TYPED));
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.org/bookmarked", long_ago, EPHY_PAGE_VISIT_TYPED));
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.org/recent", now, EPHY_PAGE_VISIT_TYPED));
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.net/old", long_ago, EPHY_PAGE_VISIT_TYPED));
+  ephy_history_service_add_visits (service, visits, NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_service_add_visits_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+  ephy_history_page_visit_list_free (visits);
+  g_clear_object (&result);
+
+  ephy_history_service_set_url_pinned (service, "http://www.example.org/pinned", TRUE, NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_service_set_url_pinned_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+  g_clear_object (&result);
+
+  ephy_history_service_set_retained_urls (service, retained_urls);
+  ephy_history_service_set_retention_policy (service, 30, 0);
+  expire_history (service);
+
+  urls = query_all_urls (service);
+  g_assert_cmpuint (g_list_length (urls), ==, 3);
+  g_assert_true (url_list_contains (urls, "http://www.example.org/recent"));
+  g_assert_true (url_list_contains (urls, "http://www.example.org/pinned"));
+  g_assert_true (url_list_contains (urls, "http://www.example.org/bookmarked"));
+  ephy_history_url_list_free (urls);
+
+  /* The host with no URLs left goes too. */
+  ephy_history_service_get_hosts (service, NULL, store_result_cb, &result);
+  urls = ephy_history_service_get_hosts_finish (service, wait_for_result (&result), &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_list_length (urls), ==, 1);
+  ephy_history_host_list_free (urls);
+
+  g_object_unref (service);
+}
+
+static void
+test_expire_excess_visits (void)
+{
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  gint64 now = g_get_real_time ();
+  GList *visits = NULL;
+  GList *urls;
+
+  for (int i = 0; i < 1200; i++) {
+    g_autofree char *url = g_strdup_printf ("http://www.example.org/%d", i);
+    visits = g_list_prepend (visits, ephy_history_page_visit_new (url, now - (1200 - i) * G_TIME_SPAN_SECOND, EPHY_PAGE_VISIT_TYPED));
+  }
+  ephy_history_service_add_visits (service, visits, NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_service_add_visits_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+  ephy_history_page_visit_list_free (visits);
+
+  /* More than one expiry batch, with the newest visits kept. */
+  ephy_history_service_set_retention_policy (service, 0, 100);
+  expire_history (service);
+
+  urls = query_all_urls (service);
+  g_assert_cmpuint (g_list_length (urls), ==, 100);
+  g_assert_cmpstr (((EphyHistoryURL *)urls->data)->url, ==, "http://www.example.org/1199");
+  g_assert_cmpstr (((EphyHistoryURL *)g_list_last (urls)->data)->url, ==, "http://www.example.org/1100");
+  ephy_history_url_list_free (urls);
+
+  g_object_unref (service);
+}
+
+static void
+test_get_host_for_url (void)
+{
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  EphyHistoryHost *host;
+  GList *hosts;
+  int id;
+
+  /* An unknown host is added, so that callers get a real id. */
+  ephy_history_service_get_host_for_url (service, "http://www.example.org/page", NULL, store_result_cb, &result);
+  host = ephy_history_service_get_host_for_url_finish (service, wait_for_result (&result), &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (host);
+  g_assert_cmpint (host->id, >, 0);
+  id = host->id;
+  ephy_history_host_free (host);
+  g_clear_object (&result);
+
+  ephy_history_service_get_host_for_url (service, "http://www.example.org/other", NULL, store_result_cb, &result);
+  host = ephy_history_service_get_host_for_url_finish (service, wait_for_result (&result), &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (host->id, ==, id);
+  ephy_history_host_free (host);
+  g_clear_object (&result);
+
+  ephy_history_service_get_hosts (service, NULL, store_result_cb, &result);
+  hosts = ephy_history_service_get_hosts_finish (service, wait_for_result (&result), &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_list_length (hosts), ==, 1);
+  ephy_history_host_list_free (hosts);
+
+  g_object_unref (service);
+}
+
+static void
+test_frecency_ranking (void)
+{
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autoptr (EphyHistoryQuery) query = ephy_history_query_new ();
+  gint64 now = g_get_real_time ();
+  GList *visits = NULL;
+  GList *urls;
+
+  /* Visited often, but long ago. */
+  for (int i = 0; i < 20; i++)
+    visits = g_list_prepend (visits, ephy_history_page_visit_new ("http://www.example.org/old", now - (200 + i) * G_TIME_SPAN_DAY, EPHY_PAGE_VISIT_LINK));
+
+  /* Typed a few times yesterday. */
+  for (int i = 0; i < 3; i++)
+    visits = g_list_prepend (visits, ephy_history_page_visit_new ("http://www.example.org/new", now - G_TIME_SPAN_DAY - i * G_TIME_SPAN_MINUTE, EPHY_PAGE_VISIT_TYPED));
+
+  ephy_history_service_add_visits (service, visits, NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_service_add_visits_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+  ephy_history_page_visit_list_free (visits);
+  g_clear_object (&result);
+
+  query->sort_type = EPHY_HISTORY_SORT_MOST_VISITED;
+  ephy_history_service_query_urls (service, query, NULL, store_result_cb, &result);
+  urls = ephy_history_service_query_urls_finish (service, wait_for_result (&result), &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_list_length (urls), ==, 2);
+  g_assert_cmpstr (((EphyHistoryURL *)urls->data)->url, ==, "http://www.example.org/old");
+  ephy_history_url_list_free (urls);
+  g_clear_object (&result);
+
+  query->sort_type = EPHY_HISTORY_SORT_FRECENCY;
+  ephy_history_service_query_urls (service, query, NULL, store_result_cb, &result);
+  urls = ephy_history_service_query_urls_finish (service, wait_for_result (&result), &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_list_length (urls), ==, 2);
+  g_assert_cmpstr (((EphyHistoryURL *)urls->data)->url, ==, "http://www.example.org/new");
+  g_assert_cmpint (((EphyHistoryURL *)urls->data)->typed_count, ==, 3);
+  ephy_history_url_list_free (urls);
+
+  g_object_unref (service);
+}
+
+static void
+test_history_cursor (void)
+{
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  g_autoptr (EphyHistoryQuery) query = ephy_history_query_new ();
+  g_autoptr (EphyHistoryCursor) cursor = NULL;
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  gint64 now = g_get_real_time ();
+  GList *visits = NULL;
+  int expected = 49;
+  int n_pages = 0;
+
+  /* Every third URL shares its last visit time with the next two, so pages
+   * have to be keyed on the URL id as well. */
+  for (int i = 0; i < 50; i++) {
+    g_autofree char *url = g_strdup_printf ("http://www.example.org/%d", i);
+    visits = g_list_prepend (visits, ephy_history_page_visit_new (url, now - (50 - i) / 3 * G_TIME_SPAN_SECOND, EPHY_PAGE_VISIT_TYPED));
+  }
+  visits = g_list_reverse (visits);
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.com/", now, EPHY_PAGE_VISIT_TYPED));
+  ephy_history_service_add_visits (service, visits, NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_service_add_visits_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+  ephy_history_page_visit_list_free (visits);
+  g_clear_object (&result);
+
+  query->substring_list = g_list_append (NULL, g_strdup ("example.org"));
+  cursor = ephy_history_cursor_new (query, 7);
+
+  while (!ephy_history_cursor_is_done (cursor)) {
+    GList *page;
+
+    ephy_history_service_cursor_next_page (service, cursor, NULL, store_result_cb, &result);
+    page = ephy_history_service_cursor_next_page_finish (service, wait_for_result (&result), &error);
+    g_assert_no_error (error);
+    g_clear_object (&result);
+
+    g_assert_cmpuint (g_list_length (page), <=, 7);
+    for (GList *l = page; l; l = l->next) {
+      g_autofree char *url = g_strdup_printf ("http://www.example.org/%d", expected--);
+      g_assert_cmpstr (((EphyHistoryURL *)l->data)->url, ==, url);
+    }
+
+    ephy_history_url_list_free (page);
+    n_pages++;
+  }
+
+  g_assert_cmpint (expected, ==, -1);
+  g_assert_cmpint (n_pages, ==, 8);
+
+  g_object_unref (service);
+}
+
+static void
+test_visit_rollups (void)
+{
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  g_autoptr (GDateTime) today = g_date_time_new_now_local ();
+  g_autoptr (GDateTime) midnight = NULL;
+  g_autoptr (GDateTime) old_day = NULL;
+  g_autoptr (GDateTime) older_day = NULL;
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autoptr (EphyHistoryQuery) query = ephy_history_query_new ();
+  gint64 now = g_get_real_time ();
+  gint64 old_day_start;
+  GList *visits = NULL;
+  GList *urls;
+  int n_old_visits = 0;
+
+  midnight = g_date_time_new_local (g_date_time_get_year (today), g_date_time_get_month (today), g_date_time_get_day_of_month (today), 0, 0, 0);
+  old_day = g_date_time_add_days (midnight, -60);
+  older_day = g_date_time_add_days (midnight, -70);
+  old_day_start = g_date_time_to_unix (old_day) * G_USEC_PER_SEC;
+
+  for (int i = 0; i < 5; i++)
+    visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.org/", old_day_start + (9 + i) * G_TIME_SPAN_HOUR, EPHY_PAGE_VISIT_LINK));
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.org/", now - G_TIME_SPAN_HOUR, EPHY_PAGE_VISIT_LINK));
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.org/", now, EPHY_PAGE_VISIT_LINK));
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.com/", g_date_time_to_unix (older_day) * G_USEC_PER_SEC + 12 * G_TIME_SPAN_HOUR, EPHY_PAGE_VISIT_TYPED));
+  ephy_history_service_add_visits (service, visits, NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_service_add_visits_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+  ephy_history_page_visit_list_free (visits);
+  g_clear_object (&result);
+
+  ephy_history_service_roll_up_visits (service, NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_service_roll_up_visits_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+  g_clear_object (&result);
+
+  /* Each old day is left with a single visit, at the last visit time. */
+  ephy_history_service_find_visits_in_time (service, 0, now, NULL, store_result_cb, &result);
+  visits = ephy_history_service_find_visits_in_time_finish (service, wait_for_result (&result), &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_list_length (visits), ==, 4);
+  for (GList *l = visits; l; l = l->next) {
+    EphyHistoryPageVisit *visit = l->data;
+
+    if (g_strcmp0 (visit->url->url, "http://www.example.org/") == 0 && visit->visit_time < old_day_start + G_TIME_SPAN_DAY) {
+      g_assert_cmpint (visit->visit_time, ==, old_day_start + 13 * G_TIME_SPAN_HOUR);
+      n_old_visits++;
+    }
+  }
+  g_assert_cmpint (n_old_visits, ==, 1);
+  ephy_history_page_visit_list_free (visits);
+  g_clear_object (&result);
+
+  /* URLs are still found by the day they were visited on. */
+  query->from = old_day_start;
+  query->to = old_day_start + G_TIME_SPAN_DAY - 1;
+  query->sort_type = EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED;
+  ephy_history_service_query_urls (service, query, NULL, store_result_cb, &result);
+  urls = ephy_history_service_query_urls_finish (service, wait_for_result (&result), &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_list_length (urls), ==, 1);
+  g_assert_cmpstr (((EphyHistoryURL *)urls->data)->url, ==, "http://www.example.org/");
+  g_assert_cmpint (((EphyHistoryURL *)urls->data)->visit_count, ==, 7);
+  ephy_history_url_list_free (urls);
+
+  g_object_unref (service);
+}
+
+static void
+roll_up_visits (EphyHistoryService *service,
+                GList              *visits)
+{
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+
+  ephy_history_service_add_visits (service, visits, NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_service_add_visits_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+  ephy_history_page_visit_list_free (visits);
+  g_clear_object (&result);
+
+  ephy_history_service_roll_up_visits (service, NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_service_roll_up_visits_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+}
+
+static void
+test_visit_rollups_keep_strongest_visit_type (void)
+{
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  g_autoptr (GDateTime) today = g_date_time_new_now_local ();
+  g_autoptr (GDateTime) midnight = NULL;
+  g_autoptr (GDateTime) old_day = NULL;
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  gint64 old_day_start;
+  GList *visits = NULL;
+
+  midnight = g_date_time_new_local (g_date_time_get_year (today), g_date_time_get_month (today), g_date_time_get_day_of_month (today), 0, 0, 0);
+  old_day = g_date_time_add_days (midnight, -60);
+  old_day_start = g_date_time_to_unix (old_day) * G_USEC_PER_SEC;
+
+  /* Typed ranks above homepage although its value is lower, both within
+   * one roll up and when merging into a day rolled up before. */
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.org/", old_day_start + 9 * G_TIME_SPAN_HOUR, EPHY_PAGE_VISIT_TYPED));
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.org/", old_day_start + 10 * G_TIME_SPAN_HOUR, EPHY_PAGE_VISIT_HOMEPAGE));
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.org/", old_day_start + 11 * G_TIME_SPAN_HOUR, EPHY_PAGE_VISIT_LINK));
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.com/", old_day_start + 9 * G_TIME_SPAN_HOUR, EPHY_PAGE_VISIT_BOOKMARK));
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.com/", old_day_start + 10 * G_TIME_SPAN_HOUR, EPHY_PAGE_VISIT_LINK));
+  roll_up_visits (service, visits);
+
+  visits = g_list_append (NULL, ephy_history_page_visit_new ("http://www.example.com/", old_day_start + 12 * G_TIME_SPAN_HOUR, EPHY_PAGE_VISIT_HOMEPAGE));
+  roll_up_visits (service, visits);
+
+  ephy_history_service_find_visits_in_time (service, old_day_start, old_day_start + G_TIME_SPAN_DAY - 1, NULL, store_result_cb, &result);
+  visits = ephy_history_service_find_visits_in_time_finish (service, wait_for_result (&result), &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_list_length (visits), ==, 2);
+  for (GList *l = visits; l; l = l->next) {
+    EphyHistoryPageVisit *visit = l->data;
+
+    if (g_strcmp0 (visit->url->url, "http://www.example.org/") == 0)
+      g_assert_cmpint (visit->visit_type, ==, EPHY_PAGE_VISIT_TYPED);
+    else
+      g_assert_cmpint (visit->visit_type, ==, EPHY_PAGE_VISIT_BOOKMARK);
+  }
+  ephy_history_page_visit_list_free (visits);
+
+  g_object_unref (service);
+}
+
+static void
+test_zoom_level_cache (void)
+{
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  GList *visits = NULL;
+
+  ephy_history_service_set_url_zoom_level (service, "https://www.gnome.org/news", 1.5, NULL, store_result_cb, &result);
+
+  /* Keep the history thread busy, the zoom level must not wait for it. */
+  for (int i = 0; i < 5000; i++) {
+    g_autofree char *url = g_strdup_printf ("http://www.example.org/%d", i);
+    visits = g_list_prepend (visits, ephy_history_page_visit_new (url, i, EPHY_PAGE_VISIT_LINK));
+  }
+  ephy_history_service_add_visits (service, visits, NULL, NULL, NULL);
+  ephy_history_page_visit_list_free (visits);
+
+  g_assert_cmpfloat (ephy_history_service_get_url_zoom_level (service, "http://gnome.org/about"), ==, 1.5);
+  g_assert_cmpfloat (ephy_history_service_get_url_zoom_level (service, "https://www.gnome.org/"), ==, 1.5);
+  g_assert_cmpfloat (ephy_history_service_get_url_zoom_level (service, "http://www.example.org/1"), ==, 0.0);
+
+  g_assert_true (ephy_history_service_set_url_zoom_level_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+  g_object_unref (service);
+
+  /* The cache is loaded from the hosts table on startup. */
+  service = ephy_history_service_new (test_db_filename (), EPHY_SQLITE_CONNECTION_MODE_READWRITE);
+  g_assert_cmpfloat (ephy_history_service_get_url_zoom_level (service, "https://www.gnome.org/"), ==, 1.5);
+  g_object_unref (service);
+}
+
+typedef struct {
+  int emissions;
+  char *last_title;
+} TitleChangedData;
+
+static void
+title_changed_cb (EphyHistoryService *service,
+                  const char         *url,
+                  const char         *title,
+                  TitleChangedData   *data)
+{
+  data->emissions++;
+  g_free (data->last_title);
+  data->last_title = g_strdup (title);
+}
+
+static void
+test_coalesced_signals (void)
+{
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  EphyHistoryPageVisit *visit;
+  TitleChangedData data = { 0, NULL };
+  int n_titles = 50;
+
+  visit = ephy_history_page_visit_new ("http://www.gnome.org/", 10, EPHY_PAGE_VISIT_TYPED);
+  ephy_history_service_add_visit (service, visit, NULL, store_result_cb, &result);
+  ephy_history_page_visit_free (visit);
+  g_assert_true (ephy_history_service_add_visit_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+  g_clear_object (&result);
+
+  g_signal_connect (service, "url-title-changed", G_CALLBACK (title_changed_cb), &data);
+
+  for (int i = 0; i < n_titles; i++) {
+    g_autofree char *title = g_strdup_printf ("Title %d", i);
+
+    ephy_history_service_set_url_title (service, "http://www.gnome.org/", title, NULL,
+                                        i == n_titles - 1 ? store_result_cb : NULL, &result);
+  }
+
+  g_assert_true (ephy_history_service_set_url_title_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+
+  /* Title changes that were not emitted yet are dropped for the newest one,
+   * which is emitted before the last task completes. */
+  g_assert_cmpint (data.emissions, >=, 1);
+  g_assert_cmpint (data.emissions, <=, n_titles);
+  g_assert_cmpstr (data.last_title, ==, "Title 49");
+
+  g_free (data.last_title);
+  g_object_unref (service);
+}
+
+static void
+completion_latency_visit_added (EphyHistoryService *service,
+                                GAsyncResult       *result,
+                                int                *pending)
+{
+  g_assert_true (ephy_history_service_add_visit_finish (service, result, NULL));
+  (*pending)--;
+}
+
+static void
+test_completion_latency (void)
+{
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  g_autoptr (GTimer) timer = g_timer_new ();
+  double max_iteration = 0;
+  int pending = 0;
+
+  for (int i = 0; i < 5000; i++) {
+    g_autofree char *url = g_strdup_printf ("http://www.example.org/%d", i);
+    EphyHistoryPageVisit *visit = ephy_history_page_visit_new (url, i, EPHY_PAGE_VISIT_LINK);
+
+    pending++;
+    ephy_history_service_add_visit (service, visit, NULL, (GAsyncReadyCallback)completion_latency_visit_added, &pending);
+    ephy_history_page_visit_free (visit);
+  }
+
+  /* How long the main loop is blocked at a time while the results of a
+   * bulk operation come in. */
+  while (pending > 0) {
+    g_timer_start (timer);
+    g_main_context_iteration (NULL, TRUE);
+    max_iteration = MAX (max_iteration, g_timer_elapsed (timer, NULL));
+  }
+
+  g_test_minimized_result (max_iteration * 1000, "Longest main loop iteration: %.2f ms", max_iteration * 1000);
+
+  g_object_unref (service);
+}
+
+static void
+urls_deleted_cb (EphyHistoryService  *service,
+                 GList               *urls,
+                 GPtrArray          **deleted)
+{
+  g_assert_null (*deleted);
+  *deleted = g_ptr_array_new_with_free_func (g_free);
+  for (GList *l = urls; l; l = l->next)
+    g_ptr_array_add (*deleted, g_strdup (((EphyHistoryURL *)l->data)->url));
+}
+
+static void
+test_delete_visits_in_range (void)
+{
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GPtrArray) deleted = NULL;
+  gint64 now = g_get_real_time ();
+  GList *visits = NULL;
+  GList *urls;
+
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.org/recent", now - 10 * G_TIME_SPAN_MINUTE, EPHY_PAGE_VISIT_TYPED));
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.com/both", now - 2 * G_TIME_SPAN_DAY, EPHY_PAGE_VISIT_TYPED));
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.com/both", now - 20 * G_TIME_SPAN_MINUTE, EPHY_PAGE_VISIT_TYPED));
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.com/old", now - 3 * G_TIME_SPAN_DAY, EPHY_PAGE_VISIT_TYPED));
+  ephy_history_service_add_visits (service, visits, NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_service_add_visits_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+  ephy_history_page_visit_list_free (visits);
+  g_clear_object (&result);
+
+  g_signal_connect (service, "urls-deleted", G_CALLBACK (urls_deleted_cb), &deleted);
+
+  ephy_history_service_delete_visits_in_range (service, now - G_TIME_SPAN_HOUR, G_MAXINT64, NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_service_delete_visits_in_range_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+  g_clear_object (&result);
+
+  /* Only the URL that was left without visits is reported, in one emission. */
+  g_assert_nonnull (deleted);
+  g_assert_cmpuint (deleted->len, ==, 1);
+  g_assert_cmpstr (g_ptr_array_index (deleted, 0), ==, "http://www.example.org/recent");
+
+  urls = query_all_urls (service);
+  g_assert_cmpuint (g_list_length (urls), ==, 2);
+  for (GList *l = urls; l; l = l->next) {
+    EphyHistoryURL *url = l->data;
+
+    if (g_strcmp0 (url->url, "http://www.example.com/both") == 0) {
+      g_assert_cmpint (url->visit_count, ==, 1);
+      g_assert_cmpint (url->last_visit_time, ==, now - 2 * G_TIME_SPAN_DAY);
+    } else {
+      g_assert_cmpstr (url->url, ==, "http://www.example.com/old");
+    }
+  }
+  ephy_history_url_list_free (urls);
+
+  g_object_unref (service);
+}
+
+static int
+delete_visits_in_range_and_count (EphyHistoryService *service,
+                                  gint64              from,
+                                  gint64              to)
+{
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  GList *urls;
+  int visit_count = 0;
+
+  ephy_history_service_delete_visits_in_range (service, from, to, NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_service_delete_visits_in_range_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+
+  urls = query_all_urls (service);
+  for (GList *l = urls; l; l = l->next)
+    visit_count += ((EphyHistoryURL *)l->data)->visit_count;
+  ephy_history_url_list_free (urls);
+
+  return visit_count;
+}
+
+static void
+test_delete_visits_in_range_with_rollups (void)
+{
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  g_autoptr (GDateTime) today = g_date_time_new_now_local ();
+  g_autoptr (GDateTime) midnight = NULL;
+  g_autoptr (GDateTime) old_day = NULL;
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  gint64 old_day_start;
+  GList *visits = NULL;
+
+  midnight = g_date_time_new_local (g_date_time_get_year (today), g_date_time_get_month (today), g_date_time_get_day_of_month (today), 0, 0, 0);
+  old_day = g_date_time_add_days (midnight, -60);
+  old_day_start = g_date_time_to_unix (old_day) * G_USEC_PER_SEC;
+
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.org/", old_day_start + 9 * G_TIME_SPAN_HOUR, EPHY_PAGE_VISIT_LINK));
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.example.org/", old_day_start + 13 * G_TIME_SPAN_HOUR, EPHY_PAGE_VISIT_LINK));
+  ephy_history_service_add_visits (service, visits, NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_service_add_visits_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+  ephy_history_page_visit_list_free (visits);
+  g_clear_object (&result);
+
+  ephy_history_service_roll_up_visits (service, NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_service_roll_up_visits_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+
+  /* A range that only covers part of the rolled up day leaves it alone,
+   * even where it covers one of its visits. */
+  g_assert_cmpint (delete_visits_in_range_and_count (service,
+                                                     old_day_start + 12 * G_TIME_SPAN_HOUR,
+                                                     old_day_start + 14 * G_TIME_SPAN_HOUR), ==, 2);
+
+  /* A range that covers all of its visits deletes it. */
+  g_assert_cmpint (delete_visits_in_range_and_count (service,
+                                                     old_day_start,
+                                                     old_day_start + G_TIME_SPAN_DAY - 1), ==, 0);
+
+  g_object_unref (service);
+}
+
+static void
+create_import_database (const char         *filename,
+                        const char * const *statements)
+{
+  g_autoptr (EphySQLiteConnection) connection = NULL;
+  g_autoptr (GError) error = NULL;
+
+  g_unlink (filename);
+  connection = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READWRITE, filename);
+  ephy_sqlite_connection_open (connection, &error);
+  g_assert_no_error (error);
+
+  for (guint i = 0; statements[i]; i++) {
+    ephy_sqlite_connection_execute (connection, statements[i], &error);
+    g_assert_no_error (error);
+  }
+
+  ephy_sqlite_connection_close (connection);
+}
+
+static void
+import_progress_cb (goffset  current,
+                    goffset  total,
+                    gpointer user_data)
+{
+  goffset *last = user_data;
+
+  g_assert_cmpint (current, >=, *last);
+  g_assert_cmpint (current, <=, total);
+  *last = current;
+}
+
+static void
+verify_imported_history (EphyHistoryService  *service,
+                         EphyHistoryImportSource source,
+                         const char          *filename)
+{
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  goffset progress = 0;
+  GList *urls;
+
+  ephy_history_import (service, source, filename, NULL,
+                       import_progress_cb, &progress,
+                       store_result_cb, &result);
+  g_assert_true (ephy_history_import_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+
+  /* Let the last progress report run. */
+  while (g_main_context_iteration (NULL, FALSE))
+    continue;
+  g_assert_cmpint (progress, ==, 5);
+
+  /* Embedded and non-web visits are skipped. */
+  urls = query_all_urls (service);
+  g_assert_cmpuint (g_list_length (urls), ==, 2);
+  for (GList *l = urls; l; l = l->next) {
+    EphyHistoryURL *url = l->data;
+
+    if (g_strcmp0 (url->url, "https://www.example.com/") == 0) {
+      g_assert_cmpstr (url->title, ==, "Example");
+      g_assert_cmpint (url->visit_count, ==, 2);
+      g_assert_cmpint (url->typed_count, ==, 1);
+      g_assert_cmpint (url->last_visit_time, ==, 1600000060000000);
+    } else {
+      g_assert_cmpstr (url->url, ==, "https://www.example.org/");
+      g_assert_cmpstr (url->title, ==, "https://www.example.org/");
+      g_assert_cmpint (url->visit_count, ==, 1);
+      g_assert_cmpint (url->last_visit_time, ==, 1600000120000000);
+    }
+  }
+  ephy_history_url_list_free (urls);
+}
+
+static void
+test_import_history (void)
+{
+  EphyHistoryService *service;
+  g_autofree char *firefox_filename = g_build_filename (g_get_tmp_dir (), "epiphany-history-test-places.sqlite", NULL);
+  g_autofree char *chrome_filename = g_build_filename (g_get_tmp_dir (), "epiphany-history-test-History", NULL);
+  const char * const firefox_statements[] = {
+    "CREATE TABLE moz_places (id INTEGER PRIMARY KEY, url LONGVARCHAR, title LONGVARCHAR)",
+    "CREATE TABLE moz_historyvisits (id INTEGER PRIMARY KEY, place_id INTEGER, visit_date INTEGER, visit_type INTEGER)",
+    "INSERT INTO moz_places VALUES (1, 'https://www.example.com/', 'Example'), "
+    "(2, 'https://www.example.org/', NULL), (3, 'https://ads.example.net/frame', 'Ad'), (4, 'place:sort=8', NULL)",
+    "INSERT INTO moz_historyvisits VALUES (1, 1, 1600000000000000, 2), (2, 1, 1600000060000000, 1), "
+    "(3, 2, 1600000120000000, 5), (4, 3, 1600000130000000, 4), (5, 4, 1600000140000000, 1)",
+    NULL
+  };
+  const char * const chrome_statements[] = {
+    "CREATE TABLE urls (id INTEGER PRIMARY KEY, url LONGVARCHAR, title LONGVARCHAR)",
+    "CREATE TABLE visits (id INTEGER PRIMARY KEY, url INTEGER, visit_time INTEGER, transition INTEGER)",
+    "INSERT INTO urls VALUES (1, 'https://www.example.com/', 'Example'), "
+    "(2, 'https://www.example.org/', NULL), (3, 'https://ads.example.net/frame', 'Ad'), (4, 'chrome://settings/', NULL)",
+    "INSERT INTO visits VALUES (1, 1, 13244473600000000, 805306369), (2, 1, 13244473660000000, 0), "
+    "(3, 2, 13244473720000000, 8), (4, 3, 13244473730000000, 3), (5, 4, 13244473740000000, 1)",
+    NULL
+  };
+
+  create_import_database (firefox_filename, firefox_statements);
+  service = ensure_empty_history (test_db_filename ());
+  verify_imported_history (service, EPHY_HISTORY_IMPORT_FIREFOX, firefox_filename);
+  /* Importing the same file again adds nothing. */
+  verify_imported_history (service, EPHY_HISTORY_IMPORT_FIREFOX, firefox_filename);
+  g_object_unref (service);
+  g_unlink (firefox_filename);
+
+  create_import_database (chrome_filename, chrome_statements);
+  service = ensure_empty_history (test_db_filename ());
+  verify_imported_history (service, EPHY_HISTORY_IMPORT_CHROME, chrome_filename);
+  g_object_unref (service);
+  g_unlink (chrome_filename);
+}
+
+static gsize
+get_heap_in_use (void)
+{
+#ifdef __GLIBC__
+  return mallinfo2 ().uordblks;
+#else
+  return 0;
+#endif
+}
+
+static void
+test_url_table_performance (void)
+{
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  g_autoptr (EphySQLiteConnection) connection = NULL;
+  g_autoptr (EphySQLiteStatement) statement = NULL;
+  g_autoptr (EphyHistoryQuery) query = ephy_history_query_new ();
+  g_autoptr (EphyHistoryURLTable) table = NULL;
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GTimer) timer = g_timer_new ();
+  const int n_urls = 10000;
+  GList *urls;
+  gsize heap_before;
+  gsize list_bytes, table_bytes;
+  double list_ms, table_ms;
+
+  connection = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READWRITE, test_db_filename ());
+  g_assert_true (ephy_sqlite_connection_open (connection, &error));
+  g_assert_no_error (error);
+
+  ephy_sqlite_connection_begin_transaction (connection, &error);
+  g_assert_no_error (error);
+  ephy_sqlite_connection_execute (connection, "INSERT INTO hosts (id, url, title) VALUES (1, 'http://example.org/', 'example.org')", &error);
+  g_assert_no_error (error);
+
+  statement = ephy_sqlite_connection_create_statement (connection,
+                                                       "INSERT INTO urls (host, url, title, visit_count, last_visit_time, sync_id) VALUES (1, ?, ?, ?, ?, ?)",
+                                                       EPHY_SQLITE_STATEMENT_LONG_LIVED, &error);
+  g_assert_no_error (error);
+  for (int i = 0; i < n_urls; i++) {
+    g_autofree char *url = g_strdup_printf ("https://www.site%d.example.org/articles/%d", i % 500, i);
+    g_autofree char *title = g_strdup_printf ("Article number %d on site %d", i, i % 500);
+    g_autofree char *sync_id = g_strdup_printf ("%032x", i);
+
+    ephy_sqlite_statement_reset (statement);
+    ephy_sqlite_statement_bind_string (statement, 0, url, &error);
+    ephy_sqlite_statement_bind_string (statement, 1, title, &error);
+    ephy_sqlite_statement_bind_int (statement, 2, i % 100, &error);
+    ephy_sqlite_statement_bind_int64 (statement, 3, (gint64)i * G_TIME_SPAN_MINUTE, &error);
+    ephy_sqlite_statement_bind_string (statement, 4, sync_id, &error);
+    ephy_sqlite_statement_step (statement, &error);
+    g_assert_no_error (error);
+  }
+  g_clear_object (&statement);
+  ephy_sqlite_connection_commit_transaction (connection, &error);
+  g_assert_no_error (error);
+
+  query->sort_type = EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED;
+
+  heap_before = get_heap_in_use ();
+  g_timer_start (timer);
+  ephy_history_service_query_urls (service, query, NULL, store_result_cb, &result);
+  urls = ephy_history_service_query_urls_finish (service, wait_for_result (&result), &error);
+  list_ms = g_timer_elapsed (timer, NULL) * 1000;
+  list_bytes = get_heap_in_use () - heap_before;
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_list_length (urls), ==, n_urls);
+  ephy_history_url_list_free (urls);
+  g_clear_object (&result);
+
+  heap_before = get_heap_in_use ();
+  g_timer_start (timer);
+  ephy_history_service_query_url_table (service, query, NULL, store_result_cb, &result);
+  table = ephy_history_service_query_url_table_finish (service, wait_for_result (&result), &error);
+  table_ms = g_timer_elapsed (timer, NULL) * 1000;
+  table_bytes = get_heap_in_use () - heap_before;
+  g_assert_no_error (error);
+  g_assert_cmpuint (ephy_history_url_table_get_length (table), ==, n_urls);
+  g_assert_cmpstr (ephy_history_url_table_get_url (table, 0), ==, "https://www.site499.example.org/articles/9999");
+  g_clear_object (&result);
+
+  /* A list costs six allocations per row: the URL, its host, three strings
+   * and the list node. A table costs three in total. */
+  g_test_message ("Querying %d URLs: list %.2f ms, %" G_GSIZE_FORMAT " KiB; table %.2f ms, %" G_GSIZE_FORMAT " KiB",
+                  n_urls, list_ms, list_bytes / 1024, table_ms, table_bytes / 1024);
+  g_test_minimized_result (table_ms, "URL table query: %.2f ms", table_ms);
+#ifdef __GLIBC__
+  g_assert_cmpuint (table_bytes, <, list_bytes);
+#endif
+
+  ephy_sqlite_connection_close (connection);
+  g_object_unref (service);
+}
+
+static void
+test_import_history_performance (void)
+{
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  g_autofree char *filename = g_build_filename (g_get_tmp_dir (), "epiphany-history-test-places.sqlite", NULL);
+  g_autoptr (EphySQLiteConnection) connection = NULL;
+  g_autoptr (EphySQLiteStatement) statement = NULL;
+  g_autoptr (GAsyncResult) result = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GTimer) timer = NULL;
+  const int n_places = 20000;
+  const int n_visits = 200000;
+
+  g_unlink (filename);
+  connection = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READWRITE, filename);
+  ephy_sqlite_connection_open (connection, &error);
+  g_assert_no_error (error);
+  ephy_sqlite_connection_execute (connection, "CREATE TABLE moz_places (id INTEGER PRIMARY KEY, url LONGVARCHAR, title LONGVARCHAR)", &error);
+  g_assert_no_error (error);
+  ephy_sqlite_connection_execute (connection, "CREATE TABLE moz_historyvisits (id INTEGER PRIMARY KEY, place_id INTEGER, visit_date INTEGER, visit_type INTEGER)", &error);
+  g_assert_no_error (error);
+
+  ephy_sqlite_connection_begin_transaction (connection, &error);
+  g_assert_no_error (error);
+  statement = ephy_sqlite_connection_create_statement (connection, "INSERT INTO moz_places VALUES (?, ?, ?)",
+                                                       EPHY_SQLITE_STATEMENT_LONG_LIVED, &error);
+  g_assert_no_error (error);
+  for (int i = 1; i <= n_places; i++) {
+    g_autofree char *url = g_strdup_printf ("https://host%d.example.com/page/%d", i % 500, i);
+
+    ephy_sqlite_statement_reset (statement);
+    ephy_sqlite_statement_bind_int (statement, 0, i, NULL);
+    ephy_sqlite_statement_bind_string (statement, 1, url, NULL);
+    ephy_sqlite_statement_bind_string (statement, 2, url + 8, NULL);
+    ephy_sqlite_statement_step (statement, &error);
+    g_assert_no_error (error);
+  }
+  g_clear_object (&statement);
+
+  statement = ephy_sqlite_connection_create_statement (connection, "INSERT INTO moz_historyvisits VALUES (?, ?, ?, ?)",
+                                                       EPHY_SQLITE_STATEMENT_LONG_LIVED, &error);
+  g_assert_no_error (error);
+  for (int i = 1; i <= n_visits; i++) {
+    ephy_sqlite_statement_reset (statement);
+    ephy_sqlite_statement_bind_int (statement, 0, i, NULL);
+    ephy_sqlite_statement_bind_int (statement, 1, g_random_int_range (1, n_places + 1), NULL);
+    ephy_sqlite_statement_bind_int64 (statement, 2, 1600000000000000 + (gint64)i * G_TIME_SPAN_MINUTE, NULL);
+    ephy_sqlite_statement_bind_int (statement, 3, g_random_int_range (1, 3), NULL);
+    ephy_sqlite_statement_step (statement, &error);
+    g_assert_no_error (error);
+  }
+  g_clear_object (&statement);
+  ephy_sqlite_connection_commit_transaction (connection, &error);
+  g_assert_no_error (error);
+  ephy_sqlite_connection_close (connection);
+
+  timer = g_timer_new ();
+  ephy_history_import (service, EPHY_HISTORY_IMPORT_FIREFOX, filename, NULL, NULL, NULL, store_result_cb, &result);
+  g_assert_true (ephy_history_import_finish (service, wait_for_result (&result), &error));
+  g_assert_no_error (error);
+
+  g_test_minimized_result (g_timer_elapsed (timer, NULL),
+                           "Imported %d visits in %.2f s", n_visits, g_timer_elapsed (timer, NULL));
+
+  g_object_unref (service);
+  g_unlink (filename);
+}
+
+static double
+time_url_search (EphySQLiteConnection *connection,
+                 const char           *sql,
+                 const char           *value)
+{
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GTimer) timer = g_timer_new ();
+  EphySQLiteStatement *statement;
+  const int iterations = 20;
+
+  statement = ephy_sqlite_connection_create_statement (connection, sql, EPHY_SQLITE_STATEMENT_LONG_LIVED, &error);
+  g_assert_no_error (error);
+
+  for (int i = 0; i < iterations; i++) {
+    ephy_sqlite_statement_reset (statement);
+    ephy_sqlite_statement_bind_string (statement, 0, value, &error);
+    g_assert_no_error (error);
+    if (strstr (sql, "LIKE")) {
+      ephy_sqlite_statement_bind_string (statement, 1, value + 2, &error);
+      g_assert_no_error (error);
+    }
+
+    while (ephy_sqlite_statement_step (statement, &error))
+      continue;
+    g_assert_no_error (error);
+  }
+
+  g_object_unref (statement);
+
+  return g_timer_elapsed (timer, NULL) * 1000 / iterations;
+}
+
+static void
+test_url_search_performance (void)
+{
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  EphySQLiteConnection *connection;
+  EphySQLiteStatement *statement;
+  g_autoptr (GError) error = NULL;
+  g_autofree char *pattern = NULL;
+  const char *words[] = { "news", "video", "recipe", "linux", "release", "weather", "forum", "music" };
+  const int n_urls = 500000;
+  double like_ms, match_ms;
+
+  connection = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READWRITE, test_db_filename ());
+  g_assert_true (ephy_sqlite_connection_open (connection, &error));
+  g_assert_no_error (error);
+
+  ephy_sqlite_connection_begin_transaction (connection, &error);
+  g_assert_no_error (error);
+  ephy_sqlite_connection_execute (connection, "INSERT INTO hosts (id, url, title) VALUES (1, 'http://example.org/', 'example.org')", &error);
+  g_assert_no_error (error);
+
+  statement = ephy_sqlite_connection_create_statement (connection,
+                                                       "INSERT INTO urls (host, url, title, visit_count) VALUES (1, ?, ?, ?)",
+                                                       EPHY_SQLITE_STATEMENT_LONG_LIVED, &error);
+  g_assert_no_error (error);
+
+  g_random_set_seed (42);
+  for (int i = 0; i < n_urls; i++) {
+    g_autofree char *url = g_strdup_printf ("https://www.site%d.example.org/%s/%d", i % 20000,
+                                            words[g_random_int_range (0, G_N_ELEMENTS (words))], i);
+    g_autofree char *title = g_strdup_printf ("%s %s page %d",
+                                              words[g_random_int_range (0, G_N_ELEMENTS (words))],
+                                              words[g_random_int_range (0, G_N_ELEMENTS (words))], i);
+
+    ephy_sqlite_statement_reset (statement);
+    ephy_sqlite_statement_bind_string (statement, 0, url, &error);
+    ephy_sqlite_statement_bind_string (statement, 1, title, &error);
+    ephy_sqlite_statement_bind_int (statement, 2, g_random_int_range (1, 100), &error);
+    ephy_sqlite_statement_step (statement, &error);
+    g_assert_no_error (error);
+  }
+  g_object_unref (statement);
+
+  ephy_sqlite_connection_commit_transaction (connection, &error);
+  g_assert_no_error (error);
+
+  pattern = ephy_sqlite_create_match_pattern ("site1234.");
+  like_ms = time_url_search (connection,
+                             "SELECT id FROM urls WHERE (url LIKE ? OR title LIKE ?) "
+                             "ORDER BY visit_count DESC LIMIT 10",
+                             pattern);
+  match_ms = time_url_search (connection,
+                              "SELECT id FROM urls WHERE id IN (SELECT rowid FROM urls_fts WHERE urls_fts MATCH ?) "
+                              "ORDER BY visit_count DESC LIMIT 10",
+                              "\"site1234.\"");
+
+  g_test_message ("Substring search over %d URLs: LIKE %.2f ms, search index %.2f ms", n_urls, like_ms, match_ms);
+  g_test_minimized_result (match_ms, "Search index query: %.2f ms", match_ms);
+
+  ephy_sqlite_connection_close (connection);
+  g_object_unref (connection);
+  g_object_unref (service);
+}
+
+/* The shape of the queries sent for location entry suggestions. */
+#define SUGGESTION_QUERY_SQL \
+  "SELECT DISTINCT urls.id, urls.url, urls.title, urls.visit_count, urls.typed_count, " \
+  "urls.last_visit_time, urls.hidden_from_overview, urls.host, urls.sync_id, urls.pinned " \
+  "FROM urls WHERE (urls.url LIKE ? OR urls.title LIKE ?) AND " \
+  "urls.id IN (SELECT rowid FROM urls_fts WHERE urls_fts MATCH ?) AND 1 " \
+  "ORDER BY urls.pinned DESC, urls.visit_count DESC LIMIT ? "
+
+static void
+run_suggestion_query (EphySQLiteStatement *statement,
+                      int                  i)
+{
+  g_autoptr (GError) error = NULL;
+  g_autofree char *match = g_strdup_printf ("\"site%d\"", i);
+
+  ephy_sqlite_statement_bind_string (statement, 0, "%://%e%", &error);
+  ephy_sqlite_statement_bind_string (statement, 1, "%e%", &error);
+  ephy_sqlite_statement_bind_string (statement, 2, match, &error);
+  ephy_sqlite_statement_bind_int (statement, 3, 25, &error);
+  g_assert_no_error (error);
+
+  while (ephy_sqlite_statement_step (statement, &error))
+    continue;
+  g_assert_no_error (error);
+}
+
+static void
+test_statement_cache_performance (void)
+{
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  EphySQLiteConnection *connection;
+  EphySQLiteStatement *statement;
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GTimer) timer = g_timer_new ();
+  const int iterations = 5000;
+  double uncached_ms, cached_ms;
+  guint64 hits, misses;
+
+  connection = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READWRITE, test_db_filename ());
+  g_assert_true (ephy_sqlite_connection_open (connection, &error));
+  g_assert_no_error (error);
+
+  ephy_sqlite_connection_execute (connection, "BEGIN TRANSACTION", &error);
+  ephy_sqlite_connection_execute (connection, "INSERT INTO hosts (id, url, title) VALUES (1, 'http://example.org/', 'example.org')", &error);
+  for (int i = 0; i < 1000; i++) {
+    g_autofree char *sql = g_strdup_printf ("INSERT INTO urls (host, url, title, visit_count) "
+                                            "VALUES (1, 'https://www.site%d.example.org/', 'Site %d', %d)", i, i, i % 50);
+    ephy_sqlite_connection_execute (connection, sql, &error);
+  }
+  ephy_sqlite_connection_execute (connection, "COMMIT", &error);
+  g_assert_no_error (error);
+
+  /* Suggestion queries are cheap to run against a small history, so
+   * compiling them is a large part of their cost. */
+  g_timer_start (timer);
+  for (int i = 0; i < iterations; i++) {
+    statement = ephy_sqlite_connection_create_statement (connection, SUGGESTION_QUERY_SQL, EPHY_SQLITE_STATEMENT_SHORT_LIVED, &error);
+    g_assert_no_error (error);
+    run_suggestion_query (statement, i);
+    g_object_unref (statement);
+  }
+  uncached_ms = g_timer_elapsed (timer, NULL) * 1000 / iterations;
+
+  g_timer_start (timer);
+  for (int i = 0; i < iterations; i++) {
+    statement = ephy_sqlite_connection_get_cached_statement (connection, "suggestions");
+    if (!statement)
+      statement = ephy_sqlite_connection_add_cached_statement (connection, "suggestions", SUGGESTION_QUERY_SQL, &error);
+    g_assert_no_error (error);
+    run_suggestion_query (statement, i);
+    g_object_unref (statement);
+  }
+  cached_ms = g_timer_elapsed (timer, NULL) * 1000 / iterations;
+
+  ephy_sqlite_connection_get_statement_cache_stats (connection, &hits, &misses);
+  g_assert_cmpuint (hits, ==, iterations - 1);
+  g_assert_cmpuint (misses, ==, 1);
+
+  g_test_message ("Suggestion query: %.4f ms compiled every time, %.4f ms cached, %.4f ms saved in sqlite3_prepare",
+                  uncached_ms, cached_ms, uncached_ms - cached_ms);
+  g_test_minimized_result (cached_ms, "Cached suggestion query: %.4f ms", cached_ms);
+
+  ephy_sqlite_connection_close (connection);
+  g_object_unref (connection);
+  g_object_unref (service);
+}
+
+static void
+assert_query_uses_index (EphySQLiteConnection *connection,
+                         const char           *sql,
+                         const char           *index)
+{
+  g_autofree char *explain = g_strconcat ("EXPLAIN QUERY PLAN ", sql, NULL);
+  g_autoptr (GError) error = NULL;
+  EphySQLiteStatement *statement;
+  gboolean found = FALSE;
+
+  statement = ephy_sqlite_connection_create_statement (connection, explain, EPHY_SQLITE_STATEMENT_SHORT_LIVED, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (statement);
+
+  /* The fourth column of the query plan holds the human readable detail,
+   * e.g. "SEARCH urls USING COVERING INDEX urls_url_index (url=?)". */
+  while (ephy_sqlite_statement_step (statement, &error)) {
+    const char *detail = ephy_sqlite_statement_get_column_as_string (statement, 3);
+    if (detail && strstr (detail, index))
+      found = TRUE;
+  }
+  g_assert_no_error (error);
+  g_object_unref (statement);
+
+  if (!found)
+    g_error ("Query \"%s\" does not use index %s", sql, index);
+}
+
+static void
+verify_indexes_are_used (EphyHistoryService *service,
+                         GAsyncResult       *result,
+                         gpointer            user_data)
+{
+  GMainLoop *loop = user_data;
+  EphySQLiteConnection *connection;
+  g_autoptr (GError) error = NULL;
+  gboolean success;
+
+  success = ephy_history_service_add_visits_finish (service, result, &error);
+  g_assert_no_error (error);
+  g_assert_true (success);
+
+  connection = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READWRITE, test_db_filename ());
+  g_assert_true (ephy_sqlite_connection_open (connection, &error));
+  g_assert_no_error (error);
+
+  assert_query_uses_index (connection, "SELECT id FROM urls WHERE url=?", "urls_url_index");
+  assert_query_uses_index (connection, "SELECT id FROM urls WHERE host=?", "urls_host_index");
+  assert_query_uses_index (connection, "SELECT id FROM urls ORDER BY last_visit_time DESC LIMIT 10", "urls_last_visit_time_index");
+  assert_query_uses_index (connection, "SELECT visit_time FROM visits WHERE url=? AND visit_time >= ?", "visits_url_visit_time_index");
+  assert_query_uses_index (connection, "SELECT id FROM hosts WHERE url=?", "hosts_url_index");
+
+  ephy_sqlite_connection_close (connection);
+  g_object_unref (connection);
+
+  g_object_unref (service);
+  g_main_loop_quit (loop);
+}
+
+static void
+test_indexes (void)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  GList *visits;
+
+  visits = create_visits_for_complex_tests ();
+  ephy_history_service_add_visits (service, visits, NULL, (GAsyncReadyCallback)verify_indexes_are_used, loop);
+  ephy_history_page_visit_list_free (visits);
+
+  g_main_loop_run (loop);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  int ret;
+
+#ifdef __GLIBC__
+  /* Keeps every thread on the main arena, which is the only one mallinfo2()
+   * reports on, so that it also sees results built on the history threads. */
+  mallopt (M_ARENA_MAX, 1);
+#endif
+
+  gtk_test_init (&argc, &argv);
+
+  ephy_debug_init ();
+
+  if (!ephy_file_helpers_init (NULL,
+                               EPHY_FILE_HELPERS_TESTING_MODE | EPHY_FILE_HELPERS_ENSURE_EXISTS,
+                               NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  g_test_add_func ("/embed/history/test_create_history_service", test_create_history_service);
+  g_test_add_func ("/embed/history/test_create_history_service_and_destroy_later", test_create_history_service_and_destroy_later);
+  g_test_add_func ("/embed/history/test_create_history_entry", test_create_history_entry);
+  g_test_add_func ("/embed/history/test_readonly_mode", test_readonly_mode);
+  g_test_add_func ("/embed/history/test_create_history_entries", test_create_history_entries);
+  g_test_add_func ("/embed/history/test_set_url_title", test_set_url_title);
+  g_test_add_func ("/embed/history/test_set_url_title_is_correct", test_set_url_title_is_correct);
+  g_test_add_func ("/embed/history/test_set_url_title_url_not_existent", test_set_url_title_url_not_existent);
+  g_test_add_func ("/embed/history/test_get_url", test_get_url);
+  g_test_add_func ("/embed/history/test_get_url_not_existent", test_get_url_not_existent);
+  g_test_add_func ("/embed/history/test_get_url_read_after_write", test_get_url_read_after_write);
+  g_test_add_func ("/embed/history/test_complex_url_query", test_complex_url_query);
+  g_test_add_func ("/embed/history/test_complex_url_query_with_time_range", test_complex_url_query_with_time_range);
+  g_test_add_func ("/embed/history/test_clear", test_clear);
+  g_test_add_func ("/embed/history/test_cancellation", test_cancellation);
+  g_test_add_func ("/embed/history/test_indexes", test_indexes);
+  g_test_add_func ("/embed/history/test_indexed_substring_query", test_indexed_substring_query);
+  g_test_add_func ("/embed/history/test_url_search_index_backfill", test_url_search_index_backfill);
+  g_test_add_func ("/embed/history/test_batched_writes", test_batched_writes);
+  g_test_add_func ("/embed/history/test_superseded_queries", test_superseded_queries);
+  g_test_add_func ("/embed/history/test_expire_old_visits", test_expire_old_visits);
+  g_test_add_func ("/embed/history/test_expire_excess_visits", test_expire_excess_visits);
+  g_test_add_func ("/embed/history/test_get_host_for_url", test_get_host_for_url);
+  g_test_add_func ("/embed/history/test_frecency_ranking", test_frecency_ranking);
+  g_test_add_func ("/embed/history/test_history_cursor", test_history_cursor);
+  g_test_add_func ("/embed/history/test_visit_rollups", test_visit_rollups);
+  g_test_add_func ("/embed/history/test_visit_rollups_keep_strongest_visit_type", test_visit_rollups_keep_strongest_visit_type);
+  g_test_add_func ("/embed/history/test_zoom_level_cache", test_zoom_level_cache);
+  g_test_add_func ("/embed/history/test_coalesced_signals", test_coalesced_signals);
+  g_test_add_func ("/embed/history/test_delete_visits_in_range", test_delete_visits_in_range);
+  g_test_add_func ("/embed/history/test_delete_visits_in_range_with_rollups", test_delete_visits_in_range_with_rollups);
+  g_test_add_func ("/embed/history/test_import_history", test_import_history);
+
+  if (g_test_perf ()) {
+    g_test_add_func ("/embed/history/test_url_search_performance", test_url_search_performance);
+    g_test_add_func ("/embed/history/test_statement_cache_performance", test_statement_cache_performance);
+    g_test_add_func ("/embed/history/test_completion_latency", test_completion_latency);
+    g_test_add_func ("/embed/history/test_import_history_performance", test_import_history_performance);
+    g_test_add_func ("/embed/history/test_url_table_performance", test_url_table_performance);
+  }
 
   ret = g_test_run ();
 
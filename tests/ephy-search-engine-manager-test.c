@@ -283,6 +283,80 @@ test_parse_bang_search (void)
   g_settings_reset (EPHY_SETTINGS_MAIN, EPHY_PREFS_INCOGNITO_SEARCH_ENGINE);
 }
 
+static void
+assert_bang_completions (EphySearchEngineManager *manager,
+                         const char              *prefix,
+                         const char * const      *expected_bangs)
+{
+  g_autoptr (GPtrArray) engines = ephy_search_engine_manager_complete_bang (manager, prefix);
+
+  g_assert_cmpuint (engines->len, ==, g_strv_length ((char **)expected_bangs));
+  for (guint i = 0; i < engines->len; i++)
+    g_assert_cmpstr (ephy_search_engine_get_bang (g_ptr_array_index (engines, i)), ==, expected_bangs[i]);
+}
+
+static void
+test_complete_bang (void)
+{
+  g_autoptr (EphySearchEngineManager) manager = ephy_search_engine_manager_new ();
+  g_autoptr (EphySearchEngine) placeholder_engine = g_object_new (EPHY_TYPE_SEARCH_ENGINE, NULL);
+  g_autoptr (EphySearchEngine) wiktionary = NULL;
+  EphySearchEngine *engine;
+  const char *bangs[] = { "!wiki", "!g", "!w", "#ddg", "!wa" };
+  guint i = 0;
+
+  /* Same as in test_parse_bang_search(), start from our own engines only. */
+  ephy_search_engine_manager_add_engine (manager, placeholder_engine);
+  while ((engine = g_list_model_get_item (G_LIST_MODEL (manager), i))) {
+    if (engine == placeholder_engine)
+      i++;
+    else
+      ephy_search_engine_manager_delete_engine (manager, engine);
+
+    g_clear_object (&engine);
+  }
+
+  for (guint j = 0; j < G_N_ELEMENTS (bangs); j++) {
+    g_autofree char *name = g_strdup_printf ("Engine %u", j);
+    g_autoptr (EphySearchEngine) test_engine =
+      g_object_new (EPHY_TYPE_SEARCH_ENGINE,
+                    "name", name,
+                    "url", "https://example.com/?q=%s",
+                    "bang", bangs[j],
+                    NULL);
+    ephy_search_engine_manager_add_engine (manager, test_engine);
+  }
+
+  assert_bang_completions (manager, "!w", (const char *[]){ "!w", "!wa", "!wiki", NULL });
+  assert_bang_completions (manager, "!wi", (const char *[]){ "!wiki", NULL });
+  assert_bang_completions (manager, "!wiki", (const char *[]){ "!wiki", NULL });
+  assert_bang_completions (manager, "!", (const char *[]){ "!g", "!w", "!wa", "!wiki", NULL });
+  assert_bang_completions (manager, "#", (const char *[]){ "#ddg", NULL });
+  assert_bang_completions (manager, "!x", (const char *[]){ NULL });
+  assert_bang_completions (manager, "!wikis", (const char *[]){ NULL });
+  assert_bang_completions (manager, "", (const char *[]){ NULL });
+
+  /* Changing, adding and removing bangs is picked up. */
+  engine = ephy_search_engine_manager_find_engine_by_name (manager, "Engine 1");
+  ephy_search_engine_set_bang (engine, "!wg");
+  assert_bang_completions (manager, "!w", (const char *[]){ "!w", "!wa", "!wg", "!wiki", NULL });
+
+  wiktionary = g_object_new (EPHY_TYPE_SEARCH_ENGINE,
+                             "name", "Wiktionary",
+                             "url", "https://example.com/?q=%s",
+                             "bang", "!wikt",
+                             NULL);
+  ephy_search_engine_manager_add_engine (manager, wiktionary);
+  assert_bang_completions (manager, "!wi", (const char *[]){ "!wiki", "!wikt", NULL });
+
+  ephy_search_engine_manager_delete_engine (manager, engine);
+  assert_bang_completions (manager, "!w", (const char *[]){ "!w", "!wa", "!wiki", "!wikt", NULL });
+
+  g_settings_reset (EPHY_SETTINGS_MAIN, EPHY_PREFS_SEARCH_ENGINES);
+  g_settings_reset (EPHY_SETTINGS_MAIN, EPHY_PREFS_DEFAULT_SEARCH_ENGINE);
+  g_settings_reset (EPHY_SETTINGS_MAIN, EPHY_PREFS_INCOGNITO_SEARCH_ENGINE);
+}
+
 static void
 test_opensearch (void)
 {
@@ -324,6 +398,7 @@ main (int   argc,
   g_test_add_func ("/lib/search-engine-manager/test_search_bang_for_name", test_search_bang_for_name);
   g_test_add_func ("/lib/search-engine-manager/test_search_engine_manager", test_search_engine_manager);
   g_test_add_func ("/lib/search-engine-manager/test_parse_bang_search", test_parse_bang_search);
+  g_test_add_func ("/lib/search-engine-manager/test_complete_bang", test_complete_bang);
   g_test_add_func ("/lib/search-engine-manager/test_opensearch", test_opensearch);
 
   ret = g_test_run ();
@@ -0,0 +1,461 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2; -*- */
+/*
+ *  Copyright © 2026 Epiphany Developers
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-debug.h"
+#include "ephy-file-helpers.h"
+#include "ephy-search-suggestions-cache.h"
+#include "ephy-suggestion.h"
+
+#include <libsoup/soup.h>
+#include <string.h>
+
+static SoupServer *server;
+static GTlsDatabase *tls_database;
+static SoupSession *session;
+static guint request_count;
+static char *last_query;
+static guint connect_count;
+
+static void
+server_callback (SoupServer        *s,
+                 SoupServerMessage *msg,
+                 const char        *path,
+                 GHashTable        *query,
+                 gpointer           data)
+{
+  const char *q = query ? g_hash_table_lookup (query, "q") : NULL;
+  g_autofree char *body = NULL;
+
+  request_count++;
+  g_free (last_query);
+  last_query = g_strdup (q);
+
+  body = g_strdup_printf ("[\"%s\", [\"%s one\", \"%s two\", \"something else\"]]", q, q, q);
+  soup_server_message_set_status (msg, SOUP_STATUS_OK, NULL);
+  soup_server_message_set_response (msg, "application/x-suggestions+json",
+                                    SOUP_MEMORY_COPY, body, strlen (body));
+}
+
+static void
+network_event_cb (SoupMessage        *msg,
+                  GSocketClientEvent  event,
+                  GIOStream          *connection)
+{
+  if (event == G_SOCKET_CLIENT_CONNECTING)
+    connect_count++;
+}
+
+static void
+request_queued_cb (SoupSession *s,
+                   SoupMessage *msg)
+{
+  const char *query = g_uri_get_query (soup_message_get_uri (msg));
+
+  /* Only count the connections made for actual loads, not for preconnecting. */
+  if (query && strcmp (query, "q=") != 0)
+    g_signal_connect (msg, "network-event", G_CALLBACK (network_event_cb), NULL);
+}
+
+static SoupSession *
+create_session (void)
+{
+  SoupSession *s = soup_session_new_with_options ("tls-database", tls_database, NULL);
+
+  g_signal_connect (s, "request-queued", G_CALLBACK (request_queued_cb), NULL);
+
+  return s;
+}
+
+static EphySearchEngine *
+create_engine (void)
+{
+  g_autoslist (GUri) uris = soup_server_get_uris (server);
+  int port = g_uri_get_port (uris->data);
+  g_autofree char *url = g_strdup_printf ("https://127.0.0.1:%d/search?q=%%s", port);
+  g_autofree char *suggestions_url = g_strdup_printf ("https://127.0.0.1:%d/suggest?q=%%s", port);
+
+  return g_object_new (EPHY_TYPE_SEARCH_ENGINE,
+                       "name", "Test",
+                       "url", url,
+                       "suggestions-url", suggestions_url,
+                       NULL);
+}
+
+typedef struct {
+  gboolean done;
+  GSequence *suggestions;
+  GError *error;
+} LoadResult;
+
+static void
+load_result_clear (LoadResult *result)
+{
+  g_clear_pointer (&result->suggestions, g_sequence_free);
+  g_clear_error (&result->error);
+  result->done = FALSE;
+}
+
+static void
+load_cb (EphySearchSuggestionsCache *cache,
+         GAsyncResult               *result,
+         LoadResult                 *load)
+{
+  load->suggestions = ephy_search_suggestions_cache_load_finish (cache, result, &load->error);
+  load->done = TRUE;
+}
+
+static void
+start_load (EphySearchSuggestionsCache *cache,
+            EphySearchEngine           *engine,
+            const char                 *query,
+            GCancellable               *cancellable,
+            LoadResult                 *result)
+{
+  load_result_clear (result);
+  ephy_search_suggestions_cache_load_async (cache, engine, query, cancellable,
+                                            (GAsyncReadyCallback)load_cb, result);
+}
+
+static void
+wait_for_load (LoadResult *result)
+{
+  while (!result->done)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+load (EphySearchSuggestionsCache *cache,
+      EphySearchEngine           *engine,
+      const char                 *query,
+      LoadResult                 *result)
+{
+  start_load (cache, engine, query, NULL, result);
+  wait_for_load (result);
+  g_assert_no_error (result->error);
+  g_assert_nonnull (result->suggestions);
+}
+
+static void
+test_coalescing (void)
+{
+  g_autoptr (EphySearchSuggestionsCache) cache = ephy_search_suggestions_cache_new (session, 10, G_TIME_SPAN_MINUTE, 0);
+  g_autoptr (EphySearchEngine) engine = create_engine ();
+  LoadResult first = { 0 };
+  LoadResult second = { 0 };
+  EphySuggestion *suggestion;
+
+  request_count = 0;
+
+  /* Identical loads in flight at the same time share one request. */
+  start_load (cache, engine, "epiphany", NULL, &first);
+  start_load (cache, engine, "Epiphany ", NULL, &second);
+  wait_for_load (&first);
+  wait_for_load (&second);
+  g_assert_cmpuint (request_count, ==, 1);
+
+  g_assert_no_error (first.error);
+  g_assert_no_error (second.error);
+  g_assert_cmpint (g_sequence_get_length (first.suggestions), ==, 3);
+  g_assert_cmpint (g_sequence_get_length (second.suggestions), ==, 3);
+
+  suggestion = g_sequence_get (g_sequence_get_begin_iter (first.suggestions));
+  g_assert_true (g_str_has_prefix (ephy_suggestion_get_unescaped_title (suggestion), "epiphany one"));
+
+  /* Loading it again is answered from the cache. */
+  load (cache, engine, "  EPIPHANY", &first);
+  g_assert_cmpuint (request_count, ==, 1);
+  g_assert_cmpint (g_sequence_get_length (first.suggestions), ==, 3);
+
+  load_result_clear (&first);
+  load_result_clear (&second);
+}
+
+static void
+test_query_as_typed (void)
+{
+  g_autoptr (EphySearchSuggestionsCache) cache = ephy_search_suggestions_cache_new (session, 10, G_TIME_SPAN_MINUTE, 0);
+  g_autoptr (EphySearchEngine) engine = create_engine ();
+  LoadResult result = { 0 };
+
+  request_count = 0;
+
+  /* Only the cache key is normalized, the engine gets the query as typed. */
+  load (cache, engine, "GNOME  Web", &result);
+  g_assert_cmpuint (request_count, ==, 1);
+  g_assert_cmpstr (last_query, ==, "GNOME  Web");
+
+  load (cache, engine, "gnome web", &result);
+  g_assert_cmpuint (request_count, ==, 1);
+
+  load_result_clear (&result);
+}
+
+static void
+test_debounce (void)
+{
+  g_autoptr (EphySearchSuggestionsCache) cache = ephy_search_suggestions_cache_new (session, 10, G_TIME_SPAN_MINUTE, 50);
+  g_autoptr (EphySearchEngine) engine = create_engine ();
+  g_autoptr (GCancellable) first_cancellable = g_cancellable_new ();
+  g_autoptr (GCancellable) second_cancellable = g_cancellable_new ();
+  LoadResult first = { 0 };
+  LoadResult second = { 0 };
+  LoadResult third = { 0 };
+
+  request_count = 0;
+
+  /* Typing cancels the query of the previous keystroke, so only the last
+   * one should make it to the network. */
+  start_load (cache, engine, "w", first_cancellable, &first);
+  g_cancellable_cancel (first_cancellable);
+  start_load (cache, engine, "we", second_cancellable, &second);
+  g_cancellable_cancel (second_cancellable);
+  start_load (cache, engine, "web", NULL, &third);
+
+  wait_for_load (&first);
+  wait_for_load (&second);
+  wait_for_load (&third);
+
+  g_assert_error (first.error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_assert_error (second.error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_assert_no_error (third.error);
+  g_assert_cmpuint (request_count, ==, 1);
+
+  load_result_clear (&first);
+  load_result_clear (&second);
+  load_result_clear (&third);
+}
+
+static void
+test_prefix_lookup (void)
+{
+  g_autoptr (EphySearchSuggestionsCache) cache = ephy_search_suggestions_cache_new (session, 10, G_TIME_SPAN_MINUTE, 0);
+  g_autoptr (EphySearchEngine) engine = create_engine ();
+  g_autoptr (GSequence) suggestions = NULL;
+  LoadResult result = { 0 };
+  gboolean is_exact;
+
+  request_count = 0;
+
+  suggestions = ephy_search_suggestions_cache_lookup (cache, engine, "gnome", &is_exact);
+  g_assert_null (suggestions);
+
+  load (cache, engine, "gnome", &result);
+  g_assert_cmpuint (request_count, ==, 1);
+
+  suggestions = ephy_search_suggestions_cache_lookup (cache, engine, "gnome", &is_exact);
+  g_assert_nonnull (suggestions);
+  g_assert_true (is_exact);
+  g_assert_cmpint (g_sequence_get_length (suggestions), ==, 3);
+  g_clear_pointer (&suggestions, g_sequence_free);
+
+  /* Only the suggestions that still start with the longer query are kept. */
+  suggestions = ephy_search_suggestions_cache_lookup (cache, engine, "Gnome t", &is_exact);
+  g_assert_nonnull (suggestions);
+  g_assert_false (is_exact);
+  g_assert_cmpint (g_sequence_get_length (suggestions), ==, 1);
+  g_clear_pointer (&suggestions, g_sequence_free);
+
+  suggestions = ephy_search_suggestions_cache_lookup (cache, engine, "gnomes", &is_exact);
+  g_assert_null (suggestions);
+
+  g_assert_cmpuint (request_count, ==, 1);
+
+  load_result_clear (&result);
+}
+
+static void
+test_expiry_and_eviction (void)
+{
+  g_autoptr (EphySearchSuggestionsCache) cache = NULL;
+  g_autoptr (EphySearchEngine) engine = create_engine ();
+  LoadResult result = { 0 };
+
+  request_count = 0;
+
+  cache = ephy_search_suggestions_cache_new (session, 10, 1, 0);
+  load (cache, engine, "expiring", &result);
+  g_usleep (1000);
+  load (cache, engine, "expiring", &result);
+  g_assert_cmpuint (request_count, ==, 2);
+  g_clear_object (&cache);
+
+  request_count = 0;
+
+  cache = ephy_search_suggestions_cache_new (session, 2, G_TIME_SPAN_MINUTE, 0);
+  load (cache, engine, "first", &result);
+  load (cache, engine, "second", &result);
+  load (cache, engine, "first", &result);
+  g_assert_cmpuint (request_count, ==, 2);
+
+  /* "second" is now the least recently used one. */
+  load (cache, engine, "third", &result);
+  load (cache, engine, "first", &result);
+  g_assert_cmpuint (request_count, ==, 3);
+  load (cache, engine, "second", &result);
+  g_assert_cmpuint (request_count, ==, 4);
+
+  load_result_clear (&result);
+}
+
+static void
+preconnect_cb (EphySearchSuggestionsCache *cache,
+               GAsyncResult               *result,
+               gboolean                   *done)
+{
+  g_autoptr (GError) error = NULL;
+
+  g_assert_true (ephy_search_suggestions_cache_preconnect_finish (cache, result, &error));
+  g_assert_no_error (error);
+  *done = TRUE;
+}
+
+static void
+preconnect (EphySearchSuggestionsCache *cache,
+            EphySearchEngine           *engine)
+{
+  gboolean done = FALSE;
+
+  ephy_search_suggestions_cache_preconnect_async (cache, engine, NULL,
+                                                  (GAsyncReadyCallback)preconnect_cb, &done);
+  while (!done)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+test_preconnect (void)
+{
+  g_autoptr (SoupSession) client = create_session ();
+  g_autoptr (EphySearchSuggestionsCache) cache = ephy_search_suggestions_cache_new (client, 10, G_TIME_SPAN_MINUTE, 0);
+  g_autoptr (EphySearchEngine) engine = create_engine ();
+  LoadResult result = { 0 };
+
+  request_count = 0;
+  connect_count = 0;
+
+  /* Preconnecting does not send any request. */
+  preconnect (cache, engine);
+  g_assert_cmpuint (request_count, ==, 0);
+
+  /* The loads reuse the connection that is already open. */
+  load (cache, engine, "warm", &result);
+  load (cache, engine, "warmer", &result);
+  g_assert_cmpuint (request_count, ==, 2);
+  g_assert_cmpuint (connect_count, ==, 0);
+
+  load_result_clear (&result);
+}
+
+#define TIME_TO_FIRST_SUGGESTION_ITERATIONS 20
+
+static double
+time_to_first_suggestion (gboolean prewarm)
+{
+  g_autoptr (GTimer) timer = g_timer_new ();
+  double total = 0;
+
+  for (guint i = 0; i < TIME_TO_FIRST_SUGGESTION_ITERATIONS; i++) {
+    g_autoptr (SoupSession) client = create_session ();
+    g_autoptr (EphySearchSuggestionsCache) cache = ephy_search_suggestions_cache_new (client, 10, G_TIME_SPAN_MINUTE, 0);
+    g_autoptr (EphySearchEngine) engine = create_engine ();
+    LoadResult result = { 0 };
+
+    if (prewarm)
+      preconnect (cache, engine);
+
+    g_timer_start (timer);
+    load (cache, engine, "first", &result);
+    total += g_timer_elapsed (timer, NULL);
+
+    load_result_clear (&result);
+  }
+
+  return total * 1000 / TIME_TO_FIRST_SUGGESTION_ITERATIONS;
+}
+
+static void
+test_time_to_first_suggestion (void)
+{
+  double cold_ms;
+  double prewarmed_ms;
+
+  cold_ms = time_to_first_suggestion (FALSE);
+  prewarmed_ms = time_to_first_suggestion (TRUE);
+
+  g_test_message ("Cold connection: %.2f ms", cold_ms);
+  g_test_minimized_result (prewarmed_ms, "Time to first suggestion with a prewarmed connection: %.2f ms", prewarmed_ms);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_autoptr (GTlsCertificate) certificate = NULL;
+  g_autoptr (GError) error = NULL;
+  int ret;
+
+  ephy_debug_init ();
+
+  g_test_init (&argc, &argv, NULL);
+
+  if (!ephy_file_helpers_init (NULL,
+                               EPHY_FILE_HELPERS_TESTING_MODE | EPHY_FILE_HELPERS_ENSURE_EXISTS,
+                               NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  /* A local stand-in for the suggestions server. It uses TLS so that the
+   * handshake is part of what preconnecting saves. */
+  certificate = g_tls_certificate_new_from_files (g_test_get_filename (G_TEST_DIST, "data", "test-server-cert.pem", NULL),
+                                                  g_test_get_filename (G_TEST_DIST, "data", "test-server-key.pem", NULL),
+                                                  &error);
+  g_assert_no_error (error);
+  tls_database = g_tls_file_database_new (g_test_get_filename (G_TEST_DIST, "data", "test-server-cert.pem", NULL),
+                                          &error);
+  g_assert_no_error (error);
+
+  server = soup_server_new ("tls-certificate", certificate, NULL);
+  soup_server_add_handler (server, "/suggest", server_callback, NULL, NULL);
+  soup_server_listen_local (server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY | SOUP_SERVER_LISTEN_HTTPS, &error);
+  g_assert_no_error (error);
+
+  session = create_session ();
+
+  g_test_add_func ("/lib/search-suggestions-cache/coalescing", test_coalescing);
+  g_test_add_func ("/lib/search-suggestions-cache/query_as_typed", test_query_as_typed);
+  g_test_add_func ("/lib/search-suggestions-cache/debounce", test_debounce);
+  g_test_add_func ("/lib/search-suggestions-cache/prefix_lookup", test_prefix_lookup);
+  g_test_add_func ("/lib/search-suggestions-cache/expiry_and_eviction", test_expiry_and_eviction);
+  g_test_add_func ("/lib/search-suggestions-cache/preconnect", test_preconnect);
+
+  if (g_test_perf ())
+    g_test_add_func ("/lib/search-suggestions-cache/time_to_first_suggestion", test_time_to_first_suggestion);
+
+  ret = g_test_run ();
+
+  g_object_unref (session);
+  g_object_unref (server);
+  g_object_unref (tls_database);
+  g_free (last_query);
+  ephy_file_helpers_shutdown ();
+
+  return ret;
+}
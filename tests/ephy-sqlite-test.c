@@ -222,10 +222,171 @@ test_table_exists (void)
   g_free (temporary_file);
 }
 
+static void
+test_cached_statement (void)
+{
+  gchar *temporary_file;
+  EphySQLiteConnection *connection;
+  GError *error = NULL;
+  EphySQLiteStatement *statement = NULL;
+  guint64 hits, misses;
+
+  temporary_file = g_build_filename (g_get_tmp_dir (), "epiphany-sqlite-test.db", NULL);
+  connection = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READWRITE, temporary_file);
+  g_assert_true (ephy_sqlite_connection_open (connection, &error));
+  g_assert_no_error (error);
+
+  create_table_and_insert_row (connection);
+
+  g_assert_null (ephy_sqlite_connection_get_cached_statement (connection, "select-by-id"));
+  statement = ephy_sqlite_connection_add_cached_statement (connection, "select-by-id", "SELECT text FROM test WHERE id = ?", &error);
+  g_assert_nonnull (statement);
+  g_assert_no_error (error);
+
+  g_assert_true (ephy_sqlite_statement_bind_int (statement, 0, 3, &error));
+  g_assert_no_error (error);
+  g_assert_true (ephy_sqlite_statement_step (statement, &error));
+  g_assert_no_error (error);
+  g_assert_cmpstr (ephy_sqlite_statement_get_column_as_string (statement, 0), ==, "test");
+  g_object_unref (statement);
+
+  /* The cached statement comes back reset, ready to be bound again. */
+  statement = ephy_sqlite_connection_get_cached_statement (connection, "select-by-id");
+  g_assert_nonnull (statement);
+  g_assert_true (ephy_sqlite_statement_bind_int (statement, 0, 4, &error));
+  g_assert_no_error (error);
+  g_assert_false (ephy_sqlite_statement_step (statement, &error));
+  g_assert_no_error (error);
+  g_object_unref (statement);
+
+  ephy_sqlite_connection_get_statement_cache_stats (connection, &hits, &misses);
+  g_assert_cmpuint (hits, ==, 1);
+  g_assert_cmpuint (misses, ==, 1);
+
+  statement = ephy_sqlite_connection_add_cached_statement (connection, "broken", "BLAHBLAHBLAHBA", &error);
+  g_assert_null (statement);
+  g_assert_nonnull (error);
+  g_clear_error (&error);
+  g_assert_null (ephy_sqlite_connection_get_cached_statement (connection, "broken"));
+
+  ephy_sqlite_connection_close (connection);
+  ephy_sqlite_connection_delete_database (connection);
+
+  g_object_unref (connection);
+  g_free (temporary_file);
+}
+
+static void
+test_manual_checkpoints (void)
+{
+  gchar *temporary_file;
+  EphySQLiteConnection *connection;
+  GError *error = NULL;
+  guint64 count;
+  gint64 wal_size;
+
+  temporary_file = g_build_filename (g_get_tmp_dir (), "epiphany-sqlite-test.db", NULL);
+  connection = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READWRITE, temporary_file);
+  g_assert_true (ephy_sqlite_connection_open (connection, &error));
+  g_assert_no_error (error);
+
+  ephy_sqlite_connection_enable_manual_checkpoints (connection, 0);
+  g_assert_cmpint (ephy_sqlite_connection_get_wal_size (connection), ==, 0);
+
+  /* Commits only grow the WAL until it is checkpointed. */
+  create_table_and_insert_row (connection);
+  wal_size = ephy_sqlite_connection_get_wal_size (connection);
+  g_assert_cmpint (wal_size, >, 0);
+  ephy_sqlite_connection_get_checkpoint_stats (connection, &count, NULL, NULL);
+  g_assert_cmpuint (count, ==, 0);
+
+  ephy_sqlite_connection_execute (connection, "INSERT INTO test (id, text) VALUES (4, \"test\")", &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (ephy_sqlite_connection_get_wal_size (connection), >, wal_size);
+
+  g_assert_true (ephy_sqlite_connection_checkpoint (connection, EPHY_SQLITE_CHECKPOINT_TRUNCATE, &error));
+  g_assert_no_error (error);
+  g_assert_cmpint (ephy_sqlite_connection_get_wal_size (connection), ==, 0);
+  ephy_sqlite_connection_get_checkpoint_stats (connection, &count, NULL, NULL);
+  g_assert_cmpuint (count, ==, 1);
+
+  /* Past the size limit, the commit truncates the WAL itself. */
+  ephy_sqlite_connection_enable_manual_checkpoints (connection, 1);
+  ephy_sqlite_connection_execute (connection, "INSERT INTO test (id, text) VALUES (5, \"test\")", &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (ephy_sqlite_connection_get_wal_size (connection), ==, 0);
+  ephy_sqlite_connection_get_checkpoint_stats (connection, &count, NULL, NULL);
+  g_assert_cmpuint (count, ==, 2);
+
+  ephy_sqlite_connection_close (connection);
+  ephy_sqlite_connection_delete_database (connection);
+
+  g_object_unref (connection);
+  g_free (temporary_file);
+}
+
+static void
+test_query_stats (void)
+{
+  gchar *temporary_file;
+  EphySQLiteConnection *connection;
+  GError *error = NULL;
+  EphySQLiteStatement *statement = NULL;
+  g_autoptr (GPtrArray) stats = NULL;
+  EphySQLiteQueryStats *query = NULL;
+
+  g_assert_true (ephy_sqlite_query_stats_enabled ());
+
+  temporary_file = g_build_filename (g_get_tmp_dir (), "epiphany-sqlite-test.db", NULL);
+  connection = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READWRITE, temporary_file);
+  g_assert_true (ephy_sqlite_connection_open (connection, &error));
+  g_assert_no_error (error);
+
+  create_table_and_insert_row (connection);
+  ephy_sqlite_connection_execute (connection, "INSERT INTO test (id, text) VALUES (4, \"test\")", &error);
+  g_assert_no_error (error);
+
+  statement = ephy_sqlite_connection_create_statement (connection, "SELECT text FROM test WHERE id > ?", EPHY_SQLITE_STATEMENT_LONG_LIVED, &error);
+  g_assert_no_error (error);
+  for (int i = 0; i < 3; i++) {
+    ephy_sqlite_statement_reset (statement);
+    g_assert_true (ephy_sqlite_statement_bind_int (statement, 0, i + 2, &error));
+    while (ephy_sqlite_statement_step (statement, &error))
+      continue;
+    g_assert_no_error (error);
+  }
+  g_object_unref (statement);
+
+  stats = ephy_sqlite_get_query_stats ();
+  for (guint i = 0; i < stats->len; i++) {
+    EphySQLiteQueryStats *s = g_ptr_array_index (stats, i);
+
+    if (g_strcmp0 (s->sql, "SELECT text FROM test WHERE id > ?") == 0)
+      query = s;
+    if (i > 0)
+      g_assert_cmpint (s->total_time, <=, ((EphySQLiteQueryStats *)g_ptr_array_index (stats, i - 1))->total_time);
+  }
+
+  /* Two rows, one row, and none. */
+  g_assert_nonnull (query);
+  g_assert_cmpuint (query->count, ==, 3);
+  g_assert_cmpuint (query->rows, ==, 3);
+  g_assert_cmpint (query->max_time, <=, query->total_time);
+
+  ephy_sqlite_connection_close (connection);
+  ephy_sqlite_connection_delete_database (connection);
+
+  g_object_unref (connection);
+  g_free (temporary_file);
+}
+
 int
 main (int   argc,
       char *argv[])
 {
+  /* Collect query stats, without logging any query as slow. */
+  g_setenv ("EPHY_SQLITE_STATS", "60000", TRUE);
+
   gtk_test_init (&argc, &argv);
 
   g_test_add_func ("/lib/sqlite/ephy-sqlite/create_connection", test_create_connection);
@@ -233,6 +394,9 @@ main (int   argc,
   g_test_add_func ("/lib/sqlite/ephy-sqlite/create_table_and_insert_row", test_create_table_and_insert_row);
   g_test_add_func ("/lib/sqlite/ephy-sqlite/bind_data", test_bind_data);
   g_test_add_func ("/lib/sqlite/ephy-sqlite/table_exists", test_table_exists);
+  g_test_add_func ("/lib/sqlite/ephy-sqlite/cached_statement", test_cached_statement);
+  g_test_add_func ("/lib/sqlite/ephy-sqlite/manual_checkpoints", test_manual_checkpoints);
+  g_test_add_func ("/lib/sqlite/ephy-sqlite/query_stats", test_query_stats);
 
   return g_test_run ();
 }